@@ -1,10 +1,88 @@
 package org.sssta.nesdroid;
 
+import android.view.Surface;
+
+import java.nio.ByteBuffer;
+
 /**
  * Created by cauchywei on 16/5/7.
  */
 public class Nes {
 
+    // same values as the native PixelFormat / ANativeWindow formats
+    public static final int PIXEL_FORMAT_RGBA_8888 = 1;
+    public static final int PIXEL_FORMAT_RGB_565 = 4;
+
+    // same values as the native FilterType
+    public static final int FILTER_NEAREST = 0;
+    public static final int FILTER_SCALE2X = 1;
+    public static final int FILTER_SCALE3X = 2;
+    public static final int FILTER_XBR2X = 3;
+
+    // indices into getMetrics(), same order as the native Counter
+    public static final int METRIC_CYCLES = 0;
+    public static final int METRIC_INSTRUCTIONS = 1;
+    public static final int METRIC_FRAMES = 2;
+    public static final int METRIC_CPU_NANOS = 3;
+    public static final int METRIC_PPU_NANOS = 4;
+    public static final int METRIC_APU_NANOS = 5;
+    public static final int METRIC_PRESENT_NANOS = 6;
+    public static final int METRIC_DMA_STALLS = 7;
+    public static final int METRIC_DMA_STALL_CYCLES = 8;
+    public static final int METRIC_AUDIO_UNDERRUNS = 9;
+    public static final int METRIC_DEADLINE_MISSES = 10;
+    public static final int METRIC_SKIPPED_FRAMES = 11;
+    public static final int METRIC_WALL_NANOS = 12;
+    public static final int METRIC_FRAME_P50_NANOS = 13;
+    public static final int METRIC_FRAME_P95_NANOS = 14;
+    public static final int METRIC_FRAME_P99_NANOS = 15;
+    // from a setButtons() event to the present of the first frame that saw it
+    public static final int METRIC_INPUT_LATENCY_P50_NANOS = 16;
+    public static final int METRIC_INPUT_LATENCY_P95_NANOS = 17;
+    public static final int METRIC_INPUT_LATENCY_P99_NANOS = 18;
+    // reads of $2000-$2007 then $4000-$401F, then writes in the same order
+    public static final int METRIC_MMIO_READS = 19;
+    public static final int METRIC_MMIO_REGISTERS = 8 + 0x20;
+    public static final int METRIC_MMIO_WRITES = METRIC_MMIO_READS + METRIC_MMIO_REGISTERS;
+    // setSpeed() and the speed achieved over the last second, in thousandths, then the
+    // frames the throttle rendered and skipped since the rom was loaded
+    public static final int METRIC_SPEED_PERMILLE = METRIC_MMIO_WRITES + METRIC_MMIO_REGISTERS;
+    public static final int METRIC_ACHIEVED_SPEED_PERMILLE = METRIC_SPEED_PERMILLE + 1;
+    public static final int METRIC_RENDERED_FRAMES = METRIC_SPEED_PERMILLE + 2;
+    public static final int METRIC_FAST_FORWARD_SKIPPED_FRAMES = METRIC_SPEED_PERMILLE + 3;
+
+    // getLoadStatus(), same values as the native RomLoader::Status
+    public static final int LOAD_IDLE = 0;
+    public static final int LOAD_RUNNING = 1;
+    public static final int LOAD_READY = 2;
+    public static final int LOAD_FAILED = 3;
+
+    // debugger: address spaces, access bits, debugControl() commands and the
+    // layout of getDebugState(), same values as the native Debugger
+    public static final int SPACE_CPU = 0;
+    public static final int SPACE_PPU = 1;
+    public static final int ACCESS_READ = 1;
+    public static final int ACCESS_WRITE = 2;
+    public static final int ACCESS_EXECUTE = 4;
+    public static final int DEBUG_PAUSE = 0;
+    public static final int DEBUG_RESUME = 1;
+    public static final int DEBUG_STEP_INTO = 2;
+    public static final int DEBUG_STEP_OVER = 3;
+    public static final int DEBUG_PC = 0;
+    public static final int DEBUG_A = 1;
+    public static final int DEBUG_X = 2;
+    public static final int DEBUG_Y = 3;
+    public static final int DEBUG_SP = 4;
+    public static final int DEBUG_P = 5;
+    public static final int DEBUG_HIT_SPACE = 6;
+    public static final int DEBUG_HIT_ADDRESS = 7;
+    public static final int DEBUG_HIT_ACCESS = 8;
+    public static final int DEBUG_HIT_VALUE = 9;
+
+    // startCapture() formats, same values as the native CaptureFormat
+    public static final int CAPTURE_Y4M = 0;
+    public static final int CAPTURE_PNG = 1;
+
     static {
         System.loadLibrary("nes-simulator-jni");
     }
@@ -13,4 +91,89 @@ public class Nes {
     public native void reset();
     public native void release();
 
+    // read a .nes, .zip or .gz rom in the background, runFrame() starts it once ready
+    public native boolean loadRom(String path);
+
+    public native int getLoadStatus();
+
+    // pad state, bit n is button A, B, Select, Start, Up, Down, Left, Right; eventTime as
+    // MotionEvent.getEventTime(), 0 for now. The game reads it when it next strobes the pads.
+    public native void setButtons(int port, int buttons, long eventTime);
+
+    // emulation thread: emulate the frames that are due, true if one was rendered
+    public native boolean runFrame();
+
+    // 1 is real time, above fast forwards at that multiplier, 0 runs uncapped
+    public native void setSpeed(float speed);
+
+    // draw frames on a second thread, one frame behind the emulation
+    public native void setPipelined(boolean pipelined);
+
+    // scale only applies to FILTER_NEAREST
+    public native void setFilter(int type, int scale);
+
+    // nanoseconds per frame for each filter
+    public native long[] benchmarkFilters(int frames);
+
+    // draw the last frame into the surface, converted and filtered natively
+    public native boolean render(Surface surface);
+
+    // draw the last frame into a direct buffer whose lines are stride bytes apart
+    public native boolean renderToBuffer(ByteBuffer buffer, int stride, int format);
+
+    // save file for battery backed PRG-RAM of the roms loaded from now on
+    public native void setSavePath(String path);
+
+    // directory for the code maps of the roms loaded from now on, e.g. getCacheDir()
+    public native void setCodeCacheDirectory(String directory);
+
+    // run the loaded rom from its recompiled plugin in directory, which has to be
+    // getApplicationInfo().nativeLibraryDir: the plugins ship in the APK's jniLibs
+    public native boolean loadNativeCode(String directory);
+
+    // call from onPause: blocks until the game saves so far are on disk
+    public native void syncSaveRam();
+
+    // Game Genie code, or "AAAA:VV" / "AAAA?CC:VV" in hex; below $8000 the value is frozen
+    public native boolean addCheat(String code);
+
+    public native void clearCheats();
+
+    // stop before the instruction at pc; returns an id for removeWatch()
+    public native int addBreakpoint(int pc);
+
+    // stop on ACCESS_* bits to first..last; cpu ram as $0000-$07FF, PPU registers as $2000-$2007
+    public native int addWatchpoint(int space, int first, int last, int access);
+
+    public native boolean removeWatch(int id);
+
+    // one of the DEBUG_* commands, runFrame() emulates nothing while paused
+    public native void debugControl(int command);
+
+    // null while running, else indexed by the DEBUG_PC ... DEBUG_HIT_VALUE constants
+    public native int[] getDebugState();
+
+    // counters since the last resetMetrics(), indexed by the METRIC_* constants
+    public native long[] getMetrics();
+
+    // the same as a readable report, also written to the log
+    public native String dumpMetrics();
+
+    // inputs by latency in 1 ms buckets, the last one counts everything slower
+    public native long[] getInputLatencyHistogram();
+
+    public native void resetMetrics();
+
+    // record every executed instruction into a gzip compressed binary trace
+    public native boolean startTrace(String path);
+
+    public native void stopTrace();
+
+    // record every frame and the audio in the background: basePath.y4m or basePath-NNNNNN.png,
+    // and basePath.wav; frames are dropped rather than slow the emulation down
+    public native boolean startCapture(String basePath, int format);
+
+    // frames written, of which repeated, and frames dropped; null if nothing was recording
+    public native long[] stopCapture();
+
 }
@@ -0,0 +1,718 @@
+#include <cmath>
+#include <cstring>
+
+#include "Apu.h"
+#include "cpu.h"
+
+namespace nesdroid {
+
+    static const byte LengthTable[32] = {
+            10, 254, 20, 2, 40, 4, 80, 6, 160, 8, 60, 10, 14, 12, 26, 14,
+            12, 16, 24, 18, 48, 20, 96, 22, 192, 24, 72, 26, 16, 28, 32, 30,
+    };
+
+    static const byte DutyTable[4][8] = {
+            {0, 1, 0, 0, 0, 0, 0, 0},
+            {0, 1, 1, 0, 0, 0, 0, 0},
+            {0, 1, 1, 1, 1, 0, 0, 0},
+            {1, 0, 0, 1, 1, 1, 1, 1},
+    };
+
+    static const byte TriangleTable[32] = {
+            15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0,
+            0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+    };
+
+    static const dbyte NoiseTable[16] = {
+            4, 8, 16, 32, 64, 96, 128, 160, 202, 254, 380, 508, 762, 1016, 2034, 4068,
+    };
+
+    static const byte DmcTable[16] = {
+            214, 190, 170, 160, 143, 127, 113, 107, 95, 80, 71, 64, 53, 42, 36, 27,
+    };
+
+    static float PulseTable[31];
+    static float TndTable[203];
+
+    static void initTables() {
+        static bool initialized = false;
+        if (initialized) {
+            return;
+        }
+        for (int i = 0; i < 31; i++) {
+            PulseTable[i] = 95.52f / (8128.0f / i + 100);
+        }
+        for (int i = 0; i < 203; i++) {
+            TndTable[i] = 163.67f / (24329.0f / i + 100);
+        }
+        initialized = true;
+    }
+
+    ///////////Pulse///////////
+
+    void Pulse::writeControl(byte value) {
+        dutyMode = (byte) ((value >> 6) & 3);
+        lengthEnabled = ((value >> 5) & 1) == 0;
+        envelopeLoop = ((value >> 5) & 1) == 1;
+        envelopeEnabled = ((value >> 4) & 1) == 0;
+        envelopePeriod = (byte) (value & 15);
+        constantVolume = (byte) (value & 15);
+        envelopeStart = true;
+    }
+
+    void Pulse::writeSweep(byte value) {
+        sweepEnabled = ((value >> 7) & 1) == 1;
+        sweepPeriod = (byte) (((value >> 4) & 7) + 1);
+        sweepNegate = ((value >> 3) & 1) == 1;
+        sweepShift = (byte) (value & 7);
+        sweepReload = true;
+    }
+
+    void Pulse::writeTimerLow(byte value) {
+        timerPeriod = (dbyte) ((timerPeriod & 0xFF00) | value);
+    }
+
+    void Pulse::writeTimerHigh(byte value) {
+        lengthValue = LengthTable[value >> 3];
+        timerPeriod = (dbyte) ((timerPeriod & 0x00FF) | ((value & 7) << 8));
+        envelopeStart = true;
+        dutyValue = 0;
+    }
+
+    void Pulse::stepTimer() {
+        if (timerValue == 0) {
+            timerValue = timerPeriod;
+            dutyValue = (byte) ((dutyValue + 1) % 8);
+        } else {
+            timerValue--;
+        }
+    }
+
+    void Pulse::stepEnvelope() {
+        if (envelopeStart) {
+            envelopeVolume = 15;
+            envelopeValue = envelopePeriod;
+            envelopeStart = false;
+        } else if (envelopeValue > 0) {
+            envelopeValue--;
+        } else {
+            if (envelopeVolume > 0) {
+                envelopeVolume--;
+            } else if (envelopeLoop) {
+                envelopeVolume = 15;
+            }
+            envelopeValue = envelopePeriod;
+        }
+    }
+
+    void Pulse::stepSweep() {
+        if (sweepReload) {
+            if (sweepEnabled && sweepValue == 0) {
+                sweep();
+            }
+            sweepValue = sweepPeriod;
+            sweepReload = false;
+        } else if (sweepValue > 0) {
+            sweepValue--;
+        } else {
+            if (sweepEnabled) {
+                sweep();
+            }
+            sweepValue = sweepPeriod;
+        }
+    }
+
+    void Pulse::stepLength() {
+        if (lengthEnabled && lengthValue > 0) {
+            lengthValue--;
+        }
+    }
+
+    void Pulse::sweep() {
+        dbyte delta = timerPeriod >> sweepShift;
+        if (sweepNegate) {
+            timerPeriod -= delta;
+            // pulse 1 negates with one's complement
+            if (channel == 1) {
+                timerPeriod--;
+            }
+        } else {
+            timerPeriod += delta;
+        }
+    }
+
+    byte Pulse::output() const {
+        if (!enabled || lengthValue == 0 || DutyTable[dutyMode][dutyValue] == 0) {
+            return 0;
+        }
+        if (timerPeriod < 8 || timerPeriod > 0x7FF) {
+            return 0;
+        }
+        return envelopeEnabled ? envelopeVolume : constantVolume;
+    }
+
+    ///////////Triangle///////////
+
+    void Triangle::writeControl(byte value) {
+        lengthEnabled = ((value >> 7) & 1) == 0;
+        counterPeriod = (byte) (value & 0x7F);
+    }
+
+    void Triangle::writeTimerLow(byte value) {
+        timerPeriod = (dbyte) ((timerPeriod & 0xFF00) | value);
+    }
+
+    void Triangle::writeTimerHigh(byte value) {
+        lengthValue = LengthTable[value >> 3];
+        timerPeriod = (dbyte) ((timerPeriod & 0x00FF) | ((value & 7) << 8));
+        timerValue = timerPeriod;
+        counterReload = true;
+    }
+
+    void Triangle::stepTimer() {
+        if (timerValue == 0) {
+            timerValue = timerPeriod;
+            if (lengthValue > 0 && counterValue > 0) {
+                dutyValue = (byte) ((dutyValue + 1) % 32);
+            }
+        } else {
+            timerValue--;
+        }
+    }
+
+    void Triangle::stepLength() {
+        if (lengthEnabled && lengthValue > 0) {
+            lengthValue--;
+        }
+    }
+
+    void Triangle::stepCounter() {
+        if (counterReload) {
+            counterValue = counterPeriod;
+        } else if (counterValue > 0) {
+            counterValue--;
+        }
+        if (lengthEnabled) {
+            counterReload = false;
+        }
+    }
+
+    byte Triangle::output() const {
+        if (!enabled || lengthValue == 0 || counterValue == 0) {
+            return 0;
+        }
+        return TriangleTable[dutyValue];
+    }
+
+    ///////////Noise///////////
+
+    void Noise::writeControl(byte value) {
+        lengthEnabled = ((value >> 5) & 1) == 0;
+        envelopeLoop = ((value >> 5) & 1) == 1;
+        envelopeEnabled = ((value >> 4) & 1) == 0;
+        envelopePeriod = (byte) (value & 15);
+        constantVolume = (byte) (value & 15);
+        envelopeStart = true;
+    }
+
+    void Noise::writePeriod(byte value) {
+        mode = (value & 0x80) == 0x80;
+        timerPeriod = NoiseTable[value & 0x0F];
+    }
+
+    void Noise::writeLength(byte value) {
+        lengthValue = LengthTable[value >> 3];
+        envelopeStart = true;
+    }
+
+    void Noise::stepTimer() {
+        if (timerValue == 0) {
+            timerValue = timerPeriod;
+            byte shift = (byte) (mode ? 6 : 1);
+            dbyte b1 = (dbyte) (shiftRegister & 1);
+            dbyte b2 = (dbyte) ((shiftRegister >> shift) & 1);
+            shiftRegister >>= 1;
+            shiftRegister |= (b1 ^ b2) << 14;
+        } else {
+            timerValue--;
+        }
+    }
+
+    void Noise::stepEnvelope() {
+        if (envelopeStart) {
+            envelopeVolume = 15;
+            envelopeValue = envelopePeriod;
+            envelopeStart = false;
+        } else if (envelopeValue > 0) {
+            envelopeValue--;
+        } else {
+            if (envelopeVolume > 0) {
+                envelopeVolume--;
+            } else if (envelopeLoop) {
+                envelopeVolume = 15;
+            }
+            envelopeValue = envelopePeriod;
+        }
+    }
+
+    void Noise::stepLength() {
+        if (lengthEnabled && lengthValue > 0) {
+            lengthValue--;
+        }
+    }
+
+    byte Noise::output() const {
+        if (!enabled || lengthValue == 0 || (shiftRegister & 1) == 1) {
+            return 0;
+        }
+        return envelopeEnabled ? envelopeVolume : constantVolume;
+    }
+
+    ///////////DMC///////////
+
+    void DMC::writeControl(byte value) {
+        irq = (value & 0x80) == 0x80;
+        loop = (value & 0x40) == 0x40;
+        tickPeriod = DmcTable[value & 0x0F];
+    }
+
+    void DMC::writeValue(byte value) {
+        this->value = (byte) (value & 0x7F);
+    }
+
+    void DMC::writeAddress(byte value) {
+        // Sample address = %11AAAAAA.AA000000
+        sampleAddress = (addr_t) (0xC000 | (value << 6));
+    }
+
+    void DMC::writeLength(byte value) {
+        // Sample length = %0000LLLL.LLLL0001
+        sampleLength = (dbyte) ((value << 4) | 1);
+    }
+
+    void DMC::restart() {
+        currentAddress = sampleAddress;
+        currentLength = sampleLength;
+    }
+
+    void DMC::stepTimer(Cpu *cpu) {
+        if (!enabled) {
+            return;
+        }
+        stepReader(cpu);
+        if (tickValue == 0) {
+            tickValue = tickPeriod;
+            stepShifter();
+        } else {
+            tickValue--;
+        }
+    }
+
+    void DMC::stepReader(Cpu *cpu) {
+        if (currentLength > 0 && bitCount == 0) {
+            // charged in one step with any pending OAM DMA stall
+            cpu->stall(4);
+            CpuMemory &memory = cpu->getMemory();
+            byte *page = memory.getPage((byte) (currentAddress >> 8));
+            shiftRegister = page != nullptr ? page[currentAddress & 0xFF] : memory.read(currentAddress);
+            bitCount = 8;
+            currentAddress++;
+            if (currentAddress == 0) {
+                currentAddress = 0x8000;
+            }
+            currentLength--;
+            if (currentLength == 0) {
+                if (loop) {
+                    restart();
+                } else if (irq) {
+                    cpu->setIrqLine(IRQ_DMC, true);
+                }
+            }
+        }
+    }
+
+    void DMC::stepShifter() {
+        if (bitCount == 0) {
+            return;
+        }
+        if ((shiftRegister & 1) == 1) {
+            if (value <= 125) {
+                value += 2;
+            }
+        } else {
+            if (value >= 2) {
+                value -= 2;
+            }
+        }
+        shiftRegister >>= 1;
+        bitCount--;
+    }
+
+    ///////////Filter///////////
+
+    void Filter::lowPass(float sampleRate, float cutoff) {
+        float c = sampleRate / (float) M_PI / cutoff;
+        float a0i = 1 / (1 + c);
+        b0 = a0i;
+        b1 = a0i;
+        a1 = (1 - c) * a0i;
+        prevX = prevY = 0;
+    }
+
+    void Filter::highPass(float sampleRate, float cutoff) {
+        float c = sampleRate / (float) M_PI / cutoff;
+        float a0i = 1 / (1 + c);
+        b0 = c * a0i;
+        b1 = -c * a0i;
+        a1 = (1 - c) * a0i;
+        prevX = prevY = 0;
+    }
+
+    ///////////APU///////////
+
+    APU::APU() {
+        initTables();
+        setSampleRate(DEFAULT_SAMPLE_RATE);
+        reset();
+    }
+
+    void APU::reset() {
+        memset(&pulse1, 0, sizeof(pulse1));
+        memset(&pulse2, 0, sizeof(pulse2));
+        memset(&triangle, 0, sizeof(triangle));
+        memset(&noise, 0, sizeof(noise));
+        memset(&dmc, 0, sizeof(dmc));
+        pulse1.channel = 1;
+        pulse2.channel = 2;
+        noise.shiftRegister = 1;
+
+        cycle = 0;
+        framePeriod = 4;
+        frameValue = 0;
+        frameIRQ = false;
+        framePhase = 0;
+        samplePhase = 0;
+        sampleCount = 0;
+    }
+
+    void APU::setSampleRate(int sampleRate) {
+        this->sampleRate = sampleRate;
+        filters[0].highPass(sampleRate, 90);
+        filters[1].highPass(sampleRate, 440);
+        filters[2].lowPass(sampleRate, 14000);
+    }
+
+    void APU::setDecimation(int decimation) {
+        this->decimation = decimation < 0 ? 0 : decimation;
+        decimationCount = 0;
+    }
+
+    void APU::step(int cycles) {
+        while (cycles-- > 0) {
+            cycle++;
+            stepTimer();
+
+            framePhase += 240;
+            if (framePhase >= (uint32_t) CPU_FREQUENCY) {
+                framePhase -= CPU_FREQUENCY;
+                stepFrameCounter();
+            }
+
+            if (decimation == 0) {
+                continue;
+            }
+            samplePhase += sampleRate;
+            if (samplePhase >= (uint32_t) CPU_FREQUENCY) {
+                samplePhase -= CPU_FREQUENCY;
+                if (++decimationCount >= decimation) {
+                    decimationCount = 0;
+                    sendSample();
+                }
+            }
+        }
+    }
+
+    void APU::sendSample() {
+        float value = output();
+        for (int i = 0; i < 3; i++) {
+            value = filters[i].step(value);
+        }
+        if (sampleCount < MAX_FRAME_SAMPLES) {
+            float scaled = value * 32767;
+            if (scaled > 32767) {
+                scaled = 32767;
+            } else if (scaled < -32768) {
+                scaled = -32768;
+            }
+            samples[sampleCount++] = (int16_t) scaled;
+        }
+    }
+
+    float APU::output() const {
+        byte p1 = pulse1.output();
+        byte p2 = pulse2.output();
+        byte t = triangle.output();
+        byte n = noise.output();
+        byte d = dmc.output();
+        float pulseOut = PulseTable[p1 + p2];
+        float tndOut = TndTable[3 * t + 2 * n + d];
+        return pulseOut + tndOut;
+    }
+
+    // mode 0:    mode 1:       function
+    // ---------  -----------  -----------------------------
+    //  - - - f    - - - - -    IRQ (if bit 6 is clear)
+    //  - l - l    l - l - -    Length counter and sweep
+    //  e e e e    e e e e -    Envelope and linear counter
+    void APU::stepFrameCounter() {
+        switch (framePeriod) {
+            case 4:
+                frameValue = (byte) ((frameValue + 1) % 4);
+                switch (frameValue) {
+                    case 0:
+                    case 2:
+                        stepEnvelope();
+                        break;
+                    case 1:
+                        stepEnvelope();
+                        stepSweep();
+                        stepLength();
+                        break;
+                    case 3:
+                        stepEnvelope();
+                        stepSweep();
+                        stepLength();
+                        fireIRQ();
+                        break;
+                    default:
+                        break;
+                }
+                break;
+            case 5:
+                frameValue = (byte) ((frameValue + 1) % 5);
+                switch (frameValue) {
+                    case 0:
+                    case 2:
+                        stepEnvelope();
+                        break;
+                    case 1:
+                    case 3:
+                        stepEnvelope();
+                        stepSweep();
+                        stepLength();
+                        break;
+                    default:
+                        break;
+                }
+                break;
+            default:
+                break;
+        }
+    }
+
+    void APU::stepTimer() {
+        if (cycle % 2 == 0) {
+            pulse1.stepTimer();
+            pulse2.stepTimer();
+            noise.stepTimer();
+            dmc.stepTimer(cpu);
+        }
+        triangle.stepTimer();
+    }
+
+    void APU::stepEnvelope() {
+        pulse1.stepEnvelope();
+        pulse2.stepEnvelope();
+        triangle.stepCounter();
+        noise.stepEnvelope();
+    }
+
+    void APU::stepSweep() {
+        pulse1.stepSweep();
+        pulse2.stepSweep();
+    }
+
+    void APU::stepLength() {
+        pulse1.stepLength();
+        pulse2.stepLength();
+        triangle.stepLength();
+        noise.stepLength();
+    }
+
+    void APU::fireIRQ() {
+        // held until $4015 is read or $4017 inhibits it
+        if (frameIRQ) {
+            cpu->setIrqLine(IRQ_FRAME_COUNTER, true);
+        }
+    }
+
+    byte APU::readRegister(addr_t address) {
+        if (address == 0x4015) {
+            return readStatus();
+        }
+        return 0;
+    }
+
+    void APU::writeRegister(addr_t address, byte value) {
+        switch (address) {
+            case 0x4000:
+                pulse1.writeControl(value);
+                break;
+            case 0x4001:
+                pulse1.writeSweep(value);
+                break;
+            case 0x4002:
+                pulse1.writeTimerLow(value);
+                break;
+            case 0x4003:
+                pulse1.writeTimerHigh(value);
+                break;
+            case 0x4004:
+                pulse2.writeControl(value);
+                break;
+            case 0x4005:
+                pulse2.writeSweep(value);
+                break;
+            case 0x4006:
+                pulse2.writeTimerLow(value);
+                break;
+            case 0x4007:
+                pulse2.writeTimerHigh(value);
+                break;
+            case 0x4008:
+                triangle.writeControl(value);
+                break;
+            case 0x400A:
+                triangle.writeTimerLow(value);
+                break;
+            case 0x400B:
+                triangle.writeTimerHigh(value);
+                break;
+            case 0x400C:
+                noise.writeControl(value);
+                break;
+            case 0x400E:
+                noise.writePeriod(value);
+                break;
+            case 0x400F:
+                noise.writeLength(value);
+                break;
+            case 0x4010:
+                dmc.writeControl(value);
+                if (!dmc.irq) {
+                    cpu->setIrqLine(IRQ_DMC, false);
+                }
+                break;
+            case 0x4011:
+                dmc.writeValue(value);
+                break;
+            case 0x4012:
+                dmc.writeAddress(value);
+                break;
+            case 0x4013:
+                dmc.writeLength(value);
+                break;
+            case 0x4015:
+                writeControl(value);
+                break;
+            case 0x4017:
+                writeFrameCounter(value);
+                break;
+            default:
+                break;
+        }
+    }
+
+    byte APU::readStatus() {
+        byte result = 0;
+        if (pulse1.lengthValue > 0) {
+            result |= 1;
+        }
+        if (pulse2.lengthValue > 0) {
+            result |= 2;
+        }
+        if (triangle.lengthValue > 0) {
+            result |= 4;
+        }
+        if (noise.lengthValue > 0) {
+            result |= 8;
+        }
+        if (dmc.currentLength > 0) {
+            result |= 16;
+        }
+        if (cpu->isIrqAsserted(IRQ_FRAME_COUNTER)) {
+            result |= 64;
+        }
+        if (cpu->isIrqAsserted(IRQ_DMC)) {
+            result |= 128;
+        }
+        // reading acknowledges the frame IRQ, not the DMC one
+        cpu->setIrqLine(IRQ_FRAME_COUNTER, false);
+        return result;
+    }
+
+    void APU::writeControl(byte value) {
+        cpu->setIrqLine(IRQ_DMC, false);
+        pulse1.enabled = (value & 1) == 1;
+        pulse2.enabled = (value & 2) == 2;
+        triangle.enabled = (value & 4) == 4;
+        noise.enabled = (value & 8) == 8;
+        dmc.enabled = (value & 16) == 16;
+        if (!pulse1.enabled) {
+            pulse1.lengthValue = 0;
+        }
+        if (!pulse2.enabled) {
+            pulse2.lengthValue = 0;
+        }
+        if (!triangle.enabled) {
+            triangle.lengthValue = 0;
+        }
+        if (!noise.enabled) {
+            noise.lengthValue = 0;
+        }
+        if (!dmc.enabled) {
+            dmc.currentLength = 0;
+        } else if (dmc.currentLength == 0) {
+            dmc.restart();
+        }
+    }
+
+    void APU::writeFrameCounter(byte value) {
+        framePeriod = (byte) (4 + ((value >> 7) & 1));
+        frameIRQ = ((value >> 6) & 1) == 0;
+        if (!frameIRQ) {
+            cpu->setIrqLine(IRQ_FRAME_COUNTER, false);
+        }
+        if (framePeriod == 5) {
+            stepEnvelope();
+            stepSweep();
+            stepLength();
+        }
+    }
+
+    void APU::save(State &state) const {
+        state.put(pulse1);
+        state.put(pulse2);
+        state.put(triangle);
+        state.put(noise);
+        state.put(dmc);
+        state.put(cycle);
+        state.put(framePeriod);
+        state.put(frameValue);
+        state.put(frameIRQ);
+        state.put(framePhase);
+    }
+
+    void APU::load(State &state) {
+        state.get(pulse1);
+        state.get(pulse2);
+        state.get(triangle);
+        state.get(noise);
+        state.get(dmc);
+        state.get(cycle);
+        state.get(framePeriod);
+        state.get(frameValue);
+        state.get(frameIRQ);
+        state.get(framePhase);
+    }
+}
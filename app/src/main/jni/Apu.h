@@ -0,0 +1,272 @@
+#ifndef NESDROID_APU_H
+#define NESDROID_APU_H
+
+#include "commons.h"
+#include "State.h"
+
+namespace nesdroid {
+
+    static const int CPU_FREQUENCY = 1789773;
+    static const int DEFAULT_SAMPLE_RATE = 44100;
+    static const int MAX_FRAME_SAMPLES = 4096;
+
+    class Cpu;
+
+    struct Pulse {
+        bool enabled;
+        byte channel;
+        bool lengthEnabled;
+        byte lengthValue;
+        dbyte timerPeriod;
+        dbyte timerValue;
+        byte dutyMode;
+        byte dutyValue;
+        bool sweepReload;
+        bool sweepEnabled;
+        bool sweepNegate;
+        byte sweepShift;
+        byte sweepPeriod;
+        byte sweepValue;
+        bool envelopeEnabled;
+        bool envelopeLoop;
+        bool envelopeStart;
+        byte envelopePeriod;
+        byte envelopeValue;
+        byte envelopeVolume;
+        byte constantVolume;
+
+        void writeControl(byte value);
+
+        void writeSweep(byte value);
+
+        void writeTimerLow(byte value);
+
+        void writeTimerHigh(byte value);
+
+        void stepTimer();
+
+        void stepEnvelope();
+
+        void stepSweep();
+
+        void stepLength();
+
+        void sweep();
+
+        byte output() const;
+    };
+
+    struct Triangle {
+        bool enabled;
+        bool lengthEnabled;
+        byte lengthValue;
+        dbyte timerPeriod;
+        dbyte timerValue;
+        byte dutyValue;
+        byte counterPeriod;
+        byte counterValue;
+        bool counterReload;
+
+        void writeControl(byte value);
+
+        void writeTimerLow(byte value);
+
+        void writeTimerHigh(byte value);
+
+        void stepTimer();
+
+        void stepLength();
+
+        void stepCounter();
+
+        byte output() const;
+    };
+
+    struct Noise {
+        bool enabled;
+        bool mode;
+        dbyte shiftRegister;
+        bool lengthEnabled;
+        byte lengthValue;
+        dbyte timerPeriod;
+        dbyte timerValue;
+        bool envelopeEnabled;
+        bool envelopeLoop;
+        bool envelopeStart;
+        byte envelopePeriod;
+        byte envelopeValue;
+        byte envelopeVolume;
+        byte constantVolume;
+
+        void writeControl(byte value);
+
+        void writePeriod(byte value);
+
+        void writeLength(byte value);
+
+        void stepTimer();
+
+        void stepEnvelope();
+
+        void stepLength();
+
+        byte output() const;
+    };
+
+    struct DMC {
+        bool enabled;
+        byte value;
+        addr_t sampleAddress;
+        dbyte sampleLength;
+        addr_t currentAddress;
+        dbyte currentLength;
+        byte shiftRegister;
+        byte bitCount;
+        byte tickPeriod;
+        byte tickValue;
+        bool loop;
+        bool irq;
+
+        void writeControl(byte value);
+
+        void writeValue(byte value);
+
+        void writeAddress(byte value);
+
+        void writeLength(byte value);
+
+        void restart();
+
+        void stepTimer(Cpu *cpu);
+
+        void stepReader(Cpu *cpu);
+
+        void stepShifter();
+
+        byte output() const {
+            return value;
+        }
+    };
+
+    // first order IIR filter
+    struct Filter {
+        float b0;
+        float b1;
+        float a1;
+        float prevX;
+        float prevY;
+
+        void lowPass(float sampleRate, float cutoff);
+
+        void highPass(float sampleRate, float cutoff);
+
+        inline float step(float x) {
+            float y = b0 * x + b1 * prevX - a1 * prevY;
+            prevY = y;
+            prevX = x;
+            return y;
+        }
+    };
+
+    class APU {
+
+    public:
+
+        APU();
+
+        void connect(Cpu *cpu) {
+            this->cpu = cpu;
+        }
+
+        void reset();
+
+        // advance the given number of cpu cycles
+        void step(int cycles);
+
+        byte readRegister(addr_t address);
+
+        void writeRegister(addr_t address, byte value);
+
+        void setSampleRate(int sampleRate);
+
+        int getSampleRate() const {
+            return sampleRate;
+        }
+
+        // Mix one output sample out of every `decimation` samples, 0 mutes the mixer.
+        // Channels, length counters, IRQs and DMC fetches keep running either way,
+        // only the mixing and filtering work is skipped.
+        void setDecimation(int decimation);
+
+        int getDecimation() const {
+            return decimation;
+        }
+
+        // mono samples produced since the last clearSamples()
+        const int16_t *getSamples() const {
+            return samples;
+        }
+
+        int getSampleCount() const {
+            return sampleCount;
+        }
+
+        void clearSamples() {
+            sampleCount = 0;
+        }
+
+        void save(State &state) const;
+
+        void load(State &state);
+
+    private:
+
+        void stepFrameCounter();
+
+        void stepTimer();
+
+        void stepEnvelope();
+
+        void stepSweep();
+
+        void stepLength();
+
+        void fireIRQ();
+
+        void sendSample();
+
+        float output() const;
+
+        void writeControl(byte value);
+
+        void writeFrameCounter(byte value);
+
+        byte readStatus();
+
+        Cpu *cpu = nullptr;
+
+        Pulse pulse1;
+        Pulse pulse2;
+        Triangle triangle;
+        Noise noise;
+        DMC dmc;
+
+        uint64_t cycle;
+        byte framePeriod;
+        byte frameValue;
+        bool frameIRQ;
+        // frame sequencer runs at 240Hz: one step each time this passes CPU_FREQUENCY
+        uint32_t framePhase;
+
+        // output side, not part of the machine state
+        int sampleRate = DEFAULT_SAMPLE_RATE;
+        uint32_t samplePhase = 0;
+        int decimation = 1;
+        int decimationCount = 0;
+        Filter filters[3];
+        int16_t samples[MAX_FRAME_SAMPLES];
+        int sampleCount = 0;
+    };
+}
+
+#endif //NESDROID_APU_H
@@ -0,0 +1,44 @@
+#include <cstdint>
+#include <cstring>
+#include <new>
+
+#include "Arena.h"
+
+namespace nesdroid {
+
+    Arena::~Arena() {
+        delete[] block;
+    }
+
+    bool Arena::reserve(size_t size) {
+        used = 0;
+        size = align(size);
+        if (size <= capacity) {
+            return true;
+        }
+
+        delete[] block;
+        block = new(std::nothrow) byte[size + CACHE_LINE - 1];
+        if (block == nullptr) {
+            base = nullptr;
+            capacity = 0;
+            return false;
+        }
+
+        base = (byte *) align((size_t) (uintptr_t) block);
+        capacity = size;
+        return true;
+    }
+
+    byte *Arena::allocate(size_t size) {
+        size = align(size);
+        if (used + size > capacity) {
+            return nullptr;
+        }
+
+        byte *p = base + used;
+        used += size;
+        memset(p, 0, size);
+        return p;
+    }
+}
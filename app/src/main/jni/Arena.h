@@ -0,0 +1,55 @@
+#ifndef NESDROID_ARENA_H
+#define NESDROID_ARENA_H
+
+#include <cstddef>
+
+#include "commons.h"
+
+namespace nesdroid {
+
+    // One block of memory for the lifetime of a machine. Blocks are carved off
+    // in order and cache-line aligned, so whatever is allocated first sits
+    // together at the front; nothing is freed on its own, reserve() starts over.
+    class Arena {
+
+    public:
+
+        static const size_t CACHE_LINE = 64;
+
+        static size_t align(size_t size) {
+            return (size + CACHE_LINE - 1) & ~(CACHE_LINE - 1);
+        }
+
+        Arena() { }
+
+        virtual ~Arena();
+
+        // drop every block and make room for size bytes (sum of align()ed sizes),
+        // allocating only when the current block is too small
+        bool reserve(size_t size);
+
+        // zeroed, cache-line aligned block, nullptr once the arena is full
+        byte *allocate(size_t size);
+
+        size_t getCapacity() const {
+            return capacity;
+        }
+
+        size_t getUsed() const {
+            return used;
+        }
+
+    private:
+
+        Arena(const Arena &) = delete;
+
+        Arena &operator=(const Arena &) = delete;
+
+        byte *block = nullptr;
+        byte *base = nullptr;
+        size_t capacity = 0;
+        size_t used = 0;
+    };
+}
+
+#endif //NESDROID_ARENA_H
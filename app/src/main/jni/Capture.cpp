@@ -0,0 +1,297 @@
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <zlib.h>
+
+#include "Capture.h"
+#include "Console.h"
+
+namespace nesdroid {
+
+    static const int PIXELS = SCREEN_WIDTH * SCREEN_HEIGHT;
+
+    // palette index of black
+    static const byte BLACK = 0x0F;
+
+    // FNV-1a over 64-bit words: a few microseconds a frame
+    static uint64_t hashFrame(const byte *frame, const byte *emphasis) {
+        uint64_t hash = 14695981039346656037ULL;
+        for (int i = 0; i < PIXELS; i += 8) {
+            uint64_t word;
+            memcpy(&word, frame + i, sizeof(word));
+            hash = (hash ^ word) * 1099511628211ULL;
+        }
+        for (int i = 0; i < SCREEN_HEIGHT; i++) {
+            hash = (hash ^ emphasis[i]) * 1099511628211ULL;
+        }
+        return hash;
+    }
+
+    static void putLe(byte *out, uint32_t value, int bytes) {
+        for (int i = 0; i < bytes; i++) {
+            out[i] = (byte) (value >> (8 * i));
+        }
+    }
+
+    static void putBe(std::vector<byte> &out, uint32_t value) {
+        for (int shift = 24; shift >= 0; shift -= 8) {
+            out.push_back((byte) (value >> shift));
+        }
+    }
+
+    static void putPngChunk(std::vector<byte> &out, const char *type, const byte *data, size_t size) {
+        putBe(out, (uint32_t) size);
+        size_t start = out.size();
+        out.insert(out.end(), type, type + 4);
+        out.insert(out.end(), data, data + size);
+        putBe(out, (uint32_t) crc32(0, out.data() + start, (uInt) (size + 4)));
+    }
+
+    Capture::~Capture() {
+        close();
+    }
+
+    bool Capture::open(const char *basePath, CaptureFormat format, int sampleRate) {
+        close();
+
+        this->format = format;
+        this->basePath = basePath;
+        this->sampleRate = sampleRate;
+
+        std::string audioPath = this->basePath + ".wav";
+        audioFile = fopen(audioPath.c_str(), "wb");
+        if (audioFile == nullptr) {
+            LOG("Failed to open capture %s\n", audioPath.c_str());
+            return false;
+        }
+        if (format == CAPTURE_Y4M) {
+            std::string videoPath = this->basePath + ".y4m";
+            videoFile = fopen(videoPath.c_str(), "wb");
+            if (videoFile == nullptr) {
+                LOG("Failed to open capture %s\n", videoPath.c_str());
+                fclose(audioFile);
+                audioFile = nullptr;
+                return false;
+            }
+            fprintf(videoFile, "YUV4MPEG2 W%d H%d F1000000000:%llu Ip A1:1 C444\n", SCREEN_WIDTH, SCREEN_HEIGHT,
+                    (unsigned long long) FRAME_NANOS);
+        }
+        audioBytes = 0;
+        writeWavHeader(0);
+
+        if (slots.empty()) {
+            slots.resize(MAX_SLOTS);
+        }
+        head.store(0);
+        tail.store(0);
+        hasPicture = false;
+        pendingDrops = 0;
+        pngIndex = 0;
+        frames.store(0);
+        repeatedFrames.store(0);
+        droppedFrames.store(0);
+        encoded.clear();
+        silence.assign((size_t) ((uint64_t) sampleRate * FRAME_NANOS / 1000000000ULL), 0);
+
+        stopping.store(false);
+        thread = std::thread(&Capture::run, this);
+        return true;
+    }
+
+    void Capture::close() {
+        if (audioFile == nullptr) {
+            return;
+        }
+        stopping.store(true);
+        changed.notify_one();
+        thread.join();
+
+        // frames dropped after the last one queued still take their time
+        for (; pendingDrops > 0; pendingDrops--) {
+            writeVideo();
+            writeAudio(silence.data(), (int) silence.size());
+        }
+        if (videoFile != nullptr) {
+            fclose(videoFile);
+            videoFile = nullptr;
+        }
+        fseek(audioFile, 0, SEEK_SET);
+        writeWavHeader(audioBytes);
+        fclose(audioFile);
+        audioFile = nullptr;
+
+        LOG("Capture %s: %llu frames, %llu repeated, %llu dropped\n", basePath.c_str(),
+            (unsigned long long) getFrames(), (unsigned long long) getRepeatedFrames(),
+            (unsigned long long) getDroppedFrames());
+    }
+
+    void Capture::submit(const byte *frame, const byte *emphasis, const int16_t *samples, int sampleCount) {
+        uint64_t t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) == MAX_SLOTS) {
+            // the encoder is behind: never wait for it
+            pendingDrops++;
+            droppedFrames.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+
+        CaptureSlot &slot = slots[t % MAX_SLOTS];
+        uint64_t hash = hashFrame(frame, emphasis);
+        slot.repeat = hasPicture && hash == lastHash;
+        if (!slot.repeat) {
+            memcpy(slot.frame, frame, sizeof(slot.frame));
+            memcpy(slot.emphasis, emphasis, sizeof(slot.emphasis));
+        }
+        lastHash = hash;
+        hasPicture = true;
+        slot.dropsBefore = pendingDrops;
+        pendingDrops = 0;
+        slot.sampleCount = std::min(sampleCount, MAX_FRAME_SAMPLES);
+        memcpy(slot.samples, samples, slot.sampleCount * sizeof(int16_t));
+
+        tail.store(t + 1, std::memory_order_release);
+        changed.notify_one();
+    }
+
+    void Capture::run() {
+        while (true) {
+            uint64_t h = head.load(std::memory_order_relaxed);
+            if (h == tail.load(std::memory_order_acquire)) {
+                if (stopping.load()) {
+                    return;
+                }
+                // the producer does not take the lock, a lost wake-up costs one timeout
+                std::unique_lock<std::mutex> lock(mutex);
+                changed.wait_for(lock, std::chrono::milliseconds(5));
+                continue;
+            }
+            encode(slots[h % MAX_SLOTS]);
+            head.store(h + 1, std::memory_order_release);
+        }
+    }
+
+    void Capture::encode(const CaptureSlot &slot) {
+        for (uint32_t i = 0; i < slot.dropsBefore; i++) {
+            writeVideo();
+            writeAudio(silence.data(), (int) silence.size());
+        }
+
+        if (slot.repeat) {
+            repeatedFrames.fetch_add(1, std::memory_order_relaxed);
+        } else if (format == CAPTURE_Y4M) {
+            convertYuv(slot);
+        } else {
+            encodePng(slot);
+        }
+        writeVideo();
+        writeAudio(slot.samples, slot.sampleCount);
+        frames.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void Capture::writeVideo() {
+        if (encoded.empty()) {
+            // nothing to repeat yet: black keeps the video as long as the audio
+            std::unique_ptr<CaptureSlot> black(new CaptureSlot());
+            memset(black->frame, BLACK, sizeof(black->frame));
+            memset(black->emphasis, 0, sizeof(black->emphasis));
+            if (format == CAPTURE_Y4M) {
+                convertYuv(*black);
+            } else {
+                encodePng(*black);
+            }
+        }
+        if (format == CAPTURE_Y4M) {
+            fwrite(encoded.data(), 1, encoded.size(), videoFile);
+            return;
+        }
+        char path[32];
+        snprintf(path, sizeof(path), "-%06llu.png", (unsigned long long) pngIndex++);
+        std::string name = basePath + path;
+        FILE *file = fopen(name.c_str(), "wb");
+        if (file == nullptr) {
+            LOG("Failed to write %s\n", name.c_str());
+            return;
+        }
+        fwrite(encoded.data(), 1, encoded.size(), file);
+        fclose(file);
+    }
+
+    void Capture::writeAudio(const int16_t *samples, int count) {
+        // little endian like every Android ABI
+        fwrite(samples, sizeof(int16_t), (size_t) count, audioFile);
+        audioBytes += count * sizeof(int16_t);
+    }
+
+    void Capture::convertYuv(const CaptureSlot &slot) {
+        rgba.resize(PIXELS * 4);
+        palette.convertFrame(slot.frame, slot.emphasis, rgba.data(), SCREEN_WIDTH * 4, PIXEL_FORMAT_RGBA_8888);
+
+        static const char FRAME_HEADER[] = "FRAME\n";
+        size_t headerSize = sizeof(FRAME_HEADER) - 1;
+        encoded.resize(headerSize + 3 * PIXELS);
+        memcpy(encoded.data(), FRAME_HEADER, headerSize);
+        byte *y = encoded.data() + headerSize;
+        byte *u = y + PIXELS;
+        byte *v = u + PIXELS;
+        // BT.601, studio range
+        for (int i = 0; i < PIXELS; i++) {
+            int r = rgba[i * 4];
+            int g = rgba[i * 4 + 1];
+            int b = rgba[i * 4 + 2];
+            y[i] = (byte) (((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+            u[i] = (byte) (((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+            v[i] = (byte) (((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+        }
+    }
+
+    void Capture::encodePng(const CaptureSlot &slot) {
+        rgba.resize(PIXELS * 4);
+        palette.convertFrame(slot.frame, slot.emphasis, rgba.data(), SCREEN_WIDTH * 4, PIXEL_FORMAT_RGBA_8888);
+
+        // RGB lines, each behind filter type 0
+        const int lineSize = 1 + SCREEN_WIDTH * 3;
+        std::vector<byte> raw((size_t) lineSize * SCREEN_HEIGHT);
+        for (int line = 0; line < SCREEN_HEIGHT; line++) {
+            byte *out = &raw[line * lineSize];
+            const byte *in = &rgba[line * SCREEN_WIDTH * 4];
+            *out++ = 0;
+            for (int x = 0; x < SCREEN_WIDTH; x++) {
+                *out++ = in[x * 4];
+                *out++ = in[x * 4 + 1];
+                *out++ = in[x * 4 + 2];
+            }
+        }
+        uLongf deflatedSize = compressBound((uLong) raw.size());
+        std::vector<byte> deflated(deflatedSize);
+        compress2(deflated.data(), &deflatedSize, raw.data(), (uLong) raw.size(), Z_BEST_SPEED);
+
+        static const byte SIGNATURE[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+        byte header[13] = {0};
+        header[2] = SCREEN_WIDTH >> 8;
+        header[3] = SCREEN_WIDTH & 0xFF;
+        header[7] = SCREEN_HEIGHT;
+        header[8] = 8;      // bits per channel
+        header[9] = 2;      // truecolor
+        encoded.assign(SIGNATURE, SIGNATURE + sizeof(SIGNATURE));
+        putPngChunk(encoded, "IHDR", header, sizeof(header));
+        putPngChunk(encoded, "IDAT", deflated.data(), deflatedSize);
+        putPngChunk(encoded, "IEND", nullptr, 0);
+    }
+
+    void Capture::writeWavHeader(uint32_t dataSize) {
+        byte header[44];
+        memcpy(header, "RIFF", 4);
+        putLe(header + 4, 36 + dataSize, 4);
+        memcpy(header + 8, "WAVEfmt ", 8);
+        putLe(header + 16, 16, 4);
+        putLe(header + 20, 1, 2);       // PCM
+        putLe(header + 22, 1, 2);       // mono
+        putLe(header + 24, (uint32_t) sampleRate, 4);
+        putLe(header + 28, (uint32_t) sampleRate * 2, 4);
+        putLe(header + 32, 2, 2);
+        putLe(header + 34, 16, 2);
+        memcpy(header + 36, "data", 4);
+        putLe(header + 40, dataSize, 4);
+        fwrite(header, 1, sizeof(header), audioFile);
+    }
+}
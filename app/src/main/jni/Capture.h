@@ -0,0 +1,129 @@
+#ifndef NESDROID_CAPTURE_H
+#define NESDROID_CAPTURE_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "commons.h"
+#include "Apu.h"
+#include "Palette.h"
+#include "Ppu.h"
+
+namespace nesdroid {
+
+    enum CaptureFormat {
+        // <base>.y4m, 4:4:4 at the NTSC frame rate, and <base>.wav
+        CAPTURE_Y4M = 0,
+        // <base>-000000.png, one per frame, and <base>.wav
+        CAPTURE_PNG = 1,
+    };
+
+    // One frame on its way to the encoder: the PPU output as palette indices and
+    // the mono samples mixed while it was emulated.
+    struct CaptureSlot {
+        bool repeat;            // same picture as the frame before, pixels not copied
+        uint32_t dropsBefore;   // frames lost to a full queue right before this one
+        int sampleCount;
+        byte frame[SCREEN_WIDTH * SCREEN_HEIGHT];
+        byte emphasis[SCREEN_HEIGHT];
+        int16_t samples[MAX_FRAME_SAMPLES];
+    };
+
+    // Records the emulated frames and audio on a thread of its own. The emulation
+    // thread hands frames over through a single-producer ring and never waits:
+    // with the ring full the frame is dropped and counted, and the encoder fills
+    // the gap with the last picture and silence so audio and video stay in step.
+    // A picture whose hash matches the one before is queued without its pixels
+    // and reuses the previous encoding.
+    class Capture {
+
+    public:
+
+        static const int MAX_SLOTS = 16;
+
+        Capture() { }
+
+        virtual ~Capture();
+
+        bool open(const char *basePath, CaptureFormat format, int sampleRate);
+
+        // encode everything submitted and close the files, from the thread that submits
+        void close();
+
+        bool isOpen() const {
+            return audioFile != nullptr;
+        }
+
+        // emulation thread, once per frame
+        void submit(const byte *frame, const byte *emphasis, const int16_t *samples, int sampleCount);
+
+        uint64_t getFrames() const {
+            return frames.load(std::memory_order_relaxed);
+        }
+
+        uint64_t getRepeatedFrames() const {
+            return repeatedFrames.load(std::memory_order_relaxed);
+        }
+
+        uint64_t getDroppedFrames() const {
+            return droppedFrames.load(std::memory_order_relaxed);
+        }
+
+    private:
+
+        void run();
+
+        void encode(const CaptureSlot &slot);
+
+        // the current picture again, for repeats and drops; black before the first
+        void writeVideo();
+
+        void writeAudio(const int16_t *samples, int count);
+
+        void convertYuv(const CaptureSlot &slot);
+
+        void encodePng(const CaptureSlot &slot);
+
+        void writeWavHeader(uint32_t dataSize);
+
+        CaptureFormat format = CAPTURE_Y4M;
+        std::string basePath;
+        int sampleRate = DEFAULT_SAMPLE_RATE;
+        FILE *videoFile = nullptr;
+        FILE *audioFile = nullptr;
+        uint32_t audioBytes = 0;
+        uint64_t pngIndex = 0;
+        Palette palette;
+
+        // ring of slots: the emulation thread fills at tail, the encoder empties at head
+        std::vector<CaptureSlot> slots;
+        std::atomic<uint64_t> head{0};
+        std::atomic<uint64_t> tail{0};
+
+        // emulation thread only
+        uint64_t lastHash = 0;
+        bool hasPicture = false;
+        uint32_t pendingDrops = 0;
+
+        // encoder thread only: the last picture as written
+        std::vector<byte> rgba;
+        std::vector<byte> encoded;
+        std::vector<int16_t> silence;
+
+        std::thread thread;
+        std::mutex mutex;
+        std::condition_variable changed;
+        std::atomic<bool> stopping{false};
+
+        std::atomic<uint64_t> frames{0};
+        std::atomic<uint64_t> repeatedFrames{0};
+        std::atomic<uint64_t> droppedFrames{0};
+    };
+}
+
+#endif //NESDROID_CAPTURE_H
@@ -0,0 +1,142 @@
+#include <cstdlib>
+#include <cstring>
+
+#include "Cheats.h"
+
+namespace nesdroid {
+
+    static const char GAME_GENIE_LETTERS[] = "APZLGITYEOXUKSVN";
+
+    static int parseHex(const char *begin, const char *end) {
+        if (begin == end || end - begin > 4) {
+            return -1;
+        }
+        int value = 0;
+        for (const char *p = begin; p < end; p++) {
+            int digit;
+            if (*p >= '0' && *p <= '9') {
+                digit = *p - '0';
+            } else if (*p >= 'a' && *p <= 'f') {
+                digit = *p - 'a' + 10;
+            } else if (*p >= 'A' && *p <= 'F') {
+                digit = *p - 'A' + 10;
+            } else {
+                return -1;
+            }
+            value = value << 4 | digit;
+        }
+        return value;
+    }
+
+    bool Cheats::decodeGameGenie(const char *code, Cheat &cheat) {
+        size_t length = strlen(code);
+        if (length != 6 && length != 8) {
+            return false;
+        }
+        int n[8];
+        for (size_t i = 0; i < length; i++) {
+            // upper case; a space would turn into the terminator strchr matches
+            char upper = (char) (code[i] & ~0x20);
+            const char *letter = upper == 0 ? nullptr : strchr(GAME_GENIE_LETTERS, upper);
+            if (letter == nullptr) {
+                return false;
+            }
+            n[i] = (int) (letter - GAME_GENIE_LETTERS);
+        }
+
+        cheat.address = (addr_t) (0x8000 | ((n[3] & 7) << 12) | ((n[5] & 7) << 8) | ((n[4] & 8) << 8)
+                                  | ((n[2] & 7) << 4) | ((n[1] & 8) << 4) | (n[4] & 7) | (n[3] & 8));
+        if (length == 6) {
+            cheat.value = (byte) (((n[1] & 7) << 4) | ((n[0] & 8) << 4) | (n[0] & 7) | (n[5] & 8));
+            cheat.compare = -1;
+        } else {
+            cheat.value = (byte) (((n[1] & 7) << 4) | ((n[0] & 8) << 4) | (n[0] & 7) | (n[7] & 8));
+            cheat.compare = ((n[7] & 7) << 4) | ((n[6] & 8) << 4) | (n[6] & 7) | (n[5] & 8);
+        }
+        return true;
+    }
+
+    bool Cheats::add(const char *code) {
+        Cheat cheat;
+        const char *colon = strchr(code, ':');
+        if (colon == nullptr) {
+            if (!decodeGameGenie(code, cheat)) {
+                return false;
+            }
+        } else {
+            const char *question = strchr(code, '?');
+            const char *addressEnd = question != nullptr && question < colon ? question : colon;
+            int address = parseHex(code, addressEnd);
+            int value = parseHex(colon + 1, code + strlen(code));
+            int compare = addressEnd == question ? parseHex(question + 1, colon) : -1;
+            if (address < 0 || value < 0 || value > 0xFF || compare > 0xFF
+                || (addressEnd == question && compare < 0)) {
+                return false;
+            }
+            cheat.address = (addr_t) address;
+            cheat.value = (byte) value;
+            cheat.compare = compare;
+        }
+
+        if (cheat.address >= 0x2000 && cheat.address < 0x6000) {
+            // registers, nothing a freeze could hold
+            return false;
+        }
+        if (cheat.address >= 0x8000) {
+            patches.push_back(cheat);
+            // pages built so far may miss the new patch
+            shadows.clear();
+        } else {
+            freezes.push_back(cheat);
+        }
+        return true;
+    }
+
+    void Cheats::clear() {
+        patches.clear();
+        freezes.clear();
+        shadows.clear();
+    }
+
+    void Cheats::overlay(byte **map) {
+        if (patches.empty()) {
+            return;
+        }
+        for (int slot = 0; slot < 8; slot++) {
+            map[slot] = shadowFor(map[slot], slot);
+        }
+    }
+
+    byte *Cheats::shadowFor(byte *source, int slot) {
+        auto key = std::make_pair((const byte *) source, slot);
+        auto found = shadows.find(key);
+        if (found != shadows.end()) {
+            return found->second.empty() ? source : found->second.data();
+        }
+
+        // an empty entry remembers that nothing applies to this page
+        std::vector<byte> &shadow = shadows[key];
+        addr_t base = (addr_t) (0x8000 + slot * PAGE_SIZE);
+        for (auto &patch : patches) {
+            int offset = patch.address - base;
+            if (offset < 0 || offset >= PAGE_SIZE || (patch.compare >= 0 && source[offset] != patch.compare)) {
+                continue;
+            }
+            if (shadow.empty()) {
+                shadow.assign(source, source + PAGE_SIZE);
+            }
+            shadow[offset] = patch.value;
+        }
+        return shadow.empty() ? source : shadow.data();
+    }
+
+    void Cheats::applyFreezes(byte *ram, byte *prgRam) const {
+        for (auto &freeze : freezes) {
+            if (freeze.address < 0x2000) {
+                ram[freeze.address & 0x7FF] = freeze.value;
+            } else if (freeze.address >= 0x6000 && prgRam != nullptr) {
+                prgRam[freeze.address & 0x1FFF] = freeze.value;
+            }
+        }
+    }
+}
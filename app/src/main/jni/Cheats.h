@@ -0,0 +1,65 @@
+#ifndef NESDROID_CHEATS_H
+#define NESDROID_CHEATS_H
+
+#include <map>
+#include <utility>
+#include <vector>
+
+#include "commons.h"
+
+namespace nesdroid {
+
+    // One code: a ROM patch at $8000-$FFFF, only where the original byte equals
+    // compare if there is one, or a RAM freeze below $8000.
+    struct Cheat {
+        addr_t address;
+        byte value;
+        int compare;    // -1 for none
+    };
+
+    // Cheat codes laid over the bus without costing the read path anything.
+    // ROM patches live in shadow copies of the 4K PRG pages they touch; mappers
+    // swap those in for the originals whenever they switch banks (overlay()).
+    // Freezes are written into RAM once per frame (applyFreezes()).
+    class Cheats {
+
+    public:
+
+        static const int PAGE_SIZE = 0x1000;
+
+        // six or eight letter Game Genie code
+        static bool decodeGameGenie(const char *code, Cheat &cheat);
+
+        // Game Genie, "AAAA:VV" or "AAAA?CC:VV" in hex; false if not understood or
+        // aimed at the registers at $2000-$5FFF
+        bool add(const char *code);
+
+        void clear();
+
+        bool hasPatches() const {
+            return !patches.empty();
+        }
+
+        bool hasFreezes() const {
+            return !freezes.empty();
+        }
+
+        // replace the 4K pages of $8000-$FFFF in map with their patched copies
+        void overlay(byte **map);
+
+        // write frozen values into 2K of cpu ram and the PRG-RAM (may be nullptr)
+        void applyFreezes(byte *ram, byte *prgRam) const;
+
+    private:
+
+        // the patched copy of source as seen at slot, source itself if nothing applies
+        byte *shadowFor(byte *source, int slot);
+
+        std::vector<Cheat> patches;
+        std::vector<Cheat> freezes;
+        // by original page and slot: the same bank may show up at other addresses
+        std::map<std::pair<const byte *, int>, std::vector<byte>> shadows;
+    };
+}
+
+#endif //NESDROID_CHEATS_H
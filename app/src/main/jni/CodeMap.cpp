@@ -0,0 +1,285 @@
+#include <cstdio>
+#include <cstring>
+#include <zlib.h>
+
+#include "CodeMap.h"
+#include "cpu.h"
+#include "Memory.h"
+
+namespace nesdroid {
+
+    static const char CODE_MAP_MAGIC[4] = {'N', 'C', 'D', 'L'};
+    static const uint32_t CODE_MAP_VERSION = 1;
+
+    struct CodeMapHeader {
+        char magic[4];
+        uint32_t version;
+        uint64_t hash;
+        uint32_t size;
+        uint32_t reserved;
+    };
+
+    static const byte OPCODE_JSR = 0x20;
+    static const byte OPCODE_RTI = 0x40;
+    static const byte OPCODE_JMP = 0x4C;
+    static const byte OPCODE_RTS = 0x60;
+    static const byte OPCODE_JMP_INDIRECT = 0x6C;
+
+    // instructions whose operand address is read as data; stores and
+    // read-modify-writes into $8000-$FFFF talk to the board instead
+    static bool readsOperand(byte opcode) {
+        static const char *const NOT_READING[] = {
+                "STA", "STX", "STY", "SAX", "AHX", "SHX", "SHY", "TAS", "JMP", "JSR",
+                "ASL", "LSR", "ROL", "ROR", "INC", "DEC", "SLO", "RLA", "SRE", "RRA", "DCP", "ISC",
+        };
+        switch (AddressingModeTable[opcode]) {
+            case IMPLIED:
+            case ACCUMULATOR:
+            case IMMEDIATE:
+            case RELATIVE:
+                return false;
+            default:
+                break;
+        }
+        for (const char *name : NOT_READING) {
+            if (strcmp(InstructionNameTable[opcode], name) == 0) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    static const struct ReadTable {
+        bool reads[256];
+
+        ReadTable() {
+            for (int i = 0; i < 256; i++) {
+                reads[i] = readsOperand((byte) i);
+            }
+        }
+    } READS;
+
+    void CodeMap::attach(const byte *prg, size_t size, uint64_t romHash) {
+        this->prg = prg;
+        hash = romHash;
+        // value-initialized, all clear
+        flags = std::vector<std::atomic<byte>>(size);
+        dirty = false;
+    }
+
+    long CodeMap::offsetOf(const IMapper *mapper, addr_t address) const {
+        if (address < 0x8000 || prg == nullptr) {
+            return -1;
+        }
+        const byte *p = mapper->prgAddress(address);
+        if (p < prg || p >= prg + flags.size()) {
+            return -1;
+        }
+        return p - prg;
+    }
+
+    void CodeMap::markInstruction(const IMapper *mapper, addr_t pc, byte opcode, byte flag) {
+        long offset = offsetOf(mapper, pc);
+        if (offset >= 0) {
+            mark((size_t) offset, (byte) (CODE_OPCODE | flag));
+        }
+        for (int i = 1; i < InstructionLengthTable[opcode]; i++) {
+            offset = offsetOf(mapper, (addr_t) (pc + i));
+            if (offset >= 0) {
+                mark((size_t) offset, (byte) (CODE_OPERAND | flag));
+            }
+        }
+    }
+
+    void CodeMap::logInstruction(const IMapper *mapper, addr_t pc, byte opcode, addr_t address) {
+        if (pc < 0x8000 || flags.empty()) {
+            return;
+        }
+        markInstruction(mapper, pc, opcode, CODE_EXECUTED);
+        long target = offsetOf(mapper, address);
+        if (target < 0) {
+            return;
+        }
+        if (opcode == OPCODE_JMP_INDIRECT) {
+            mark((size_t) target, CODE_ENTRY | CODE_JUMP_TABLE);
+        } else if (opcode == OPCODE_JMP || opcode == OPCODE_JSR) {
+            mark((size_t) target, CODE_ENTRY);
+        } else if (READS.reads[opcode]) {
+            mark((size_t) target, CODE_DATA);
+        }
+    }
+
+    void CodeMap::analyze(IMapper *mapper) {
+        if (flags.empty()) {
+            return;
+        }
+        // offset of a byte the game always sees at address, -1 for none
+        auto fixedOffset = [this, mapper](addr_t address) -> long {
+            return mapper->isPrgFixed(address) ? offsetOf(mapper, address) : -1;
+        };
+        std::vector<addr_t> pending;
+        auto enter = [&](addr_t target, byte flag) {
+            long offset = fixedOffset(target);
+            if (offset >= 0) {
+                mark((size_t) offset, (byte) (CODE_ENTRY | flag));
+                pending.push_back(target);
+            }
+        };
+        // two bytes of a pointer in rom, marked as data; false if they can change
+        auto readPointer = [&](addr_t address, addr_t &value) {
+            long low = fixedOffset(address);
+            long high = fixedOffset((addr_t) (address + 1));
+            if (low < 0 || high < 0) {
+                return false;
+            }
+            mark((size_t) low, CODE_DATA);
+            mark((size_t) high, CODE_DATA);
+            value = (addr_t) (prg[low] | prg[high] << 8);
+            return true;
+        };
+
+        for (addr_t vector : {0xFFFA, 0xFFFC, 0xFFFE}) {
+            addr_t target;
+            if (readPointer(vector, target)) {
+                enter(target, 0);
+            }
+        }
+
+        while (!pending.empty()) {
+            addr_t pc = pending.back();
+            pending.pop_back();
+            while (true) {
+                long offset = fixedOffset(pc);
+                // followed before, or inside another instruction
+                if (offset < 0 || (getFlags((size_t) offset) & (CODE_OPCODE | CODE_OPERAND)) != 0) {
+                    break;
+                }
+                byte opcode = prg[offset];
+                int length = InstructionLengthTable[opcode];
+                if (length == 0 || InstructionTable[opcode] == nullptr) {
+                    // not code after all
+                    break;
+                }
+                addr_t operand = 0;
+                bool complete = true;
+                for (int i = 1; i < length; i++) {
+                    long byteOffset = fixedOffset((addr_t) (pc + i));
+                    if (byteOffset < 0) {
+                        complete = false;
+                        break;
+                    }
+                    operand |= prg[byteOffset] << (8 * (i - 1));
+                }
+                if (!complete) {
+                    break;
+                }
+                markInstruction(mapper, pc, opcode, 0);
+
+                addr_t next = (addr_t) (pc + length);
+                AddressingMode mode = AddressingModeTable[opcode];
+                if (opcode == OPCODE_JMP) {
+                    enter(operand, 0);
+                    break;
+                } else if (opcode == OPCODE_JMP_INDIRECT) {
+                    addr_t target;
+                    if (readPointer(operand, target)) {
+                        enter(target, CODE_JUMP_TABLE);
+                    }
+                    break;
+                } else if (opcode == OPCODE_JSR) {
+                    // assumed to return
+                    enter(operand, 0);
+                } else if (opcode == OPCODE_RTS || opcode == OPCODE_RTI || opcode == 0x00) {
+                    break;
+                } else if (mode == RELATIVE) {
+                    enter((addr_t) (next + (int8_t) operand), 0);
+                } else if (READS.reads[opcode] && (mode == ABSOLUTE || mode == ABSOLUTE_X || mode == ABSOLUTE_Y)) {
+                    long data = fixedOffset(operand);
+                    if (data >= 0) {
+                        mark((size_t) data, CODE_DATA);
+                    }
+                }
+                pc = next;
+            }
+        }
+    }
+
+    size_t CodeMap::count(int mask) const {
+        size_t total = 0;
+        for (const std::atomic<byte> &flag : flags) {
+            if ((flag.load(std::memory_order_relaxed) & mask) == mask) {
+                total++;
+            }
+        }
+        return total;
+    }
+
+    std::string CodeMap::pathIn(const std::string &directory) const {
+        char name[32];
+        snprintf(name, sizeof(name), "/%016llx.cdl", (unsigned long long) hash);
+        return directory + name;
+    }
+
+    bool CodeMap::load(const std::string &directory) {
+        if (directory.empty() || flags.empty()) {
+            return false;
+        }
+        std::string path = pathIn(directory);
+        gzFile file = gzopen(path.c_str(), "rb");
+        if (file == nullptr) {
+            return false;
+        }
+        CodeMapHeader header;
+        std::vector<byte> loaded(flags.size());
+        bool valid = gzread(file, &header, sizeof(header)) == (int) sizeof(header)
+                     && memcmp(header.magic, CODE_MAP_MAGIC, sizeof(CODE_MAP_MAGIC)) == 0
+                     && header.version == CODE_MAP_VERSION && header.hash == hash && header.size == flags.size()
+                     && gzread(file, loaded.data(), (unsigned) loaded.size()) == (int) loaded.size();
+        gzclose(file);
+        if (!valid) {
+            LOG("Ignoring code map %s\n", path.c_str());
+            return false;
+        }
+        for (size_t i = 0; i < flags.size(); i++) {
+            flags[i].fetch_or(loaded[i], std::memory_order_relaxed);
+        }
+        return true;
+    }
+
+    bool CodeMap::save(const std::string &directory) {
+        if (directory.empty() || flags.empty() || !dirty) {
+            return false;
+        }
+        // the old map stays until the new one is complete; what the consoles
+        // mark while it is written goes into the next save
+        dirty = false;
+        std::vector<byte> snapshot(flags.size());
+        for (size_t i = 0; i < flags.size(); i++) {
+            snapshot[i] = flags[i].load(std::memory_order_relaxed);
+        }
+        std::string path = pathIn(directory);
+        std::string temporary = path + ".tmp";
+        gzFile file = gzopen(temporary.c_str(), "wb6");
+        if (file == nullptr) {
+            LOG("Failed to write code map %s\n", temporary.c_str());
+            dirty = true;
+            return false;
+        }
+        CodeMapHeader header;
+        memcpy(header.magic, CODE_MAP_MAGIC, sizeof(CODE_MAP_MAGIC));
+        header.version = CODE_MAP_VERSION;
+        header.hash = hash;
+        header.size = (uint32_t) flags.size();
+        header.reserved = 0;
+        bool written = gzwrite(file, &header, sizeof(header)) == (int) sizeof(header)
+                       && gzwrite(file, snapshot.data(), (unsigned) snapshot.size()) == (int) snapshot.size();
+        written = gzclose(file) == Z_OK && written;
+        if (!written || rename(temporary.c_str(), path.c_str()) != 0) {
+            LOG("Failed to write code map %s\n", path.c_str());
+            remove(temporary.c_str());
+            dirty = true;
+            return false;
+        }
+        return true;
+    }
+}
@@ -0,0 +1,87 @@
+#ifndef NESDROID_CODEMAP_H
+#define NESDROID_CODEMAP_H
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "commons.h"
+
+namespace nesdroid {
+
+    class IMapper;
+
+    // what a PRG ROM byte was found to be, any combination
+    enum CodeFlag {
+        CODE_OPCODE = 1,        // first byte of an instruction
+        CODE_OPERAND = 2,       // operand byte of an instruction
+        CODE_DATA = 4,          // read by an instruction
+        CODE_ENTRY = 8,         // target of a vector, jump, call or branch
+        CODE_JUMP_TABLE = 16,   // reached through an indirect jump
+        CODE_EXECUTED = 32,     // seen running, not only inferred
+    };
+
+    // Code and data map of a rom's PRG ROM, by offset into it. A static pass
+    // follows the code reachable from the NMI, reset and IRQ vectors through the
+    // windows the board never switches; the cpu then logs what it executes and
+    // reads while the game runs, covering the switched banks and the targets of
+    // indirect jumps. The map is kept in a cache file named after the rom hash,
+    // so the next start has the code boundaries before the first frame.
+    //
+    // One map serves every console playing the rom, see RomStore: marking is
+    // lock free, loading, analyzing and saving are left to the store.
+    class CodeMap {
+
+    public:
+
+        // start over for the size bytes of PRG ROM at prg, as the mapper maps them
+        void attach(const byte *prg, size_t size, uint64_t romHash);
+
+        // static pass through the mapper as it is at power-on
+        void analyze(IMapper *mapper);
+
+        // cpu, before the instruction at pc runs; address is its operand address
+        void logInstruction(const IMapper *mapper, addr_t pc, byte opcode, addr_t address);
+
+        // merge <directory>/<hash>.cdl, false if there is none for this rom
+        bool load(const std::string &directory);
+
+        // write the map if anything was added since it was loaded or saved
+        bool save(const std::string &directory);
+
+        byte getFlags(size_t offset) const {
+            return offset < flags.size() ? flags[offset].load(std::memory_order_relaxed) : (byte) 0;
+        }
+
+        size_t getSize() const {
+            return flags.size();
+        }
+
+        // bytes with all of mask set
+        size_t count(int mask) const;
+
+    private:
+
+        std::string pathIn(const std::string &directory) const;
+
+        // offset into PRG ROM of a cpu address, or -1 outside of it, e.g. below
+        // $8000 or in a page the cheats patched
+        long offsetOf(const IMapper *mapper, addr_t address) const;
+
+        void mark(size_t offset, byte flag) {
+            if ((flags[offset].load(std::memory_order_relaxed) & flag) != flag) {
+                flags[offset].fetch_or(flag, std::memory_order_relaxed);
+                dirty.store(true, std::memory_order_relaxed);
+            }
+        }
+
+        void markInstruction(const IMapper *mapper, addr_t pc, byte opcode, byte flag);
+
+        const byte *prg = nullptr;
+        uint64_t hash = 0;
+        std::vector<std::atomic<byte>> flags;
+        std::atomic<bool> dirty{false};
+    };
+}
+
+#endif //NESDROID_CODEMAP_H
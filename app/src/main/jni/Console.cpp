@@ -0,0 +1,448 @@
+#include <cstring>
+
+#include "Console.h"
+#include "Capture.h"
+#include "Input.h"
+#include "Mapper.h"
+#include "Metrics.h"
+#include "Movie.h"
+#include "Trace.h"
+#include "PpuPipeline.h"
+#include "RomStore.h"
+
+namespace nesdroid {
+
+    Console::Console() {
+        cpu.getMemory().setControllers(controllers);
+        cpu.getMemory().setPpu(&ppu);
+        cpu.getMemory().setApu(&apu);
+        apu.connect(&cpu);
+        debugger.connect(&cpu, &ppu);
+        cpu.getMemory().setDebugger(&debugger);
+        ppu.setDebugger(&debugger);
+        layout(nullptr);
+        ppu.reset();
+    }
+
+    Console::~Console() {
+        stopTrace();
+        uint64_t frames, repeated, dropped;
+        stopCapture(frames, repeated, dropped);
+        stopPipeline();
+        saveCodeMap();
+        destroyMapper();
+        cpu.setCodeMap(nullptr);
+        cpu.setNativeCode(nullptr);
+        RomStore::shared().release(banks);
+        saveRam.close();
+    }
+
+    void Console::setOutputEnabled(bool enabled) {
+        outputEnabled = enabled;
+        if (pipeline != nullptr) {
+            pipeline->setOutputEnabled(enabled);
+        } else {
+            ppu.setOutputEnabled(enabled);
+        }
+    }
+
+    void Console::setPipelined(bool pipelined) {
+        if (pipelined == this->pipelined) {
+            return;
+        }
+        this->pipelined = pipelined;
+        if (pipelined) {
+            startPipeline();
+        } else {
+            stopPipeline();
+        }
+    }
+
+    void Console::startPipeline() {
+        if (!pipelined || pipeline != nullptr || mapper == nullptr) {
+            return;
+        }
+        pipeline = new PpuPipeline(ppu, mapper);
+        if (!pipeline->isValid()) {
+            delete pipeline;
+            pipeline = nullptr;
+            return;
+        }
+        // the console's PPU only keeps time from now on
+        pipeline->setOutputEnabled(outputEnabled);
+        ppu.setOutputEnabled(false);
+        ppu.setRecorder(pipeline);
+    }
+
+    void Console::stopPipeline() {
+        if (pipeline == nullptr) {
+            return;
+        }
+        ppu.setRecorder(nullptr);
+        ppu.setOutputEnabled(outputEnabled);
+        delete pipeline;
+        pipeline = nullptr;
+    }
+
+    const byte *Console::getFrontBuffer() const {
+        return pipeline != nullptr ? pipeline->getFrontBuffer() : ppu.getFrontBuffer();
+    }
+
+    const byte *Console::getFrontEmphasis() const {
+        return pipeline != nullptr ? pipeline->getFrontEmphasis() : ppu.getFrontEmphasis();
+    }
+
+    bool Console::prepareSaveRam() {
+        saveRamPrepared = !savePath.empty() && saveRam.open(savePath.c_str(), PRG_RAM_SIZE);
+        return saveRamPrepared;
+    }
+
+    bool Console::layout(ROM *rom) {
+        destroyMapper();
+        // the banks may go away with the last console playing them
+        cpu.setCodeMap(nullptr);
+        cpu.setNativeCode(nullptr);
+        RomStore::shared().release(banks);
+        banks = nullptr;
+        // flushes whatever the previous cartridge saved, unless mapped ahead for this one
+        bool battery = rom != nullptr && rom->isHasBatteryRam();
+        if (!saveRamPrepared || !battery) {
+            saveRam.close();
+        }
+        saveRamPrepared = false;
+
+        // battery backed boards start PRG-RAM from the save file
+        battery = battery && (saveRam.isOpen()
+                              || (!savePath.empty() && saveRam.open(savePath.c_str(), PRG_RAM_SIZE)));
+
+        // PRG and CHR ROM are shared with the other consoles playing the rom
+        size_t cartridgeSize = 0;
+        if (rom != nullptr) {
+            banks = RomStore::shared().acquire(rom);
+            if (banks == nullptr) {
+                return false;
+            }
+            cartridgeSize = Arena::align(MAX_MAPPER_SIZE) + Arena::align(CHR_RAM_SIZE)
+                            + Arena::align(PRG_RAM_SIZE);
+        }
+
+        size_t size = Arena::align(CpuMemory::RAM_SIZE) + Arena::align(OAM_SIZE)
+                      + Arena::align(PALETTE_SIZE) + Arena::align(NAMETABLE_SIZE)
+                      + cartridgeSize + Arena::align(FRAMES_SIZE);
+        if (!arena.reserve(size)) {
+            LOG("Out of memory for the machine\n");
+            return false;
+        }
+
+        // hottest first: zero page and stack lead the cpu ram, then OAM and palette
+        cpu.getMemory().setRam(arena.allocate(CpuMemory::RAM_SIZE));
+        byte *oam = arena.allocate(OAM_SIZE);
+        byte *palette = arena.allocate(PALETTE_SIZE);
+
+        byte *mapperStorage = nullptr;
+        if (rom != nullptr) {
+            mapperStorage = arena.allocate(MAX_MAPPER_SIZE);
+        }
+        byte *nameTables = arena.allocate(NAMETABLE_SIZE);
+
+        Cartridge cartridge;
+        if (rom != nullptr) {
+            // a working copy: loading a state, as movie seeks and rollbacks do,
+            // must not reach the save file, only what the game writes does
+            cartridge.prgRam = arena.allocate(PRG_RAM_SIZE);
+            if (battery) {
+                memcpy(cartridge.prgRam, saveRam.getData(), PRG_RAM_SIZE);
+            }
+            cartridge.chrRam = arena.allocate(CHR_RAM_SIZE);
+            // read-only pages: the mappers never write PRG or CHR ROM
+            cartridge.prgBanks = rom->getRomCount();
+            cartridge.prg = const_cast<byte *>(banks->getPrg());
+            cartridge.chrBanks = rom->getVromCount();
+            cartridge.chr = const_cast<byte *>(banks->getChr());
+        }
+
+        ppu.setMemory(oam, palette, nameTables, arena.allocate(FRAMES_SIZE));
+
+        if (rom == nullptr) {
+            return true;
+        }
+        mapper = createMapper(rom, cartridge, mapperStorage);
+        return mapper != nullptr;
+    }
+
+    void Console::destroyMapper() {
+        if (mapper != nullptr) {
+            mapper->~IMapper();
+            mapper = nullptr;
+        }
+        cpu.getMemory().setMapper(nullptr);
+        ppu.connect(&cpu, nullptr);
+    }
+
+    bool Console::insert(ROM *rom) {
+        // the render thread reads the cartridge that is about to go away
+        stopPipeline();
+        saveCodeMap();
+        cpu.setCodeMap(nullptr);
+        this->rom = nullptr;
+        if (rom == nullptr || !rom->isValid() || rom->getRomCount() == 0 || !layout(rom)) {
+            // the previous cartridge is gone either way
+            layout(nullptr);
+            ppu.reset();
+            return false;
+        }
+
+        this->rom = rom;
+        cpu.getMemory().setMapper(mapper);
+        ppu.connect(&cpu, mapper);
+        mapper->connect(&cpu, &ppu);
+        mapper->setCheats(&cheats);
+        powerOn();
+        // code boundaries before the first frame: what earlier runs logged, then
+        // what the power-on banks show, unless another console had the rom first
+        banks->prepareCodeMap(mapper, codeCacheDirectory);
+        if (!codeCacheDirectory.empty()) {
+            cpu.setCodeMap(&banks->getCodeMap());
+        }
+        startPipeline();
+        return true;
+    }
+
+    bool Console::loadNativeCode(const std::string &path) {
+        cpu.setNativeCode(nullptr);
+        const NativeCode *native = banks != nullptr ? banks->loadNativeCode(path) : nullptr;
+        if (native == nullptr) {
+            return false;
+        }
+        cpu.setNativeCode(native);
+        return true;
+    }
+
+    void Console::powerOn() {
+        frame = 0;
+        resetRequested = false;
+        frameInterrupted = false;
+        cpu.setHalted(false);
+        controllers[0] = Controller();
+        controllers[1] = Controller();
+        cpu.getMemory().reset();
+        ppu.reset();
+        if (mapper != nullptr) {
+            mapper->reset();
+        }
+        apu.reset();
+        cpu.reset();
+        if (pipeline != nullptr) {
+            pipeline->resync();
+        }
+    }
+
+    void Console::stepFrame() {
+        if (cpu.isHalted()) {
+            return;
+        }
+        uint64_t frameStart = Metrics::now();
+
+        if (!frameInterrupted) {
+            // the movie snapshots the machine and applies the frame input before anything runs
+            if (movie != nullptr) {
+                if (input != nullptr) {
+                    input->latch(controllers);
+                }
+                movie->onFrameBegin();
+            }
+
+            if (resetRequested) {
+                resetRequested = false;
+                cpu.reset();
+            }
+
+            // once a frame is enough for games to see frozen values, the bus stays untouched
+            if (cheats.hasFreezes() && mapper != nullptr) {
+                cheats.applyFreezes(cpu.getMemory().getPage(0), mapper->getPrgRam());
+            }
+
+            // the movie may have loaded a state
+            frameStartCycles = cpu.getCycles();
+
+            controllers[0].clearPolled();
+            controllers[1].clearPolled();
+            apu.clearSamples();
+        }
+        frameInterrupted = false;
+
+        uint64_t ppuFrame = ppu.getFrame();
+        while (ppu.getFrame() == ppuFrame) {
+            step();
+            if (cpu.isHalted() && ppu.getFrame() == ppuFrame) {
+                frameInterrupted = true;
+                return;
+            }
+        }
+        frame++;
+
+        if (pipeline != nullptr) {
+            pipeline->endFrame();
+        }
+        if (input != nullptr) {
+            input->onFrameEnd();
+        }
+        // frames emulated without output, skipped or re-simulated, were never presented
+        if (capture != nullptr && outputEnabled) {
+            capture->submit(getFrontBuffer(), getFrontEmphasis(), apu.getSamples(), apu.getSampleCount());
+        }
+        if (saveRam.isOpen()) {
+            saveRam.commit(mapper->getPrgRam(), mapper->takePrgRamDirty());
+        }
+        flushMetrics(frameStart, frameStartCycles);
+
+        if (movie != nullptr) {
+            movie->onFrameEnd();
+        }
+    }
+
+    uint64_t Console::step() {
+        if (--timeSampleCountdown == 0) {
+            return timedStep();
+        }
+        ppu.beginInstruction(cpu.getCycles());
+        uint64_t cycles = cpu.excuse();
+        ppu.runTo(cpu.getCycles());
+        apu.step((int) cycles);
+        if (mapper != nullptr && ppu.getClock() >= mapper->getIrqClock()) {
+            mapper->onIrq();
+        }
+        return cycles;
+    }
+
+    uint64_t Console::timedStep() {
+        timeSampleCountdown = Metrics::TIME_SAMPLE_INTERVAL;
+
+        uint64_t start = Metrics::now();
+        ppu.beginInstruction(cpu.getCycles());
+        uint64_t cycles = cpu.excuse();
+        uint64_t cpuDone = Metrics::now();
+        ppu.runTo(cpu.getCycles());
+        uint64_t ppuDone = Metrics::now();
+        apu.step((int) cycles);
+        uint64_t apuDone = Metrics::now();
+        if (mapper != nullptr && ppu.getClock() >= mapper->getIrqClock()) {
+            mapper->onIrq();
+        }
+
+        // stands for the steps in between
+        Metrics::add(COUNTER_CPU_NANOS, (cpuDone - start) * Metrics::TIME_SAMPLE_INTERVAL);
+        Metrics::add(COUNTER_PPU_NANOS, (ppuDone - cpuDone) * Metrics::TIME_SAMPLE_INTERVAL);
+        Metrics::add(COUNTER_APU_NANOS, (apuDone - ppuDone) * Metrics::TIME_SAMPLE_INTERVAL);
+        return cycles;
+    }
+
+    void Console::flushMetrics(uint64_t frameStart, uint64_t startCycles) {
+        uint64_t instructions, stalls, stalledCycles;
+        cpu.takeCounters(instructions, stalls, stalledCycles);
+        Metrics::add(COUNTER_CYCLES, cpu.getCycles() - startCycles);
+        Metrics::add(COUNTER_INSTRUCTIONS, instructions);
+        Metrics::add(COUNTER_DMA_STALLS, stalls);
+        Metrics::add(COUNTER_DMA_STALL_CYCLES, stalledCycles);
+        Metrics::add(COUNTER_FRAMES, 1);
+
+        uint32_t reads[MMIO_REGISTERS], writes[MMIO_REGISTERS];
+        cpu.getMemory().takeMmioCounts(reads, writes);
+        Metrics::addMmio(reads, writes);
+
+        Metrics::addFrameTime(Metrics::now() - frameStart);
+    }
+
+    bool Console::addCheat(const char *code) {
+        if (!cheats.add(code)) {
+            LOG("Unknown cheat code %s\n", code);
+            return false;
+        }
+        if (mapper != nullptr) {
+            mapper->remap();
+        }
+        return true;
+    }
+
+    void Console::clearCheats() {
+        cheats.clear();
+        if (mapper != nullptr) {
+            mapper->remap();
+        }
+    }
+
+    bool Console::startCapture(const char *basePath, int format) {
+        uint64_t frames, repeated, dropped;
+        stopCapture(frames, repeated, dropped);
+        capture = new Capture();
+        if (!capture->open(basePath, (CaptureFormat) format, apu.getSampleRate())) {
+            delete capture;
+            capture = nullptr;
+            return false;
+        }
+        return true;
+    }
+
+    bool Console::stopCapture(uint64_t &frames, uint64_t &repeated, uint64_t &dropped) {
+        if (capture == nullptr) {
+            return false;
+        }
+        capture->close();
+        frames = capture->getFrames();
+        repeated = capture->getRepeatedFrames();
+        dropped = capture->getDroppedFrames();
+        delete capture;
+        capture = nullptr;
+        return true;
+    }
+
+    bool Console::startTrace(const char *path) {
+        stopTrace();
+        traceWriter = new TraceWriter();
+        if (!traceWriter->open(path)) {
+            delete traceWriter;
+            traceWriter = nullptr;
+            return false;
+        }
+        traceStream = new TraceStream(*traceWriter, 0);
+        cpu.setTrace(traceStream);
+        return true;
+    }
+
+    void Console::stopTrace() {
+        if (traceWriter == nullptr) {
+            return;
+        }
+        cpu.setTrace(nullptr);
+        delete traceStream;
+        delete traceWriter;
+        traceStream = nullptr;
+        traceWriter = nullptr;
+    }
+
+    void Console::save(State &state) const {
+        state.put(frame);
+        controllers[0].save(state);
+        controllers[1].save(state);
+        cpu.save(state);
+        ppu.save(state);
+        apu.save(state);
+    }
+
+    bool Console::load(State &state) {
+        state.rewind();
+        state.get(frame);
+        controllers[0].load(state);
+        controllers[1].load(state);
+        cpu.load(state);
+        ppu.load(state);
+        apu.load(state);
+        if (mapper != nullptr) {
+            mapper->reschedule();
+        }
+        if (pipeline != nullptr) {
+            pipeline->resync();
+        }
+        return state.isValid();
+    }
+}
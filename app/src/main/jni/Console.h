@@ -0,0 +1,265 @@
+#ifndef NESDROID_CONSOLE_H
+#define NESDROID_CONSOLE_H
+
+#include <string>
+
+#include "commons.h"
+#include "Arena.h"
+#include "Cheats.h"
+#include "CodeMap.h"
+#include "Native.h"
+#include "RomStore.h"
+#include "Debugger.h"
+#include "cpu.h"
+#include "Ppu.h"
+#include "Apu.h"
+#include "Controller.h"
+#include "State.h"
+#include "rom.h"
+#include "SaveRam.h"
+
+namespace nesdroid {
+
+    // NTSC frame period, 1 / 60.0988 s
+    static const uint64_t FRAME_NANOS = 16639267;
+
+    class Capture;
+    class Input;
+    class Movie;
+    class PpuPipeline;
+    class TraceWriter;
+
+    // The whole machine: cpu, bus devices and the cartridge. Their memory (ram,
+    // OAM, VRAM, frame buffers, mapper and cartridge banks) is carved out of one
+    // arena, allocated again only when a bigger rom is inserted.
+    class Console {
+
+    public:
+
+        Console();
+
+        virtual ~Console();
+
+        // plug in a loaded rom and power on, false if the mapper is unsupported
+        bool insert(ROM *rom);
+
+        // save file for the PRG-RAM of the next battery backed rom inserted
+        void setSavePath(const char *path) {
+            savePath = path != nullptr ? path : "";
+        }
+
+        const std::string &getSavePath() const {
+            return savePath;
+        }
+
+        // map the save file ahead of insert(), e.g. while the rom is still being
+        // inflated; insert() uses it if the rom turns out battery backed
+        bool prepareSaveRam();
+
+        // block until the PRG-RAM written so far is on disk, e.g. when the app
+        // goes to the background; the emulation itself never waits for it
+        void syncSaveRam() {
+            saveRam.sync();
+        }
+
+        // Directory of the code maps of the roms inserted from now on, "" for
+        // none. With one, the cpu also logs the code it runs into the map.
+        void setCodeCacheDirectory(const char *directory) {
+            codeCacheDirectory = directory != nullptr ? directory : "";
+        }
+
+        const std::string &getCodeCacheDirectory() const {
+            return codeCacheDirectory;
+        }
+
+        // code and data of the rom's PRG ROM as far as known, nullptr without a rom
+        const CodeMap *getCodeMap() const {
+            return banks != nullptr ? &banks->getCodeMap() : nullptr;
+        }
+
+        // write the code map to the cache directory if it grew
+        void saveCodeMap() {
+            if (banks != nullptr) {
+                banks->saveCodeMap(codeCacheDirectory);
+            }
+        }
+
+        // Run the inserted rom's instructions from a plugin recompiled for it, see
+        // tools/recompile.cpp; false if path is not one for this rom. Nothing else
+        // loads plugins. On Android they ship in the APK as lib/<abi>/lib<hash>.so
+        // and are loaded from the app's nativeLibraryDir: since Android 10 code
+        // cannot be mapped from files the app can write, such as its cache.
+        bool loadNativeCode(const std::string &path);
+
+        // interpret again; the plugin stays loaded for the other consoles
+        void unloadNativeCode() {
+            cpu.setNativeCode(nullptr);
+        }
+
+        // the rom's recompiled code, loaded or not; nullptr without a rom
+        const NativeCode *getNativeCode() const {
+            return banks != nullptr ? &banks->getNativeCode() : nullptr;
+        }
+
+        // the rom's read-only banks in the RomStore, nullptr without a rom
+        const RomBanks *getBanks() const {
+            return banks;
+        }
+
+        void powerOn();
+
+        // reset button, takes effect at the start of the next frame
+        void reset() {
+            resetRequested = true;
+        }
+
+        // emulate until the end of the current frame; returns early while the
+        // debugger holds the cpu, the frame goes on once it is resumed
+        void stepFrame();
+
+        // run one cpu instruction and the matching ppu/apu time, returns cpu cycles
+        uint64_t step();
+
+        // skip pixel output for the coming frames, timing stays exact
+        void setOutputEnabled(bool enabled);
+
+        bool isOutputEnabled() const {
+            return outputEnabled;
+        }
+
+        // draw frames on a second thread, a frame behind the emulation
+        void setPipelined(bool pipelined);
+
+        bool isPipelined() const {
+            return pipelined;
+        }
+
+        // newest completed picture, from the render thread when pipelined
+        const byte *getFrontBuffer() const;
+
+        const byte *getFrontEmphasis() const;
+
+        void setAudioDecimation(int decimation) {
+            apu.setDecimation(decimation);
+        }
+
+        PPU &getPpu() {
+            return ppu;
+        }
+
+        APU &getApu() {
+            return apu;
+        }
+
+        uint64_t getFrame() const {
+            return frame;
+        }
+
+        Controller &getController(int port) {
+            return controllers[port & 1];
+        }
+
+        ROM *getRom() const {
+            return rom;
+        }
+
+        // A movie fixes the pads for a whole frame: while one is set the live
+        // input is sampled at the frame start, otherwise at the game's strobe.
+        void setMovie(Movie *movie) {
+            this->movie = movie;
+            routeInput();
+        }
+
+        // live pads from the UI, owned by the caller; nullptr for none
+        void setInput(Input *input) {
+            this->input = input;
+            routeInput();
+        }
+
+        // Game Genie or raw "AAAA:VV" / "AAAA?CC:VV" code, false if the code is
+        // not understood
+        bool addCheat(const char *code);
+
+        void clearCheats();
+
+        Debugger &getDebugger() {
+            return debugger;
+        }
+
+        void getCpuRegisters(Registers &registers) {
+            cpu.getRegisters(registers);
+        }
+
+        // binary trace of every instruction, compressed to path in the background
+        bool startTrace(const char *path);
+
+        void stopTrace();
+
+        // record every frame and its audio in the background, format a CaptureFormat
+        bool startCapture(const char *basePath, int format);
+
+        // false if no capture was running; otherwise the frame counts of the run
+        bool stopCapture(uint64_t &frames, uint64_t &repeated, uint64_t &dropped);
+
+        void save(State &state) const;
+
+        bool load(State &state);
+
+    private:
+
+        friend class Movie;
+        friend class Lockstep;
+
+        // carve the arena for the machine and rom's cartridge, nullptr for none
+        bool layout(ROM *rom);
+
+        void destroyMapper();
+
+        void routeInput() {
+            cpu.getMemory().setInput(movie == nullptr ? input : nullptr);
+        }
+
+        void startPipeline();
+
+        // step() with the time of each part measured, one in TIME_SAMPLE_INTERVAL
+        uint64_t timedStep();
+
+        void flushMetrics(uint64_t frameStart, uint64_t startCycles);
+
+        void stopPipeline();
+
+        // registers lead the object, the arena starts with zero page, stack and OAM
+        Cpu cpu;
+        PPU ppu;
+        APU apu;
+        Controller controllers[2];
+        ROM *rom = nullptr;
+        IMapper *mapper = nullptr;
+        Movie *movie = nullptr;
+        Input *input = nullptr;
+        PpuPipeline *pipeline = nullptr;
+        TraceWriter *traceWriter = nullptr;
+        TraceStream *traceStream = nullptr;
+        Capture *capture = nullptr;
+        bool pipelined = false;
+        bool outputEnabled = true;
+
+        Arena arena;
+        Cheats cheats;
+        Debugger debugger;
+        RomBanks *banks = nullptr;
+        std::string codeCacheDirectory;
+        SaveRam saveRam;
+        std::string savePath;
+        bool saveRamPrepared = false;
+
+        uint64_t frame = 0;
+        bool resetRequested = false;
+        // the debugger stopped the cpu inside the frame
+        bool frameInterrupted = false;
+        uint64_t frameStartCycles = 0;
+        int timeSampleCountdown = 1;
+    };
+}
+
+#endif //NESDROID_CONSOLE_H
@@ -0,0 +1,39 @@
+#include "Controller.h"
+
+namespace nesdroid {
+
+    byte Controller::read() {
+        polled = true;
+
+        byte value = 0;
+        if (index < 8) {
+            value = (byte) ((buttons >> index) & 1);
+        } else {
+            // official pads return 1 after all 8 buttons were shifted out
+            value = 1;
+        }
+
+        if (!strobe && index < 8) {
+            index++;
+        }
+        return value;
+    }
+
+    void Controller::write(byte value) {
+        strobe = (byte) (value & 1);
+        if (strobe) {
+            index = 0;
+        }
+    }
+
+    // buttons are input rather than machine state, they are applied every frame
+    void Controller::save(State &state) const {
+        state.put(index);
+        state.put(strobe);
+    }
+
+    void Controller::load(State &state) {
+        state.get(index);
+        state.get(strobe);
+    }
+}
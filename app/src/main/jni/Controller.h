@@ -0,0 +1,61 @@
+#ifndef NESDROID_CONTROLLER_H
+#define NESDROID_CONTROLLER_H
+
+#include "commons.h"
+#include "State.h"
+
+namespace nesdroid {
+
+    enum Button {
+        BUTTON_A = 0,
+        BUTTON_B = 1,
+        BUTTON_SELECT = 2,
+        BUTTON_START = 3,
+        BUTTON_UP = 4,
+        BUTTON_DOWN = 5,
+        BUTTON_LEFT = 6,
+        BUTTON_RIGHT = 7
+    };
+
+    // Standard joypad behind $4016/$4017.
+    // Buttons are kept as a bitmask, bit n is Button n.
+    class Controller {
+
+    public:
+
+        // $4016/$4017 read, returns the next button bit in D0
+        byte read();
+
+        // $4016 write, bit 0 is the strobe
+        void write(byte value);
+
+        void setButtons(byte buttons) {
+            this->buttons = buttons;
+        }
+
+        byte getButtons() const {
+            return buttons;
+        }
+
+        // true once the game has read the port since the last clearPolled()
+        bool isPolled() const {
+            return polled;
+        }
+
+        void clearPolled() {
+            polled = false;
+        }
+
+        void save(State &state) const;
+
+        void load(State &state);
+
+    private:
+        byte buttons = 0;
+        byte index = 0;
+        byte strobe = 0;
+        bool polled = false;
+    };
+}
+
+#endif //NESDROID_CONTROLLER_H
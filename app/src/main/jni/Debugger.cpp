@@ -0,0 +1,191 @@
+#include <algorithm>
+#include <cstring>
+
+#include "Debugger.h"
+#include "Ppu.h"
+#include "cpu.h"
+
+namespace nesdroid {
+
+    static const byte OPCODE_JSR = 0x20;
+
+    // ram and the PPU registers are mirrored, watches use the first copy
+    static addr_t canonical(addr_t address) {
+        if (address < 0x2000) {
+            return (addr_t) (address & 0x07FF);
+        }
+        if (address < 0x4000) {
+            return (addr_t) (0x2000 | (address & 7));
+        }
+        return address;
+    }
+
+    int Debugger::addBreakpoint(addr_t pc) {
+        std::lock_guard<std::mutex> lock(mutex);
+        return add(SPACE_CPU, pc, pc, ACCESS_EXECUTE, false);
+    }
+
+    int Debugger::addWatchpoint(int space, addr_t first, addr_t last, int access) {
+        std::lock_guard<std::mutex> lock(mutex);
+        return add(space, first, last, access, false);
+    }
+
+    int Debugger::add(int space, addr_t first, addr_t last, int access, bool temporary) {
+        if (space == SPACE_PPU) {
+            // nothing runs from PPU memory
+            access &= ACCESS_READ | ACCESS_WRITE;
+            last = std::min(last, (addr_t) 0x3FFF);
+        } else if (space != SPACE_CPU) {
+            return -1;
+        }
+        access &= ACCESS_READ | ACCESS_WRITE | ACCESS_EXECUTE;
+        if (first > last || access == 0) {
+            return -1;
+        }
+        Watch watch = {nextId++, space, first, last, access, temporary};
+        watches.push_back(watch);
+        rebuild();
+        return watch.id;
+    }
+
+    bool Debugger::remove(int id) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto found = std::find_if(watches.begin(), watches.end(), [id](const Watch &watch) {
+            return watch.id == id;
+        });
+        if (found == watches.end()) {
+            return false;
+        }
+        watches.erase(found);
+        rebuild();
+        return true;
+    }
+
+    void Debugger::clear() {
+        std::lock_guard<std::mutex> lock(mutex);
+        watches.clear();
+        stepping = false;
+        rebuild();
+    }
+
+    void Debugger::pause() {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!cpu->isHalted()) {
+            // every page traps execution until the next instruction stops
+            stepping = true;
+            rebuild();
+        }
+    }
+
+    void Debugger::resume() {
+        std::lock_guard<std::mutex> lock(mutex);
+        release();
+    }
+
+    void Debugger::stepInto() {
+        std::lock_guard<std::mutex> lock(mutex);
+        stepping = true;
+        rebuild();
+        release();
+    }
+
+    void Debugger::stepOver() {
+        std::lock_guard<std::mutex> lock(mutex);
+        addr_t pc = cpu->getPC();
+        byte *page = cpu->getMemory().getPage((byte) (pc >> 8));
+        if (page != nullptr && page[pc & 0xFF] == OPCODE_JSR) {
+            add(SPACE_CPU, (addr_t) (pc + 3), (addr_t) (pc + 3), ACCESS_EXECUTE, true);
+        } else {
+            stepping = true;
+            rebuild();
+        }
+        release();
+    }
+
+    bool Debugger::isPaused() const {
+        return cpu != nullptr && cpu->isHalted();
+    }
+
+    DebugHit Debugger::getHit() {
+        std::lock_guard<std::mutex> lock(mutex);
+        return hit;
+    }
+
+    void Debugger::release() {
+        if (!cpu->isHalted()) {
+            return;
+        }
+        // stopped before the instruction at pc: let it run this time
+        addr_t pc = cpu->getPC();
+        skipArmed = hit.access == ACCESS_EXECUTE && hit.address == pc;
+        skipPc = pc;
+        cpu->setHalted(false);
+    }
+
+    bool Debugger::onExecute(addr_t pc, byte opcode) {
+        std::lock_guard<std::mutex> lock(mutex);
+        bool skip = skipArmed && pc == skipPc;
+        skipArmed = false;
+        if (skip) {
+            return false;
+        }
+
+        bool stop = stepping;
+        for (auto &watch : watches) {
+            stop = stop || (watch.space == SPACE_CPU && (watch.access & ACCESS_EXECUTE)
+                            && pc >= watch.first && pc <= watch.last);
+        }
+        if (stop) {
+            DebugHit execute = {SPACE_CPU, pc, ACCESS_EXECUTE, opcode};
+            this->stop(execute);
+        }
+        return stop;
+    }
+
+    void Debugger::onAccess(int space, addr_t address, byte value, int access) {
+        std::lock_guard<std::mutex> lock(mutex);
+        addr_t watched = space == SPACE_CPU ? canonical(address) : address;
+        for (auto &watch : watches) {
+            if (watch.space == space && (watch.access & access) && watched >= watch.first && watched <= watch.last) {
+                // the instruction finishes, the console stops after it
+                DebugHit data = {space, address, access, value};
+                stop(data);
+                return;
+            }
+        }
+    }
+
+    void Debugger::stop(const DebugHit &hit) {
+        this->hit = hit;
+        stepping = false;
+        watches.erase(std::remove_if(watches.begin(), watches.end(), [](const Watch &watch) {
+            return watch.temporary;
+        }), watches.end());
+        rebuild();
+        cpu->setHalted(true);
+    }
+
+    void Debugger::rebuild() {
+        byte *cpuTraps = cpu->getMemory().getTraps();
+        byte *ppuTraps = ppu->getTraps();
+        memset(cpuTraps, stepping ? ACCESS_EXECUTE : 0, 256);
+        memset(ppuTraps, 0, 64);
+
+        for (auto &watch : watches) {
+            if (watch.space == SPACE_PPU) {
+                for (int page = watch.first >> 8; page <= watch.last >> 8; page++) {
+                    ppuTraps[page] |= watch.access;
+                }
+                continue;
+            }
+            // a page traps if any address in it is watched, through mirrors too
+            for (int page = 0; page < 256; page++) {
+                addr_t low = canonical((addr_t) (page << 8));
+                addr_t high = page >= 0x20 && page < 0x40 ? (addr_t) 0x2007 : (addr_t) (low | 0xFF);
+                if (watch.first <= high && watch.last >= low) {
+                    cpuTraps[page] |= watch.access;
+                }
+            }
+        }
+    }
+}
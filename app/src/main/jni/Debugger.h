@@ -0,0 +1,118 @@
+#ifndef NESDROID_DEBUGGER_H
+#define NESDROID_DEBUGGER_H
+
+#include <mutex>
+#include <vector>
+
+#include "commons.h"
+#include "Memory.h"
+
+namespace nesdroid {
+
+    class Cpu;
+    class PPU;
+
+    // address space of a watch
+    enum Space {
+        SPACE_CPU = 0,
+        SPACE_PPU = 1,
+    };
+
+    // where and why the machine stopped
+    struct DebugHit {
+        int space;
+        addr_t address;
+        int access;     // ACCESS_*
+        byte value;     // read or written, the opcode for ACCESS_EXECUTE
+    };
+
+    // Breakpoints, watchpoints and stepping. Watches are not compared per
+    // access: the cpu bus and the PPU data port look up a trap table by page,
+    // and only pages that hold an active watch have bits set, so a run without
+    // watches costs a table load whose branch is never taken. Execute traps are
+    // looked up once per instruction, at the opcode fetch.
+    //
+    // A hit halts the cpu (Cpu::isHalted()): at an execute trap before the
+    // instruction runs, at a read or write once the accessing instruction is
+    // done. The console then leaves stepFrame() until resume() or a step.
+    // PPU watches see $2007 accesses, not the rendering fetches.
+    class Debugger {
+
+    public:
+
+        void connect(Cpu *cpu, PPU *ppu) {
+            this->cpu = cpu;
+            this->ppu = ppu;
+        }
+
+        // stop before the instruction at pc, returns the id for remove()
+        int addBreakpoint(addr_t pc);
+
+        // Stop on accesses (ACCESS_* bits) to first..last of space. Cpu watches
+        // use the canonical addresses, $0000-$07FF for ram and $2000-$2007 for
+        // the PPU registers; their mirrors trap as well. -1 if the range is empty.
+        int addWatchpoint(int space, addr_t first, addr_t last, int access);
+
+        bool remove(int id);
+
+        void clear();
+
+        // stop before the next instruction
+        void pause();
+
+        void resume();
+
+        // run one instruction, into subroutines and interrupt handlers
+        void stepInto();
+
+        // run one instruction, a JSR up to its return
+        void stepOver();
+
+        bool isPaused() const;
+
+        // the last stop, valid while paused
+        DebugHit getHit();
+
+        // ---- called through the trap tables only ----
+
+        // the cpu is about to run the instruction at pc; true to stop instead
+        bool onExecute(addr_t pc, byte opcode);
+
+        void onAccess(int space, addr_t address, byte value, int access);
+
+    private:
+
+        struct Watch {
+            int id;
+            int space;
+            addr_t first;
+            addr_t last;
+            int access;
+            bool temporary;     // step over: removed at the next stop
+        };
+
+        int add(int space, addr_t first, addr_t last, int access, bool temporary);
+
+        // halt the cpu with hit, drop temporary watches
+        void stop(const DebugHit &hit);
+
+        // leave the pause, the instruction at the current pc is not trapped again
+        void release();
+
+        // fill the trap tables from the watches
+        void rebuild();
+
+        Cpu *cpu = nullptr;
+        PPU *ppu = nullptr;
+
+        std::mutex mutex;
+        std::vector<Watch> watches;
+        int nextId = 1;
+        bool stepping = false;
+        bool skipArmed = false;
+        addr_t skipPc = 0;
+        DebugHit hit = {SPACE_CPU, 0, 0, 0};
+    };
+}
+
+#endif //NESDROID_DEBUGGER_H
@@ -0,0 +1,536 @@
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+
+#include "Filter.h"
+#include "Ppu.h"
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON) || defined(__aarch64__)
+#include <arm_neon.h>
+#define NESDROID_NEON 1
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define NESDROID_SSE2 1
+#endif
+
+namespace nesdroid {
+
+    // border around the converted frame, xBR reads two pixels away
+    static const int PAD = 2;
+
+    static const int BANDS = 8;
+    static const int BAND_HEIGHT = SCREEN_HEIGHT / BANDS;
+
+    template<typename T>
+    struct PixelTraits;
+
+    template<>
+    struct PixelTraits<uint32_t> {
+        static inline uint32_t blend(uint32_t a, uint32_t b) {
+            return (a & b) + (((a ^ b) & 0xFEFEFEFEu) >> 1);
+        }
+
+        static inline void rgb(uint32_t p, int &r, int &g, int &b) {
+            r = p & 0xFF;
+            g = (p >> 8) & 0xFF;
+            b = (p >> 16) & 0xFF;
+        }
+    };
+
+    template<>
+    struct PixelTraits<uint16_t> {
+        static inline uint16_t blend(uint16_t a, uint16_t b) {
+            return (uint16_t) ((a & b) + (((a ^ b) & 0xF7DE) >> 1));
+        }
+
+        static inline void rgb(uint16_t p, int &r, int &g, int &b) {
+            r = (p >> 11) << 3;
+            g = ((p >> 5) & 0x3F) << 2;
+            b = (p & 0x1F) << 3;
+        }
+    };
+
+    // ---- nearest ----
+
+    template<typename T>
+    static inline void expandLine(const T *in, T *out, int scale) {
+        for (int x = 0; x < SCREEN_WIDTH; x++) {
+            for (int i = 0; i < scale; i++) {
+                *out++ = in[x];
+            }
+        }
+    }
+
+#if defined(NESDROID_NEON)
+
+    static inline void expandLine(const uint32_t *in, uint32_t *out, int scale) {
+        if (scale != 2) {
+            expandLine<uint32_t>(in, out, scale);
+            return;
+        }
+        for (int x = 0; x < SCREEN_WIDTH; x += 4) {
+            uint32x4_t v = vld1q_u32(in + x);
+            uint32x4x2_t pixels = {{v, v}};
+            vst2q_u32(out + x * 2, pixels);
+        }
+    }
+
+    static inline void expandLine(const uint16_t *in, uint16_t *out, int scale) {
+        if (scale != 2) {
+            expandLine<uint16_t>(in, out, scale);
+            return;
+        }
+        for (int x = 0; x < SCREEN_WIDTH; x += 8) {
+            uint16x8_t v = vld1q_u16(in + x);
+            uint16x8x2_t pixels = {{v, v}};
+            vst2q_u16(out + x * 2, pixels);
+        }
+    }
+
+#elif defined(NESDROID_SSE2)
+
+    static inline void expandLine(const uint32_t *in, uint32_t *out, int scale) {
+        if (scale != 2) {
+            expandLine<uint32_t>(in, out, scale);
+            return;
+        }
+        for (int x = 0; x < SCREEN_WIDTH; x += 4) {
+            __m128i v = _mm_loadu_si128((const __m128i *) (in + x));
+            _mm_storeu_si128((__m128i *) (out + x * 2), _mm_unpacklo_epi32(v, v));
+            _mm_storeu_si128((__m128i *) (out + x * 2 + 4), _mm_unpackhi_epi32(v, v));
+        }
+    }
+
+    static inline void expandLine(const uint16_t *in, uint16_t *out, int scale) {
+        if (scale != 2) {
+            expandLine<uint16_t>(in, out, scale);
+            return;
+        }
+        for (int x = 0; x < SCREEN_WIDTH; x += 8) {
+            __m128i v = _mm_loadu_si128((const __m128i *) (in + x));
+            _mm_storeu_si128((__m128i *) (out + x * 2), _mm_unpacklo_epi16(v, v));
+            _mm_storeu_si128((__m128i *) (out + x * 2 + 8), _mm_unpackhi_epi16(v, v));
+        }
+    }
+
+#endif
+
+    template<typename T>
+    static void nearest(const T *src, int srcStride, byte *dst, int dstStride, int scale, int y0, int y1) {
+        for (int y = y0; y < y1; y++) {
+            byte *first = dst + y * scale * dstStride;
+            expandLine(src + y * srcStride, (T *) first, scale);
+            for (int i = 1; i < scale; i++) {
+                memcpy(first + i * dstStride, first, SCREEN_WIDTH * scale * sizeof(T));
+            }
+        }
+    }
+
+    // ---- Scale2x ----
+    //   B
+    // D E F  ->  E0 E1
+    //   H        E2 E3
+
+    template<typename T>
+    static inline void scale2xLine(const T *above, const T *line, const T *below, T *out0, T *out1) {
+        for (int x = 0; x < SCREEN_WIDTH; x++) {
+            T B = above[x], D = line[x - 1], E = line[x], F = line[x + 1], H = below[x];
+            if (B != H && D != F) {
+                out0[x * 2] = D == B ? D : E;
+                out0[x * 2 + 1] = B == F ? F : E;
+                out1[x * 2] = D == H ? D : E;
+                out1[x * 2 + 1] = H == F ? F : E;
+            } else {
+                out0[x * 2] = out0[x * 2 + 1] = out1[x * 2] = out1[x * 2 + 1] = E;
+            }
+        }
+    }
+
+#if defined(NESDROID_NEON)
+
+    static inline void scale2xLine(const uint32_t *above, const uint32_t *line, const uint32_t *below,
+                                   uint32_t *out0, uint32_t *out1) {
+        for (int x = 0; x < SCREEN_WIDTH; x += 4) {
+            uint32x4_t B = vld1q_u32(above + x);
+            uint32x4_t D = vld1q_u32(line + x - 1);
+            uint32x4_t E = vld1q_u32(line + x);
+            uint32x4_t F = vld1q_u32(line + x + 1);
+            uint32x4_t H = vld1q_u32(below + x);
+
+            uint32x4_t flat = vorrq_u32(vceqq_u32(B, H), vceqq_u32(D, F));
+            uint32x4x2_t top, bottom;
+            top.val[0] = vbslq_u32(vbicq_u32(vceqq_u32(D, B), flat), D, E);
+            top.val[1] = vbslq_u32(vbicq_u32(vceqq_u32(B, F), flat), F, E);
+            bottom.val[0] = vbslq_u32(vbicq_u32(vceqq_u32(D, H), flat), D, E);
+            bottom.val[1] = vbslq_u32(vbicq_u32(vceqq_u32(H, F), flat), F, E);
+            vst2q_u32(out0 + x * 2, top);
+            vst2q_u32(out1 + x * 2, bottom);
+        }
+    }
+
+#elif defined(NESDROID_SSE2)
+
+    static inline __m128i select(__m128i mask, __m128i a, __m128i b) {
+        return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+    }
+
+    static inline void scale2xLine(const uint32_t *above, const uint32_t *line, const uint32_t *below,
+                                   uint32_t *out0, uint32_t *out1) {
+        for (int x = 0; x < SCREEN_WIDTH; x += 4) {
+            __m128i B = _mm_loadu_si128((const __m128i *) (above + x));
+            __m128i D = _mm_loadu_si128((const __m128i *) (line + x - 1));
+            __m128i E = _mm_loadu_si128((const __m128i *) (line + x));
+            __m128i F = _mm_loadu_si128((const __m128i *) (line + x + 1));
+            __m128i H = _mm_loadu_si128((const __m128i *) (below + x));
+
+            __m128i flat = _mm_or_si128(_mm_cmpeq_epi32(B, H), _mm_cmpeq_epi32(D, F));
+            __m128i e0 = select(_mm_andnot_si128(flat, _mm_cmpeq_epi32(D, B)), D, E);
+            __m128i e1 = select(_mm_andnot_si128(flat, _mm_cmpeq_epi32(B, F)), F, E);
+            __m128i e2 = select(_mm_andnot_si128(flat, _mm_cmpeq_epi32(D, H)), D, E);
+            __m128i e3 = select(_mm_andnot_si128(flat, _mm_cmpeq_epi32(H, F)), F, E);
+
+            _mm_storeu_si128((__m128i *) (out0 + x * 2), _mm_unpacklo_epi32(e0, e1));
+            _mm_storeu_si128((__m128i *) (out0 + x * 2 + 4), _mm_unpackhi_epi32(e0, e1));
+            _mm_storeu_si128((__m128i *) (out1 + x * 2), _mm_unpacklo_epi32(e2, e3));
+            _mm_storeu_si128((__m128i *) (out1 + x * 2 + 4), _mm_unpackhi_epi32(e2, e3));
+        }
+    }
+
+#endif
+
+    template<typename T>
+    static void scale2x(const T *src, int srcStride, byte *dst, int dstStride, int y0, int y1) {
+        for (int y = y0; y < y1; y++) {
+            const T *line = src + y * srcStride;
+            scale2xLine(line - srcStride, line, line + srcStride,
+                        (T *) (dst + y * 2 * dstStride), (T *) (dst + (y * 2 + 1) * dstStride));
+        }
+    }
+
+    // ---- Scale3x ----
+    // A B C      E0 E1 E2
+    // D E F  ->  E3 E4 E5
+    // G H I      E6 E7 E8
+
+    template<typename T>
+    static void scale3x(const T *src, int srcStride, byte *dst, int dstStride, int y0, int y1) {
+        for (int y = y0; y < y1; y++) {
+            const T *above = src + (y - 1) * srcStride;
+            const T *line = src + y * srcStride;
+            const T *below = src + (y + 1) * srcStride;
+            T *out0 = (T *) (dst + y * 3 * dstStride);
+            T *out1 = (T *) (dst + (y * 3 + 1) * dstStride);
+            T *out2 = (T *) (dst + (y * 3 + 2) * dstStride);
+
+            for (int x = 0; x < SCREEN_WIDTH; x++) {
+                T A = above[x - 1], B = above[x], C = above[x + 1];
+                T D = line[x - 1], E = line[x], F = line[x + 1];
+                T G = below[x - 1], H = below[x], I = below[x + 1];
+                T *o0 = out0 + x * 3, *o1 = out1 + x * 3, *o2 = out2 + x * 3;
+
+                if (B != H && D != F) {
+                    o0[0] = D == B ? D : E;
+                    o0[1] = (D == B && E != C) || (B == F && E != A) ? B : E;
+                    o0[2] = B == F ? F : E;
+                    o1[0] = (D == B && E != G) || (D == H && E != A) ? D : E;
+                    o1[1] = E;
+                    o1[2] = (B == F && E != I) || (H == F && E != C) ? F : E;
+                    o2[0] = D == H ? D : E;
+                    o2[1] = (D == H && E != I) || (H == F && E != G) ? H : E;
+                    o2[2] = H == F ? F : E;
+                } else {
+                    o0[0] = o0[1] = o0[2] = E;
+                    o1[0] = o1[1] = o1[2] = E;
+                    o2[0] = o2[1] = o2[2] = E;
+                }
+            }
+        }
+    }
+
+    // ---- 2xBR ----
+    //    A1 B1 C1
+    // A0 A  B  C  C4
+    // D0 D  E  F  F4
+    // G0 G  H  I  I4
+    //    G5 H5 I5
+
+    // weighted YUV difference
+    template<typename T>
+    static inline int distance(T a, T b) {
+        if (a == b) {
+            return 0;
+        }
+        int r1, g1, b1, r2, g2, b2;
+        PixelTraits<T>::rgb(a, r1, g1, b1);
+        PixelTraits<T>::rgb(b, r2, g2, b2);
+        int dr = r1 - r2, dg = g1 - g2, db = b1 - b2;
+        int y = 299 * dr + 587 * dg + 114 * db;
+        int u = -169 * dr - 331 * dg + 500 * db;
+        int v = 500 * dr - 419 * dg - 81 * db;
+        return (48 * abs(y) + 7 * abs(u) + 6 * abs(v)) >> 10;
+    }
+
+    // The corner of E towards I; other corners mirror the neighbourhood with
+    // dx = +-1 and dy = +-stride.
+    template<typename T>
+    static inline T xbrCorner(const T *e, int dx, int dy) {
+#define P(x, y) e[(x) * dx + (y) * dy]
+        T E = P(0, 0), F = P(1, 0), H = P(0, 1);
+        if (E == F || E == H) {
+            return E;
+        }
+        T B = P(0, -1), C = P(1, -1), D = P(-1, 0), G = P(-1, 1), I = P(1, 1);
+        T F4 = P(2, 0), I4 = P(2, 1), H5 = P(0, 2), I5 = P(1, 2);
+#undef P
+        int edge = distance(E, C) + distance(E, G) + distance(I, F4) + distance(I, H5) + 4 * distance(H, F);
+        int across = distance(H, D) + distance(H, I5) + distance(F, I4) + distance(F, B) + 4 * distance(E, I);
+        if (edge >= across) {
+            return E;
+        }
+        T pixel = distance(E, F) <= distance(E, H) ? F : H;
+        return PixelTraits<T>::blend(E, pixel);
+    }
+
+    template<typename T>
+    static void xbr2x(const T *src, int srcStride, byte *dst, int dstStride, int y0, int y1) {
+        for (int y = y0; y < y1; y++) {
+            const T *line = src + y * srcStride;
+            T *out0 = (T *) (dst + y * 2 * dstStride);
+            T *out1 = (T *) (dst + (y * 2 + 1) * dstStride);
+            for (int x = 0; x < SCREEN_WIDTH; x++) {
+                const T *e = line + x;
+                out0[x * 2] = xbrCorner(e, -1, -srcStride);
+                out0[x * 2 + 1] = xbrCorner(e, 1, -srcStride);
+                out1[x * 2] = xbrCorner(e, -1, srcStride);
+                out1[x * 2 + 1] = xbrCorner(e, 1, srcStride);
+            }
+        }
+    }
+
+    template<typename T>
+    static void runFilter(FilterType type, int scale, const T *src, int srcStride, byte *dst, int dstStride,
+                          int y0, int y1) {
+        switch (type) {
+            case FILTER_SCALE2X:
+                scale2x(src, srcStride, dst, dstStride, y0, y1);
+                break;
+            case FILTER_SCALE3X:
+                scale3x(src, srcStride, dst, dstStride, y0, y1);
+                break;
+            case FILTER_XBR2X:
+                xbr2x(src, srcStride, dst, dstStride, y0, y1);
+                break;
+            default:
+                nearest(src, srcStride, dst, dstStride, scale, y0, y1);
+                break;
+        }
+    }
+
+    static inline uint64_t now() {
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    }
+
+    FilterPipeline::FilterPipeline(const Palette &palette, int threads)
+            : palette(palette), pool(threads), convertsLeft(0), filtersLeft(0) {
+        indices.resize(SCREEN_WIDTH * SCREEN_HEIGHT);
+        emphasis.resize(SCREEN_HEIGHT);
+        std::lock_guard<std::mutex> lock(presentLock);
+        resize();
+    }
+
+    FilterPipeline::~FilterPipeline() {
+        // the workers use our buffers, which go before the pool does
+        pool.wait();
+    }
+
+    void FilterPipeline::setFilter(FilterType type, int scale) {
+        std::lock_guard<std::mutex> lock(presentLock);
+        finish();
+        this->type = type;
+        switch (type) {
+            case FILTER_SCALE2X:
+            case FILTER_XBR2X:
+                this->scale = 2;
+                break;
+            case FILTER_SCALE3X:
+                this->scale = 3;
+                break;
+            default:
+                this->type = FILTER_NEAREST;
+                this->scale = scale < 1 ? 1 : scale > MAX_SCALE ? MAX_SCALE : scale;
+                break;
+        }
+        resize();
+    }
+
+    void FilterPipeline::setFormat(PixelFormat format) {
+        std::lock_guard<std::mutex> lock(presentLock);
+        finish();
+        this->format = format == PIXEL_FORMAT_RGB_565 ? PIXEL_FORMAT_RGB_565 : PIXEL_FORMAT_RGBA_8888;
+        resize();
+    }
+
+    int FilterPipeline::getWidth() const {
+        return SCREEN_WIDTH * scale;
+    }
+
+    int FilterPipeline::getHeight() const {
+        return SCREEN_HEIGHT * scale;
+    }
+
+    void FilterPipeline::resize() {
+        int bpp = bytesPerPixel(format);
+        sourceStride = SCREEN_WIDTH + PAD * 2;
+        source.assign((size_t) sourceStride * (SCREEN_HEIGHT + PAD * 2) * bpp, 0);
+
+        size_t size = (size_t) getWidth() * getHeight() * bpp;
+        outputs[0].assign(size, 0);
+        outputs[1].assign(size, 0);
+        inFlight = false;
+        completed = false;
+    }
+
+    byte *FilterPipeline::sourceLine(int y) {
+        return source.data() + ((size_t) (y + PAD) * sourceStride + PAD) * bytesPerPixel(format);
+    }
+
+    void FilterPipeline::start(const byte *frame, const byte *emphasis, byte *dst, int stride) {
+        memcpy(indices.data(), frame, indices.size());
+        memcpy(this->emphasis.data(), emphasis, this->emphasis.size());
+        target = dst;
+        targetStride = stride;
+
+        // the filters read the lines around their band, so all of the frame has
+        // to be converted first: the last band converted starts the filter stage
+        convertsLeft = BANDS;
+        filtersLeft = BANDS;
+        pool.dispatch([this](int band) {
+            convertBand(band);
+            if (--convertsLeft == 0) {
+                pool.dispatch([this](int band) {
+                    filterBand(band);
+                    --filtersLeft;
+                }, BANDS);
+            }
+        }, BANDS);
+    }
+
+    void FilterPipeline::convertBand(int band) {
+        int bpp = bytesPerPixel(format);
+        int y0 = band * BAND_HEIGHT;
+        int y1 = y0 + BAND_HEIGHT;
+
+        for (int y = y0; y < y1; y++) {
+            byte *line = sourceLine(y);
+            palette.convertLine(&indices[y * SCREEN_WIDTH], emphasis[y], line, format);
+            for (int i = 1; i <= PAD; i++) {
+                memcpy(line - i * bpp, line, bpp);
+                memcpy(line + (SCREEN_WIDTH - 1 + i) * bpp, line + (SCREEN_WIDTH - 1) * bpp, bpp);
+            }
+        }
+
+        size_t lineSize = (size_t) sourceStride * bpp;
+        if (band == 0) {
+            for (int i = 1; i <= PAD; i++) {
+                memcpy(sourceLine(-i) - PAD * bpp, sourceLine(0) - PAD * bpp, lineSize);
+            }
+        }
+        if (band == BANDS - 1) {
+            for (int i = 1; i <= PAD; i++) {
+                memcpy(sourceLine(SCREEN_HEIGHT - 1 + i) - PAD * bpp,
+                       sourceLine(SCREEN_HEIGHT - 1) - PAD * bpp, lineSize);
+            }
+        }
+    }
+
+    void FilterPipeline::filterBand(int band) {
+        int y0 = band * BAND_HEIGHT;
+        int y1 = y0 + BAND_HEIGHT;
+        if (format == PIXEL_FORMAT_RGB_565) {
+            runFilter(type, scale, (const uint16_t *) sourceLine(0), sourceStride, target, targetStride, y0, y1);
+        } else {
+            runFilter(type, scale, (const uint32_t *) sourceLine(0), sourceStride, target, targetStride, y0, y1);
+        }
+    }
+
+    void FilterPipeline::publish() {
+        if (inFlight && filtersLeft == 0) {
+            back ^= 1;
+            inFlight = false;
+            completed = true;
+        }
+    }
+
+    void FilterPipeline::filter(const byte *frame, const byte *emphasis, void *dst, int stride) {
+        std::lock_guard<std::mutex> lock(presentLock);
+        finish();
+        start(frame, emphasis, (byte *) dst, stride);
+        pool.wait();
+    }
+
+    void FilterPipeline::submit(const byte *frame, const byte *emphasis) {
+        std::lock_guard<std::mutex> lock(presentLock);
+        finish();
+        start(frame, emphasis, outputs[back].data(), getWidth() * bytesPerPixel(format));
+        inFlight = true;
+    }
+
+    bool FilterPipeline::present(void *dst, int stride) {
+        std::lock_guard<std::mutex> lock(presentLock);
+        publish();
+        if (!completed) {
+            return false;
+        }
+
+        const std::vector<byte> &output = outputs[back ^ 1];
+        int lineSize = getWidth() * bytesPerPixel(format);
+        for (int y = 0; y < getHeight(); y++) {
+            memcpy((byte *) dst + y * stride, &output[y * lineSize], lineSize);
+        }
+        return true;
+    }
+
+    void FilterPipeline::wait() {
+        std::lock_guard<std::mutex> lock(presentLock);
+        finish();
+    }
+
+    void FilterPipeline::finish() {
+        // the workers never take presentLock
+        pool.wait();
+        publish();
+    }
+
+    uint64_t FilterPipeline::benchmark(FilterType type, int scale, int frames) {
+        FilterType lastType = this->type;
+        int lastScale = this->scale;
+        setFilter(type, scale);
+
+        // flat tiles with diagonal edges, so the edge rules have work to do
+        std::vector<byte> frame(SCREEN_WIDTH * SCREEN_HEIGHT);
+        std::vector<byte> lineEmphasis(SCREEN_HEIGHT, 0);
+        for (int y = 0; y < SCREEN_HEIGHT; y++) {
+            for (int x = 0; x < SCREEN_WIDTH; x++) {
+                int tile = (x >> 3) + (y >> 3) * 3;
+                frame[y * SCREEN_WIDTH + x] = (byte) ((tile + ((x & 7) > (y & 7) ? 0x10 : 0)) & 0x3F);
+            }
+        }
+
+        int stride = getWidth() * bytesPerPixel(format);
+        std::vector<byte> output((size_t) stride * getHeight());
+        filter(frame.data(), lineEmphasis.data(), output.data(), stride);
+
+        frames = std::max(1, frames);
+        uint64_t begin = now();
+        for (int i = 0; i < frames; i++) {
+            filter(frame.data(), lineEmphasis.data(), output.data(), stride);
+        }
+        uint64_t cost = (now() - begin) / frames;
+
+        setFilter(lastType, lastScale);
+        return cost;
+    }
+}
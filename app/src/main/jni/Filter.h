@@ -0,0 +1,128 @@
+#ifndef NESDROID_FILTER_H
+#define NESDROID_FILTER_H
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+#include "commons.h"
+#include "Palette.h"
+#include "WorkerPool.h"
+
+namespace nesdroid {
+
+    enum FilterType {
+        // integer scale 1 to 4
+        FILTER_NEAREST = 0,
+        FILTER_SCALE2X = 1,
+        FILTER_SCALE3X = 2,
+        // 2x with blended edges, after Hyllian's 2xBR
+        FILTER_XBR2X = 3,
+        FILTER_COUNT
+    };
+
+    // Scales the ppu output on the cpu so the surface needs no shader. The frame is
+    // converted through the palette into a padded buffer, then filtered, both split
+    // into horizontal bands over a worker pool.
+    //
+    // submit() starts frame N and returns, the workers filter it while the caller
+    // emulates N + 1; present() copies the newest completed frame. filter() does the
+    // same work synchronously straight into the destination.
+    class FilterPipeline {
+
+    public:
+
+        static const int MAX_SCALE = 4;
+
+        FilterPipeline(const Palette &palette, int threads = WorkerPool::defaultThreads());
+
+        virtual ~FilterPipeline();
+
+        // scale only applies to FILTER_NEAREST, the others have their own
+        void setFilter(FilterType type, int scale = 2);
+
+        void setFormat(PixelFormat format);
+
+        FilterType getFilter() const {
+            return type;
+        }
+
+        int getScale() const {
+            return scale;
+        }
+
+        PixelFormat getFormat() const {
+            return format;
+        }
+
+        int getWidth() const;
+
+        int getHeight() const;
+
+        // filter the frame into dst, whose lines are `stride` bytes apart
+        void filter(const byte *frame, const byte *emphasis, void *dst, int stride);
+
+        // copy the frame and start filtering it in the background
+        void submit(const byte *frame, const byte *emphasis);
+
+        // copy the newest completed frame, false if there is none yet
+        bool present(void *dst, int stride);
+
+        // block until the frame in flight is done
+        void wait();
+
+        // average cost of one frame in nanoseconds for a filter, timed over `frames`
+        // frames; drops the completed frame
+        uint64_t benchmark(FilterType type, int scale, int frames);
+
+    private:
+
+        void start(const byte *frame, const byte *emphasis, byte *dst, int stride);
+
+        void convertBand(int band);
+
+        void filterBand(int band);
+
+        byte *sourceLine(int y);
+
+        // under presentLock, which also keeps the settings and buffers from
+        // changing while a frame is started or presented
+        void resize();
+
+        // hand a finished frame in flight over to present(), under presentLock
+        void publish();
+
+        // let the frame in flight complete and publish it, under presentLock
+        void finish();
+
+        const Palette &palette;
+        WorkerPool pool;
+
+        FilterType type = FILTER_NEAREST;
+        int scale = 1;
+        PixelFormat format = PIXEL_FORMAT_RGBA_8888;
+
+        // frame in flight, copied so the ppu can move on
+        std::vector<byte> indices;
+        std::vector<byte> emphasis;
+
+        // converted pixels with a border of replicated edge pixels, so filters
+        // can read neighbours without bounds checks
+        std::vector<byte> source;
+        int sourceStride = 0;
+
+        byte *target = nullptr;
+        int targetStride = 0;
+        std::atomic<int> convertsLeft;
+        std::atomic<int> filtersLeft;
+
+        // submit() writes outputs[back], present() reads the other one
+        std::vector<byte> outputs[2];
+        int back = 0;
+        bool inFlight = false;
+        bool completed = false;
+        std::mutex presentLock;
+    };
+}
+
+#endif //NESDROID_FILTER_H
@@ -0,0 +1,361 @@
+#include <algorithm>
+#include <chrono>
+#include <sched.h>
+
+#include "FrameScheduler.h"
+#include "Console.h"
+#include "Metrics.h"
+
+namespace nesdroid {
+
+    // an idle worker looks for frames to steal at least this often
+    static const uint64_t IDLE_POLL_NANOS = FRAME_NANOS / 4;
+
+    // this many of the latest 8 frames missed move a session home, at most
+    // once in so many frames
+    static const int MIGRATE_MISSES = 2;
+    static const uint64_t MIGRATE_INTERVAL_FRAMES = 60;
+
+    // heap order with the earliest deadline on top
+    struct DeadlineOrder {
+        template<typename T>
+        bool operator()(const T *a, const T *b) const {
+            return a->deadline > b->deadline;
+        }
+    };
+
+    static void pinToCore(int core) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(core, &set);
+        // best effort, e.g. cores taken offline keep the thread unpinned
+        sched_setaffinity(0, sizeof(set), &set);
+    }
+
+    int FrameScheduler::defaultThreads() {
+        return std::max(1, (int) std::thread::hardware_concurrency());
+    }
+
+    FrameScheduler::FrameScheduler(int threads) {
+        threads = std::max(1, threads);
+        for (int i = 0; i < threads; i++) {
+            workers.emplace_back(new Worker());
+        }
+        for (int i = 0; i < threads; i++) {
+            workers[i]->thread = std::thread(&FrameScheduler::work, this, i);
+        }
+    }
+
+    FrameScheduler::~FrameScheduler() {
+        stopping = true;
+        for (auto &worker : workers) {
+            poke(*worker);
+        }
+        retired.notify_all();
+        for (auto &worker : workers) {
+            worker->thread.join();
+        }
+        for (auto &entry : sessions) {
+            delete entry.second;
+        }
+    }
+
+    int FrameScheduler::add(Console *console, const FrameCallback &callback) {
+        Session *session = new Session();
+        session->console = console;
+        session->callback = callback;
+        session->deadline = Metrics::now() + FRAME_NANOS;
+
+        // fewest sessions: a new one has no cost to weigh yet
+        int home = 0;
+        for (int i = 1; i < (int) workers.size(); i++) {
+            if (workers[i]->sessions < workers[home]->sessions) {
+                home = i;
+            }
+        }
+        session->home = home;
+        workers[home]->sessions++;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            session->id = nextId++;
+            sessions[session->id] = session;
+        }
+        requeue(session);
+        return session->id;
+    }
+
+    void FrameScheduler::remove(int id) {
+        std::unique_lock<std::mutex> lock(mutex);
+        auto found = sessions.find(id);
+        if (found == sessions.end()) {
+            return;
+        }
+        Session *session = found->second;
+        // retired by the worker that next takes it, within a frame
+        session->removed = true;
+        while (!session->retired && !stopping) {
+            retired.wait(lock);
+        }
+        sessions.erase(found);
+        Worker &home = *workers[session->home];
+        home.sessions--;
+        home.load -= session->costNanos;
+        delete session;
+    }
+
+    bool FrameScheduler::getStats(int id, SessionStats &stats) {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto found = sessions.find(id);
+        if (found == sessions.end()) {
+            return false;
+        }
+        stats = found->second->stats;
+        return true;
+    }
+
+    SessionStats FrameScheduler::getTotals() {
+        std::lock_guard<std::mutex> lock(mutex);
+        SessionStats totals;
+        uint64_t jitterSum = 0;
+        uint64_t intervals = 0;
+        uint64_t costSum = 0;
+        for (auto &entry : sessions) {
+            const Session &session = *entry.second;
+            const SessionStats &stats = session.stats;
+            totals.frames += stats.frames;
+            totals.skipped += stats.skipped;
+            totals.dropped += stats.dropped;
+            totals.missed += stats.missed;
+            totals.stolen += stats.stolen;
+            totals.migrations += stats.migrations;
+            totals.maxLatenessNanos = std::max(totals.maxLatenessNanos, stats.maxLatenessNanos);
+            jitterSum += session.jitterSum;
+            intervals += session.intervals;
+            costSum += session.costSum;
+        }
+        totals.jitterNanos = intervals > 0 ? jitterSum / intervals : 0;
+        totals.frameNanos = totals.frames > 0 ? costSum / totals.frames : 0;
+        return totals;
+    }
+
+    void FrameScheduler::poke(Worker &worker) {
+        {
+            std::lock_guard<std::mutex> lock(worker.mutex);
+            worker.poked = true;
+        }
+        worker.wake.notify_one();
+    }
+
+    void FrameScheduler::release(Worker &worker, uint64_t now) {
+        DeadlineOrder order;
+        while (!worker.sleeping.empty() && worker.sleeping.front()->deadline <= now + FRAME_NANOS) {
+            std::pop_heap(worker.sleeping.begin(), worker.sleeping.end(), order);
+            worker.ready.push_back(worker.sleeping.back());
+            worker.sleeping.pop_back();
+            std::push_heap(worker.ready.begin(), worker.ready.end(), order);
+        }
+    }
+
+    void FrameScheduler::requeue(Session *session) {
+        Worker &home = *workers[session->home];
+        bool earlier;
+        {
+            std::lock_guard<std::mutex> lock(home.mutex);
+            home.sleeping.push_back(session);
+            std::push_heap(home.sleeping.begin(), home.sleeping.end(), DeadlineOrder());
+            // the home worker sleeps past this frame's release
+            earlier = !home.busy && session->deadline - FRAME_NANOS < home.wakeAt;
+            if (earlier) {
+                home.poked = true;
+            }
+        }
+        if (earlier) {
+            home.wake.notify_one();
+        }
+    }
+
+    FrameScheduler::Session *FrameScheduler::steal(int thief) {
+        uint64_t now = Metrics::now();
+        int victim = -1;
+        uint64_t earliest = UINT64_MAX;
+        for (int i = 0; i < (int) workers.size(); i++) {
+            if (i == thief) {
+                continue;
+            }
+            Worker &worker = *workers[i];
+            std::lock_guard<std::mutex> lock(worker.mutex);
+            // an idle worker runs its own frames
+            if (!worker.busy) {
+                continue;
+            }
+            release(worker, now);
+            if (!worker.ready.empty() && worker.ready.front()->deadline < earliest) {
+                earliest = worker.ready.front()->deadline;
+                victim = i;
+            }
+        }
+        if (victim < 0) {
+            return nullptr;
+        }
+        Worker &worker = *workers[victim];
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        if (worker.ready.empty()) {
+            return nullptr;
+        }
+        std::pop_heap(worker.ready.begin(), worker.ready.end(), DeadlineOrder());
+        Session *session = worker.ready.back();
+        worker.ready.pop_back();
+        return session;
+    }
+
+    void FrameScheduler::work(int index) {
+        if (index < (int) std::thread::hardware_concurrency()) {
+            pinToCore(index);
+        }
+        Worker &worker = *workers[index];
+        while (true) {
+            Session *session = nullptr;
+            bool backlog;
+            {
+                std::unique_lock<std::mutex> lock(worker.mutex);
+                while (!stopping) {
+                    release(worker, Metrics::now());
+                    if (!worker.ready.empty()) {
+                        std::pop_heap(worker.ready.begin(), worker.ready.end(), DeadlineOrder());
+                        session = worker.ready.back();
+                        worker.ready.pop_back();
+                        break;
+                    }
+                    worker.busy = false;
+                    lock.unlock();
+                    session = steal(index);
+                    lock.lock();
+                    if (session != nullptr) {
+                        break;
+                    }
+                    // until the next release of its own, or sooner to steal
+                    uint64_t now = Metrics::now();
+                    uint64_t wait = IDLE_POLL_NANOS;
+                    if (!worker.sleeping.empty()) {
+                        uint64_t release = worker.sleeping.front()->deadline - FRAME_NANOS;
+                        wait = std::min(wait, release > now ? release - now : 0);
+                    }
+                    worker.wakeAt = now + wait;
+                    if (!worker.poked && wait > 0) {
+                        worker.wake.wait_for(lock, std::chrono::nanoseconds(wait));
+                    }
+                    worker.poked = false;
+                }
+                if (session == nullptr) {
+                    return;
+                }
+                worker.busy = true;
+                backlog = !worker.ready.empty();
+            }
+            // more due than this worker can start now: someone idle may take it
+            if (backlog) {
+                for (int i = 0; i < (int) workers.size(); i++) {
+                    if (i != index) {
+                        poke(*workers[i]);
+                    }
+                }
+            }
+
+            if (session->removed) {
+                retire(session);
+                continue;
+            }
+            runFrame(index, session);
+            requeue(session);
+        }
+    }
+
+    void FrameScheduler::retire(Session *session) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            session->retired = true;
+        }
+        retired.notify_all();
+    }
+
+    void FrameScheduler::runFrame(int index, Session *session) {
+        uint64_t begin = Metrics::now();
+        uint64_t dropped = 0;
+        if (begin > session->deadline + MAX_LAG_FRAMES * FRAME_NANOS) {
+            dropped = (begin - session->deadline) / FRAME_NANOS;
+            session->deadline = begin + FRAME_NANOS;
+            session->lastFinish = 0;
+        }
+        // predicted to miss: keep the time, not the picture
+        bool render = begin + session->costNanos <= session->deadline;
+        session->console->setOutputEnabled(render);
+        session->console->stepFrame();
+        if (session->callback) {
+            session->callback(session->id, render);
+        }
+        uint64_t finish = Metrics::now();
+
+        uint64_t cost = finish - begin;
+        uint64_t average = session->costNanos == 0 ? cost : (session->costNanos * 7 + cost) / 8;
+        Worker &home = *workers[session->home];
+        home.load += average - session->costNanos;
+        session->costNanos = average;
+
+        bool missed = finish > session->deadline;
+        session->misses = (session->misses << 1 | (missed ? 1 : 0)) & 0xFF;
+        int target = -1;
+        if (__builtin_popcount(session->misses) >= MIGRATE_MISSES
+            && session->stats.frames >= session->migratedFrame + MIGRATE_INTERVAL_FRAMES) {
+            // where it fits in a frame and leaves the worker no busier than
+            // home was; with every worker overloaded skipping is all that helps
+            uint64_t homeLoad = home.load;
+            uint64_t lowest = homeLoad;
+            for (int i = 0; i < (int) workers.size(); i++) {
+                uint64_t load = workers[i]->load;
+                if (load + average <= FRAME_NANOS && load + 2 * average <= homeLoad && load < lowest) {
+                    lowest = load;
+                    target = i;
+                }
+            }
+        }
+
+        if (missed) {
+            Metrics::add(COUNTER_DEADLINE_MISSES, 1);
+        }
+        if (!render) {
+            Metrics::add(COUNTER_SKIPPED_FRAMES, 1);
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        SessionStats &stats = session->stats;
+        stats.frames++;
+        stats.skipped += render ? 0 : 1;
+        stats.dropped += dropped;
+        if (missed) {
+            stats.missed++;
+            stats.maxLatenessNanos = std::max(stats.maxLatenessNanos, finish - session->deadline);
+        }
+        stats.stolen += index != session->home ? 1 : 0;
+        if (session->lastFinish != 0) {
+            uint64_t interval = finish - session->lastFinish;
+            session->jitterSum += interval > FRAME_NANOS ? interval - FRAME_NANOS : FRAME_NANOS - interval;
+            session->intervals++;
+            stats.jitterNanos = session->jitterSum / session->intervals;
+        }
+        session->costSum += cost;
+        stats.frameNanos = session->costSum / stats.frames;
+        session->lastFinish = finish;
+        session->deadline += FRAME_NANOS;
+
+        if (target >= 0 && target != session->home) {
+            home.load -= average;
+            home.sessions--;
+            workers[target]->load += average;
+            workers[target]->sessions++;
+            session->home = target;
+            session->misses = 0;
+            session->migratedFrame = stats.frames;
+            stats.migrations++;
+        }
+    }
+}
@@ -0,0 +1,137 @@
+#ifndef NESDROID_FRAMESCHEDULER_H
+#define NESDROID_FRAMESCHEDULER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include "commons.h"
+
+namespace nesdroid {
+
+    class Console;
+
+    // deadline statistics of a session, or summed over all of them
+    struct SessionStats {
+        uint64_t frames = 0;            // emulated, skipped ones included
+        uint64_t skipped = 0;           // emulated without rendering to keep up
+        uint64_t dropped = 0;           // given up on when too far behind
+        uint64_t missed = 0;            // finished after their deadline
+        uint64_t stolen = 0;            // run by another core than the home one
+        uint64_t migrations = 0;        // moves to another home core
+        uint64_t maxLatenessNanos = 0;  // worst finish past a deadline
+        uint64_t jitterNanos = 0;       // mean distance of the frame intervals from FRAME_NANOS
+        uint64_t frameNanos = 0;        // mean cost of a frame
+    };
+
+    // Runs the frames of many consoles at the NTSC frame rate on one thread per
+    // core, instead of a thread per console. Each worker keeps the frames due on
+    // it earliest deadline first; a session comes back to its home worker after
+    // every frame so its machine stays in that core's caches. A worker without
+    // frames due takes the most urgent one from a busy worker. A session that
+    // keeps missing its deadlines moves home to the least loaded worker. A frame
+    // predicted to miss is emulated without rendering, and a session more than
+    // MAX_LAG_FRAMES behind drops the backlog, as Throttle does.
+    //
+    // A console belongs to the scheduler from add() to remove(): frames, pads
+    // and state go through the frame callback, which runs on the worker right
+    // after each frame. Pipelined consoles bring their own render thread and are
+    // better left sequential here.
+    class FrameScheduler {
+
+    public:
+
+        static const uint64_t MAX_LAG_FRAMES = 8;
+
+        // rendered is false for frames skipped to catch up
+        typedef std::function<void(int session, bool rendered)> FrameCallback;
+
+        // one per core
+        static int defaultThreads();
+
+        explicit FrameScheduler(int threads = defaultThreads());
+
+        virtual ~FrameScheduler();
+
+        // schedule console's frames from now on, returns the session
+        int add(Console *console, const FrameCallback &callback = nullptr);
+
+        // stop scheduling a session, returns once none of its frames runs
+        void remove(int session);
+
+        bool getStats(int session, SessionStats &stats);
+
+        SessionStats getTotals();
+
+        int getThreads() const {
+            return (int) workers.size();
+        }
+
+    private:
+
+        struct Session {
+            int id;
+            Console *console;
+            FrameCallback callback;
+            int home;
+            uint64_t deadline;      // of the next frame
+            uint64_t lastFinish = 0;
+            uint64_t costNanos = 0; // moving average of a frame
+            uint32_t misses = 0;    // the latest frames, one bit each
+            uint64_t migratedFrame = 0;
+            std::atomic<bool> removed{false};
+            bool retired = false;       // under the scheduler lock
+            uint64_t jitterSum = 0;
+            uint64_t intervals = 0;
+            uint64_t costSum = 0;
+            SessionStats stats;
+        };
+
+        struct Worker {
+            std::thread thread;
+            std::mutex mutex;
+            std::condition_variable wake;
+            // heaps: frames due by deadline, frames to come by release time
+            std::vector<Session *> ready;
+            std::vector<Session *> sleeping;
+            bool busy = false;
+            bool poked = false;
+            uint64_t wakeAt = 0;
+            std::atomic<uint64_t> load{0};  // frame costs of the sessions at home
+            std::atomic<int> sessions{0};
+        };
+
+        void work(int index);
+
+        // move what is released by now from sleeping to ready, under the lock
+        void release(Worker &worker, uint64_t now);
+
+        // most urgent frame of a busy worker, nullptr for none
+        Session *steal(int thief);
+
+        void runFrame(int index, Session *session);
+
+        // back home for the next frame
+        void requeue(Session *session);
+
+        void poke(Worker &worker);
+
+        void retire(Session *session);
+
+        std::vector<std::unique_ptr<Worker>> workers;
+        std::atomic<bool> stopping{false};
+
+        // sessions and their statistics
+        std::mutex mutex;
+        std::condition_variable retired;
+        std::unordered_map<int, Session *> sessions;
+        int nextId = 0;
+    };
+}
+
+#endif //NESDROID_FRAMESCHEDULER_H
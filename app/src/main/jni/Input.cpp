@@ -0,0 +1,50 @@
+#include "Input.h"
+#include "Metrics.h"
+
+namespace nesdroid {
+
+    void Input::setButtons(int port, byte buttons, uint64_t eventTime) {
+        // 0 stands for no event
+        uint64_t micros = eventTime / 1000 + 1;
+        int shift = (port & 1) * 8;
+        uint64_t old = snapshot.load(std::memory_order_relaxed);
+        uint64_t next;
+        do {
+            uint64_t pads = (old & 0xFFFF & ~(0xFFull << shift)) | ((uint64_t) buttons << shift);
+            next = micros << 16 | pads;
+        } while (!snapshot.compare_exchange_weak(old, next, std::memory_order_release, std::memory_order_relaxed));
+    }
+
+    void Input::latch(Controller *controllers) {
+        uint64_t value = snapshot.load(std::memory_order_acquire);
+        controllers[0].setButtons((byte) value);
+        controllers[1].setButtons((byte) (value >> 8));
+
+        uint64_t time = value >> 16;
+        if (time != latchedTime) {
+            latchedTime = time;
+            if (frameEventTime == 0) {
+                frameEventTime = time;
+            }
+        }
+    }
+
+    void Input::onFrameEnd() {
+        if (frameEventTime == 0) {
+            return;
+        }
+        // a frame that was never presented keeps its older event
+        uint64_t none = 0;
+        pendingEventTime.compare_exchange_strong(none, frameEventTime, std::memory_order_release);
+        frameEventTime = 0;
+    }
+
+    void Input::onPresent(uint64_t now) {
+        uint64_t micros = pendingEventTime.exchange(0, std::memory_order_acquire);
+        if (micros == 0) {
+            return;
+        }
+        uint64_t eventTime = (micros - 1) * 1000;
+        Metrics::addInputLatency(now > eventTime ? now - eventTime : 0);
+    }
+}
@@ -0,0 +1,50 @@
+#ifndef NESDROID_INPUT_H
+#define NESDROID_INPUT_H
+
+#include <atomic>
+
+#include "commons.h"
+#include "Controller.h"
+
+namespace nesdroid {
+
+    // Pads as the UI thread last saw them. The emulation thread copies them into
+    // the controllers when the game strobes $4016, the latest moment the
+    // hardware would see the buttons, instead of once at the start of a frame.
+    //
+    // Every change carries the time of the touch or key event. The first new
+    // event a frame picks up is followed to the first present after that frame,
+    // and the time in between goes into the input latency histogram of Metrics.
+    class Input {
+
+    public:
+
+        // ui thread: buttons of a pad (bit n is Button n) as of eventTime, in
+        // Metrics::now() nanoseconds; lock-free
+        void setButtons(int port, byte buttons, uint64_t eventTime);
+
+        // emulation thread: the game strobes the pads, hand them the newest state
+        void latch(Controller *controllers);
+
+        // emulation thread: the frame emulated so far is complete
+        void onFrameEnd();
+
+        // presenting thread: a completed frame reached the screen
+        void onPresent(uint64_t now);
+
+    private:
+
+        // pads in bits 0-15, event time in microseconds above, in one word so
+        // that readers never see the buttons of one event with the time of another
+        std::atomic<uint64_t> snapshot{0};
+
+        // emulation thread only
+        uint64_t latchedTime = 0;
+        uint64_t frameEventTime = 0;
+
+        // event time of a completed frame that was not presented yet, 0 for none
+        std::atomic<uint64_t> pendingEventTime{0};
+    };
+}
+
+#endif //NESDROID_INPUT_H
@@ -0,0 +1,204 @@
+#include <cstring>
+
+#include "Lockstep.h"
+
+namespace nesdroid {
+
+    // Keeps the chunks of a trace in memory instead of writing them out,
+    // until clear() recycles them.
+    class TraceWindow : public TraceWriter {
+
+    public:
+
+        virtual ~TraceWindow() {
+            for (auto chunk : owned) {
+                delete chunk;
+            }
+        }
+
+        virtual TraceChunk *acquire() override {
+            if (spare.empty()) {
+                owned.push_back(new TraceChunk());
+                spare.push_back(owned.back());
+            }
+            TraceChunk *chunk = spare.back();
+            spare.pop_back();
+            chunk->count = 0;
+            return chunk;
+        }
+
+        virtual void submit(TraceChunk *chunk) override {
+            filled.push_back(chunk);
+        }
+
+        void collect(std::vector<TraceRecord> &records) const {
+            records.clear();
+            for (auto chunk : filled) {
+                records.insert(records.end(), chunk->records, chunk->records + chunk->count);
+            }
+        }
+
+        void clear() {
+            spare.insert(spare.end(), filled.begin(), filled.end());
+            filled.clear();
+        }
+
+    private:
+        std::vector<TraceChunk *> owned;
+        std::vector<TraceChunk *> spare;
+        std::vector<TraceChunk *> filled;
+    };
+
+    static bool sameRecord(const TraceRecord &a, const TraceRecord &b) {
+        return a.cycle == b.cycle && a.pc == b.pc && a.address == b.address && a.opcode == b.opcode
+               && a.operands[0] == b.operands[0] && a.operands[1] == b.operands[1]
+               && a.a == b.a && a.x == b.x && a.y == b.y && a.p == b.p && a.sp == b.sp;
+    }
+
+    Lockstep::Lockstep(ROM *rom, const std::function<void(Console &)> &configure) {
+        traces[0] = new TraceWindow();
+        traces[1] = new TraceWindow();
+        streams[0] = new TraceStream(*traces[0], 0);
+        streams[1] = new TraceStream(*traces[1], 1);
+
+        if (!reference.insert(rom) || !candidate.insert(rom)) {
+            return;
+        }
+        configure(candidate);
+        // both start from the same power-on state whatever configure did
+        reference.powerOn();
+        candidate.powerOn();
+        valid = true;
+    }
+
+    Lockstep::~Lockstep() {
+        reference.cpu.setTrace(nullptr);
+        candidate.cpu.setTrace(nullptr);
+        for (int i = 0; i < 2; i++) {
+            // the stream hands its last chunk back to the window
+            delete streams[i];
+            delete traces[i];
+        }
+    }
+
+    void Lockstep::setGranularity(Granularity granularity, int stateInterval) {
+        this->granularity = granularity;
+        this->stateInterval = stateInterval < 1 ? 1 : stateInterval;
+        // traced cpus interpret, frame granularity leaves plugins running
+        bool traced = granularity == GRANULARITY_INSTRUCTION;
+        reference.cpu.setTrace(traced ? streams[0] : nullptr);
+        candidate.cpu.setTrace(traced ? streams[1] : nullptr);
+    }
+
+    bool Lockstep::run(uint64_t frames) {
+        if (!valid) {
+            report = "rom could not be inserted";
+            return false;
+        }
+
+        for (uint64_t end = frame + frames; frame < end; frame++) {
+            if (input) {
+                for (int port = 0; port < 2; port++) {
+                    byte buttons = input(frame, port);
+                    reference.getController(port).setButtons(buttons);
+                    candidate.getController(port).setButtons(buttons);
+                }
+            }
+            reference.stepFrame();
+            candidate.stepFrame();
+            streams[0]->flush();
+            streams[1]->flush();
+
+            bool same = granularity != GRANULARITY_INSTRUCTION || compareTraces();
+            if (same && (frame + 1) % stateInterval == 0) {
+                same = compareStates();
+            }
+            if (!same) {
+                return false;
+            }
+
+            // carry the tail of this frame over as context for the next one
+            std::vector<TraceRecord> records;
+            traces[0]->collect(records);
+            history.insert(history.end(), records.begin(), records.end());
+            if ((int) history.size() > window) {
+                history.erase(history.begin(), history.end() - window);
+            }
+            traces[0]->clear();
+            traces[1]->clear();
+        }
+        return true;
+    }
+
+    bool Lockstep::compareTraces() {
+        std::vector<TraceRecord> a, b;
+        traces[0]->collect(a);
+        traces[1]->collect(b);
+
+        size_t count = a.size() < b.size() ? a.size() : b.size();
+        size_t i = 0;
+        while (i < count && sameRecord(a[i], b[i])) {
+            i++;
+        }
+        if (i == a.size() && i == b.size()) {
+            return true;
+        }
+
+        std::vector<TraceRecord> context(history);
+        context.insert(context.end(), a.begin(), a.begin() + i);
+        if ((int) context.size() > window) {
+            context.erase(context.begin(), context.end() - window);
+        }
+        describe(context, i < a.size() ? &a[i] : nullptr, i < b.size() ? &b[i] : nullptr);
+        return false;
+    }
+
+    bool Lockstep::compareStates() {
+        State a, b;
+        reference.save(a);
+        candidate.save(b);
+        if (a.getSize() == b.getSize() && memcmp(a.getData(), b.getData(), a.getSize()) == 0) {
+            return true;
+        }
+
+        // point at the instruction if the registers already told them apart
+        if (!compareTraces()) {
+            return false;
+        }
+
+        size_t offset = 0;
+        while (offset < a.getSize() && offset < b.getSize() && a.getData()[offset] == b.getData()[offset]) {
+            offset++;
+        }
+        char line[128];
+        snprintf(line, sizeof(line), "frame %llu: states differ at byte %zu of %zu/%zu, instructions agree\n",
+                 (unsigned long long) frame, offset, a.getSize(), b.getSize());
+        report = line;
+        return false;
+    }
+
+    void Lockstep::describe(const std::vector<TraceRecord> &context, const TraceRecord *reference,
+                            const TraceRecord *candidate) {
+        char line[160];
+        snprintf(line, sizeof(line), "frame %llu: instructions differ\n", (unsigned long long) frame);
+        report = line;
+        for (auto &record : context) {
+            formatTraceRecord(record, line, sizeof(line));
+            report += "  ";
+            report += line;
+            report += "\n";
+        }
+        const TraceRecord *sides[2] = {reference, candidate};
+        const char *marks[2] = {"< ", "> "};
+        for (int i = 0; i < 2; i++) {
+            if (sides[i] != nullptr) {
+                formatTraceRecord(*sides[i], line, sizeof(line));
+            } else {
+                snprintf(line, sizeof(line), "(frame ended)");
+            }
+            report += marks[i];
+            report += line;
+            report += "\n";
+        }
+    }
+}
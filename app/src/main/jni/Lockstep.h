@@ -0,0 +1,101 @@
+#ifndef NESDROID_LOCKSTEP_H
+#define NESDROID_LOCKSTEP_H
+
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "commons.h"
+#include "Console.h"
+#include "Trace.h"
+
+namespace nesdroid {
+
+    class TraceWindow;
+
+    // Runs a reference console and a candidate one, e.g. with a faster engine
+    // switched on, side by side on the same rom and input and stops at the first
+    // point where they disagree.
+    //
+    // Every `stateInterval` frames the whole machine state (registers, ram, PPU,
+    // APU) is compared byte for byte. With instruction granularity the registers,
+    // PC, effective address and cycle of every instruction are compared as well;
+    // the trace that takes runs everything through the interpreter, so recompiled
+    // code is only checked at frame granularity.
+    class Lockstep {
+
+    public:
+
+        enum Granularity {
+            GRANULARITY_FRAME,
+            GRANULARITY_INSTRUCTION,
+        };
+
+        // buttons of a pad for a frame
+        typedef std::function<byte(uint64_t frame, int port)> Input;
+
+        // configure is applied to the candidate after the rom is inserted
+        Lockstep(ROM *rom, const std::function<void(Console &)> &configure);
+
+        virtual ~Lockstep();
+
+        // false if the rom could not be inserted in either console
+        bool isValid() const {
+            return valid;
+        }
+
+        void setGranularity(Granularity granularity, int stateInterval = 1);
+
+        void setInput(const Input &input) {
+            this->input = input;
+        }
+
+        // instructions shown before a divergence
+        void setWindow(int records) {
+            window = records;
+        }
+
+        // false at the first divergence, see getReport()
+        bool run(uint64_t frames);
+
+        uint64_t getFrame() const {
+            return frame;
+        }
+
+        const std::string &getReport() const {
+            return report;
+        }
+
+        // instructions the candidate ran from a plugin, see Console::loadNativeCode
+        uint64_t getNativeInstructions() const {
+            return candidate.cpu.getNativeInstructions();
+        }
+
+    private:
+
+        bool compareTraces();
+
+        bool compareStates();
+
+        void describe(const std::vector<TraceRecord> &context, const TraceRecord *reference,
+                      const TraceRecord *candidate);
+
+        Console reference;
+        Console candidate;
+        TraceWindow *traces[2];
+        TraceStream *streams[2];
+        bool valid = false;
+
+        Granularity granularity = GRANULARITY_FRAME;
+        int stateInterval = 1;
+        int window = 16;
+        Input input;
+
+        uint64_t frame = 0;
+        // the last instructions both agreed on, for the report
+        std::vector<TraceRecord> history;
+        std::string report;
+    };
+}
+
+#endif //NESDROID_LOCKSTEP_H
@@ -0,0 +1,380 @@
+#include <cstring>
+#include <new>
+
+#include "Mapper.h"
+#include "Ppu.h"
+#include "cpu.h"
+
+namespace nesdroid {
+
+    template<typename T>
+    static IMapper *place(void *storage, ROM *rom, const Cartridge &cartridge) {
+        static_assert(sizeof(T) <= MAX_MAPPER_SIZE, "mapper does not fit its slot");
+        return new(storage) T(rom, cartridge);
+    }
+
+    IMapper *createMapper(ROM *rom, const Cartridge &cartridge, void *storage) {
+        switch (rom->getRomMapperType()) {
+            case 0:
+                return place<NROM>(storage, rom, cartridge);
+            case 4:
+                return place<MMC3>(storage, rom, cartridge);
+            default:
+                LOG("Unsupported mapper %d: %s\n", rom->getRomMapperType(), rom->getMapperName());
+                return nullptr;
+        }
+    }
+
+    NROM::NROM(ROM *rom, const Cartridge &cartridge)
+            : prg(cartridge.prg), prgBankCount(cartridge.prgBanks) {
+        prgRam = cartridge.prgRam;
+        mirrorType = rom->isHasFourScreen() ? FOUR_SCREEN_MIRRORING : rom->getMirrorType();
+
+        // boards without CHR ROM carry 8K of CHR RAM
+        byte *chr = cartridge.chrRam;
+        if (cartridge.chrBanks > 0) {
+            chr = cartridge.chr;
+        } else {
+            chrRam = cartridge.chrRam;
+            chrWritable = true;
+        }
+        for (int i = 0; i < 8; i++) {
+            chrPages[i] = chr + i * 0x400;
+        }
+        remap();
+    }
+
+    void NROM::remap() {
+        // a single 16K bank is mirrored into $C000-$FFFF
+        for (int i = 0; i < 8; i++) {
+            prgMap[i] = prg + ((i >> 2) % prgBankCount) * PRG_BANK_SIZE + (i & 3) * 0x1000;
+        }
+        overlayCheats();
+    }
+
+    byte NROM::read(addr_t address) {
+        if (address < 0x8000) {
+            return address >= 0x6000 ? readPrgRam(address) : (byte) 0;
+        }
+        return readPrg(address);
+    }
+
+    byte *NROM::getPage(byte page) {
+        if (page < 0x80) {
+            return page >= 0x60 && prgRam != nullptr ? prgRam + ((page & 0x1F) << 8) : nullptr;
+        }
+        return prgPointer(page);
+    }
+
+    void NROM::write(addr_t address, byte value) {
+        // no registers
+        if (address >= 0x6000 && address < 0x8000) {
+            writePrgRam(address, value);
+        }
+    }
+
+    dbyte NROM::readDoubleByte(addr_t address) {
+        byte low = read(address);
+        byte high = read((addr_t) (address + 1));
+        return high << 8 | low;
+    }
+
+    void NROM::writeDoubleByte(addr_t address, dbyte value) {
+    }
+
+    void NROM::save(State &state) const {
+        if (prgRam != nullptr) {
+            state.write(prgRam, PRG_RAM_SIZE);
+        }
+        if (chrWritable) {
+            state.write(chrRam, CHR_RAM_SIZE);
+        }
+    }
+
+    void NROM::load(State &state) {
+        if (prgRam != nullptr) {
+            state.read(prgRam, PRG_RAM_SIZE);
+        }
+        if (chrWritable) {
+            state.read(chrRam, CHR_RAM_SIZE);
+        }
+    }
+
+    static const int COUNTER_CLOCKS_PER_FRAME = 241;
+
+    // A12 rises once per rendering line, the visible ones and the pre-render
+    // line, at the first $1000 fetch after the $0000 ones: the sprite fetches
+    // with sprites at $1000, the next line's tiles with only the background
+    // there, never with both at $0000. 8x16 sprites take the table from the
+    // tile and empty slots fetch tile $FF, so they count as $1000. 0 for none
+    static int counterClockDot(const PPU *ppu) {
+        if (!ppu->isRenderingEnabled()) {
+            return 0;
+        }
+        if (ppu->getSpriteTable() != 0 || ppu->isTallSprites()) {
+            return 260;
+        }
+        return ppu->getBackgroundTable() != 0 ? 324 : 0;
+    }
+
+    // counter clocks of a frame up to and including the given position
+    static int clocksBefore(int line, int cycle, int dot) {
+        if (line < 240) {
+            return line + (cycle >= dot ? 1 : 0);
+        }
+        return 240 + (line == 261 && cycle >= dot ? 1 : 0);
+    }
+
+    MMC3::MMC3(ROM *rom, const Cartridge &cartridge)
+            : prg(cartridge.prg), prgPageCount(cartridge.prgBanks * 2) {
+        prgRam = cartridge.prgRam;
+        mirrorType = rom->isHasFourScreen() ? FOUR_SCREEN_MIRRORING : rom->getMirrorType();
+
+        if (cartridge.chrBanks > 0) {
+            chr = cartridge.chr;
+            chrPageCount = cartridge.chrBanks * 8;
+        } else {
+            chr = chrRam = cartridge.chrRam;
+            chrPageCount = 8;
+            chrWritable = true;
+        }
+        reset();
+    }
+
+    void MMC3::reset() {
+        static const byte initial[8] = {0, 2, 4, 5, 6, 7, 0, 1};
+        memcpy(registers, initial, sizeof(registers));
+        bankSelect = 0;
+        updateBanks();
+
+        counter = 0;
+        latch = 0;
+        reloadRequested = false;
+        irqEnabled = false;
+        irqClock = NO_IRQ;
+        if (cpu != nullptr) {
+            cpu->setIrqLine(IRQ_MAPPER, false);
+        }
+        // start counting from where the PPU is now
+        syncDot = 0;
+        sync();
+    }
+
+    void MMC3::remap() {
+        updateBanks();
+    }
+
+    void MMC3::updateBanks() {
+        int secondLast = prgPageCount - 2;
+        int r6 = registers[6] % prgPageCount;
+        bool swapped = (bankSelect & 0x40) != 0;
+        int pages[4] = {swapped ? secondLast : r6, registers[7] % prgPageCount,
+                        swapped ? r6 : secondLast, prgPageCount - 1};
+        for (int i = 0; i < 8; i++) {
+            prgMap[i] = prg + pages[i >> 1] * 0x2000 + (i & 1) * 0x1000;
+        }
+        overlayCheats();
+
+        // R0 and R1 select 2K, the low bit is ignored; bit 7 swaps the halves
+        int banks[8] = {registers[0] & 0xFE, registers[0] | 1, registers[1] & 0xFE, registers[1] | 1,
+                        registers[2], registers[3], registers[4], registers[5]};
+        int invert = (bankSelect & 0x80) ? 4 : 0;
+        for (int i = 0; i < 8; i++) {
+            chrPages[i ^ invert] = chr + (banks[i] % chrPageCount) * 0x400;
+        }
+    }
+
+    byte MMC3::read(addr_t address) {
+        if (address < 0x8000) {
+            return address >= 0x6000 ? readPrgRam(address) : (byte) 0;
+        }
+        return readPrg(address);
+    }
+
+    byte *MMC3::getPage(byte page) {
+        if (page < 0x80) {
+            return page >= 0x60 && prgRam != nullptr ? prgRam + ((page & 0x1F) << 8) : nullptr;
+        }
+        return prgPointer(page);
+    }
+
+    void MMC3::write(addr_t address, byte value) {
+        if (address < 0x8000) {
+            if (address >= 0x6000) {
+                writePrgRam(address, value);
+            }
+            return;
+        }
+
+        bool odd = (address & 1) != 0;
+        switch (address & 0xE000) {
+            case 0x8000:
+                if (odd) {
+                    registers[bankSelect & 7] = value;
+                } else {
+                    bankSelect = value;
+                }
+                updateBanks();
+                break;
+            case 0xA000:
+                // $A001 PRG-RAM protect is left alone, MMC6 boards use it differently
+                if (!odd && mirrorType != FOUR_SCREEN_MIRRORING) {
+                    mirrorType = (value & 1) ? HORIZONTAL_MIRRORING : VERTICAL_MIRRORING;
+                }
+                break;
+            case 0xC000:
+                // the clocks so far count with the old values
+                sync();
+                if (odd) {
+                    counter = 0;
+                    reloadRequested = true;
+                } else {
+                    latch = value;
+                }
+                reschedule();
+                break;
+            default:
+                // $E000 disables and acknowledges, $E001 enables
+                sync();
+                irqEnabled = odd;
+                if (!odd && cpu != nullptr) {
+                    cpu->setIrqLine(IRQ_MAPPER, false);
+                }
+                reschedule();
+                break;
+        }
+    }
+
+    dbyte MMC3::readDoubleByte(addr_t address) {
+        byte low = read(address);
+        byte high = read((addr_t) (address + 1));
+        return high << 8 | low;
+    }
+
+    void MMC3::writeDoubleByte(addr_t address, dbyte value) {
+    }
+
+    void MMC3::sync() {
+        if (ppu == nullptr) {
+            return;
+        }
+        uint64_t frame = ppu->getFrame();
+        int line = ppu->getScanLine();
+        int cycle = ppu->getCycle();
+        if (syncDot != 0) {
+            clockCounter((frame - syncFrame) * COUNTER_CLOCKS_PER_FRAME
+                         + clocksBefore(line, cycle, syncDot) - clocksBefore(syncLine, syncCycle, syncDot));
+        }
+        syncFrame = frame;
+        syncLine = line;
+        syncCycle = cycle;
+        syncDot = counterClockDot(ppu);
+    }
+
+    void MMC3::clockCounter(uint64_t clocks) {
+        if (clocks == 0) {
+            return;
+        }
+        // a clock at zero or after $C001 reloads, any other counts down
+        if (reloadRequested || counter == 0) {
+            counter = latch;
+            reloadRequested = false;
+            clocks--;
+        }
+        if (clocks <= counter) {
+            counter -= clocks;
+            return;
+        }
+        // from zero the counter goes around every latch + 1 clocks
+        uint64_t left = (clocks - counter) % (latch + 1u);
+        counter = (byte) (left == 0 ? 0 : latch + 1 - left);
+    }
+
+    void MMC3::reschedule() {
+        sync();
+        irqClock = NO_IRQ;
+        if (ppu == nullptr || !irqEnabled || syncDot == 0) {
+            return;
+        }
+
+        // the clock that takes the counter to zero
+        uint32_t clocks = reloadRequested || counter == 0 ? latch + 1u : counter;
+
+        // walk the PPU from where it is to that clock, line by line
+        int line = syncLine;
+        int cycle = syncCycle;
+        bool odd = ppu->isOddFrame();
+        uint64_t dots = 0;
+        for (; clocks > 0; clocks--) {
+            int next;
+            if (line < 240 && cycle < syncDot) {
+                next = line;
+            } else if (line < 239) {
+                next = line + 1;
+            } else if (line < 261 || cycle < syncDot) {
+                next = 261;
+            } else {
+                // into the next frame, past the dot odd frames skip
+                dots += (odd ? 340 : 341) - cycle + syncDot;
+                line = 0;
+                cycle = syncDot;
+                odd = !odd;
+                continue;
+            }
+            dots += (next - line) * 341 + syncDot - cycle;
+            line = next;
+            cycle = syncDot;
+        }
+        irqClock = ppu->getClock() + dots;
+    }
+
+    void MMC3::onIrq() {
+        // catch the counter up to the clock that took it to zero
+        sync();
+        // held until $E000
+        cpu->setIrqLine(IRQ_MAPPER, true);
+        reschedule();
+    }
+
+    void MMC3::save(State &state) const {
+        state.put(bankSelect);
+        state.write(registers, sizeof(registers));
+        state.put(mirrorType);
+        state.put(counter);
+        state.put(latch);
+        state.put(reloadRequested);
+        state.put(irqEnabled);
+        state.put(syncFrame);
+        state.put(syncLine);
+        state.put(syncCycle);
+        state.put(syncDot);
+        if (prgRam != nullptr) {
+            state.write(prgRam, PRG_RAM_SIZE);
+        }
+        if (chrWritable) {
+            state.write(chrRam, CHR_RAM_SIZE);
+        }
+    }
+
+    void MMC3::load(State &state) {
+        state.get(bankSelect);
+        state.read(registers, sizeof(registers));
+        state.get(mirrorType);
+        state.get(counter);
+        state.get(latch);
+        state.get(reloadRequested);
+        state.get(irqEnabled);
+        state.get(syncFrame);
+        state.get(syncLine);
+        state.get(syncCycle);
+        state.get(syncDot);
+        if (prgRam != nullptr) {
+            state.read(prgRam, PRG_RAM_SIZE);
+        }
+        if (chrWritable) {
+            state.read(chrRam, CHR_RAM_SIZE);
+        }
+        updateBanks();
+        // the console reschedules once the PPU is loaded as well
+    }
+}
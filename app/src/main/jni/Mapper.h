@@ -0,0 +1,127 @@
+#ifndef NESDROID_MAPPER_H
+#define NESDROID_MAPPER_H
+
+#include "Memory.h"
+#include "rom.h"
+
+namespace nesdroid {
+
+    // room the console keeps for the mapper object
+    static const size_t MAX_MAPPER_SIZE = 512;
+
+    static const int CHR_RAM_SIZE = 0x2000;
+
+    static const int PRG_RAM_SIZE = 0x2000;
+
+    // cartridge memory, copied into the console arena
+    struct Cartridge {
+        byte *prg;      // prgBanks 16K banks back to back
+        int prgBanks;
+        byte *chr;      // chrBanks 8K banks back to back, nullptr without CHR ROM
+        int chrBanks;
+        byte *chrRam;   // 8K for boards without CHR ROM
+        byte *prgRam;   // 8K at $6000, copied from the save file for battery backed boards
+    };
+
+    // Create the mapper for rom in storage (MAX_MAPPER_SIZE bytes), nullptr if the
+    // board is not supported. It is destroyed with ~IMapper(), never deleted.
+    IMapper *createMapper(ROM *rom, const Cartridge &cartridge, void *storage);
+
+    // Mapper 0, NROM: 16K or 32K PRG, 8K CHR, no bank switching, PRG-RAM on
+    // Family Basic boards
+    class NROM : public IMapper {
+
+    public:
+
+        NROM(ROM *rom, const Cartridge &cartridge);
+
+        virtual byte read(addr_t address) override;
+
+        virtual void write(addr_t address, byte value) override;
+
+        virtual dbyte readDoubleByte(addr_t address) override;
+
+        virtual void writeDoubleByte(addr_t address, dbyte value) override;
+
+        virtual byte *getPage(byte page) override;
+
+        virtual void save(State &state) const override;
+
+        virtual void load(State &state) override;
+
+        virtual void remap() override;
+
+    private:
+        byte *prg;
+        int prgBankCount;
+    };
+
+    // Mapper 4, MMC3: four 8K PRG windows, 2K and 1K CHR banks, switchable
+    // mirroring, PRG-RAM and a scanline counter clocked by PPU A12. The counter
+    // is not stepped line by line: from it, the PPU position and whether the
+    // PPU renders the clock of the next IRQ is worked out and posted to the
+    // console, again only when one of those changes.
+    class MMC3 : public IMapper {
+
+    public:
+
+        MMC3(ROM *rom, const Cartridge &cartridge);
+
+        virtual byte read(addr_t address) override;
+
+        virtual void write(addr_t address, byte value) override;
+
+        virtual dbyte readDoubleByte(addr_t address) override;
+
+        virtual void writeDoubleByte(addr_t address, dbyte value) override;
+
+        virtual byte *getPage(byte page) override;
+
+        virtual void reset() override;
+
+        virtual void save(State &state) const override;
+
+        virtual void load(State &state) override;
+
+        virtual void onIrq() override;
+
+        virtual void reschedule() override;
+
+        virtual void remap() override;
+
+        // only $E000-$FFFF, the last 8K bank
+        virtual bool isPrgFixed(addr_t address) const override {
+            return address >= 0xE000;
+        }
+
+    private:
+
+        void updateBanks();
+
+        // apply the counter clocks the PPU went through since the last sync
+        void sync();
+
+        void clockCounter(uint64_t clocks);
+
+        byte *prg;
+        int prgPageCount;   // 8K
+        byte *chr;
+        int chrPageCount;   // 1K
+
+        byte bankSelect = 0;
+        byte registers[8];
+
+        byte counter = 0;
+        byte latch = 0;
+        bool reloadRequested = false;
+        bool irqEnabled = false;
+
+        // PPU position the counter is valid for
+        uint64_t syncFrame = 0;
+        int syncLine = 0;
+        int syncCycle = 0;
+        int syncDot = 0;    // dot of each line's clock, 0 for none
+    };
+}
+
+#endif //NESDROID_MAPPER_H
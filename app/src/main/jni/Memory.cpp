@@ -2,41 +2,87 @@
 // Created by Cauchywei on 16/5/14.
 //
 
-#include "memory.h"
+#include <cstring>
+
+#include "Memory.h"
+#include "Debugger.h"
+#include "Input.h"
+#include "Ppu.h"
+#include "Apu.h"
 
 namespace nesdroid {
 
 
     void CpuMemory::reset() {
-        //TODO reset memory
+        // power-on RAM is zero filled so that runs are reproducible
+        memset(ram, 0, RAM_SIZE);
     }
 
-    byte CpuMemory::read(addr_t address) {
+    byte *CpuMemory::getPage(byte page) {
+        if (page < 0x20) {
+            return ram + ((page & 0x07) << 8);
+        }
+        if (page >= 0x60 && mapper != nullptr) {
+            return mapper->getPage(page);
+        }
+        return nullptr;
+    }
+
+    void CpuMemory::save(State &state) const {
+        state.write(ram, RAM_SIZE);
+        if (mapper != nullptr) {
+            mapper->save(state);
+        }
+    }
+
+    void CpuMemory::load(State &state) {
+        state.read(ram, RAM_SIZE);
+        if (mapper != nullptr) {
+            mapper->load(state);
+        }
+    }
+
+    byte CpuMemory::readBus(addr_t address) {
 
         if (address < 0x2000) {
             return ram[address % 0x0800];
         } else if (address < 0x4000) {
-            //TODO read ppu register
-        } else if (address < 0x4014) {
-            //TODO read APU register
-        } else if (address == 0x4014) {
-            //TODO read PPU register
-        } else if (address == 0x4015) {
-            //TODO read APU register
-        } else if (address == 0x4016) {
-            //TODO read contoller
-        } else if (address == 0x4017) {
-            //TODO read APU register
+            mmioReads[address & 7]++;
+            return ppu->readRegister((addr_t) (0x2000 | (address & 7)));
+        } else if (address < 0x4020) {
+            mmioReads[mmioIndex(address)]++;
+            if (address == 0x4015) {
+                return apu->readRegister(address);
+            } else if (address == 0x4016) {
+                return controllers[0].read();
+            } else if (address == 0x4017) {
+                return controllers[1].read();
+            }
+            // APU channel registers and OAM DMA are write only
         } else if (address < 0x6000) {
             // TODO: I/O registers
         } else {
             return mapper->read(address);
         }
 
+        return 0;
+    }
+
+    byte CpuMemory::read(addr_t address) {
+        byte value = readBus(address);
+        if (traps[address >> 8] & ACCESS_READ) {
+            debugger->onAccess(SPACE_CPU, address, value, ACCESS_READ);
+        }
+        return value;
     }
 
 
     dbyte CpuMemory::readDoubleByte(addr_t address) {
+        addr_t next = (addr_t) (address + 1);
+        if ((traps[address >> 8] | traps[next >> 8]) & ACCESS_READ) {
+            byte low = read(address);
+            return read(next) << 8 | low;
+        }
         if (address < 0x2000) {
             return *((dbyte *) (ram + address % 0x0800));
         } else if (address < 0x4000) {
@@ -61,29 +107,44 @@ namespace nesdroid {
     }
 
     void CpuMemory::write(addr_t address, byte value) {
+        if (traps[address >> 8] & ACCESS_WRITE) {
+            debugger->onAccess(SPACE_CPU, address, value, ACCESS_WRITE);
+        }
 
         if (address < 0x2000) {
             ram[address % 0x0800] = value;
         } else if (address < 0x4000) {
-            //TODO write ppu register
-        } else if (address < 0x4014) {
-            //TODO write APU register
-        } else if (address == 0x4014) {
-            //TODO write PPU register
-        } else if (address == 0x4015) {
-            //TODO write APU register
-        } else if (address == 0x4016) {
-            //TODO write contoller
-        } else if (address == 0x4017) {
-            //TODO write APU register
+            mmioWrites[address & 7]++;
+            ppu->writeRegister((addr_t) (0x2000 | (address & 7)), value);
+        } else if (address < 0x4020) {
+            mmioWrites[mmioIndex(address)]++;
+            if (address == 0x4014) {
+                ppu->writeDma(value);
+            } else if (address == 0x4016) {
+                if (input != nullptr && (value & 1)) {
+                    input->latch(controllers);
+                }
+                controllers[0].write(value);
+                controllers[1].write(value);
+            } else if (address < 0x4018) {
+                apu->writeRegister(address, value);
+            }
         } else if (address < 0x6000) {
             // TODO: I/O registers
         } else {
             mapper->write(address, value);
+            ppu->onMapperWrite();
         }
     }
 
 
+    void CpuMemory::takeMmioCounts(uint32_t *reads, uint32_t *writes) {
+        memcpy(reads, mmioReads, sizeof(mmioReads));
+        memcpy(writes, mmioWrites, sizeof(mmioWrites));
+        memset(mmioReads, 0, sizeof(mmioReads));
+        memset(mmioWrites, 0, sizeof(mmioWrites));
+    }
+
     void CpuMemory::writeDoubleByte(addr_t address, dbyte value) {
         if (address < 0x2000) {
             *((dbyte *) (ram + address % 0x0800)) = value;
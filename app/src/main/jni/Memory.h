@@ -6,9 +6,20 @@
 #define NESDROID_MEMORY_H
 
 #include "commons.h"
+#include "Cheats.h"
+#include "Controller.h"
+#include "Metrics.h"
+#include "State.h"
+#include "rom.h"
 
 namespace nesdroid {
 
+    // kinds of access, also the bits of the debugger's trap tables
+    enum Access {
+        ACCESS_READ = 1,
+        ACCESS_WRITE = 2,
+        ACCESS_EXECUTE = 4,
+    };
 
     class IMemory {
     public:
@@ -21,11 +32,159 @@ namespace nesdroid {
         virtual void write(addr_t address, byte value) = 0;
     };
 
+    class Cpu;
+    class PPU;
+    class APU;
+    class Debugger;
+    class Input;
+
     class IMapper : public IMemory {
+    public:
+        // no IRQ coming, see getIrqClock()
+        static const uint64_t NO_IRQ = UINT64_MAX;
 
-    };
+        virtual ~IMapper() { }
+
+        // the machine the board is plugged into, for boards that raise IRQs
+        void connect(Cpu *cpu, PPU *ppu) {
+            this->cpu = cpu;
+            this->ppu = ppu;
+        }
+
+        // power on: bank and IRQ registers to their initial values
+        virtual void reset() { }
+
+        virtual void save(State &state) const { }
+
+        virtual void load(State &state) { }
+
+        // PPU clock (see PPU::getClock()) at which the board raises its next IRQ.
+        // The console compares it after every step, so the board never has to
+        // watch the PPU fetch by fetch.
+        uint64_t getIrqClock() const {
+            return irqClock;
+        }
+
+        // the PPU reached getIrqClock()
+        virtual void onIrq() { }
+
+        // rendering was switched on or off or a state was loaded: predict the
+        // next IRQ again
+        virtual void reschedule() { }
+
+        // Lay cheats (owned by the console, nullptr for none) over the PRG pages.
+        // Patched pages are swapped in at bank switches, reads stay as they are.
+        void setCheats(Cheats *cheats) {
+            this->cheats = cheats;
+            remap();
+        }
+
+        // rebuild the PRG map, e.g. after the cheats changed
+        virtual void remap() { }
+
+        // Direct pointer to a cpu page ($6000-$FFFF) backed by plain memory, nullptr
+        // if reads have side effects. Valid until the next bank switch.
+        virtual byte *getPage(byte page) {
+            return nullptr;
+        }
+
+        // PRG byte mapped at address ($8000-$FFFF), valid until the next bank switch
+        inline const byte *prgAddress(addr_t address) const {
+            return prgMap[(address >> 12) & 7] + (address & 0xFFF);
+        }
+
+        // whether the PRG mapped at address stays there whatever the game writes
+        virtual bool isPrgFixed(addr_t address) const {
+            return true;
+        }
+
+        byte getMirrorType() const {
+            return mirrorType;
+        }
+
+        // 1K pattern page mapped at $0000 + i * $400
+        byte *getChrPage(int i) const {
+            return chrPages[i & 7];
+        }
+
+        bool isChrWritable() const {
+            return chrWritable;
+        }
+
+        // 8K of CHR RAM, nullptr for boards with CHR ROM only
+        byte *getChrRam() const {
+            return chrRam;
+        }
+
+        // PPU pattern tables $0000-$1FFF through 1K pages
+        inline byte readChr(addr_t address) const {
+            return chrPages[(address >> 10) & 7][address & 0x3FF];
+        }
+
+        inline const byte *chrPointer(addr_t address) const {
+            return &chrPages[(address >> 10) & 7][address & 0x3FF];
+        }
+
+        inline void writeChr(addr_t address, byte value) {
+            if (chrWritable) {
+                chrPages[(address >> 10) & 7][address & 0x3FF] = value;
+            }
+        }
+
+        // 8K of PRG-RAM at $6000-$7FFF, nullptr if the board has none
+        byte *getPrgRam() const {
+            return prgRam;
+        }
+
+        // SaveRam pages written since the last call
+        uint32_t takePrgRamDirty() {
+            uint32_t dirty = prgRamDirty;
+            prgRamDirty = 0;
+            return dirty;
+        }
+
+    protected:
+        // $8000-$FFFF through 4K pages
+        inline byte readPrg(addr_t address) const {
+            return prgMap[(address >> 12) & 7][address & 0xFFF];
+        }
+
+        inline byte *prgPointer(byte page) const {
+            return prgMap[(page >> 4) & 7] + ((page & 0x0F) << 8);
+        }
+
+        // call once prgMap is filled in after a bank switch
+        void overlayCheats() {
+            if (cheats != nullptr) {
+                cheats->overlay(prgMap);
+            }
+        }
+
+        inline byte readPrgRam(addr_t address) const {
+            return prgRam != nullptr ? prgRam[address & 0x1FFF] : (byte) 0;
+        }
+
+        inline void writePrgRam(addr_t address, byte value) {
+            if (prgRam != nullptr) {
+                prgRam[address & 0x1FFF] = value;
+                prgRamDirty |= 1u << ((address & 0x1FFF) >> 12);
+            }
+        }
+
+        Cpu *cpu = nullptr;
+        PPU *ppu = nullptr;
+        uint64_t irqClock = NO_IRQ;
 
-    const
+        byte *prgMap[8];
+        Cheats *cheats = nullptr;
+
+        byte mirrorType = HORIZONTAL_MIRRORING;
+        byte *chrPages[8];
+        byte *chrRam = nullptr;
+        bool chrWritable = false;
+        byte *prgRam = nullptr;
+        uint32_t prgRamDirty = 0;
+    };
 
     class CpuMemory : public IMemory {
 
@@ -33,15 +192,11 @@ namespace nesdroid {
 
         friend class Cpu;
 
-        CpuMemory() {
-            ram = new byte[0x2000];
-        }
+        static const int RAM_SIZE = 0x0800;
 
+        CpuMemory() { }
 
-        virtual ~CpuMemory() {
-            delete ram;
-            delete mapper;
-        }
+        virtual ~CpuMemory() { }
 
         virtual byte read(addr_t address) override;
 
@@ -54,14 +209,76 @@ namespace nesdroid {
 
 
     private:
-        IMapper *mapper;
-        byte *ram;
+        // the bus itself, read() without traps
+        byte readBus(addr_t address);
+
+        // ACCESS_* bits by page, set for the pages the debugger watches
+        byte traps[256] = {0};
+        Debugger *debugger = nullptr;
+        Input *input = nullptr;
+        IMapper *mapper = nullptr;
+        Controller *controllers = nullptr;
+        PPU *ppu = nullptr;
+        APU *apu = nullptr;
+        byte *ram = nullptr;
 
     public:
 
         void reset();
 
+        // 2K of internal ram, owned by the console arena
+        void setRam(byte *ram) {
+            this->ram = ram;
+        }
+
+        // mapper is owned by the console
+        void setMapper(IMapper *mapper) {
+            this->mapper = mapper;
+        }
+
+        // two pads for $4016/$4017, owned by the caller
+        void setControllers(Controller *controllers) {
+            this->controllers = controllers;
+        }
+
+        void setPpu(PPU *ppu) {
+            this->ppu = ppu;
+        }
+
+        void setApu(APU *apu) {
+            this->apu = apu;
+        }
+
+        // live pads, latched into the controllers when the game strobes $4016;
+        // nullptr leaves the buttons to whoever sets them per frame
+        void setInput(Input *input) {
+            this->input = input;
+        }
+
+        // accesses to pages with trap bits set are reported to debugger
+        void setDebugger(Debugger *debugger) {
+            this->debugger = debugger;
+        }
+
+        byte *getTraps() {
+            return traps;
+        }
+
+        // direct pointer to a page of ram or cartridge memory for DMA, nullptr for I/O
+        byte *getPage(byte page);
+
+        void save(State &state) const;
+
+        void load(State &state);
+
         dbyte readDoubleByteBugly(addr_t address);
+
+        // register accesses since the last call, by mmioIndex()
+        void takeMmioCounts(uint32_t *reads, uint32_t *writes);
+
+    private:
+        uint32_t mmioReads[MMIO_REGISTERS] = {0};
+        uint32_t mmioWrites[MMIO_REGISTERS] = {0};
     };
 }
 #endif //NESDROID_MEMERY_H
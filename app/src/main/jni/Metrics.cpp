@@ -0,0 +1,255 @@
+#include <cstring>
+#include <ctime>
+#include <mutex>
+
+#include "Metrics.h"
+
+namespace nesdroid {
+
+    // threads counting at the same time: emulation, render, filter workers and
+    // the ui thread fit with room to spare
+    static const int MAX_BLOCKS = 16;
+
+    static const char *COUNTER_NAMES[COUNTER_COUNT] = {
+            "cycles", "instructions", "frames", "cpu ns", "ppu ns", "apu ns", "present ns",
+            "dma stalls", "dma stall cycles", "audio underruns", "deadline misses", "skipped frames",
+    };
+
+    static const char *PPU_REGISTER_NAMES[8] = {
+            "PPUCTRL", "PPUMASK", "PPUSTATUS", "OAMADDR", "OAMDATA", "PPUSCROLL", "PPUADDR", "PPUDATA",
+    };
+
+    // zero-initialized static storage, claimed by a thread on its first count and
+    // handed back zeroed when it exits, its counts moved to `retired`
+    static std::mutex blocksLock;
+    static Metrics::Block blocks[MAX_BLOCKS];
+    static bool blockInUse[MAX_BLOCKS];
+    static Metrics::Block retired;
+
+    // counts before the last reset(), subtracted from every snapshot
+    static std::mutex baselineLock;
+    static MetricsSnapshot baseline;
+    static uint64_t baselineTime = 0;
+
+    uint64_t Metrics::now() {
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+    }
+
+    static void moveCounts(std::atomic<uint64_t> *into, std::atomic<uint64_t> *from, int count) {
+        for (int i = 0; i < count; i++) {
+            into[i].store(into[i].load(std::memory_order_relaxed) + from[i].load(std::memory_order_relaxed),
+                          std::memory_order_relaxed);
+            from[i].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    // a thread's claim on a block, returned by the thread's exit
+    struct BlockOwner {
+        Metrics::Block *block = nullptr;
+        bool claimed = false;
+
+        ~BlockOwner() {
+            if (block == nullptr) {
+                return;
+            }
+            std::lock_guard<std::mutex> lock(blocksLock);
+            moveCounts(retired.counters, block->counters, COUNTER_COUNT);
+            moveCounts(retired.mmioReads, block->mmioReads, MMIO_REGISTERS);
+            moveCounts(retired.mmioWrites, block->mmioWrites, MMIO_REGISTERS);
+            moveCounts(retired.frameTimes, block->frameTimes, FRAME_BUCKETS);
+            moveCounts(retired.inputLatencies, block->inputLatencies, LATENCY_BUCKETS);
+            blockInUse[block - blocks] = false;
+        }
+    };
+
+    Metrics::Block *Metrics::local() {
+        static thread_local BlockOwner owner;
+        if (!owner.claimed) {
+            owner.claimed = true;
+            std::lock_guard<std::mutex> lock(blocksLock);
+            for (int i = 0; i < MAX_BLOCKS && owner.block == nullptr; i++) {
+                if (!blockInUse[i]) {
+                    blockInUse[i] = true;
+                    owner.block = &blocks[i];
+                }
+            }
+            if (owner.block == nullptr) {
+                LOG("Metrics: no counter block left for this thread\n");
+            }
+        }
+        return owner.block;
+    }
+
+    void Metrics::add(Counter counter, uint64_t value) {
+        Block *block = local();
+        if (block != nullptr) {
+            bump(block->counters[counter], value);
+        }
+    }
+
+    void Metrics::addMmio(const uint32_t *reads, const uint32_t *writes) {
+        Block *block = local();
+        if (block == nullptr) {
+            return;
+        }
+        for (int i = 0; i < MMIO_REGISTERS; i++) {
+            if (reads[i] != 0) {
+                bump(block->mmioReads[i], reads[i]);
+            }
+            if (writes[i] != 0) {
+                bump(block->mmioWrites[i], writes[i]);
+            }
+        }
+    }
+
+    void Metrics::addFrameTime(uint64_t nanos) {
+        Block *block = local();
+        if (block == nullptr) {
+            return;
+        }
+        uint64_t bucket = nanos / FRAME_BUCKET_NANOS;
+        bump(block->frameTimes[bucket < FRAME_BUCKETS ? bucket : FRAME_BUCKETS - 1], 1);
+    }
+
+    void Metrics::addInputLatency(uint64_t nanos) {
+        Block *block = local();
+        if (block == nullptr) {
+            return;
+        }
+        uint64_t bucket = nanos / LATENCY_BUCKET_NANOS;
+        bump(block->inputLatencies[bucket < LATENCY_BUCKETS ? bucket : LATENCY_BUCKETS - 1], 1);
+    }
+
+    static void sum(MetricsSnapshot &snapshot) {
+        memset(&snapshot, 0, sizeof(snapshot));
+        // a block is never half moved to `retired`
+        std::lock_guard<std::mutex> lock(blocksLock);
+        for (int b = 0; b <= MAX_BLOCKS; b++) {
+            const Metrics::Block &block = b < MAX_BLOCKS ? blocks[b] : retired;
+            for (int i = 0; i < COUNTER_COUNT; i++) {
+                snapshot.counters[i] += block.counters[i].load(std::memory_order_relaxed);
+            }
+            for (int i = 0; i < MMIO_REGISTERS; i++) {
+                snapshot.mmioReads[i] += block.mmioReads[i].load(std::memory_order_relaxed);
+                snapshot.mmioWrites[i] += block.mmioWrites[i].load(std::memory_order_relaxed);
+            }
+            for (int i = 0; i < FRAME_BUCKETS; i++) {
+                snapshot.frameTimes[i] += block.frameTimes[i].load(std::memory_order_relaxed);
+            }
+            for (int i = 0; i < LATENCY_BUCKETS; i++) {
+                snapshot.inputLatencies[i] += block.inputLatencies[i].load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    void Metrics::snapshot(MetricsSnapshot &snapshot) {
+        sum(snapshot);
+        std::lock_guard<std::mutex> lock(baselineLock);
+        for (int i = 0; i < COUNTER_COUNT; i++) {
+            snapshot.counters[i] -= baseline.counters[i];
+        }
+        for (int i = 0; i < MMIO_REGISTERS; i++) {
+            snapshot.mmioReads[i] -= baseline.mmioReads[i];
+            snapshot.mmioWrites[i] -= baseline.mmioWrites[i];
+        }
+        for (int i = 0; i < FRAME_BUCKETS; i++) {
+            snapshot.frameTimes[i] -= baseline.frameTimes[i];
+        }
+        for (int i = 0; i < LATENCY_BUCKETS; i++) {
+            snapshot.inputLatencies[i] -= baseline.inputLatencies[i];
+        }
+        if (baselineTime == 0) {
+            baselineTime = now();
+        }
+        snapshot.wallNanos = now() - baselineTime;
+    }
+
+    void Metrics::reset() {
+        MetricsSnapshot current;
+        sum(current);
+        std::lock_guard<std::mutex> lock(baselineLock);
+        baseline = current;
+        baselineTime = now();
+    }
+
+    // upper bound of the bucket holding the p-th sample
+    static uint64_t bucketPercentile(const uint64_t *buckets, int count, uint64_t width, double p) {
+        uint64_t total = 0;
+        for (int i = 0; i < count; i++) {
+            total += buckets[i];
+        }
+        if (total == 0) {
+            return 0;
+        }
+        uint64_t rank = (uint64_t) (p * total);
+        if (rank >= total) {
+            rank = total - 1;
+        }
+        uint64_t seen = 0;
+        for (int i = 0; i < count; i++) {
+            seen += buckets[i];
+            if (seen > rank) {
+                return (i + 1) * width;
+            }
+        }
+        return count * width;
+    }
+
+    uint64_t MetricsSnapshot::percentile(double p) const {
+        return bucketPercentile(frameTimes, FRAME_BUCKETS, FRAME_BUCKET_NANOS, p);
+    }
+
+    uint64_t MetricsSnapshot::latencyPercentile(double p) const {
+        return bucketPercentile(inputLatencies, LATENCY_BUCKETS, LATENCY_BUCKET_NANOS, p);
+    }
+
+    double MetricsSnapshot::rate(Counter counter) const {
+        return wallNanos > 0 ? counters[counter] * 1e9 / wallNanos : 0;
+    }
+
+    std::string Metrics::format() {
+        MetricsSnapshot snapshot;
+        Metrics::snapshot(snapshot);
+
+        std::string out;
+        char line[128];
+        snprintf(line, sizeof(line), "over %.2f s: %.0f cycles/s, %.0f instructions/s, %.2f frames/s\n",
+                 snapshot.wallNanos / 1e9, snapshot.rate(COUNTER_CYCLES), snapshot.rate(COUNTER_INSTRUCTIONS),
+                 snapshot.rate(COUNTER_FRAMES));
+        out += line;
+        snprintf(line, sizeof(line), "frame time p50 %.2f ms, p95 %.2f ms, p99 %.2f ms\n",
+                 snapshot.percentile(0.50) / 1e6, snapshot.percentile(0.95) / 1e6,
+                 snapshot.percentile(0.99) / 1e6);
+        out += line;
+        uint64_t inputs = 0;
+        for (int i = 0; i < LATENCY_BUCKETS; i++) {
+            inputs += snapshot.inputLatencies[i];
+        }
+        if (inputs > 0) {
+            snprintf(line, sizeof(line), "input latency p50 %.0f ms, p95 %.0f ms, p99 %.0f ms over %llu inputs\n",
+                     snapshot.latencyPercentile(0.50) / 1e6, snapshot.latencyPercentile(0.95) / 1e6,
+                     snapshot.latencyPercentile(0.99) / 1e6, (unsigned long long) inputs);
+            out += line;
+        }
+        for (int i = 0; i < COUNTER_COUNT; i++) {
+            snprintf(line, sizeof(line), "%s: %llu\n", COUNTER_NAMES[i], (unsigned long long) snapshot.counters[i]);
+            out += line;
+        }
+        for (int i = 0; i < MMIO_REGISTERS; i++) {
+            if (snapshot.mmioReads[i] == 0 && snapshot.mmioWrites[i] == 0) {
+                continue;
+            }
+            if (i < 8) {
+                snprintf(line, sizeof(line), "$%04X %s: %llu reads, %llu writes\n", 0x2000 + i, PPU_REGISTER_NAMES[i],
+                         (unsigned long long) snapshot.mmioReads[i], (unsigned long long) snapshot.mmioWrites[i]);
+            } else {
+                snprintf(line, sizeof(line), "$%04X: %llu reads, %llu writes\n", 0x4000 + i - 8,
+                         (unsigned long long) snapshot.mmioReads[i], (unsigned long long) snapshot.mmioWrites[i]);
+            }
+            out += line;
+        }
+        return out;
+    }
+}
@@ -0,0 +1,115 @@
+#ifndef NESDROID_METRICS_H
+#define NESDROID_METRICS_H
+
+#include <atomic>
+#include <string>
+
+#include "commons.h"
+
+namespace nesdroid {
+
+    enum Counter {
+        COUNTER_CYCLES = 0,
+        COUNTER_INSTRUCTIONS,
+        COUNTER_FRAMES,
+        // wall time by stage, cpu/ppu/apu are sampled one step in TIME_SAMPLE_INTERVAL
+        COUNTER_CPU_NANOS,
+        COUNTER_PPU_NANOS,
+        COUNTER_APU_NANOS,
+        COUNTER_PRESENT_NANOS,
+        // OAM and DMC DMA
+        COUNTER_DMA_STALLS,
+        COUNTER_DMA_STALL_CYCLES,
+        // real-time frames that started after their deadline, the audio sink ran dry
+        COUNTER_AUDIO_UNDERRUNS,
+        // FrameScheduler: frames finished after their deadline, emulated without rendering
+        COUNTER_DEADLINE_MISSES,
+        COUNTER_SKIPPED_FRAMES,
+        COUNTER_COUNT
+    };
+
+    // $2000-$2007 then $4000-$401F
+    static const int MMIO_REGISTERS = 8 + 0x20;
+
+    static inline int mmioIndex(addr_t address) {
+        return address < 0x4000 ? (address & 7) : 8 + (address & 0x1F);
+    }
+
+    // frame times in buckets of 1/4 ms, the last one takes everything slower
+    static const int FRAME_BUCKETS = 256;
+    static const uint64_t FRAME_BUCKET_NANOS = 250000;
+
+    // input to present latency in buckets of 1 ms, the last one takes everything slower
+    static const int LATENCY_BUCKETS = 128;
+    static const uint64_t LATENCY_BUCKET_NANOS = 1000000;
+
+    struct MetricsSnapshot {
+        uint64_t counters[COUNTER_COUNT];
+        uint64_t mmioReads[MMIO_REGISTERS];
+        uint64_t mmioWrites[MMIO_REGISTERS];
+        uint64_t frameTimes[FRAME_BUCKETS];
+        uint64_t inputLatencies[LATENCY_BUCKETS];
+        // since the last reset()
+        uint64_t wallNanos;
+
+        // upper bound of the bucket holding the p-th frame time, p in [0, 1]
+        uint64_t percentile(double p) const;
+
+        // the same for the input latency
+        uint64_t latencyPercentile(double p) const;
+
+        // count per wall second
+        double rate(Counter counter) const;
+    };
+
+    // Counters for the whole process. Every thread owns a block it alone writes
+    // without locks or atomic read-modify-writes, and hands it back when it exits;
+    // snapshot() adds the blocks up.
+    // Hot paths (cpu, bus) count in plain fields and hand them over once a frame.
+    class Metrics {
+
+    public:
+
+        static const int TIME_SAMPLE_INTERVAL = 1024;
+
+        // one thread's counters
+        struct Block {
+            std::atomic<uint64_t> counters[COUNTER_COUNT];
+            std::atomic<uint64_t> mmioReads[MMIO_REGISTERS];
+            std::atomic<uint64_t> mmioWrites[MMIO_REGISTERS];
+            std::atomic<uint64_t> frameTimes[FRAME_BUCKETS];
+            std::atomic<uint64_t> inputLatencies[LATENCY_BUCKETS];
+        };
+
+        static uint64_t now();
+
+        static void add(Counter counter, uint64_t value);
+
+        static void addMmio(const uint32_t *reads, const uint32_t *writes);
+
+        static void addFrameTime(uint64_t nanos);
+
+        // from an input event to the present of the first frame that saw it
+        static void addInputLatency(uint64_t nanos);
+
+        static void snapshot(MetricsSnapshot &snapshot);
+
+        // start counting from zero, for every thread
+        static void reset();
+
+        // human readable report, also what the headless build prints
+        static std::string format();
+
+    private:
+
+        // the calling thread's block until it exits, nullptr while all are taken
+        static Block *local();
+
+        // single writer: a relaxed load and store instead of fetch_add
+        static inline void bump(std::atomic<uint64_t> &counter, uint64_t value) {
+            counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+        }
+    };
+}
+
+#endif //NESDROID_METRICS_H
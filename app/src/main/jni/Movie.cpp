@@ -0,0 +1,327 @@
+#include <algorithm>
+#include <cstring>
+
+#include "Movie.h"
+#include "Console.h"
+
+namespace nesdroid {
+
+    static const char MAGIC[4] = {'N', 'E', 'S', 'M'};
+    // 2: cartridge state holds PRG-RAM
+    // 3: PPU state holds the pending NMI edge instead of a delay
+    // 4: MMC3 state holds the counter's clock dot
+    // 5: CPU state holds the IRQ line
+    static const uint16_t VERSION = 5;
+
+    static const byte FLAG_PAD0 = 0x01;
+    static const byte FLAG_PAD1 = 0x02;
+    static const byte FLAG_RESET = 0x04;
+    // the game did not read the pads during this frame
+    static const byte FLAG_LAG = 0x08;
+    static const byte FLAG_KEYFRAME = 0x80;
+
+    template<typename T>
+    static inline bool writeValue(FILE *file, const T &value) {
+        return fwrite(&value, sizeof(T), 1, file) == 1;
+    }
+
+    template<typename T>
+    static inline bool readValue(FILE *file, T &value) {
+        return fread(&value, sizeof(T), 1, file) == 1;
+    }
+
+    Movie::Movie(Console &console) : console(console) {
+        lastPads[0] = lastPads[1] = 0;
+        memset(&current, 0, sizeof(current));
+    }
+
+    Movie::~Movie() {
+        stop();
+    }
+
+    bool Movie::record(const char *path, uint32_t keyframeInterval) {
+        stop();
+
+        ROM *rom = console.getRom();
+        if (rom == nullptr || keyframeInterval == 0) {
+            return false;
+        }
+
+        file = fopen(path, "wb");
+        if (!file) {
+            return false;
+        }
+
+        uint16_t reserved = 0;
+        fwrite(MAGIC, 1, sizeof(MAGIC), file);
+        writeValue(file, VERSION);
+        writeValue(file, reserved);
+        writeValue(file, keyframeInterval);
+        writeValue(file, rom->getHash());
+
+        this->keyframeInterval = keyframeInterval;
+        frames.clear();
+        keyframes.clear();
+        lastPads[0] = lastPads[1] = 0;
+        desyncFrame = -1;
+        restoredFrame = -1;
+
+        console.powerOn();
+        console.setMovie(this);
+        mode = RECORDING;
+        return true;
+    }
+
+    bool Movie::play(const char *path) {
+        stop();
+
+        if (console.getRom() == nullptr) {
+            return false;
+        }
+
+        file = fopen(path, "rb");
+        if (!file) {
+            return false;
+        }
+
+        if (!readHeader() || !readRecords() || keyframes.empty() || keyframes[0].frame != 0) {
+            LOG("Invalid movie %s\n", path);
+            stop();
+            return false;
+        }
+
+        desyncFrame = -1;
+        console.setMovie(this);
+        mode = PLAYING;
+        return seek(0);
+    }
+
+    bool Movie::readHeader() {
+        char magic[4];
+        uint16_t version;
+        uint16_t reserved;
+        uint64_t hash;
+
+        if (fread(magic, 1, sizeof(magic), file) != sizeof(magic) || memcmp(magic, MAGIC, sizeof(MAGIC)) != 0) {
+            return false;
+        }
+        if (!readValue(file, version) || !readValue(file, reserved) || version != VERSION) {
+            return false;
+        }
+        if (!readValue(file, keyframeInterval) || !readValue(file, hash) || keyframeInterval == 0) {
+            return false;
+        }
+        if (hash != console.getRom()->getHash()) {
+            LOG("Movie was recorded with another rom\n");
+            return false;
+        }
+        return true;
+    }
+
+    bool Movie::readRecords() {
+        long start = ftell(file);
+        fseek(file, 0, SEEK_END);
+        long end = ftell(file);
+        fseek(file, start, SEEK_SET);
+
+        frames.clear();
+        keyframes.clear();
+
+        byte pads[2] = {0, 0};
+        int flags;
+        // a record cut short by a killed process ends the movie instead of failing it
+        while ((flags = fgetc(file)) != EOF) {
+            if (flags == FLAG_KEYFRAME) {
+                Keyframe keyframe;
+                if (!readValue(file, keyframe.frame) || !readValue(file, keyframe.size)) {
+                    break;
+                }
+                keyframe.offset = ftell(file);
+                if (keyframe.frame != frames.size() || keyframe.offset + (long) keyframe.size > end) {
+                    break;
+                }
+                keyframes.push_back(keyframe);
+                fseek(file, keyframe.size, SEEK_CUR);
+                continue;
+            }
+
+            FrameInput input;
+            input.flags = (byte) flags;
+            if (flags & FLAG_PAD0) {
+                int value = fgetc(file);
+                if (value == EOF) {
+                    break;
+                }
+                pads[0] = (byte) value;
+            }
+            if (flags & FLAG_PAD1) {
+                int value = fgetc(file);
+                if (value == EOF) {
+                    break;
+                }
+                pads[1] = (byte) value;
+            }
+            input.pads[0] = pads[0];
+            input.pads[1] = pads[1];
+            frames.push_back(input);
+        }
+
+        return true;
+    }
+
+    bool Movie::seek(uint64_t frame) {
+        if (mode != PLAYING) {
+            return false;
+        }
+
+        frame = std::min<uint64_t>(frame, frames.size());
+
+        const Keyframe *keyframe = findKeyframe(frame);
+        if (keyframe == nullptr || !loadKeyframe(*keyframe)) {
+            return false;
+        }
+
+        // at most keyframeInterval frames between the snapshot and the target
+        while (mode == PLAYING && console.getFrame() < frame) {
+            console.stepFrame();
+        }
+        return true;
+    }
+
+    void Movie::stop() {
+        if (file) {
+            fclose(file);
+            file = nullptr;
+        }
+        if (mode != IDLE && console.movie == this) {
+            console.setMovie(nullptr);
+        }
+        mode = IDLE;
+    }
+
+    void Movie::onFrameBegin() {
+        uint64_t frame = console.getFrame();
+
+        if (mode == RECORDING) {
+            if (frame % keyframeInterval == 0) {
+                writeKeyframe(frame);
+            }
+            current.pads[0] = console.controllers[0].getButtons();
+            current.pads[1] = console.controllers[1].getButtons();
+            current.flags = console.resetRequested ? FLAG_RESET : (byte) 0;
+        } else if (mode == PLAYING) {
+            if (frame >= frames.size()) {
+                stop();
+                return;
+            }
+
+            if (frame % keyframeInterval == 0 && (int64_t) frame != restoredFrame) {
+                const Keyframe *keyframe = findKeyframe(frame);
+                if (keyframe != nullptr && keyframe->frame == frame) {
+                    checkKeyframe(*keyframe);
+                }
+            }
+            restoredFrame = -1;
+
+            const FrameInput &input = frames[frame];
+            console.controllers[0].setButtons(input.pads[0]);
+            console.controllers[1].setButtons(input.pads[1]);
+            console.resetRequested = (input.flags & FLAG_RESET) != 0;
+        }
+    }
+
+    void Movie::onFrameEnd() {
+        if (mode == PLAYING && console.getFrame() >= frames.size()) {
+            stop();
+            return;
+        }
+        if (mode != RECORDING) {
+            return;
+        }
+
+        byte flags = current.flags;
+        if (!console.controllers[0].isPolled() && !console.controllers[1].isPolled()) {
+            flags |= FLAG_LAG;
+        }
+        if (current.pads[0] != lastPads[0]) {
+            flags |= FLAG_PAD0;
+        }
+        if (current.pads[1] != lastPads[1]) {
+            flags |= FLAG_PAD1;
+        }
+
+        fputc(flags, file);
+        if (flags & FLAG_PAD0) {
+            fputc(current.pads[0], file);
+        }
+        if (flags & FLAG_PAD1) {
+            fputc(current.pads[1], file);
+        }
+
+        lastPads[0] = current.pads[0];
+        lastPads[1] = current.pads[1];
+        current.flags = flags;
+        frames.push_back(current);
+    }
+
+    void Movie::writeKeyframe(uint64_t frame) {
+        state.clear();
+        console.save(state);
+
+        Keyframe keyframe;
+        keyframe.frame = frame;
+        keyframe.size = (uint32_t) state.getSize();
+
+        fputc(FLAG_KEYFRAME, file);
+        writeValue(file, keyframe.frame);
+        writeValue(file, keyframe.size);
+        keyframe.offset = ftell(file);
+        fwrite(state.getData(), 1, state.getSize(), file);
+        // everything up to a keyframe survives a killed process
+        fflush(file);
+
+        keyframes.push_back(keyframe);
+    }
+
+    bool Movie::loadKeyframe(const Keyframe &keyframe) {
+        std::vector<byte> buffer(keyframe.size);
+        if (fseek(file, keyframe.offset, SEEK_SET) != 0
+            || fread(buffer.data(), 1, buffer.size(), file) != buffer.size()) {
+            return false;
+        }
+
+        recorded.assign(buffer.data(), buffer.size());
+        if (!console.load(recorded)) {
+            return false;
+        }
+        restoredFrame = keyframe.frame;
+        return true;
+    }
+
+    const Movie::Keyframe *Movie::findKeyframe(uint64_t frame) const {
+        // last keyframe at or before frame
+        auto it = std::upper_bound(keyframes.begin(), keyframes.end(), frame,
+                                   [](uint64_t f, const Keyframe &k) { return f < k.frame; });
+        if (it == keyframes.begin()) {
+            return nullptr;
+        }
+        return &*(it - 1);
+    }
+
+    void Movie::checkKeyframe(const Keyframe &keyframe) {
+        std::vector<byte> buffer(keyframe.size);
+        if (fseek(file, keyframe.offset, SEEK_SET) != 0
+            || fread(buffer.data(), 1, buffer.size(), file) != buffer.size()) {
+            return;
+        }
+
+        state.clear();
+        console.save(state);
+        if (state.getSize() != buffer.size() || memcmp(state.getData(), buffer.data(), buffer.size()) != 0) {
+            if (desyncFrame < 0) {
+                desyncFrame = keyframe.frame;
+                LOG("Movie desync at frame %llu\n", (unsigned long long) keyframe.frame);
+            }
+        }
+    }
+}
@@ -0,0 +1,115 @@
+#ifndef NESDROID_MOVIE_H
+#define NESDROID_MOVIE_H
+
+#include <cstdio>
+#include <vector>
+
+#include "commons.h"
+#include "State.h"
+
+namespace nesdroid {
+
+    class Console;
+
+    // Input movie: per-frame pad bitmasks and reset events in an append-only file,
+    // with a machine snapshot (keyframe) every keyframeInterval frames.
+    //
+    // File layout, little endian:
+    //   header   "NESM" | u16 version | u16 reserved | u32 keyframe interval | u64 rom hash
+    //   records  one per frame: flags byte, then pad 1 if FLAG_PAD0, pad 2 if FLAG_PAD1
+    //            (a pad byte is only stored when it changed since the previous frame)
+    //   keyframe FLAG_KEYFRAME | u64 frame | u32 size | snapshot, written before the frame's record
+    class Movie {
+
+    public:
+
+        static const uint32_t DEFAULT_KEYFRAME_INTERVAL = 600;
+
+        Movie(Console &console);
+
+        virtual ~Movie();
+
+        // power on the inserted rom and record from frame 0
+        bool record(const char *path, uint32_t keyframeInterval = DEFAULT_KEYFRAME_INTERVAL);
+
+        // load a movie made for the inserted rom and rewind to frame 0
+        bool play(const char *path);
+
+        // playback only, restore the nearest keyframe and emulate up to frame
+        bool seek(uint64_t frame);
+
+        void stop();
+
+        bool isRecording() const {
+            return mode == RECORDING;
+        }
+
+        bool isPlaying() const {
+            return mode == PLAYING;
+        }
+
+        uint64_t getFrameCount() const {
+            return frames.size();
+        }
+
+        // first frame whose state did not match the recorded keyframe, -1 if in sync
+        int64_t getDesyncFrame() const {
+            return desyncFrame;
+        }
+
+        ///////////Console hooks///////////
+        void onFrameBegin();
+
+        void onFrameEnd();
+
+    private:
+
+        enum Mode {
+            IDLE,
+            RECORDING,
+            PLAYING
+        };
+
+        struct FrameInput {
+            byte pads[2];
+            byte flags;
+        };
+
+        struct Keyframe {
+            uint64_t frame;
+            long offset;
+            uint32_t size;
+        };
+
+        bool readHeader();
+
+        bool readRecords();
+
+        void writeKeyframe(uint64_t frame);
+
+        bool loadKeyframe(const Keyframe &keyframe);
+
+        const Keyframe *findKeyframe(uint64_t frame) const;
+
+        void checkKeyframe(const Keyframe &keyframe);
+
+        Console &console;
+        FILE *file = nullptr;
+        Mode mode = IDLE;
+        uint32_t keyframeInterval = DEFAULT_KEYFRAME_INTERVAL;
+
+        std::vector<FrameInput> frames;
+        std::vector<Keyframe> keyframes;
+
+        FrameInput current;
+        byte lastPads[2];
+        // frame restored from a keyframe, its snapshot is not checked again
+        int64_t restoredFrame = -1;
+        int64_t desyncFrame = -1;
+
+        State state;
+        State recorded;
+    };
+}
+
+#endif //NESDROID_MOVIE_H
@@ -0,0 +1,59 @@
+#include <cstdio>
+#include <dlfcn.h>
+
+#include "Native.h"
+#include "cpu.h"
+
+namespace nesdroid {
+
+    void NativeCode::attach(const byte *prg, size_t size, uint64_t romHash) {
+        unload();
+        this->prg = prg;
+        this->size = size;
+        hash = romHash;
+    }
+
+    bool NativeCode::load(const std::string &path) {
+        unload();
+        if (prg == nullptr) {
+            return false;
+        }
+        void *library = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+        if (library == nullptr) {
+            LOG("Failed to load native code %s: %s\n", path.c_str(), dlerror());
+            return false;
+        }
+        NativeEntry entry = (NativeEntry) dlsym(library, NATIVE_ENTRY);
+        const NativeModule *module = entry != nullptr ? entry() : nullptr;
+        if (module == nullptr || module->version != NATIVE_VERSION || module->cpuSize != sizeof(Cpu)
+            || module->romHash != hash || module->prgSize != size) {
+            LOG("Ignoring native code %s\n", path.c_str());
+            dlclose(library);
+            return false;
+        }
+        ops.assign(size, nullptr);
+        for (uint32_t i = 0; i < module->count; i++) {
+            if (module->offsets[i] < size) {
+                ops[module->offsets[i]] = module->ops[i];
+            }
+        }
+        handle = library;
+        count = module->count;
+        return true;
+    }
+
+    void NativeCode::unload() {
+        ops.clear();
+        count = 0;
+        if (handle != nullptr) {
+            dlclose(handle);
+            handle = nullptr;
+        }
+    }
+
+    std::string NativeCode::pathIn(const std::string &directory) const {
+        char name[32];
+        snprintf(name, sizeof(name), "/lib%016llx.so", (unsigned long long) hash);
+        return directory + name;
+    }
+}
@@ -0,0 +1,90 @@
+#ifndef NESDROID_NATIVE_H
+#define NESDROID_NATIVE_H
+
+#include <string>
+#include <vector>
+
+#include "commons.h"
+#include "Memory.h"
+
+namespace nesdroid {
+
+    class Cpu;
+
+    // one instruction of PRG ROM translated ahead of time, see Cpu::runNative
+    typedef void (*NativeOp)(Cpu &cpu);
+
+    // bumped whenever what a plugin is compiled against changes meaning
+    static const uint32_t NATIVE_VERSION = 1;
+
+    // what a plugin generated by tools/recompile.cpp exports
+    struct NativeModule {
+        uint32_t version;
+        uint32_t cpuSize;           // sizeof(Cpu) the plugin was compiled with
+        uint64_t romHash;
+        uint32_t prgSize;
+        uint32_t count;
+        const uint32_t *offsets;    // PRG ROM offsets of the translated instructions
+        const NativeOp *ops;
+    };
+
+    typedef const NativeModule *(*NativeEntry)();
+
+    static const char *const NATIVE_ENTRY = "nesdroidNativeModule";
+
+    // Recompiled instructions of the inserted rom, loaded from a plugin built for
+    // its hash. The cpu runs an instruction through it when its PC maps to a
+    // translated byte of PRG ROM; code in RAM, bytes patched by cheats and
+    // anything the recompiler did not reach are interpreted.
+    class NativeCode {
+
+    public:
+
+        ~NativeCode() {
+            unload();
+        }
+
+        // start over for the size bytes of PRG ROM at prg; unloads the plugin
+        void attach(const byte *prg, size_t size, uint64_t romHash);
+
+        // false if path cannot be loaded or was built for another rom or core
+        bool load(const std::string &path);
+
+        void unload();
+
+        // <directory>/lib<hash>.so, a name the APK installer extracts
+        std::string pathIn(const std::string &directory) const;
+
+        bool isLoaded() const {
+            return handle != nullptr;
+        }
+
+        // instructions the plugin translated
+        size_t getCount() const {
+            return count;
+        }
+
+        inline NativeOp lookup(const IMapper *mapper, addr_t pc) const {
+            if (pc < 0x8000) {
+                return nullptr;
+            }
+            const byte *p = mapper->prgAddress(pc);
+            if (p < prg || p >= prg + ops.size()) {
+                return nullptr;
+            }
+            return ops[p - prg];
+        }
+
+    private:
+
+        const byte *prg = nullptr;
+        size_t size = 0;
+        uint64_t hash = 0;
+        void *handle = nullptr;
+        size_t count = 0;
+        // by PRG ROM offset, nullptr where the interpreter runs
+        std::vector<NativeOp> ops;
+    };
+}
+
+#endif //NESDROID_NATIVE_H
@@ -0,0 +1,320 @@
+#include <arpa/inet.h>
+#include <cerrno>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "Netplay.h"
+#include "Console.h"
+#include "Metrics.h"
+
+namespace nesdroid {
+
+    // magic, frame, ack and count ahead of the inputs
+    static const int HEADER_SIZE = 2 + 4 + 4 + 1;
+
+    static void putLe(byte *out, uint32_t value) {
+        for (int i = 0; i < 4; i++) {
+            out[i] = (byte) (value >> (8 * i));
+        }
+    }
+
+    static uint32_t getLe(const byte *in) {
+        return in[0] | in[1] << 8 | in[2] << 16 | (uint32_t) in[3] << 24;
+    }
+
+    void Transport::setImpairment(uint64_t delayNanos, float lossRate, uint32_t seed) {
+        this->delayNanos = delayNanos;
+        this->lossRate = lossRate;
+        random = seed != 0 ? seed : 1;
+    }
+
+    void Transport::send(const NetPacket &packet) {
+        sent++;
+        flushDelayed();
+        // xorshift32
+        random ^= random << 13;
+        random ^= random >> 17;
+        random ^= random << 5;
+        if (lossRate > 0 && random / 4294967296.0 < lossRate) {
+            lost++;
+            return;
+        }
+        if (delayNanos == 0) {
+            transmit(packet);
+            return;
+        }
+        delayed.push_back({Metrics::now() + delayNanos, packet});
+    }
+
+    bool Transport::receive(NetPacket &packet) {
+        flushDelayed();
+        return poll(packet);
+    }
+
+    void Transport::flushDelayed() {
+        if (delayed.empty()) {
+            return;
+        }
+        uint64_t current = Metrics::now();
+        while (!delayed.empty() && delayed.front().due <= current) {
+            transmit(delayed.front().packet);
+            delayed.pop_front();
+        }
+    }
+
+    void LoopbackTransport::connect(LoopbackTransport &a, LoopbackTransport &b) {
+        a.peer = &b;
+        b.peer = &a;
+    }
+
+    void LoopbackTransport::transmit(const NetPacket &packet) {
+        if (peer == nullptr) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(peer->mutex);
+        peer->inbox.push_back(packet);
+    }
+
+    bool LoopbackTransport::poll(NetPacket &packet) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (inbox.empty()) {
+            return false;
+        }
+        packet = inbox.front();
+        inbox.pop_front();
+        return true;
+    }
+
+    UdpTransport::~UdpTransport() {
+        close();
+    }
+
+    bool UdpTransport::open(int localPort, const char *remoteHost, int remotePort) {
+        close();
+
+        sockaddr_in local = {};
+        local.sin_family = AF_INET;
+        local.sin_addr.s_addr = htonl(INADDR_ANY);
+        local.sin_port = htons((uint16_t) localPort);
+        sockaddr_in remote = {};
+        remote.sin_family = AF_INET;
+        remote.sin_port = htons((uint16_t) remotePort);
+        if (inet_pton(AF_INET, remoteHost, &remote.sin_addr) != 1) {
+            LOG("Netplay: bad address %s\n", remoteHost);
+            return false;
+        }
+
+        fd = ::socket(AF_INET, SOCK_DGRAM, 0);
+        if (fd < 0) {
+            LOG("Netplay: socket failed, errno %d\n", errno);
+            return false;
+        }
+        // connected, so only the peer's datagrams come in
+        if (bind(fd, (sockaddr *) &local, sizeof(local)) != 0 ||
+            ::connect(fd, (sockaddr *) &remote, sizeof(remote)) != 0) {
+            LOG("Netplay: cannot bind %d to %s:%d, errno %d\n", localPort, remoteHost, remotePort, errno);
+            close();
+            return false;
+        }
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        return true;
+    }
+
+    void UdpTransport::close() {
+        if (fd >= 0) {
+            ::close(fd);
+            fd = -1;
+        }
+    }
+
+    void UdpTransport::transmit(const NetPacket &packet) {
+        if (fd < 0) {
+            return;
+        }
+        byte buffer[HEADER_SIZE + NetPacket::MAX_INPUTS];
+        buffer[0] = 'N';
+        buffer[1] = 'P';
+        putLe(buffer + 2, packet.frame);
+        putLe(buffer + 6, (uint32_t) packet.ack);
+        buffer[10] = packet.count;
+        memcpy(buffer + HEADER_SIZE, packet.inputs, packet.count);
+        // a full socket buffer is one more lost packet
+        ::send(fd, buffer, (size_t) (HEADER_SIZE + packet.count), 0);
+    }
+
+    bool UdpTransport::poll(NetPacket &packet) {
+        if (fd < 0) {
+            return false;
+        }
+        byte buffer[HEADER_SIZE + NetPacket::MAX_INPUTS];
+        while (true) {
+            // also fails with ECONNREFUSED until the peer's socket is up
+            ssize_t size = recv(fd, buffer, sizeof(buffer), 0);
+            if (size < 0) {
+                return false;
+            }
+            if (size < HEADER_SIZE || buffer[0] != 'N' || buffer[1] != 'P' ||
+                buffer[10] > NetPacket::MAX_INPUTS || size < HEADER_SIZE + buffer[10]) {
+                continue;
+            }
+            packet.frame = getLe(buffer + 2);
+            packet.ack = (int32_t) getLe(buffer + 6);
+            packet.count = buffer[10];
+            memcpy(packet.inputs, buffer + HEADER_SIZE, packet.count);
+            return true;
+        }
+    }
+
+    uint64_t RollbackSession::hashState(const State &state) {
+        uint64_t hash = 14695981039346656037ULL;
+        const byte *data = state.getData();
+        for (size_t i = 0; i < state.getSize(); i++) {
+            hash = (hash ^ data[i]) * 1099511628211ULL;
+        }
+        return hash;
+    }
+
+    RollbackSession::RollbackSession(Console &console, Transport &transport, int localPort, int maxRollback)
+            : console(console), transport(transport), localPort(localPort & 1),
+              maxRollback(maxRollback < 1 ? 1 : maxRollback > MAX_ROLLBACK ? MAX_ROLLBACK : maxRollback),
+              snapshots((size_t) this->maxRollback + 1) {
+        memset(localInputs, 0, sizeof(localInputs));
+        memset(remoteInputs, 0, sizeof(remoteInputs));
+        memset(usedInputs, 0, sizeof(usedInputs));
+        // pads come from the session only, live ones would differ between the peers
+        console.setInput(nullptr);
+    }
+
+    int64_t RollbackSession::getConfirmedFrame() const {
+        int64_t emulated = (int64_t) frame - 1;
+        return remoteFrame < emulated ? remoteFrame : emulated;
+    }
+
+    bool RollbackSession::advance(byte localButtons) {
+        receiveInputs();
+        if (rollbackFrom >= 0) {
+            rollback((uint64_t) rollbackFrom);
+        }
+
+        if ((int64_t) frame - remoteFrame - 1 >= maxRollback) {
+            // as far ahead of the peer as a rollback reaches
+            stalls++;
+            sendInputs((int64_t) frame - 1);
+            return false;
+        }
+
+        localInputs[frame % HISTORY] = localButtons;
+        sendInputs((int64_t) frame);
+        usedInputs[frame % HISTORY] = (int64_t) frame <= remoteFrame ? remoteInputs[frame % HISTORY] : predict();
+        runFrame(frame, true);
+        frame++;
+        return true;
+    }
+
+    void RollbackSession::rollback(uint64_t start) {
+        rollbackFrom = -1;
+        if (start >= frame || frame - start > snapshots.size()) {
+            LOG("Netplay: frame %llu is out of the rollback window\n", (unsigned long long) start);
+            return;
+        }
+        uint64_t begin = Metrics::now();
+
+        console.load(snapshots[start % snapshots.size()]);
+        bool output = console.isOutputEnabled();
+        int decimation = console.getApu().getDecimation();
+        console.setOutputEnabled(false);
+        console.setAudioDecimation(0);
+        for (uint64_t f = start; f < frame; f++) {
+            if (f + 1 == frame) {
+                // the present frame is shown and heard
+                console.setOutputEnabled(output);
+                console.setAudioDecimation(decimation);
+            }
+            usedInputs[f % HISTORY] = (int64_t) f <= remoteFrame ? remoteInputs[f % HISTORY] : predict();
+            // the snapshot before start is the one just loaded
+            runFrame(f, f != start);
+        }
+
+        rollbacks++;
+        resimulatedFrames += frame - start;
+        lastRollbackNanos = Metrics::now() - begin;
+        if (lastRollbackNanos > maxRollbackNanos) {
+            maxRollbackNanos = lastRollbackNanos;
+        }
+    }
+
+    void RollbackSession::receiveInputs() {
+        NetPacket packet;
+        while (transport.receive(packet)) {
+            if (packet.ack > ackedFrame) {
+                ackedFrame = packet.ack;
+            }
+            if (packet.count == 0 || packet.count > NetPacket::MAX_INPUTS ||
+                packet.frame >= frame + HISTORY / 2) {
+                continue;
+            }
+            int64_t first = (int64_t) packet.frame - packet.count + 1;
+            // inputs are taken in order only, a packet past a gap waits for the resend
+            if (first > remoteFrame + 1 || (int64_t) packet.frame <= remoteFrame) {
+                continue;
+            }
+            for (int64_t f = remoteFrame + 1; f <= packet.frame; f++) {
+                byte buttons = packet.inputs[f - first];
+                remoteInputs[f % HISTORY] = buttons;
+                if (f < (int64_t) frame && usedInputs[f % HISTORY] != buttons &&
+                    (rollbackFrom < 0 || f < rollbackFrom)) {
+                    rollbackFrom = f;
+                }
+            }
+            remoteFrame = packet.frame;
+        }
+    }
+
+    void RollbackSession::sendInputs(int64_t newest) {
+        NetPacket packet;
+        packet.ack = (int32_t) remoteFrame;
+        if (newest < 0) {
+            packet.frame = 0;
+            packet.count = 0;
+            transport.send(packet);
+            return;
+        }
+        // everything the peer has not acknowledged, as far as it fits
+        int64_t first = ackedFrame + 1;
+        if (first > newest) {
+            first = newest;
+        }
+        if (newest - first + 1 > NetPacket::MAX_INPUTS) {
+            first = newest - NetPacket::MAX_INPUTS + 1;
+        }
+        packet.frame = (uint32_t) newest;
+        packet.count = (byte) (newest - first + 1);
+        for (int64_t f = first; f <= newest; f++) {
+            packet.inputs[f - first] = localInputs[f % HISTORY];
+        }
+        transport.send(packet);
+    }
+
+    byte RollbackSession::predict() const {
+        return remoteFrame >= 0 ? remoteInputs[remoteFrame % HISTORY] : (byte) 0;
+    }
+
+    void RollbackSession::runFrame(uint64_t f, bool snapshot) {
+        if (snapshot) {
+            State &state = snapshots[f % snapshots.size()];
+            state.clear();
+            console.save(state);
+            // every input before f is known: no rollback reaches this state again
+            if ((int64_t) f - 1 <= remoteFrame) {
+                checksum = hashState(state);
+                checksumFrame = f;
+                hasChecksum = true;
+            }
+        }
+        console.getController(localPort).setButtons(localInputs[f % HISTORY]);
+        console.getController(localPort ^ 1).setButtons(usedInputs[f % HISTORY]);
+        console.stepFrame();
+    }
+}
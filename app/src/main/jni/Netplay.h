@@ -0,0 +1,233 @@
+#ifndef NESDROID_NETPLAY_H
+#define NESDROID_NETPLAY_H
+
+#include <deque>
+#include <mutex>
+#include <vector>
+
+#include "commons.h"
+#include "State.h"
+
+namespace nesdroid {
+
+    class Console;
+
+    // Inputs of one peer for the frames frame - count + 1 .. frame, sent every
+    // frame so that a lost packet is covered by the next one, and the newest
+    // frame of the other peer's inputs received so far.
+    struct NetPacket {
+        static const int MAX_INPUTS = 32;
+
+        uint32_t frame;
+        int32_t ack;            // -1 before any input arrived
+        byte count;
+        byte inputs[MAX_INPUTS];
+    };
+
+    // Carries packets between two peers, without any guarantee of delivery or
+    // order. Artificial delay and loss apply on the sending side, for testing
+    // over links that are better than the ones players have.
+    class Transport {
+
+    public:
+
+        virtual ~Transport() { }
+
+        // hold every packet back by delayNanos and drop a share of lossRate,
+        // from a fixed pseudo random sequence
+        void setImpairment(uint64_t delayNanos, float lossRate, uint32_t seed = 1);
+
+        void send(const NetPacket &packet);
+
+        // next packet that arrived, false if none; never blocks
+        bool receive(NetPacket &packet);
+
+        uint64_t getSent() const {
+            return sent;
+        }
+
+        uint64_t getLost() const {
+            return lost;
+        }
+
+    protected:
+
+        virtual void transmit(const NetPacket &packet) = 0;
+
+        virtual bool poll(NetPacket &packet) = 0;
+
+    private:
+
+        struct Delayed {
+            uint64_t due;
+            NetPacket packet;
+        };
+
+        void flushDelayed();
+
+        uint64_t delayNanos = 0;
+        float lossRate = 0;
+        uint32_t random = 1;
+        std::deque<Delayed> delayed;
+        uint64_t sent = 0;
+        uint64_t lost = 0;
+    };
+
+    // Both ends in one process, e.g. two consoles in a test; the ends may run on
+    // different threads.
+    class LoopbackTransport : public Transport {
+
+    public:
+
+        static void connect(LoopbackTransport &a, LoopbackTransport &b);
+
+    protected:
+
+        void transmit(const NetPacket &packet) override;
+
+        bool poll(NetPacket &packet) override;
+
+    private:
+
+        LoopbackTransport *peer = nullptr;
+        std::mutex mutex;
+        std::deque<NetPacket> inbox;
+    };
+
+    // Non-blocking UDP socket to one peer; 127.0.0.1 on both ends for a loopback test.
+    class UdpTransport : public Transport {
+
+    public:
+
+        virtual ~UdpTransport();
+
+        // bind localPort and send to the IPv4 address remoteHost:remotePort
+        bool open(int localPort, const char *remoteHost, int remotePort);
+
+        void close();
+
+    protected:
+
+        void transmit(const NetPacket &packet) override;
+
+        bool poll(NetPacket &packet) override;
+
+    private:
+
+        int fd = -1;
+    };
+
+    // Two player session over a transport with rollback. Every frame runs at once
+    // with the local pad and a prediction of the remote one, the remote pad of the
+    // last frame whose input arrived. When a remote input turns out different
+    // from its prediction, the machine goes back to the snapshot taken before that
+    // frame and emulates up to the present again with output and audio muted, all
+    // within the current frame. The session stalls rather than run more than
+    // maxRollback frames ahead of the remote inputs.
+    //
+    // Both peers start the session on the same rom right after powering on. The
+    // session sets the pads itself and detaches the live input of the console.
+    class RollbackSession {
+
+    public:
+
+        static const int MAX_ROLLBACK = 15;
+
+        RollbackSession(Console &console, Transport &transport, int localPort, int maxRollback = 8);
+
+        // exchange inputs, roll back if a prediction was wrong, then emulate the
+        // next frame with localButtons; false if the frame stalled waiting for the
+        // remote peer, the caller tries again with the next local input
+        bool advance(byte localButtons);
+
+        // frames emulated since the session started
+        uint64_t getFrame() const {
+            return frame;
+        }
+
+        // newest frame whose inputs both peers have, -1 for none; the machine
+        // state up to it will not change anymore
+        int64_t getConfirmedFrame() const;
+
+        uint64_t getRollbacks() const {
+            return rollbacks;
+        }
+
+        uint64_t getResimulatedFrames() const {
+            return resimulatedFrames;
+        }
+
+        uint64_t getStalls() const {
+            return stalls;
+        }
+
+        // time of the latest and the costliest rollback, restore and re-simulation
+        uint64_t getLastRollbackNanos() const {
+            return lastRollbackNanos;
+        }
+
+        uint64_t getMaxRollbackNanos() const {
+            return maxRollbackNanos;
+        }
+
+        // hash of the newest machine state that will not change anymore and the
+        // frame it starts; peers compare them to catch a desync, false before any
+        bool getChecksum(uint64_t &frame, uint64_t &checksum) const {
+            frame = checksumFrame;
+            checksum = this->checksum;
+            return hasChecksum;
+        }
+
+        // the checksum of a state, FNV-1a
+        static uint64_t hashState(const State &state);
+
+        // roll back to start and emulate to the present, as a misprediction would
+        void rollback(uint64_t start);
+
+    private:
+
+        static const int HISTORY = 64;
+
+        void receiveInputs();
+
+        // own inputs up to newest the peer lacks, with the ack of its inputs
+        void sendInputs(int64_t newest);
+
+        byte predict() const;
+
+        // snapshot the machine before frame f if asked, then emulate it
+        void runFrame(uint64_t f, bool snapshot);
+
+        Console &console;
+        Transport &transport;
+        int localPort;
+        int maxRollback;
+
+        uint64_t frame = 0;
+        // frames f % HISTORY: own pads, the remote pads received and the ones used
+        byte localInputs[HISTORY];
+        byte remoteInputs[HISTORY];
+        byte usedInputs[HISTORY];
+        // newest frame with every remote input up to it, -1 for none
+        int64_t remoteFrame = -1;
+        // newest frame of ours the peer acknowledged
+        int64_t ackedFrame = -1;
+        // earliest frame emulated with a wrong prediction, -1 for none
+        int64_t rollbackFrom = -1;
+
+        // snapshots before frames f % snapshots.size()
+        std::vector<State> snapshots;
+
+        bool hasChecksum = false;
+        uint64_t checksumFrame = 0;
+        uint64_t checksum = 0;
+
+        uint64_t rollbacks = 0;
+        uint64_t resimulatedFrames = 0;
+        uint64_t stalls = 0;
+        uint64_t lastRollbackNanos = 0;
+        uint64_t maxRollbackNanos = 0;
+    };
+}
+
+#endif //NESDROID_NETPLAY_H
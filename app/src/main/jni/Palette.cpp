@@ -0,0 +1,260 @@
+#include "Palette.h"
+#include "Ppu.h"
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON) || defined(__aarch64__)
+#include <arm_neon.h>
+#define NESDROID_NEON 1
+#elif defined(__SSSE3__)
+#include <tmmintrin.h>
+#define NESDROID_SSSE3 1
+#endif
+
+namespace nesdroid {
+
+    static const uint32_t BasePalette[64] = {
+            0x666666, 0x002A88, 0x1412A7, 0x3B00A4, 0x5C007E, 0x6E0040, 0x6C0600, 0x561D00,
+            0x333500, 0x0B4800, 0x005200, 0x004F08, 0x00404D, 0x000000, 0x000000, 0x000000,
+            0xADADAD, 0x155FD9, 0x4240FF, 0x7527FE, 0xA01ACC, 0xB71E7B, 0xB53120, 0x994E00,
+            0x6B6D00, 0x388700, 0x0C9300, 0x008F32, 0x007C8D, 0x000000, 0x000000, 0x000000,
+            0xFFFEFF, 0x64B0FF, 0x9290FF, 0xC676FF, 0xF36AFF, 0xFE6ECC, 0xFE8170, 0xEA9E22,
+            0xBCBE00, 0x88D800, 0x5CE430, 0x45E082, 0x48CDDE, 0x4F4F4F, 0x000000, 0x000000,
+            0xFFFEFF, 0xC0DFFF, 0xD3D2FF, 0xE8C8FF, 0xFBC2FF, 0xFEC4EA, 0xFECCC5, 0xF7D8A5,
+            0xE4E594, 0xCFEF96, 0xBDF4AB, 0xB3F3CC, 0xB5EBF2, 0xB8B8B8, 0x000000, 0x000000,
+    };
+
+    // each emphasis bit darkens the two other channels
+    static const float EMPHASIS_ATTENUATION = 0.816f;
+
+    Palette::Palette() {
+        for (int emphasis = 0; emphasis < 8; emphasis++) {
+            float scale[3] = {1, 1, 1};
+            for (int channel = 0; channel < 3; channel++) {
+                if (emphasis & (1 << channel)) {
+                    for (int other = 0; other < 3; other++) {
+                        if (other != channel) {
+                            scale[other] *= EMPHASIS_ATTENUATION;
+                        }
+                    }
+                }
+            }
+
+            for (int index = 0; index < 64; index++) {
+                uint32_t c = BasePalette[index];
+                byte r = (byte) (((c >> 16) & 0xFF) * scale[0]);
+                byte g = (byte) (((c >> 8) & 0xFF) * scale[1]);
+                byte b = (byte) ((c & 0xFF) * scale[2]);
+
+                int entry = emphasis << 6 | index;
+                // RGBA_8888 is r, g, b, a in memory
+                rgbaTable[entry] = 0xFF000000u | b << 16 | g << 8 | r;
+                rgb565Table[entry] = (uint16_t) ((r >> 3) << 11 | (g >> 2) << 5 | (b >> 3));
+
+                rgbaPlanes[emphasis][0][index] = r;
+                rgbaPlanes[emphasis][1][index] = g;
+                rgbaPlanes[emphasis][2][index] = b;
+                rgbaPlanes[emphasis][3][index] = 0xFF;
+                rgb565Planes[emphasis][0][index] = (byte) rgb565Table[entry];
+                rgb565Planes[emphasis][1][index] = (byte) (rgb565Table[entry] >> 8);
+            }
+        }
+    }
+
+#if defined(NESDROID_NEON) && defined(__aarch64__)
+
+    static inline uint8x16x4_t loadPlane(const byte *plane) {
+        uint8x16x4_t table;
+        table.val[0] = vld1q_u8(plane);
+        table.val[1] = vld1q_u8(plane + 16);
+        table.val[2] = vld1q_u8(plane + 32);
+        table.val[3] = vld1q_u8(plane + 48);
+        return table;
+    }
+
+    static void convertRgba(const byte *src, const byte (*planes)[64], uint32_t *dst) {
+        uint8x16x4_t r = loadPlane(planes[0]);
+        uint8x16x4_t g = loadPlane(planes[1]);
+        uint8x16x4_t b = loadPlane(planes[2]);
+        uint8x16_t a = vdupq_n_u8(0xFF);
+        for (int i = 0; i < SCREEN_WIDTH; i += 16) {
+            uint8x16_t index = vld1q_u8(src + i);
+            uint8x16x4_t pixels;
+            pixels.val[0] = vqtbl4q_u8(r, index);
+            pixels.val[1] = vqtbl4q_u8(g, index);
+            pixels.val[2] = vqtbl4q_u8(b, index);
+            pixels.val[3] = a;
+            vst4q_u8((uint8_t *) (dst + i), pixels);
+        }
+    }
+
+    static void convertRgb565(const byte *src, const byte (*planes)[64], uint16_t *dst) {
+        uint8x16x4_t low = loadPlane(planes[0]);
+        uint8x16x4_t high = loadPlane(planes[1]);
+        for (int i = 0; i < SCREEN_WIDTH; i += 16) {
+            uint8x16_t index = vld1q_u8(src + i);
+            uint8x16x2_t pixels;
+            pixels.val[0] = vqtbl4q_u8(low, index);
+            pixels.val[1] = vqtbl4q_u8(high, index);
+            vst2q_u8((uint8_t *) (dst + i), pixels);
+        }
+    }
+
+#elif defined(NESDROID_NEON)
+
+    // ARMv7 vtbl reaches 32 entries: look up the low half, then let vtbx fill in
+    // the lanes whose index falls into the high half
+    struct Plane {
+        uint8x8x4_t low;
+        uint8x8x4_t high;
+    };
+
+    static inline Plane loadPlane(const byte *plane) {
+        Plane table;
+        for (int i = 0; i < 4; i++) {
+            table.low.val[i] = vld1_u8(plane + i * 8);
+            table.high.val[i] = vld1_u8(plane + 32 + i * 8);
+        }
+        return table;
+    }
+
+    static inline uint8x8_t lookup(const Plane &plane, uint8x8_t index, uint8x8_t highIndex) {
+        return vtbx4_u8(vtbl4_u8(plane.low, index), plane.high, highIndex);
+    }
+
+    static void convertRgba(const byte *src, const byte (*planes)[64], uint32_t *dst) {
+        Plane r = loadPlane(planes[0]);
+        Plane g = loadPlane(planes[1]);
+        Plane b = loadPlane(planes[2]);
+        uint8x8_t a = vdup_n_u8(0xFF);
+        uint8x8_t half = vdup_n_u8(32);
+        for (int i = 0; i < SCREEN_WIDTH; i += 8) {
+            uint8x8_t index = vld1_u8(src + i);
+            uint8x8_t highIndex = vsub_u8(index, half);
+            uint8x8x4_t pixels;
+            pixels.val[0] = lookup(r, index, highIndex);
+            pixels.val[1] = lookup(g, index, highIndex);
+            pixels.val[2] = lookup(b, index, highIndex);
+            pixels.val[3] = a;
+            vst4_u8((uint8_t *) (dst + i), pixels);
+        }
+    }
+
+    static void convertRgb565(const byte *src, const byte (*planes)[64], uint16_t *dst) {
+        Plane low = loadPlane(planes[0]);
+        Plane high = loadPlane(planes[1]);
+        uint8x8_t half = vdup_n_u8(32);
+        for (int i = 0; i < SCREEN_WIDTH; i += 8) {
+            uint8x8_t index = vld1_u8(src + i);
+            uint8x8_t highIndex = vsub_u8(index, half);
+            uint8x8x2_t pixels;
+            pixels.val[0] = lookup(low, index, highIndex);
+            pixels.val[1] = lookup(high, index, highIndex);
+            vst2_u8((uint8_t *) (dst + i), pixels);
+        }
+    }
+
+#elif defined(NESDROID_SSSE3)
+
+    struct Plane {
+        __m128i quarter[4];
+    };
+
+    static inline Plane loadPlane(const byte *plane) {
+        Plane table;
+        for (int i = 0; i < 4; i++) {
+            table.quarter[i] = _mm_load_si128((const __m128i *) (plane + i * 16));
+        }
+        return table;
+    }
+
+    // pshufb covers 16 entries: the low nibble picks the entry, the high bits pick the quarter
+    static inline __m128i lookup(const Plane &plane, __m128i low, const __m128i *select) {
+        __m128i result = _mm_and_si128(_mm_shuffle_epi8(plane.quarter[0], low), select[0]);
+        result = _mm_or_si128(result, _mm_and_si128(_mm_shuffle_epi8(plane.quarter[1], low), select[1]));
+        result = _mm_or_si128(result, _mm_and_si128(_mm_shuffle_epi8(plane.quarter[2], low), select[2]));
+        result = _mm_or_si128(result, _mm_and_si128(_mm_shuffle_epi8(plane.quarter[3], low), select[3]));
+        return result;
+    }
+
+    static inline __m128i split(__m128i index, __m128i *select) {
+        __m128i quarter = _mm_and_si128(_mm_srli_epi16(index, 4), _mm_set1_epi8(0x03));
+        for (int i = 0; i < 4; i++) {
+            select[i] = _mm_cmpeq_epi8(quarter, _mm_set1_epi8((char) i));
+        }
+        return _mm_and_si128(index, _mm_set1_epi8(0x0F));
+    }
+
+    static void convertRgba(const byte *src, const byte (*planes)[64], uint32_t *dst) {
+        Plane r = loadPlane(planes[0]);
+        Plane g = loadPlane(planes[1]);
+        Plane b = loadPlane(planes[2]);
+        __m128i a = _mm_set1_epi8((char) 0xFF);
+        for (int i = 0; i < SCREEN_WIDTH; i += 16) {
+            __m128i select[4];
+            __m128i low = split(_mm_loadu_si128((const __m128i *) (src + i)), select);
+            __m128i red = lookup(r, low, select);
+            __m128i green = lookup(g, low, select);
+            __m128i blue = lookup(b, low, select);
+
+            __m128i rgLow = _mm_unpacklo_epi8(red, green);
+            __m128i rgHigh = _mm_unpackhi_epi8(red, green);
+            __m128i baLow = _mm_unpacklo_epi8(blue, a);
+            __m128i baHigh = _mm_unpackhi_epi8(blue, a);
+
+            __m128i *out = (__m128i *) (dst + i);
+            _mm_storeu_si128(out + 0, _mm_unpacklo_epi16(rgLow, baLow));
+            _mm_storeu_si128(out + 1, _mm_unpackhi_epi16(rgLow, baLow));
+            _mm_storeu_si128(out + 2, _mm_unpacklo_epi16(rgHigh, baHigh));
+            _mm_storeu_si128(out + 3, _mm_unpackhi_epi16(rgHigh, baHigh));
+        }
+    }
+
+    static void convertRgb565(const byte *src, const byte (*planes)[64], uint16_t *dst) {
+        Plane lowPlane = loadPlane(planes[0]);
+        Plane highPlane = loadPlane(planes[1]);
+        for (int i = 0; i < SCREEN_WIDTH; i += 16) {
+            __m128i select[4];
+            __m128i low = split(_mm_loadu_si128((const __m128i *) (src + i)), select);
+            __m128i l = lookup(lowPlane, low, select);
+            __m128i h = lookup(highPlane, low, select);
+
+            __m128i *out = (__m128i *) (dst + i);
+            _mm_storeu_si128(out + 0, _mm_unpacklo_epi8(l, h));
+            _mm_storeu_si128(out + 1, _mm_unpackhi_epi8(l, h));
+        }
+    }
+
+#endif
+
+    void Palette::convertLine(const byte *indices, byte emphasis, void *dst, PixelFormat format) const {
+        emphasis &= 7;
+#if defined(NESDROID_NEON) || defined(NESDROID_SSSE3)
+        if (format == PIXEL_FORMAT_RGB_565) {
+            convertRgb565(indices, rgb565Planes[emphasis], (uint16_t *) dst);
+        } else {
+            convertRgba(indices, rgbaPlanes[emphasis], (uint32_t *) dst);
+        }
+#else
+        int base = emphasis << 6;
+        if (format == PIXEL_FORMAT_RGB_565) {
+            uint16_t *out = (uint16_t *) dst;
+            for (int i = 0; i < SCREEN_WIDTH; i++) {
+                out[i] = rgb565Table[base | (indices[i] & 0x3F)];
+            }
+        } else {
+            uint32_t *out = (uint32_t *) dst;
+            for (int i = 0; i < SCREEN_WIDTH; i++) {
+                out[i] = rgbaTable[base | (indices[i] & 0x3F)];
+            }
+        }
+#endif
+    }
+
+    void Palette::convertFrame(const byte *frame, const byte *emphasis, void *dst, int stride,
+                               PixelFormat format) const {
+        byte *line = (byte *) dst;
+        for (int y = 0; y < SCREEN_HEIGHT; y++) {
+            convertLine(frame + y * SCREEN_WIDTH, emphasis[y], line, format);
+            line += stride;
+        }
+    }
+}
@@ -0,0 +1,54 @@
+#ifndef NESDROID_PALETTE_H
+#define NESDROID_PALETTE_H
+
+#include "commons.h"
+
+namespace nesdroid {
+
+    // Surface formats, same values as ANativeWindow's WINDOW_FORMAT_*
+    enum PixelFormat {
+        PIXEL_FORMAT_RGBA_8888 = 1,
+        PIXEL_FORMAT_RGB_565 = 4
+    };
+
+    static inline int bytesPerPixel(PixelFormat format) {
+        return format == PIXEL_FORMAT_RGB_565 ? 2 : 4;
+    }
+
+    // Converts PPU output (6-bit palette index per pixel, 3 emphasis bits per line)
+    // to a surface format through a 512-entry LUT per format, a whole 256 pixel
+    // line per call with NEON/SSSE3 table lookups where available.
+    class Palette {
+
+    public:
+
+        Palette();
+
+        // entry for palette index | emphasis << 6
+        uint32_t getRgba(int entry) const {
+            return rgbaTable[entry & 0x1FF];
+        }
+
+        uint16_t getRgb565(int entry) const {
+            return rgb565Table[entry & 0x1FF];
+        }
+
+        // convert one 256 pixel line
+        void convertLine(const byte *indices, byte emphasis, void *dst, PixelFormat format) const;
+
+        // convert a 256x240 frame into a surface whose lines are `stride` bytes apart
+        void convertFrame(const byte *frame, const byte *emphasis, void *dst, int stride,
+                          PixelFormat format) const;
+
+    private:
+
+        uint32_t rgbaTable[512];
+        uint16_t rgb565Table[512];
+
+        // byte planes of the tables for vector lookups, [emphasis][channel][index]
+        alignas(16) byte rgbaPlanes[8][4][64];
+        alignas(16) byte rgb565Planes[8][2][64];
+    };
+}
+
+#endif //NESDROID_PALETTE_H
@@ -2,4 +2,1005 @@
 // Created by Cauchywei on 16/5/12.
 //
 
-#include "ppu.h"
+#include <cstring>
+
+#include "Ppu.h"
+#include "Debugger.h"
+#include "PpuPipeline.h"
+#include "cpu.h"
+
+#if defined(__ARM_NEON__) || defined(__ARM_NEON) || defined(__aarch64__)
+#include <arm_neon.h>
+#define NESDROID_NEON 1
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define NESDROID_SSE2 1
+#endif
+
+namespace nesdroid {
+
+    // nametable index for each of the four logical tables, by mirror type
+    static const byte MirrorLookup[5][4] = {
+            {0, 0, 1, 1}, // HORIZONTAL_MIRRORING
+            {0, 1, 0, 1}, // VERTICAL_MIRRORING
+            {0, 1, 2, 3}, // FOUR_SCREEN_MIRRORING
+            {0, 0, 0, 0}, // SINGLE_SCREEN_0_MIRRORING
+            {1, 1, 1, 1}, // SINGLE_SCREEN_1_MIRRORING
+    };
+
+    PPU::PPU() {
+    }
+
+    void PPU::setMemory(byte *oam, byte *palette, byte *nameTables, byte *frames) {
+        oamData = oam;
+        paletteData = palette;
+        nameTableData = nameTables;
+
+        memset(frames, 0, FRAMES_SIZE);
+        front = frames;
+        back = front + SCREEN_WIDTH * SCREEN_HEIGHT;
+        frontEmphasis = back + SCREEN_WIDTH * SCREEN_HEIGHT;
+        backEmphasis = frontEmphasis + SCREEN_HEIGHT;
+    }
+
+    void PPU::reset() {
+        memset(paletteData, 0, PALETTE_SIZE);
+        memset(nameTableData, 0, NAMETABLE_SIZE);
+        memset(oamData, 0, OAM_SIZE);
+
+        cycle = 340;
+        scanLine = 240;
+        frame = 0;
+
+        v = t = 0;
+        x = w = f = 0;
+        registerValue = 0;
+
+        nmiOccurred = nmiOutput = nmiPrevious = false;
+        nmiPending = vblankSuppressed = false;
+        nmiClock = 0;
+
+        nameTableByte = attributeTableByte = lowTileByte = highTileByte = 0;
+        tileData = 0;
+
+        spriteCount = 0;
+        memset(spritePatterns, 0, sizeof(spritePatterns));
+        memset(spritePositions, 0, sizeof(spritePositions));
+        memset(spritePriorities, 0, sizeof(spritePriorities));
+        memset(spriteIndexes, 0, sizeof(spriteIndexes));
+        spriteZeroOnLine = false;
+
+        flagSpriteZeroHit = flagSpriteOverflow = 0;
+        oamAddress = 0;
+        bufferedData = 0;
+
+        writeControl(0);
+        writeMask(0);
+    }
+
+    inline addr_t PPU::mirrorAddress(addr_t address) const {
+        address = (addr_t) ((address - 0x2000) % 0x1000);
+        int table = address / 0x0400;
+        int offset = address % 0x0400;
+        return (addr_t) (MirrorLookup[mapper->getMirrorType()][table] * 0x0400 + offset);
+    }
+
+    byte PPU::read(addr_t address) {
+        address = (addr_t) (address % 0x4000);
+        if (address < 0x2000) {
+            return mapper->readChr(address);
+        } else if (address < 0x3F00) {
+            return nameTableData[mirrorAddress(address)];
+        } else {
+            return readPalette((addr_t) (address % 32));
+        }
+    }
+
+    void PPU::write(addr_t address, byte value) {
+        address = (addr_t) (address % 0x4000);
+        if (address < 0x2000) {
+            mapper->writeChr(address, value);
+        } else if (address < 0x3F00) {
+            nameTableData[mirrorAddress(address)] = value;
+        } else {
+            writePalette((addr_t) (address % 32), value);
+        }
+    }
+
+    void PPU::runTo(uint64_t cycles) {
+        if (cycles > cpuCycles) {
+            step((int) ((cycles - cpuCycles) * 3));
+            cpuCycles = cycles;
+        }
+        // the cpu looks for an NMI edge before the last cycle of an instruction,
+        // one within that last cycle is taken after the next instruction
+        if (nmiPending && clock - nmiClock > 3) {
+            nmiPending = false;
+            cpu->triggerInterrupt(NON_MASKABLE_INTERUPT);
+        }
+    }
+
+    inline void PPU::syncWithCpu() {
+        // the access is on the last cycle of the instruction, the cpu counted them all
+        if (cpu != nullptr) {
+            runTo(cpu->getCycles() - 1);
+        }
+    }
+
+    byte PPU::readRegister(addr_t address) {
+        syncWithCpu();
+        // $2002 and $2007 reads change PPU state
+        if (recorder != nullptr && (address == 0x2002 || address == 0x2007)) {
+            recorder->recordRead(address);
+        }
+        switch (address) {
+            case 0x2002:
+                return readStatus();
+            case 0x2004:
+                return readOAMData();
+            case 0x2007:
+                return readData();
+            default:
+                return 0;
+        }
+    }
+
+    void PPU::writeRegister(addr_t address, byte value) {
+        syncWithCpu();
+        if (recorder != nullptr) {
+            recorder->recordWrite(address, value);
+        }
+        registerValue = value;
+        switch (address) {
+            case 0x2000: {
+                byte patterns = (byte) (flagBackgroundTable | flagSpriteTable << 1 | flagSpriteSize << 2);
+                writeControl(value);
+                // the pattern tables move the A12 rises scanline counters see
+                if (mapper != nullptr &&
+                    patterns != (flagBackgroundTable | flagSpriteTable << 1 | flagSpriteSize << 2)) {
+                    mapper->reschedule();
+                }
+                break;
+            }
+            case 0x2001: {
+                bool rendering = isRenderingEnabled();
+                writeMask(value);
+                // scanline counters only run while rendering
+                if (mapper != nullptr && rendering != isRenderingEnabled()) {
+                    mapper->reschedule();
+                }
+                break;
+            }
+            case 0x2003:
+                oamAddress = value;
+                break;
+            case 0x2004:
+                writeOAMData(value);
+                break;
+            case 0x2005:
+                writeScroll(value);
+                break;
+            case 0x2006:
+                writeAddress(value);
+                break;
+            case 0x2007:
+                writeData(value);
+                break;
+            default:
+                break;
+        }
+    }
+
+    // $2000: PPUCTRL
+    void PPU::writeControl(byte value) {
+        flagNameTable = (byte) (value & 3);
+        flagIncrement = (byte) ((value >> 2) & 1);
+        flagSpriteTable = (byte) ((value >> 3) & 1);
+        flagBackgroundTable = (byte) ((value >> 4) & 1);
+        flagSpriteSize = (byte) ((value >> 5) & 1);
+        flagMasterSlave = (byte) ((value >> 6) & 1);
+        nmiOutput = ((value >> 7) & 1) == 1;
+        nmiChange(clock);
+        // t: ....BA.. ........ = d: ......BA
+        t = (addr_t) ((t & 0xF3FF) | ((value & 0x03) << 10));
+    }
+
+    // $2001: PPUMASK
+    void PPU::writeMask(byte value) {
+        flagGrayscale = (byte) (value & 1);
+        flagShowLeftBackground = (byte) ((value >> 1) & 1);
+        flagShowLeftSprites = (byte) ((value >> 2) & 1);
+        flagShowBackground = (byte) ((value >> 3) & 1);
+        flagShowSprites = (byte) ((value >> 4) & 1);
+        flagEmphasis = (byte) ((value >> 5) & 7);
+    }
+
+    // $2002: PPUSTATUS
+    byte PPU::readStatus() {
+        byte result = (byte) (registerValue & 0x1F);
+        result |= flagSpriteOverflow << 5;
+        result |= flagSpriteZeroHit << 6;
+        if (nmiOccurred) {
+            result |= 1 << 7;
+        }
+        if (scanLine == 241 && cycle == 0) {
+            // a dot before vblank: the flag reads clear and is not set this frame
+            vblankSuppressed = true;
+        } else if (nmiPending && clock - nmiClock < 2) {
+            // on the dot vblank starts or the one after: the flag reads set, no NMI
+            nmiPending = false;
+        }
+        nmiOccurred = false;
+        nmiChange(clock);
+        // w:                   = 0
+        w = 0;
+        return result;
+    }
+
+    // $2004: OAMDATA (read)
+    byte PPU::readOAMData() {
+        byte data = oamData[oamAddress];
+        // unimplemented attribute bits read back as 0
+        if ((oamAddress & 0x03) == 0x02) {
+            data &= 0xE3;
+        }
+        return data;
+    }
+
+    // $2004: OAMDATA (write)
+    void PPU::writeOAMData(byte value) {
+        oamData[oamAddress] = value;
+        oamAddress++;
+    }
+
+    // $4014: OAMDMA
+    void PPU::writeDma(byte page) {
+        // 256 writes to $2004 in one go, starting at OAMADDR and wrapping around
+        byte *source = cpu->getMemory().getPage(page);
+        if (source != nullptr) {
+            int head = OAM_SIZE - oamAddress;
+            memcpy(oamData + oamAddress, source, (size_t) head);
+            memcpy(oamData, source + head, (size_t) oamAddress);
+        } else {
+            addr_t address = (addr_t) (page << 8);
+            for (int i = 0; i < OAM_SIZE; i++) {
+                writeOAMData(cpu->getMemory().read(address++));
+            }
+        }
+
+        if (recorder != nullptr) {
+            for (int i = 0; i < OAM_SIZE; i++) {
+                recorder->recordWrite(0x2004, oamData[(oamAddress + i) & 0xFF]);
+            }
+        }
+
+        // one dummy cycle, one more to align on odd cycles, then 256 read/write pairs
+        cpu->stall(513 + (cpu->getCycles() & 1));
+    }
+
+    // $2005: PPUSCROLL
+    void PPU::writeScroll(byte value) {
+        if (w == 0) {
+            // t: ........ ...HGFED = d: HGFED...
+            // x:               CBA = d: .....CBA
+            // w:                   = 1
+            t = (addr_t) ((t & 0xFFE0) | (value >> 3));
+            x = (byte) (value & 0x07);
+            w = 1;
+        } else {
+            // t: .CBA..HG FED..... = d: HGFEDCBA
+            // w:                   = 0
+            t = (addr_t) ((t & 0x8FFF) | ((value & 0x07) << 12));
+            t = (addr_t) ((t & 0xFC1F) | ((value & 0xF8) << 2));
+            w = 0;
+        }
+    }
+
+    // $2006: PPUADDR
+    void PPU::writeAddress(byte value) {
+        if (w == 0) {
+            // t: ..FEDCBA ........ = d: ..FEDCBA
+            // t: .X...... ........ = 0
+            // w:                   = 1
+            t = (addr_t) ((t & 0x80FF) | ((value & 0x3F) << 8));
+            w = 1;
+        } else {
+            // t: ........ HGFEDCBA = d: HGFEDCBA
+            // v                    = t
+            // w:                   = 0
+            t = (addr_t) ((t & 0xFF00) | value);
+            v = t;
+            w = 0;
+        }
+    }
+
+    // $2007: PPUDATA (read)
+    byte PPU::readData() {
+        byte value = read(v);
+        if (traps[(v >> 8) & 0x3F] & ACCESS_READ) {
+            debugger->onAccess(SPACE_PPU, (addr_t) (v & 0x3FFF), value, ACCESS_READ);
+        }
+        // emulate buffered reads
+        if (v % 0x4000 < 0x3F00) {
+            byte buffered = bufferedData;
+            bufferedData = value;
+            value = buffered;
+        } else {
+            bufferedData = read((addr_t) (v - 0x1000));
+        }
+        // increment address
+        v += flagIncrement == 0 ? 1 : 32;
+        return value;
+    }
+
+    // $2007: PPUDATA (write)
+    void PPU::writeData(byte value) {
+        if (traps[(v >> 8) & 0x3F] & ACCESS_WRITE) {
+            debugger->onAccess(SPACE_PPU, (addr_t) (v & 0x3FFF), value, ACCESS_WRITE);
+        }
+        write(v, value);
+        v += flagIncrement == 0 ? 1 : 32;
+    }
+
+    void PPU::nmiChange(uint64_t at) {
+        bool nmi = nmiOutput && nmiOccurred;
+        if (nmi && !nmiPrevious && cpu != nullptr) {
+            // runTo() passes it on once the cpu can see it
+            nmiPending = true;
+            nmiClock = at;
+        }
+        nmiPrevious = nmi;
+    }
+
+    void PPU::setVerticalBlank(uint64_t at) {
+        if (outputEnabled) {
+            byte *buffer = front;
+            front = back;
+            back = buffer;
+
+            buffer = frontEmphasis;
+            frontEmphasis = backEmphasis;
+            backEmphasis = buffer;
+        }
+        if (vblankSuppressed) {
+            vblankSuppressed = false;
+            return;
+        }
+        nmiOccurred = true;
+        nmiChange(at);
+    }
+
+    void PPU::clearVerticalBlank() {
+        nmiOccurred = false;
+        nmiChange(clock);
+    }
+
+    void PPU::incrementX() {
+        // increment hori(v)
+        // if coarse X == 31
+        if ((v & 0x001F) == 31) {
+            // coarse X = 0
+            v &= 0xFFE0;
+            // switch horizontal nametable
+            v ^= 0x0400;
+        } else {
+            // increment coarse X
+            v++;
+        }
+    }
+
+    void PPU::incrementY() {
+        // increment vert(v)
+        // if fine Y < 7
+        if ((v & 0x7000) != 0x7000) {
+            // increment fine Y
+            v += 0x1000;
+        } else {
+            // fine Y = 0
+            v &= 0x8FFF;
+            // let y = coarse Y
+            int y = (v & 0x03E0) >> 5;
+            if (y == 29) {
+                // coarse Y = 0
+                y = 0;
+                // switch vertical nametable
+                v ^= 0x0800;
+            } else if (y == 31) {
+                // coarse Y = 0, nametable not switched
+                y = 0;
+            } else {
+                // increment coarse Y
+                y++;
+            }
+            // put coarse Y back into v
+            v = (addr_t) ((v & 0xFC1F) | (y << 5));
+        }
+    }
+
+    void PPU::copyX() {
+        // hori(v) = hori(t)
+        // v: .....F.. ...EDCBA = t: .....F.. ...EDCBA
+        v = (addr_t) ((v & 0xFBE0) | (t & 0x041F));
+    }
+
+    void PPU::copyY() {
+        // vert(v) = vert(t)
+        // v: .IHGF.ED CBA..... = t: .IHGF.ED CBA.....
+        v = (addr_t) ((v & 0x841F) | (t & 0x7BE0));
+    }
+
+    void PPU::fetchNameTableByte() {
+        nameTableByte = read((addr_t) (0x2000 | (v & 0x0FFF)));
+    }
+
+    void PPU::fetchAttributeTableByte() {
+        addr_t address = (addr_t) (0x23C0 | (v & 0x0C00) | ((v >> 4) & 0x38) | ((v >> 2) & 0x07));
+        int shift = ((v >> 4) & 4) | (v & 2);
+        attributeTableByte = (byte) (((read(address) >> shift) & 3) << 2);
+    }
+
+    void PPU::fetchLowTileByte() {
+        int fineY = (v >> 12) & 7;
+        addr_t address = (addr_t) (0x1000 * flagBackgroundTable + nameTableByte * 16 + fineY);
+        lowTileByte = mapper->readChr(address);
+    }
+
+    void PPU::fetchHighTileByte() {
+        int fineY = (v >> 12) & 7;
+        addr_t address = (addr_t) (0x1000 * flagBackgroundTable + nameTableByte * 16 + fineY);
+        highTileByte = mapper->readChr((addr_t) (address + 8));
+    }
+
+    void PPU::storeTileData() {
+        uint32_t data = 0;
+        for (int i = 0; i < 8; i++) {
+            byte a = attributeTableByte;
+            byte p1 = (byte) ((lowTileByte & 0x80) >> 7);
+            byte p2 = (byte) ((highTileByte & 0x80) >> 6);
+            lowTileByte <<= 1;
+            highTileByte <<= 1;
+            data <<= 4;
+            data |= a | p1 | p2;
+        }
+        tileData |= data;
+    }
+
+    byte PPU::backgroundPixel() {
+        if (flagShowBackground == 0) {
+            return 0;
+        }
+        uint32_t data = (uint32_t) (tileData >> 32) >> ((7 - x) * 4);
+        return (byte) (data & 0x0F);
+    }
+
+    byte PPU::spritePixel(byte &index) {
+        index = 0;
+        if (flagShowSprites == 0) {
+            return 0;
+        }
+        for (int i = 0; i < spriteCount; i++) {
+            int offset = (cycle - 1) - spritePositions[i];
+            if (offset < 0 || offset > 7) {
+                continue;
+            }
+            offset = 7 - offset;
+            byte color = (byte) ((spritePatterns[i] >> (offset * 4)) & 0x0F);
+            if (color % 4 == 0) {
+                continue;
+            }
+            index = (byte) i;
+            return color;
+        }
+        return 0;
+    }
+
+    void PPU::renderPixel() {
+        int x = cycle - 1;
+        int y = scanLine;
+
+        byte background = backgroundPixel();
+        byte i;
+        byte sprite = spritePixel(i);
+
+        if (x < 8 && flagShowLeftBackground == 0) {
+            background = 0;
+        }
+        if (x < 8 && flagShowLeftSprites == 0) {
+            sprite = 0;
+        }
+
+        bool b = background % 4 != 0;
+        bool s = sprite % 4 != 0;
+        byte color;
+        if (!b && !s) {
+            color = 0;
+        } else if (!b && s) {
+            color = (byte) (sprite | 0x10);
+        } else if (b && !s) {
+            color = background;
+        } else {
+            if (spriteIndexes[i] == 0 && x < 255) {
+                flagSpriteZeroHit = 1;
+            }
+            if (spritePriorities[i] == 0) {
+                color = (byte) (sprite | 0x10);
+            } else {
+                color = background;
+            }
+        }
+
+        byte index = (byte) (readPalette(color) & 0x3F);
+        if (flagGrayscale) {
+            index &= 0x30;
+        }
+        back[y * SCREEN_WIDTH + x] = index;
+    }
+
+    void PPU::testSpriteZeroHit() {
+        if (!spriteZeroOnLine || flagSpriteZeroHit) {
+            return;
+        }
+
+        int x = cycle - 1;
+        if (x == 255) {
+            return;
+        }
+
+        byte i;
+        byte sprite = spritePixel(i);
+        if (sprite % 4 == 0 || spriteIndexes[i] != 0 || (x < 8 && flagShowLeftSprites == 0)) {
+            return;
+        }
+
+        byte background = backgroundPixel();
+        if (background % 4 == 0 || (x < 8 && flagShowLeftBackground == 0)) {
+            return;
+        }
+
+        flagSpriteZeroHit = 1;
+    }
+
+    // SpreadBits[flip][b] puts bit k of a pattern byte into bit 0 of the nibble of
+    // its pixel, leftmost pixel in the top nibble
+    static uint32_t SpreadBits[2][256];
+
+    static bool initSpreadBits() {
+        for (int b = 0; b < 256; b++) {
+            uint32_t normal = 0, flipped = 0;
+            for (int k = 0; k < 8; k++) {
+                if (b & (1 << k)) {
+                    normal |= 1u << (4 * k);
+                    flipped |= 1u << (4 * (7 - k));
+                }
+            }
+            SpreadBits[0][b] = normal;
+            SpreadBits[1][b] = flipped;
+        }
+        return true;
+    }
+
+    static const bool spreadBitsReady = initSpreadBits();
+
+    addr_t PPU::spritePatternAddress(int i, int row) const {
+        byte tile = oamData[i * 4 + 1];
+        byte attributes = oamData[i * 4 + 2];
+        if (flagSpriteSize == 0) {
+            if ((attributes & 0x80) == 0x80) {
+                row = 7 - row;
+            }
+            return (addr_t) (0x1000 * flagSpriteTable + tile * 16 + row);
+        }
+
+        if ((attributes & 0x80) == 0x80) {
+            row = 15 - row;
+        }
+        int table = tile & 1;
+        tile &= 0xFE;
+        if (row > 7) {
+            tile++;
+            row -= 8;
+        }
+        return (addr_t) (0x1000 * table + tile * 16 + row);
+    }
+
+    uint32_t PPU::fetchSpritePattern(int i, addr_t address) {
+        byte attributes = oamData[i * 4 + 2];
+        int flip = (attributes >> 6) & 1;
+        byte low = mapper->readChr(address);
+        byte high = mapper->readChr((addr_t) (address + 8));
+        uint32_t palette = (uint32_t) ((attributes & 3) << 2) * 0x11111111u;
+        return palette | SpreadBits[flip][low] | SpreadBits[flip][high] << 1;
+    }
+
+    uint64_t PPU::spritesOnLineScalar(const byte *oam, int line, int height) {
+        uint64_t hits = 0;
+        for (int i = 0; i < 64; i++) {
+            unsigned row = (unsigned) (line - oam[i * 4]);
+            hits |= (uint64_t) (row < (unsigned) height) << i;
+        }
+        return hits;
+    }
+
+    // The Y bytes are gathered out of OAM and compared 16 at a time.
+    uint64_t PPU::spritesOnLine(const byte *oam, int line, int height) {
+#if defined(NESDROID_NEON)
+        static const uint8_t weights[16] = {1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128};
+        uint8x16_t bit = vld1q_u8(weights);
+        uint8x16_t l = vdupq_n_u8((uint8_t) line);
+        uint8x16_t h = vdupq_n_u8((uint8_t) height);
+        uint64_t hits = 0;
+        for (int group = 0; group < 4; group++) {
+            // lane 0 of the de-interleave is the Y byte of 16 sprites
+            uint8x16_t y = vld4q_u8(oam + group * 64).val[0];
+            uint8x16_t in = vandq_u8(vcleq_u8(y, l), vcltq_u8(vsubq_u8(l, y), h));
+            uint8x16_t m = vandq_u8(in, bit);
+#if defined(__aarch64__)
+            uint64_t low = vaddv_u8(vget_low_u8(m));
+            uint64_t high = vaddv_u8(vget_high_u8(m));
+#else
+            uint8x8_t sum = vpadd_u8(vget_low_u8(m), vget_high_u8(m));
+            sum = vpadd_u8(sum, sum);
+            sum = vpadd_u8(sum, sum);
+            uint64_t low = vget_lane_u8(sum, 0);
+            uint64_t high = vget_lane_u8(sum, 1);
+#endif
+            hits |= (low | high << 8) << (group * 16);
+        }
+        return hits;
+#elif defined(NESDROID_SSE2)
+        __m128i l = _mm_set1_epi8((char) line);
+        __m128i last = _mm_set1_epi8((char) (height - 1));
+        __m128i yMask = _mm_set1_epi32(0xFF);
+        uint64_t hits = 0;
+        for (int group = 0; group < 4; group++) {
+            const __m128i *p = (const __m128i *) (oam + group * 64);
+            __m128i y01 = _mm_packs_epi32(_mm_and_si128(_mm_loadu_si128(p), yMask),
+                                          _mm_and_si128(_mm_loadu_si128(p + 1), yMask));
+            __m128i y23 = _mm_packs_epi32(_mm_and_si128(_mm_loadu_si128(p + 2), yMask),
+                                          _mm_and_si128(_mm_loadu_si128(p + 3), yMask));
+            __m128i y = _mm_packus_epi16(y01, y23);
+            // y <= line and line - y <= height - 1, unsigned
+            __m128i above = _mm_cmpeq_epi8(_mm_max_epu8(y, l), l);
+            __m128i row = _mm_sub_epi8(l, y);
+            __m128i within = _mm_cmpeq_epi8(_mm_min_epu8(row, last), row);
+            hits |= (uint64_t) (uint16_t) _mm_movemask_epi8(_mm_and_si128(above, within)) << (group * 16);
+        }
+        return hits;
+#else
+        return spritesOnLineScalar(oam, line, height);
+#endif
+    }
+
+    void PPU::evaluateSprites() {
+        int h = flagSpriteSize == 0 ? 8 : 16;
+        uint64_t hits = spritesOnLine(oamData, scanLine, h);
+
+        spriteZeroOnLine = (hits & 1) != 0;
+        int count = 0;
+        addr_t addresses[8];
+        int last = -1;
+        for (uint64_t pending = hits; pending != 0 && count < 8; pending &= pending - 1) {
+            int i = __builtin_ctzll(pending);
+            addresses[count] = spritePatternAddress(i, scanLine - oamData[i * 4]);
+            __builtin_prefetch(mapper->chrPointer(addresses[count]));
+            spriteIndexes[count] = (byte) i;
+            last = i;
+            count++;
+        }
+
+        for (int j = 0; j < count; j++) {
+            int i = spriteIndexes[j];
+            spritePatterns[j] = fetchSpritePattern(i, addresses[j]);
+            spritePositions[j] = oamData[i * 4 + 3];
+            spritePriorities[j] = (byte) ((oamData[i * 4 + 2] >> 5) & 1);
+        }
+        spriteCount = count;
+
+        // with eight found the scan goes on through the rest of OAM
+        if (count == 8) {
+            checkSpriteOverflow(last + 1, h);
+        }
+    }
+
+    // After eight sprites the hardware keeps scanning OAM but also steps the byte
+    // within each entry, so it compares tiles, attributes or X against the line:
+    // overflow gets both false positives and false negatives.
+    void PPU::checkSpriteOverflow(int n, int height) {
+        int m = 0;
+        for (; n < 64; n++) {
+            unsigned row = (unsigned) (scanLine - oamData[n * 4 + m]);
+            if (row < (unsigned) height) {
+                flagSpriteOverflow = 1;
+                return;
+            }
+            m = (m + 1) & 3;
+        }
+    }
+
+    // tick updates cycle, scanLine and frame counters
+    void PPU::tick() {
+        if (flagShowBackground != 0 || flagShowSprites != 0) {
+            // the pre-render line is one dot shorter on odd frames
+            if (f == 1 && scanLine == 261 && cycle == 339) {
+                cycle = 0;
+                scanLine = 0;
+                frame++;
+                f ^= 1;
+                return;
+            }
+        }
+        cycle++;
+        if (cycle > 340) {
+            cycle = 0;
+            scanLine++;
+            if (scanLine > 261) {
+                scanLine = 0;
+                frame++;
+                f ^= 1;
+            }
+        }
+    }
+
+    void PPU::onMapperWrite() {
+        if (recorder != nullptr) {
+            recorder->recordMapper(mapper);
+        }
+    }
+
+    int PPU::idleDots() const {
+        bool renderingEnabled = flagShowBackground != 0 || flagShowSprites != 0;
+        bool renderLine = scanLine < 240 || scanLine == 261;
+        // first cycle of the line that does more than count; tick() wraps the line
+        // after cycle 340, and the short pre-render line of odd frames after 339
+        int next = renderingEnabled && f == 1 && scanLine == 261 ? 340 : 341;
+        if (renderingEnabled) {
+            if (renderLine) {
+                if (cycle < 257) {
+                    next = cycle + 1;
+                } else if (scanLine == 261 && cycle < 304) {
+                    next = cycle < 279 ? 280 : cycle + 1;
+                } else if (cycle < 336) {
+                    next = cycle < 320 ? 321 : cycle + 1;
+                }
+            } else if (cycle < 257) {
+                next = scanLine == 241 && cycle < 1 ? 1 : 257;
+            }
+        } else if (scanLine < 240 && outputEnabled && cycle < 256) {
+            next = cycle + 1;
+        } else if ((scanLine == 241 || scanLine == 261) && cycle < 1) {
+            next = 1;
+        }
+        return next - 1 - cycle;
+    }
+
+    bool PPU::canFetchTile() const {
+        if (outputEnabled || (cycle & 7) != 0 || (flagShowBackground == 0 && flagShowSprites == 0)) {
+            return false;
+        }
+        if (scanLine < 240) {
+            return cycle == 320 || cycle == 328 || (cycle < 256 && (!spriteZeroOnLine || flagSpriteZeroHit));
+        }
+        // the first dot of the pre-render line also ends vblank
+        return scanLine == 261 && (cycle == 320 || cycle == 328 || (cycle > 0 && cycle < 256));
+    }
+
+    void PPU::fetchTile() {
+        // the per dot shifts, the fetches in their order, then the store and increments of the eighth dot
+        tileData <<= 32;
+        fetchNameTableByte();
+        fetchAttributeTableByte();
+        fetchLowTileByte();
+        fetchHighTileByte();
+        storeTileData();
+        cycle += 8;
+        incrementX();
+        if (cycle == 256) {
+            incrementY();
+        }
+    }
+
+    void PPU::step(int dots) {
+        if (recorder != nullptr) {
+            recorder->advance(dots);
+        }
+        clock += dots;
+        while (dots-- > 0) {
+            // vblank, hblank and lines with rendering off have long stretches of nothing
+            int idle = idleDots();
+            if (idle > 0) {
+                if (idle > dots + 1) {
+                    idle = dots + 1;
+                }
+                cycle += idle;
+                dots -= idle - 1;
+                continue;
+            }
+            if (dots >= 7 && canFetchTile()) {
+                fetchTile();
+                dots -= 7;
+                continue;
+            }
+            tick();
+
+            bool renderingEnabled = flagShowBackground != 0 || flagShowSprites != 0;
+            bool preLine = scanLine == 261;
+            bool visibleLine = scanLine < 240;
+            bool renderLine = preLine || visibleLine;
+            bool preFetchCycle = cycle >= 321 && cycle <= 336;
+            bool visibleCycle = cycle >= 1 && cycle <= 256;
+            bool fetchCycle = preFetchCycle || visibleCycle;
+
+            if (outputEnabled && visibleLine && cycle == 1) {
+                backEmphasis[scanLine] = flagEmphasis;
+            }
+
+            if (renderingEnabled) {
+                // background logic
+                if (visibleLine && visibleCycle) {
+                    if (outputEnabled) {
+                        renderPixel();
+                    } else {
+                        testSpriteZeroHit();
+                    }
+                }
+                if (renderLine && fetchCycle) {
+                    tileData <<= 4;
+                    switch (cycle % 8) {
+                        case 1:
+                            fetchNameTableByte();
+                            break;
+                        case 3:
+                            fetchAttributeTableByte();
+                            break;
+                        case 5:
+                            fetchLowTileByte();
+                            break;
+                        case 7:
+                            fetchHighTileByte();
+                            break;
+                        case 0:
+                            storeTileData();
+                            break;
+                        default:
+                            break;
+                    }
+                }
+                if (preLine && cycle >= 280 && cycle <= 304) {
+                    copyY();
+                }
+                if (renderLine) {
+                    if (fetchCycle && cycle % 8 == 0) {
+                        incrementX();
+                    }
+                    if (cycle == 256) {
+                        incrementY();
+                    }
+                    if (cycle == 257) {
+                        copyX();
+                    }
+                }
+
+                // sprite logic
+                if (cycle == 257) {
+                    if (visibleLine) {
+                        evaluateSprites();
+                    } else {
+                        spriteCount = 0;
+                    }
+                }
+            } else if (outputEnabled && visibleLine && visibleCycle) {
+                // rendering off shows the backdrop color
+                back[scanLine * SCREEN_WIDTH + cycle - 1] = (byte) (readPalette(0) & 0x3F);
+            }
+
+            // vblank logic
+            if (scanLine == 241 && cycle == 1) {
+                // the clock of this dot
+                setVerticalBlank(clock - dots);
+            }
+            if (preLine && cycle == 1) {
+                clearVerticalBlank();
+                flagSpriteZeroHit = 0;
+                flagSpriteOverflow = 0;
+            }
+        }
+    }
+
+    void PPU::save(State &state) const {
+        state.put(cycle);
+        state.put(scanLine);
+        state.put(frame);
+        state.write(paletteData, PALETTE_SIZE);
+        state.write(nameTableData, NAMETABLE_SIZE);
+        state.write(oamData, OAM_SIZE);
+        state.put(v);
+        state.put(t);
+        state.put(x);
+        state.put(w);
+        state.put(f);
+        state.put(registerValue);
+        state.put(nmiOccurred);
+        state.put(nmiOutput);
+        state.put(nmiPrevious);
+        state.put(nmiPending);
+        // the clock is not state, how long ago the edge was is
+        uint64_t nmiAge = nmiPending ? clock - nmiClock : 0;
+        state.put(nmiAge);
+        state.put(nameTableByte);
+        state.put(attributeTableByte);
+        state.put(lowTileByte);
+        state.put(highTileByte);
+        state.put(tileData);
+        state.put(spriteCount);
+        state.put(spritePatterns);
+        state.put(spritePositions);
+        state.put(spritePriorities);
+        state.put(spriteIndexes);
+        state.put(spriteZeroOnLine);
+        state.put(flagNameTable);
+        state.put(flagIncrement);
+        state.put(flagSpriteTable);
+        state.put(flagBackgroundTable);
+        state.put(flagSpriteSize);
+        state.put(flagMasterSlave);
+        state.put(flagGrayscale);
+        state.put(flagShowLeftBackground);
+        state.put(flagShowLeftSprites);
+        state.put(flagShowBackground);
+        state.put(flagShowSprites);
+        state.put(flagEmphasis);
+        state.put(flagSpriteZeroHit);
+        state.put(flagSpriteOverflow);
+        state.put(oamAddress);
+        state.put(bufferedData);
+    }
+
+    void PPU::load(State &state) {
+        state.get(cycle);
+        state.get(scanLine);
+        state.get(frame);
+        state.read(paletteData, PALETTE_SIZE);
+        state.read(nameTableData, NAMETABLE_SIZE);
+        state.read(oamData, OAM_SIZE);
+        state.get(v);
+        state.get(t);
+        state.get(x);
+        state.get(w);
+        state.get(f);
+        state.get(registerValue);
+        state.get(nmiOccurred);
+        state.get(nmiOutput);
+        state.get(nmiPrevious);
+        state.get(nmiPending);
+        uint64_t nmiAge = 0;
+        state.get(nmiAge);
+        nmiClock = clock - nmiAge;
+        state.get(nameTableByte);
+        state.get(attributeTableByte);
+        state.get(lowTileByte);
+        state.get(highTileByte);
+        state.get(tileData);
+        state.get(spriteCount);
+        state.get(spritePatterns);
+        state.get(spritePositions);
+        state.get(spritePriorities);
+        state.get(spriteIndexes);
+        state.get(spriteZeroOnLine);
+        state.get(flagNameTable);
+        state.get(flagIncrement);
+        state.get(flagSpriteTable);
+        state.get(flagBackgroundTable);
+        state.get(flagSpriteSize);
+        state.get(flagMasterSlave);
+        state.get(flagGrayscale);
+        state.get(flagShowLeftBackground);
+        state.get(flagShowLeftSprites);
+        state.get(flagShowBackground);
+        state.get(flagShowSprites);
+        state.get(flagEmphasis);
+        state.get(flagSpriteZeroHit);
+        state.get(flagSpriteOverflow);
+        state.get(oamAddress);
+        state.get(bufferedData);
+    }
+}
@@ -5,10 +5,331 @@
 #ifndef NESDROID_PPU_H
 #define NESDROID_PPU_H
 
+#include "commons.h"
+#include "Memory.h"
+#include "State.h"
 
-class PPU {
+namespace nesdroid {
 
-};
+    static const int SCREEN_WIDTH = 256;
+    static const int SCREEN_HEIGHT = 240;
 
+    static const int OAM_SIZE = 256;
+    static const int PALETTE_SIZE = 32;
+    static const int NAMETABLE_SIZE = 4096;
+    // two frames of palette indices and their emphasis lines
+    static const int FRAMES_SIZE = 2 * (SCREEN_WIDTH * SCREEN_HEIGHT + SCREEN_HEIGHT);
+
+    class Cpu;
+    class Debugger;
+    class PpuPipeline;
+
+    class PPU {
+
+    public:
+
+        PPU();
+
+        // cpu may be nullptr for a PPU that only renders
+        void connect(Cpu *cpu, IMapper *mapper) {
+            this->cpu = cpu;
+            this->mapper = mapper;
+        }
+
+        // register writes, reads with side effects, stepped dots and mapper
+        // bank switches are also logged to the recorder, nullptr for none
+        void setRecorder(PpuPipeline *recorder) {
+            this->recorder = recorder;
+        }
+
+        // $2007 accesses to pages with trap bits set are reported to debugger
+        void setDebugger(Debugger *debugger) {
+            this->debugger = debugger;
+        }
+
+        // ACCESS_* bits for the 64 pages of $0000-$3FFF
+        byte *getTraps() {
+            return traps;
+        }
+
+        // the cpu wrote to the cartridge, CHR banks or mirroring may have changed
+        void onMapperWrite();
+
+        // memory comes from the console arena and must be set before reset()
+        void setMemory(byte *oam, byte *palette, byte *nameTables, byte *frames);
+
+        void reset();
+
+        // advance the given number of dots
+        void step(int dots);
+
+        // the cpu begins an instruction at the given cycle, the PPU is level with it
+        void beginInstruction(uint64_t cycles) {
+            cpuCycles = cycles;
+        }
+
+        // catch up with the cpu at the given cycle, three dots each, and raise an
+        // NMI the cpu has seen by then
+        void runTo(uint64_t cycles);
+
+        byte readRegister(addr_t address);
+
+        void writeRegister(addr_t address, byte value);
+
+        // $4014: copy a cpu page into OAM and stall the cpu for 513/514 cycles
+        void writeDma(byte page);
+
+        // When output is disabled the PPU keeps every timing side effect
+        // (VBlank, NMI, sprite 0 hit, sprite overflow, mapper scanline clocks)
+        // but does not produce pixels and the front buffer is left untouched.
+        void setOutputEnabled(bool enabled) {
+            outputEnabled = enabled;
+        }
+
+        bool isOutputEnabled() const {
+            return outputEnabled;
+        }
+
+        uint64_t getFrame() const {
+            return frame;
+        }
+
+        // dots stepped since the PPU was built, three per cpu cycle; not part of
+        // the state and never rewound, for scheduling
+        uint64_t getClock() const {
+            return clock;
+        }
+
+        int getScanLine() const {
+            return scanLine;
+        }
+
+        int getCycle() const {
+            return cycle;
+        }
+
+        // the pre-render line of an odd frame is a dot shorter while rendering
+        bool isOddFrame() const {
+            return f != 0;
+        }
+
+        bool isRenderingEnabled() const {
+            return flagShowBackground != 0 || flagShowSprites != 0;
+        }
+
+        // pattern tables of PPUCTRL, 0 for $0000 and 1 for $1000; they decide
+        // when A12 rises for scanline counters
+        byte getBackgroundTable() const {
+            return flagBackgroundTable;
+        }
+
+        byte getSpriteTable() const {
+            return flagSpriteTable;
+        }
+
+        bool isTallSprites() const {
+            return flagSpriteSize != 0;
+        }
+
+        // last completed picture, 6-bit palette indices with grayscale applied
+        const byte *getFrontBuffer() const {
+            return front;
+        }
+
+        // PPUMASK emphasis bits (0-7) in effect for each line of the front buffer
+        const byte *getFrontEmphasis() const {
+            return frontEmphasis;
+        }
+
+        void save(State &state) const;
+
+        void load(State &state);
+
+        // Bit i set for every sprite of oam whose Y puts `line` within `height`:
+        // with SSE2 or NEON when built for it, and the plain loop the vector
+        // paths must agree with
+        static uint64_t spritesOnLine(const byte *oam, int line, int height);
+
+        static uint64_t spritesOnLineScalar(const byte *oam, int line, int height);
+
+    private:
+
+        byte read(addr_t address);
+
+        void write(addr_t address, byte value);
+
+        inline byte readPalette(addr_t address) const {
+            if (address >= 16 && address % 4 == 0) {
+                address -= 16;
+            }
+            return paletteData[address];
+        }
+
+        inline void writePalette(addr_t address, byte value) {
+            if (address >= 16 && address % 4 == 0) {
+                address -= 16;
+            }
+            paletteData[address] = value;
+        }
+
+        inline addr_t mirrorAddress(addr_t address) const;
+
+        void tick();
+
+        // dots after the current one in which step() would only count, up to the end of the line
+        int idleDots() const;
+
+        // without output the eight dots of a background tile need nothing but its
+        // fetches, unless sprite zero may hit on them
+        bool canFetchTile() const;
+
+        // the eight dots after the current one at once, see canFetchTile()
+        void fetchTile();
+
+        void writeControl(byte value);
+
+        void writeMask(byte value);
+
+        byte readStatus();
+
+        byte readOAMData();
+
+        void writeOAMData(byte value);
+
+        void writeScroll(byte value);
+
+        void writeAddress(byte value);
+
+        byte readData();
+
+        void writeData(byte value);
+
+        // before a register access, run to the cycle of the access
+        inline void syncWithCpu();
+
+        // at is the clock of the dot that changed the NMI output
+        void nmiChange(uint64_t at);
+
+        void setVerticalBlank(uint64_t at);
+
+        void clearVerticalBlank();
+
+        void incrementX();
+
+        void incrementY();
+
+        void copyX();
+
+        void copyY();
+
+        void fetchNameTableByte();
+
+        void fetchAttributeTableByte();
+
+        void fetchLowTileByte();
+
+        void fetchHighTileByte();
+
+        void storeTileData();
+
+        byte backgroundPixel();
+
+        byte spritePixel(byte &index);
+
+        void renderPixel();
+
+        // sprite 0 hit detection only, used while output is disabled
+        void testSpriteZeroHit();
+
+        void evaluateSprites();
+
+        void checkSpriteOverflow(int n, int height);
+
+        addr_t spritePatternAddress(int i, int row) const;
+
+        uint32_t fetchSpritePattern(int i, addr_t address);
+
+        Cpu *cpu = nullptr;
+        IMapper *mapper = nullptr;
+        PpuPipeline *recorder = nullptr;
+        Debugger *debugger = nullptr;
+        byte traps[64] = {0};
+
+        bool outputEnabled = true;
+
+        uint64_t clock = 0;
+        uint64_t cpuCycles = 0;     // the cpu cycle the dots run so far reach
+        int cycle;      // 0-340
+        int scanLine;   // 0-261, 0-239=visible, 240=post, 241-260=vblank, 261=pre
+        uint64_t frame;
+
+        byte *paletteData = nullptr;
+        byte *nameTableData = nullptr;
+        byte *oamData = nullptr;
+
+        // PPU registers
+        addr_t v;   // current vram address (15 bit)
+        addr_t t;   // temporary vram address (15 bit)
+        byte x;     // fine x scroll (3 bit)
+        byte w;     // write toggle (1 bit)
+        byte f;     // even/odd frame flag (1 bit)
+
+        byte registerValue;
+
+        // NMI flags
+        bool nmiOccurred;
+        bool nmiOutput;
+        bool nmiPrevious;
+        bool nmiPending;        // edge not passed on to the cpu yet
+        uint64_t nmiClock;      // of that edge
+        bool vblankSuppressed;  // $2002 was read the dot before vblank
+
+        // background temporary variables
+        byte nameTableByte;
+        byte attributeTableByte;
+        byte lowTileByte;
+        byte highTileByte;
+        uint64_t tileData;
+
+        // sprite temporary variables
+        int spriteCount;
+        uint32_t spritePatterns[8];
+        byte spritePositions[8];
+        byte spritePriorities[8];
+        byte spriteIndexes[8];
+        bool spriteZeroOnLine;
+
+        // $2000 PPUCTRL
+        byte flagNameTable;       // 0: $2000; 1: $2400; 2: $2800; 3: $2C00
+        byte flagIncrement;       // 0: add 1; 1: add 32
+        byte flagSpriteTable;     // 0: $0000; 1: $1000; ignored in 8x16 mode
+        byte flagBackgroundTable; // 0: $0000; 1: $1000
+        byte flagSpriteSize;      // 0: 8x8; 1: 8x16
+        byte flagMasterSlave;     // 0: read EXT; 1: write EXT
+
+        // $2001 PPUMASK
+        byte flagGrayscale;          // 0: color; 1: grayscale
+        byte flagShowLeftBackground; // 0: hide; 1: show
+        byte flagShowLeftSprites;    // 0: hide; 1: show
+        byte flagShowBackground;     // 0: hide; 1: show
+        byte flagShowSprites;        // 0: hide; 1: show
+        byte flagEmphasis;           // bit 0 red, bit 1 green, bit 2 blue
+
+        // $2002 PPUSTATUS
+        byte flagSpriteZeroHit;
+        byte flagSpriteOverflow;
+
+        // $2003 OAMADDR
+        byte oamAddress;
+
+        // $2007 PPUDATA
+        byte bufferedData; // for buffered reads
+
+        byte *front = nullptr;
+        byte *back = nullptr;
+        byte *frontEmphasis = nullptr;
+        byte *backEmphasis = nullptr;
+    };
+}
 
 #endif //NESDROID_PPU_H
@@ -0,0 +1,218 @@
+#include <cstring>
+
+#include "PpuPipeline.h"
+#include "Mapper.h"
+#include "Metrics.h"
+
+namespace nesdroid {
+
+    // a frame rarely logs more than a few thousand events
+    static const size_t EVENT_CAPACITY = 1 << 15;
+
+    // palette indices and the emphasis of each line
+    static const size_t PICTURE_SIZE = SCREEN_WIDTH * SCREEN_HEIGHT + SCREEN_HEIGHT;
+
+    void PpuPipeline::RenderMapper::copy(IMapper *mapper, byte *chrRamCopy) {
+        source = mapper->getChrRam();
+        chrRam = source != nullptr ? chrRamCopy : nullptr;
+        if (source != nullptr) {
+            memcpy(chrRam, source, CHR_RAM_SIZE);
+        }
+        chrWritable = mapper->isChrWritable();
+        mirrorType = mapper->getMirrorType();
+        for (int i = 0; i < 8; i++) {
+            setChrPage(i, mapper->getChrPage(i));
+        }
+    }
+
+    void PpuPipeline::RenderMapper::setChrPage(int i, byte *page) {
+        if (source != nullptr && page >= source && page < source + CHR_RAM_SIZE) {
+            page = chrRam + (page - source);
+        }
+        chrPages[i & 7] = page;
+    }
+
+    PpuPipeline::PpuPipeline(PPU &ppu, IMapper *mapper)
+            : ppu(ppu), mapper(mapper), publishedTail(0), head(0), replayedFrames(0) {
+        size_t size = Arena::align(OAM_SIZE) + Arena::align(PALETTE_SIZE) + Arena::align(NAMETABLE_SIZE)
+                      + Arena::align(FRAMES_SIZE) + Arena::align(CHR_RAM_SIZE) + Arena::align(PICTURE_SIZE) * 2
+                      + Arena::align(EVENT_CAPACITY * sizeof(Event));
+        if (!arena.reserve(size)) {
+            LOG("Out of memory for the render thread\n");
+            return;
+        }
+
+        byte *oam = arena.allocate(OAM_SIZE);
+        byte *palette = arena.allocate(PALETTE_SIZE);
+        byte *nameTables = arena.allocate(NAMETABLE_SIZE);
+        renderPpu.setMemory(oam, palette, nameTables, arena.allocate(FRAMES_SIZE));
+        renderPpu.connect(nullptr, &renderMapper);
+        chrRam = arena.allocate(CHR_RAM_SIZE);
+        ready = arena.allocate(PICTURE_SIZE);
+        presented = arena.allocate(PICTURE_SIZE);
+        events = (Event *) arena.allocate(EVENT_CAPACITY * sizeof(Event));
+
+        resync();
+        valid = true;
+        thread = std::thread(&PpuPipeline::run, this);
+    }
+
+    PpuPipeline::~PpuPipeline() {
+        if (!valid) {
+            return;
+        }
+        drain();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        changed.notify_all();
+        thread.join();
+    }
+
+    void PpuPipeline::recordMapper(IMapper *mapper) {
+        for (int i = 0; i < 8; i++) {
+            byte *page = mapper->getChrPage(i);
+            if (page != chrPages[i]) {
+                chrPages[i] = page;
+                push(EVENT_CHR_PAGE, 0, (byte) i, page);
+            }
+        }
+        if (mapper->getMirrorType() != mirrorType) {
+            mirrorType = mapper->getMirrorType();
+            push(EVENT_MIRROR, 0, mirrorType);
+        }
+    }
+
+    void PpuPipeline::push(byte type, addr_t address, byte value, byte *page) {
+        if (tail - head.load(std::memory_order_acquire) >= EVENT_CAPACITY) {
+            // the render thread is a whole log behind, wait for room
+            publish();
+            std::unique_lock<std::mutex> lock(mutex);
+            changed.wait(lock, [this] { return tail - head.load() < EVENT_CAPACITY; });
+        }
+
+        Event &event = events[tail % EVENT_CAPACITY];
+        event.dots = (uint32_t) pendingDots;
+        event.address = address;
+        event.type = type;
+        event.value = value;
+        event.page = page;
+        pendingDots = 0;
+        tail++;
+    }
+
+    void PpuPipeline::publish() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            publishedTail.store(tail);
+        }
+        changed.notify_all();
+    }
+
+    void PpuPipeline::drain() {
+        publish();
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [this] { return head.load() == tail; });
+    }
+
+    void PpuPipeline::endFrame() {
+        push(EVENT_FRAME, 0, 0);
+        producedFrames++;
+        publish();
+
+        // at most one frame in flight
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [this] { return replayedFrames.load() + 1 >= producedFrames; });
+        if (readyFresh) {
+            std::swap(ready, presented);
+            readyFresh = false;
+        }
+    }
+
+    void PpuPipeline::resync() {
+        drain();
+
+        // the render thread is idle until the next publish()
+        State state;
+        ppu.save(state);
+        renderPpu.load(state);
+        renderMapper.copy(mapper, chrRam);
+        for (int i = 0; i < 8; i++) {
+            chrPages[i] = mapper->getChrPage(i);
+        }
+        mirrorType = mapper->getMirrorType();
+        pendingDots = 0;
+
+        // show the picture that came with the state until a new one is drawn
+        lastFront = renderPpu.getFrontBuffer();
+        memcpy(presented, lastFront, SCREEN_WIDTH * SCREEN_HEIGHT);
+        memcpy(presented + SCREEN_WIDTH * SCREEN_HEIGHT, renderPpu.getFrontEmphasis(), SCREEN_HEIGHT);
+        readyFresh = false;
+    }
+
+    void PpuPipeline::run() {
+        uint64_t position = head.load();
+        while (true) {
+            uint64_t end;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                changed.wait(lock, [&] { return stopping || publishedTail.load() != position; });
+                end = publishedTail.load();
+                if (end == position) {
+                    return;
+                }
+            }
+
+            uint64_t start = Metrics::now();
+            for (; position < end; position++) {
+                replay(events[position % EVENT_CAPACITY]);
+            }
+            Metrics::add(COUNTER_PPU_NANOS, Metrics::now() - start);
+
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                head.store(position);
+            }
+            changed.notify_all();
+        }
+    }
+
+    void PpuPipeline::replay(const Event &event) {
+        if (event.dots > 0) {
+            renderPpu.step((int) event.dots);
+            if (renderPpu.getFrontBuffer() != lastFront) {
+                lastFront = renderPpu.getFrontBuffer();
+                std::lock_guard<std::mutex> lock(mutex);
+                memcpy(ready, lastFront, SCREEN_WIDTH * SCREEN_HEIGHT);
+                memcpy(ready + SCREEN_WIDTH * SCREEN_HEIGHT, renderPpu.getFrontEmphasis(), SCREEN_HEIGHT);
+                readyFresh = true;
+            }
+        }
+
+        switch (event.type) {
+            case EVENT_WRITE:
+                renderPpu.writeRegister(event.address, event.value);
+                break;
+            case EVENT_READ:
+                renderPpu.readRegister(event.address);
+                break;
+            case EVENT_CHR_PAGE:
+                renderMapper.setChrPage(event.value, event.page);
+                break;
+            case EVENT_MIRROR:
+                renderMapper.setMirrorType(event.value);
+                break;
+            case EVENT_OUTPUT:
+                renderPpu.setOutputEnabled(event.value != 0);
+                break;
+            case EVENT_FRAME: {
+                std::lock_guard<std::mutex> lock(mutex);
+                replayedFrames++;
+                break;
+            }
+            default:
+                break;
+        }
+    }
+}
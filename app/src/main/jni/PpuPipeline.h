@@ -0,0 +1,172 @@
+#ifndef NESDROID_PPUPIPELINE_H
+#define NESDROID_PPUPIPELINE_H
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "commons.h"
+#include "Arena.h"
+#include "Memory.h"
+#include "Ppu.h"
+
+namespace nesdroid {
+
+    // Renders on a second thread. The console's PPU keeps running on the cpu
+    // thread with output disabled, which still answers $2002, sprite 0 hit and
+    // the other timing the cpu can observe, and logs what it is told: register
+    // writes, $2002/$2007 reads, OAM DMA bytes and mapper CHR/mirroring changes,
+    // each stamped with the dots stepped since the previous entry. A second PPU
+    // replays the log with output enabled, drawing frame N while the cpu runs N + 1.
+    class PpuPipeline {
+
+    public:
+
+        // ppu is the console's; starts from a copy of its state
+        PpuPipeline(PPU &ppu, IMapper *mapper);
+
+        virtual ~PpuPipeline();
+
+        // false if there was no memory for it
+        bool isValid() const {
+            return valid;
+        }
+
+        // ---- cpu thread, called by the console's PPU ----
+
+        void advance(int dots) {
+            pendingDots += dots;
+        }
+
+        void recordWrite(addr_t address, byte value) {
+            push(EVENT_WRITE, address, value);
+        }
+
+        void recordRead(addr_t address) {
+            push(EVENT_READ, address, 0);
+        }
+
+        void recordMapper(IMapper *mapper);
+
+        // ---- cpu thread, called by the console ----
+
+        void setOutputEnabled(bool enabled) {
+            push(EVENT_OUTPUT, 0, (byte) enabled);
+        }
+
+        // The console frame is over: hand its log to the render thread, let that
+        // finish the frame before and take the newest picture.
+        void endFrame();
+
+        // the console's PPU was reset or loaded, start over from its state
+        void resync();
+
+        // newest completed picture, stable until the next endFrame()
+        const byte *getFrontBuffer() const {
+            return presented;
+        }
+
+        const byte *getFrontEmphasis() const {
+            return presented + SCREEN_WIDTH * SCREEN_HEIGHT;
+        }
+
+    private:
+
+        enum EventType {
+            EVENT_WRITE,
+            EVENT_READ,
+            // value is the page number, page the cpu side pointer
+            EVENT_CHR_PAGE,
+            EVENT_MIRROR,
+            EVENT_OUTPUT,
+            EVENT_FRAME,
+        };
+
+        struct Event {
+            uint32_t dots;   // to step before applying the event
+            addr_t address;
+            byte type;
+            byte value;
+            byte *page;
+        };
+
+        // Only the pattern pages and mirroring of the cartridge, as the log says
+        // they were. CHR RAM is a private copy, the cpu side runs ahead on its own.
+        class RenderMapper : public IMapper {
+        public:
+            virtual byte read(addr_t address) override {
+                return 0;
+            }
+
+            virtual void write(addr_t address, byte value) override {
+            }
+
+            virtual dbyte readDoubleByte(addr_t address) override {
+                return 0;
+            }
+
+            virtual void writeDoubleByte(addr_t address, dbyte value) override {
+            }
+
+            void copy(IMapper *mapper, byte *chrRamCopy);
+
+            void setChrPage(int i, byte *page);
+
+            void setMirrorType(byte type) {
+                mirrorType = type;
+            }
+
+        private:
+            // the original CHR RAM, pages into it are moved to our copy
+            byte *source = nullptr;
+        };
+
+        void push(byte type, addr_t address, byte value, byte *page = nullptr);
+
+        // make everything pushed so far visible to the render thread
+        void publish();
+
+        // block until the render thread has replayed everything published
+        void drain();
+
+        void run();
+
+        void replay(const Event &event);
+
+        PPU &ppu;
+        IMapper *mapper;
+
+        Arena arena;
+        PPU renderPpu;
+        RenderMapper renderMapper;
+        byte *chrRam = nullptr;
+
+        // what the log last said about the cartridge
+        byte *chrPages[8];
+        byte mirrorType = 0;
+
+        Event *events = nullptr;
+        uint64_t pendingDots = 0;
+        // producer and consumer positions, events[position % EVENT_CAPACITY]
+        uint64_t tail = 0;
+        std::atomic<uint64_t> publishedTail;
+        std::atomic<uint64_t> head;
+        uint64_t producedFrames = 0;
+        std::atomic<uint64_t> replayedFrames;
+
+        // pictures: ready is written by the render thread, presented is read by the console
+        const byte *lastFront = nullptr;
+        byte *ready = nullptr;
+        byte *presented = nullptr;
+        bool readyFresh = false;
+
+        std::mutex mutex;
+        std::condition_variable changed;
+        bool valid = false;
+        bool stopping = false;
+        std::thread thread;
+    };
+}
+
+#endif //NESDROID_PPUPIPELINE_H
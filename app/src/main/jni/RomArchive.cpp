@@ -0,0 +1,246 @@
+#include <cstring>
+#include <string>
+#include <strings.h>
+#include <vector>
+#include <zlib.h>
+
+#include "RomArchive.h"
+
+namespace nesdroid {
+
+    static const int METHOD_STORED = 0;
+    static const int METHOD_DEFLATE = 8;
+    // not a zip method, a whole .gz file
+    static const int METHOD_GZIP = 0x100;
+
+    static const uint32_t ZIP_LOCAL_HEADER = 0x04034b50;
+    static const uint32_t ZIP_CENTRAL_HEADER = 0x02014b50;
+    static const uint32_t ZIP_END_OF_DIRECTORY = 0x06054b50;
+    static const size_t ZIP_LOCAL_HEADER_SIZE = 30;
+    static const size_t ZIP_CENTRAL_HEADER_SIZE = 46;
+    static const size_t ZIP_END_SIZE = 22;
+    static const size_t ZIP_MAX_COMMENT = 0xFFFF;
+
+    static uint16_t le16(const byte *p) {
+        return (uint16_t) (p[0] | p[1] << 8);
+    }
+
+    static uint32_t le32(const byte *p) {
+        return (uint32_t) p[0] | (uint32_t) p[1] << 8 | (uint32_t) p[2] << 16 | (uint32_t) p[3] << 24;
+    }
+
+    // Inflates one entry from the current file position, at most compressedSize
+    // bytes of input are consumed.
+    class EntryStream {
+
+    public:
+
+        EntryStream(FILE *file, int method, size_t compressedSize)
+                : file(file), method(method), remaining(compressedSize) {
+            memset(&stream, 0, sizeof(stream));
+            if (method == METHOD_DEFLATE) {
+                valid = inflateInit2(&stream, -MAX_WBITS) == Z_OK;
+            } else if (method == METHOD_GZIP) {
+                valid = inflateInit2(&stream, 16 + MAX_WBITS) == Z_OK;
+            } else {
+                valid = method == METHOD_STORED;
+            }
+        }
+
+        virtual ~EntryStream() {
+            if (valid && method != METHOD_STORED) {
+                inflateEnd(&stream);
+            }
+        }
+
+        // fills out unless the entry ends or is broken, returns the bytes read
+        size_t read(byte *out, size_t size) {
+            if (!valid) {
+                return 0;
+            }
+            if (method == METHOD_STORED) {
+                size_t wanted = size < remaining ? size : remaining;
+                size_t got = fread(out, 1, wanted, file);
+                remaining -= got;
+                return got;
+            }
+
+            stream.next_out = out;
+            stream.avail_out = (uInt) size;
+            while (stream.avail_out > 0 && !ended) {
+                if (stream.avail_in == 0 && remaining > 0) {
+                    size_t wanted = remaining < sizeof(input) ? remaining : sizeof(input);
+                    size_t got = fread(input, 1, wanted, file);
+                    if (got == 0) {
+                        break;
+                    }
+                    remaining -= got;
+                    stream.next_in = input;
+                    stream.avail_in = (uInt) got;
+                }
+                int status = inflate(&stream, Z_NO_FLUSH);
+                if (status == Z_STREAM_END) {
+                    ended = true;
+                } else if (status == Z_BUF_ERROR && stream.avail_in == 0 && remaining == 0) {
+                    break;
+                } else if (status != Z_OK && status != Z_BUF_ERROR) {
+                    LOG("Corrupt rom archive: %s\n", stream.msg != nullptr ? stream.msg : "inflate failed");
+                    valid = false;
+                    break;
+                }
+            }
+            return size - stream.avail_out;
+        }
+
+    private:
+        FILE *file;
+        int method;
+        size_t remaining;
+        bool valid = false;
+        bool ended = false;
+        z_stream stream;
+        byte input[0x4000];
+    };
+
+    static std::string baseName(const char *path, const char *extension) {
+        const char *slash = strrchr(path, '/');
+        std::string name = slash != nullptr ? slash + 1 : path;
+        size_t length = strlen(extension);
+        if (name.size() > length && strcasecmp(name.c_str() + name.size() - length, extension) == 0) {
+            name.resize(name.size() - length);
+        }
+        return name;
+    }
+
+    ROM *RomArchive::open(const char *path, const Filter &filter) {
+        FILE *file = fopen(path, "rb");
+        if (file == nullptr) {
+            return nullptr;
+        }
+
+        byte magic[4] = {0};
+        size_t magicSize = fread(magic, 1, sizeof(magic), file);
+        fseek(file, 0, SEEK_END);
+        long fileSize = ftell(file);
+        fseek(file, 0, SEEK_SET);
+
+        ROM *rom = nullptr;
+        if (magicSize == 4 && le32(magic) == ZIP_LOCAL_HEADER) {
+            rom = openZip(file, filter);
+        } else if (magicSize >= 2 && magic[0] == 0x1f && magic[1] == 0x8b) {
+            rom = extract(file, METHOD_GZIP, (size_t) fileSize, baseName(path, ".gz").c_str(), filter);
+        } else if (fileSize > 0) {
+            rom = extract(file, METHOD_STORED, (size_t) fileSize, baseName(path, "").c_str(), filter);
+        }
+        fclose(file);
+        return rom;
+    }
+
+    ROM *RomArchive::openZip(FILE *file, const Filter &filter) {
+        // the central directory has the sizes even when the local headers don't
+        fseek(file, 0, SEEK_END);
+        long fileSize = ftell(file);
+        size_t tailSize = (size_t) fileSize < ZIP_END_SIZE + ZIP_MAX_COMMENT
+                          ? (size_t) fileSize : ZIP_END_SIZE + ZIP_MAX_COMMENT;
+        std::vector<byte> tail(tailSize);
+        fseek(file, fileSize - (long) tailSize, SEEK_SET);
+        if (tailSize < ZIP_END_SIZE || fread(tail.data(), 1, tailSize, file) != tailSize) {
+            return nullptr;
+        }
+        const byte *end = nullptr;
+        for (size_t i = tailSize - ZIP_END_SIZE + 1; i-- > 0;) {
+            if (le32(&tail[i]) == ZIP_END_OF_DIRECTORY) {
+                end = &tail[i];
+                break;
+            }
+        }
+        if (end == nullptr) {
+            LOG("Not a zip archive\n");
+            return nullptr;
+        }
+
+        uint16_t entries = le16(end + 10);
+        uint32_t directorySize = le32(end + 12);
+        uint32_t directoryOffset = le32(end + 16);
+        if ((size_t) directoryOffset + directorySize > (size_t) fileSize) {
+            return nullptr;
+        }
+        std::vector<byte> directory(directorySize);
+        fseek(file, directoryOffset, SEEK_SET);
+        if (fread(directory.data(), 1, directorySize, file) != directorySize) {
+            return nullptr;
+        }
+
+        size_t position = 0;
+        for (int i = 0; i < entries; i++) {
+            if (position + ZIP_CENTRAL_HEADER_SIZE > directorySize
+                || le32(&directory[position]) != ZIP_CENTRAL_HEADER) {
+                break;
+            }
+            const byte *entry = &directory[position];
+            uint16_t flags = le16(entry + 8);
+            uint16_t method = le16(entry + 10);
+            uint32_t compressedSize = le32(entry + 20);
+            uint32_t size = le32(entry + 24);
+            uint16_t nameLength = le16(entry + 28);
+            uint16_t extraLength = le16(entry + 30);
+            uint16_t commentLength = le16(entry + 32);
+            uint32_t localOffset = le32(entry + 42);
+            size_t next = position + ZIP_CENTRAL_HEADER_SIZE + nameLength + extraLength + commentLength;
+            if (next > directorySize) {
+                break;
+            }
+            std::string name((const char *) entry + ZIP_CENTRAL_HEADER_SIZE, nameLength);
+            position = next;
+
+            // encrypted, zip64 or something other than deflate can't be a rom we run
+            if ((flags & 1) || (method != METHOD_STORED && method != METHOD_DEFLATE)
+                || size < HEADER_LENGTH || size == 0xFFFFFFFF) {
+                continue;
+            }
+
+            byte local[ZIP_LOCAL_HEADER_SIZE];
+            fseek(file, localOffset, SEEK_SET);
+            if (fread(local, 1, sizeof(local), file) != sizeof(local) || le32(local) != ZIP_LOCAL_HEADER) {
+                continue;
+            }
+            fseek(file, le16(local + 26) + le16(local + 28), SEEK_CUR);
+
+            ROM *rom = extract(file, method, compressedSize, name.c_str(), filter);
+            if (rom != nullptr) {
+                return rom;
+            }
+        }
+        return nullptr;
+    }
+
+    ROM *RomArchive::extract(FILE *file, int method, size_t compressedSize, const char *name,
+                             const Filter &filter) {
+        EntryStream stream(file, method, compressedSize);
+
+        byte header[HEADER_LENGTH];
+        if (stream.read(header, HEADER_LENGTH) != HEADER_LENGTH) {
+            return nullptr;
+        }
+        size_t imageSize = ROM::getImageSize(header);
+        if (imageSize == 0 || (filter && !filter(name, header))) {
+            return nullptr;
+        }
+
+        byte *content = new byte[imageSize];
+        memcpy(content, header, HEADER_LENGTH);
+        if (stream.read(content + HEADER_LENGTH, imageSize - HEADER_LENGTH) != imageSize - HEADER_LENGTH) {
+            LOG("Truncated rom %s\n", name);
+            delete[] content;
+            return nullptr;
+        }
+
+        ROM *rom = new ROM(content, imageSize);
+        rom->load();
+        if (!rom->isValid()) {
+            delete rom;
+            return nullptr;
+        }
+        return rom;
+    }
+}
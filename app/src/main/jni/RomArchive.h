@@ -0,0 +1,35 @@
+#ifndef NESDROID_ROMARCHIVE_H
+#define NESDROID_ROMARCHIVE_H
+
+#include <functional>
+
+#include "commons.h"
+#include "rom.h"
+
+namespace nesdroid {
+
+    // Loads a rom out of a raw .nes, a .gz or a .zip file without temporary files.
+    // Entries are inflated a block at a time straight into the image the ROM takes
+    // over; after the first 16 bytes the iNES header is known, so the image is
+    // allocated at its final size and entries the filter rejects are not inflated
+    // any further.
+    class RomArchive {
+
+    public:
+
+        // name of the entry and its iNES header, false to skip it
+        typedef std::function<bool(const char *name, const byte *header)> Filter;
+
+        // the first valid rom the filter accepts, loaded, or nullptr. An indexer
+        // can walk every header of an archive with a filter that returns false.
+        static ROM *open(const char *path, const Filter &filter = Filter());
+
+    private:
+
+        static ROM *openZip(FILE *file, const Filter &filter);
+
+        static ROM *extract(FILE *file, int method, size_t compressedSize, const char *name, const Filter &filter);
+    };
+}
+
+#endif //NESDROID_ROMARCHIVE_H
@@ -0,0 +1,87 @@
+#include "RomLoader.h"
+#include "RomArchive.h"
+#include "Metrics.h"
+
+namespace nesdroid {
+
+    // reading and the save file, side by side
+    static const int LOADER_THREADS = 2;
+
+    RomLoader::RomLoader() : pool(LOADER_THREADS), status(LOAD_IDLE), outstanding(0) {
+    }
+
+    RomLoader::~RomLoader() {
+        pool.wait();
+        delete console;
+        delete rom;
+    }
+
+    bool RomLoader::start(const char *path, const std::string &savePath, const std::string &codeCacheDirectory) {
+        if (getStatus() == LOAD_RUNNING) {
+            return false;
+        }
+        // a result nobody took
+        pool.wait();
+        delete console;
+        delete rom;
+        rom = nullptr;
+
+        this->path = path;
+        console = new Console();
+        console->setSavePath(savePath.c_str());
+        console->setCodeCacheDirectory(codeCacheDirectory.c_str());
+        outstanding.store(1);
+        status.store(LOAD_RUNNING, std::memory_order_release);
+        pool.dispatch([this](int) { read(); }, 1);
+        return true;
+    }
+
+    void RomLoader::read() {
+        uint64_t start = Metrics::now();
+        bool mapping = false;
+        rom = RomArchive::open(path.c_str(), [this, &mapping](const char *name, const byte *header) {
+            // battery flag: map the save file while the rest inflates
+            if ((header[6] & 0b10) && !console->getSavePath().empty() && !mapping) {
+                mapping = true;
+                outstanding.fetch_add(1);
+                pool.dispatch([this](int) { mapSaveRam(); }, 1);
+            }
+            return true;
+        });
+        if (rom == nullptr) {
+            LOG("Failed to read rom %s\n", path.c_str());
+        } else {
+            LOG("Read %s in %llu us\n", path.c_str(), (unsigned long long) (Metrics::now() - start) / 1000);
+        }
+        finish();
+    }
+
+    void RomLoader::mapSaveRam() {
+        if (!console->prepareSaveRam()) {
+            LOG("Failed to map save file %s\n", console->getSavePath().c_str());
+        }
+        finish();
+    }
+
+    void RomLoader::finish() {
+        if (outstanding.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+            return;
+        }
+        // both tasks are done, this thread sees everything they wrote
+        bool inserted = rom != nullptr && console->insert(rom);
+        status.store(inserted ? LOAD_READY : LOAD_FAILED, std::memory_order_release);
+    }
+
+    Console *RomLoader::take(ROM *&rom) {
+        if (getStatus() != LOAD_READY) {
+            rom = nullptr;
+            return nullptr;
+        }
+        Console *prepared = console;
+        rom = this->rom;
+        console = nullptr;
+        this->rom = nullptr;
+        status.store(LOAD_IDLE, std::memory_order_release);
+        return prepared;
+    }
+}
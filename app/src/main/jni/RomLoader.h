@@ -0,0 +1,68 @@
+#ifndef NESDROID_ROMLOADER_H
+#define NESDROID_ROMLOADER_H
+
+#include <atomic>
+#include <string>
+
+#include "commons.h"
+#include "Console.h"
+#include "WorkerPool.h"
+
+namespace nesdroid {
+
+    // Prepares a rom and a console for it on a background pool, so that the UI
+    // thread never waits for the disk. Reading and inflating the archive runs as
+    // one task; as soon as the header shows a battery the save file is mapped
+    // by a second one in parallel. When both are done the cartridge is laid out,
+    // the mapper built and the machine powered on, and the console is handed
+    // over ready to run its first frame.
+    class RomLoader {
+
+    public:
+
+        // same values as the LOAD_* constants of Nes
+        enum Status {
+            LOAD_IDLE = 0,
+            LOAD_RUNNING = 1,
+            LOAD_READY = 2,
+            LOAD_FAILED = 3,
+        };
+
+        RomLoader();
+
+        // waits for a running load and drops what it prepared
+        virtual ~RomLoader();
+
+        // start preparing the rom at path (.nes, .zip or .gz), false while
+        // another load is running; see Console for the two paths
+        bool start(const char *path, const std::string &savePath, const std::string &codeCacheDirectory);
+
+        Status getStatus() const {
+            return (Status) status.load(std::memory_order_acquire);
+        }
+
+        // once LOAD_READY: the powered on console and its rom, both owned by the
+        // caller from now on. The loader goes back to LOAD_IDLE.
+        Console *take(ROM *&rom);
+
+    private:
+
+        void read();
+
+        void mapSaveRam();
+
+        // a task is done, the last one inserts the cartridge
+        void finish();
+
+        WorkerPool pool;
+        std::atomic<int> status;
+        // tasks that have to finish before the cartridge goes in
+        std::atomic<int> outstanding;
+
+        std::string path;
+        Console *console = nullptr;
+        ROM *rom = nullptr;
+    };
+}
+
+#endif //NESDROID_ROMLOADER_H
@@ -0,0 +1,142 @@
+#include <cstring>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "RomStore.h"
+#include "rom.h"
+
+namespace nesdroid {
+
+    RomBanks::~RomBanks() {
+        nativeCode.unload();
+        if (prg != nullptr) {
+            munmap(prg, mappedSize);
+        }
+    }
+
+    bool RomBanks::map(const ROM *rom) {
+        hash = rom->getHash();
+        prgSize = (size_t) rom->getRomCount() * PRG_BANK_SIZE;
+        chrSize = (size_t) rom->getVromCount() * CHR_BANK_SIZE;
+        size_t page = (size_t) sysconf(_SC_PAGESIZE);
+        mappedSize = (prgSize + chrSize + page - 1) / page * page;
+
+        void *memory = mmap(nullptr, mappedSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (memory == MAP_FAILED) {
+            LOG("Out of memory for %zu bytes of rom banks\n", mappedSize);
+            return false;
+        }
+        prg = (byte *) memory;
+        for (int i = 0; i < rom->getRomCount(); i++) {
+            memcpy(prg + i * PRG_BANK_SIZE, rom->getPrgBank(i), PRG_BANK_SIZE);
+        }
+        for (int i = 0; i < rom->getVromCount(); i++) {
+            memcpy(prg + prgSize + i * CHR_BANK_SIZE, rom->getChrBank(i), CHR_BANK_SIZE);
+        }
+        // a stray write into ROM faults instead of changing every console's game
+        mprotect(prg, mappedSize, PROT_READ);
+
+        codeMap.attach(prg, prgSize, hash);
+        nativeCode.attach(prg, prgSize, hash);
+        return true;
+    }
+
+    bool RomBanks::matches(const ROM *rom) const {
+        if (rom->getHash() != hash || (size_t) rom->getRomCount() * PRG_BANK_SIZE != prgSize
+            || (size_t) rom->getVromCount() * CHR_BANK_SIZE != chrSize) {
+            return false;
+        }
+        for (int i = 0; i < rom->getRomCount(); i++) {
+            if (memcmp(prg + i * PRG_BANK_SIZE, rom->getPrgBank(i), PRG_BANK_SIZE) != 0) {
+                return false;
+            }
+        }
+        for (int i = 0; i < rom->getVromCount(); i++) {
+            if (memcmp(prg + prgSize + i * CHR_BANK_SIZE, rom->getChrBank(i), CHR_BANK_SIZE) != 0) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void RomBanks::prepareCodeMap(IMapper *mapper, const std::string &directory) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!cacheLoaded && !directory.empty()) {
+            cacheLoaded = codeMap.load(directory);
+        }
+        if (!analyzed) {
+            codeMap.analyze(mapper);
+            analyzed = true;
+        }
+    }
+
+    bool RomBanks::saveCodeMap(const std::string &directory) {
+        std::lock_guard<std::mutex> lock(mutex);
+        return codeMap.save(directory);
+    }
+
+    const NativeCode *RomBanks::loadNativeCode(const std::string &path) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (!nativeCode.isLoaded()) {
+            nativeCode.load(path);
+        }
+        return nativeCode.isLoaded() ? &nativeCode : nullptr;
+    }
+
+    RomStore &RomStore::shared() {
+        static RomStore store;
+        return store;
+    }
+
+    RomBanks *RomStore::acquire(ROM *rom) {
+        std::lock_guard<std::mutex> lock(mutex);
+        RomBanks *acquired = rom->getSharedBanks();
+        if (acquired == nullptr) {
+            auto found = banks.find(rom->getHash());
+            if (found != banks.end() && found->second->matches(rom)) {
+                acquired = found->second;
+            } else {
+                acquired = new RomBanks();
+                if (!acquired->map(rom)) {
+                    delete acquired;
+                    return nullptr;
+                }
+                if (found == banks.end()) {
+                    banks[acquired->hash] = acquired;
+                } else {
+                    LOG("Rom hash collision on %016llx\n", (unsigned long long) acquired->hash);
+                }
+                count++;
+                bytes += acquired->mappedSize;
+            }
+            // the rom holds a reference of its own in place of its file image
+            acquired->references++;
+            rom->shareBanks(acquired);
+        }
+        acquired->references++;
+        return acquired;
+    }
+
+    void RomStore::release(RomBanks *released) {
+        if (released == nullptr) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        if (--released->references > 0) {
+            return;
+        }
+        auto found = banks.find(released->hash);
+        if (found != banks.end() && found->second == released) {
+            banks.erase(found);
+        }
+        count--;
+        bytes -= released->mappedSize;
+        delete released;
+    }
+
+    void RomStore::getUsage(size_t &count, size_t &bytes) {
+        std::lock_guard<std::mutex> lock(mutex);
+        count = this->count;
+        bytes = this->bytes;
+    }
+}
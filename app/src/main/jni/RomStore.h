@@ -0,0 +1,128 @@
+#ifndef NESDROID_ROMSTORE_H
+#define NESDROID_ROMSTORE_H
+
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "commons.h"
+#include "CodeMap.h"
+#include "Native.h"
+
+class ROM;
+
+namespace nesdroid {
+
+    class IMapper;
+
+    // PRG and CHR ROM of one rom in read-only pages, with what is known about
+    // its code, shared by every console playing it. Mutable state (RAM, CHR RAM,
+    // registers, the mapper) stays with each console.
+    class RomBanks {
+
+    public:
+
+        uint64_t getHash() const {
+            return hash;
+        }
+
+        const byte *getPrg() const {
+            return prg;
+        }
+
+        size_t getPrgSize() const {
+            return prgSize;
+        }
+
+        // nullptr for boards with CHR RAM only
+        const byte *getChr() const {
+            return chrSize > 0 ? prg + prgSize : nullptr;
+        }
+
+        size_t getChrSize() const {
+            return chrSize;
+        }
+
+        // consoles log into it while they run
+        CodeMap &getCodeMap() {
+            return codeMap;
+        }
+
+        const CodeMap &getCodeMap() const {
+            return codeMap;
+        }
+
+        // merge the cached map from directory and run the static pass, both once
+        // for the process whichever console inserts the rom first
+        void prepareCodeMap(IMapper *mapper, const std::string &directory);
+
+        bool saveCodeMap(const std::string &directory);
+
+        // the plugin at path, loaded by the first console asking for it; nullptr
+        // if it does not fit the rom
+        const NativeCode *loadNativeCode(const std::string &path);
+
+        const NativeCode &getNativeCode() const {
+            return nativeCode;
+        }
+
+    private:
+
+        friend class RomStore;
+
+        RomBanks() { }
+
+        ~RomBanks();
+
+        RomBanks(const RomBanks &) = delete;
+
+        RomBanks &operator=(const RomBanks &) = delete;
+
+        // copy the banks of rom into fresh pages and seal them
+        bool map(const ROM *rom);
+
+        bool matches(const ROM *rom) const;
+
+        uint64_t hash = 0;
+        byte *prg = nullptr;        // PRG then CHR, one mapping
+        size_t prgSize = 0;
+        size_t chrSize = 0;
+        size_t mappedSize = 0;
+        int references = 0;
+
+        std::mutex mutex;
+        CodeMap codeMap;
+        bool analyzed = false;
+        bool cacheLoaded = false;
+        NativeCode nativeCode;
+    };
+
+    // Process-wide store of rom banks by content. Consoles inserting the same
+    // game share one copy of its banks, whichever ROM object they were given; a
+    // hash collision gets banks of its own. Thread safe.
+    class RomStore {
+
+    public:
+
+        static RomStore &shared();
+
+        // banks with the content of rom, nullptr if out of memory; each call is
+        // matched by a release(). The first one also hands rom a reference of its
+        // own and frees its file image, see ROM::shareBanks().
+        RomBanks *acquire(ROM *rom);
+
+        void release(RomBanks *banks);
+
+        // distinct banks held and the bytes they map
+        void getUsage(size_t &count, size_t &bytes);
+
+    private:
+
+        std::mutex mutex;
+        std::unordered_map<uint64_t, RomBanks *> banks;
+        size_t count = 0;
+        size_t bytes = 0;
+    };
+}
+
+#endif //NESDROID_ROMSTORE_H
@@ -0,0 +1,122 @@
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "SaveRam.h"
+
+namespace nesdroid {
+
+    SaveRam::~SaveRam() {
+        close();
+    }
+
+    bool SaveRam::open(const char *path, size_t size) {
+        close();
+
+        fd = ::open(path, O_RDWR | O_CREAT, 0600);
+        if (fd < 0) {
+            LOG("Failed to open save file %s\n", path);
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0 || ((size_t) st.st_size < size && ftruncate(fd, (off_t) size) != 0)) {
+            LOG("Failed to size save file %s\n", path);
+            ::close(fd);
+            fd = -1;
+            return false;
+        }
+        void *mapped = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (mapped == MAP_FAILED) {
+            LOG("Failed to map save file %s\n", path);
+            ::close(fd);
+            fd = -1;
+            return false;
+        }
+
+        data = (byte *) mapped;
+        this->size = size;
+        pending = 0;
+        flushing = false;
+        stopping = false;
+        thread = std::thread(&SaveRam::run, this);
+        return true;
+    }
+
+    void SaveRam::close() {
+        if (data == nullptr) {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        changed.notify_all();
+        thread.join();
+
+        // the emulation is gone, a last synchronous flush of everything is fine here
+        msync(data, size, MS_SYNC);
+        munmap(data, size);
+        ::close(fd);
+        data = nullptr;
+        fd = -1;
+    }
+
+    void SaveRam::commit(const byte *ram, uint32_t dirtyPages) {
+        if (data == nullptr || dirtyPages == 0) {
+            return;
+        }
+        for (int i = 0; i < 32; i++) {
+            size_t offset = (size_t) i * PAGE_SIZE;
+            if ((dirtyPages & (1u << i)) && offset < size) {
+                memcpy(data + offset, ram + offset, std::min((size_t) PAGE_SIZE, size - offset));
+            }
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            pending |= dirtyPages;
+        }
+        changed.notify_all();
+    }
+
+    void SaveRam::sync() {
+        if (data == nullptr) {
+            return;
+        }
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [this] { return pending == 0 && !flushing; });
+    }
+
+    void SaveRam::run() {
+        // msync() wants addresses aligned to the system page, which may be larger
+        size_t systemPage = (size_t) sysconf(_SC_PAGESIZE);
+
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            changed.wait(lock, [this] { return stopping || pending != 0; });
+            if (stopping) {
+                return;
+            }
+            uint32_t pages = pending;
+            pending = 0;
+            flushing = true;
+
+            lock.unlock();
+            for (int i = 0; i < 32; i++) {
+                size_t offset = (size_t) i * PAGE_SIZE;
+                if (!(pages & (1u << i)) || offset >= size) {
+                    continue;
+                }
+                size_t start = offset / systemPage * systemPage;
+                size_t end = offset + PAGE_SIZE < size ? offset + PAGE_SIZE : size;
+                msync(data + start, end - start, MS_SYNC);
+            }
+            lock.lock();
+
+            flushing = false;
+            changed.notify_all();
+        }
+    }
+}
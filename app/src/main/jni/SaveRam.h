@@ -0,0 +1,65 @@
+#ifndef NESDROID_SAVERAM_H
+#define NESDROID_SAVERAM_H
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "commons.h"
+
+namespace nesdroid {
+
+    // Save file of battery backed PRG-RAM, mapped shared. The game plays on a
+    // working copy; the pages it wrote during a frame are copied into the mapping
+    // at the frame's end, so a killed process loses at most that frame, and
+    // msync()ed on a thread of its own, the emulation thread never waits for the disk.
+    class SaveRam {
+
+    public:
+
+        // granularity of the dirty mask, one bit per page
+        static const int PAGE_SIZE = 0x1000;
+
+        SaveRam() { }
+
+        virtual ~SaveRam();
+
+        // map size bytes of path, created zero filled if missing
+        bool open(const char *path, size_t size);
+
+        // flush and unmap
+        void close();
+
+        bool isOpen() const {
+            return data != nullptr;
+        }
+
+        byte *getData() const {
+            return data;
+        }
+
+        // frame boundary: copy the pages in the mask from ram and queue them for
+        // writing back
+        void commit(const byte *ram, uint32_t dirtyPages);
+
+        // block until everything committed is on disk, e.g. going to the background
+        void sync();
+
+    private:
+
+        void run();
+
+        int fd = -1;
+        byte *data = nullptr;
+        size_t size = 0;
+
+        std::thread thread;
+        std::mutex mutex;
+        std::condition_variable changed;
+        uint32_t pending = 0;
+        bool flushing = false;
+        bool stopping = false;
+    };
+}
+
+#endif //NESDROID_SAVERAM_H
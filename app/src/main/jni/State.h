@@ -0,0 +1,79 @@
+#ifndef NESDROID_STATE_H
+#define NESDROID_STATE_H
+
+#include <cstring>
+#include <vector>
+
+#include "commons.h"
+
+namespace nesdroid {
+
+    // State is a flat byte buffer holding a snapshot of the whole machine.
+    // Every component appends its fields with put()/write() in save order and
+    // reads them back in the same order with get()/read().
+    class State {
+
+    public:
+
+        void clear() {
+            data.clear();
+            position = 0;
+            overflow = false;
+        }
+
+        void rewind() {
+            position = 0;
+            overflow = false;
+        }
+
+        void assign(const byte *src, size_t size) {
+            data.assign(src, src + size);
+            rewind();
+        }
+
+        void write(const void *src, size_t size) {
+            const byte *p = (const byte *) src;
+            data.insert(data.end(), p, p + size);
+        }
+
+        void read(void *dst, size_t size) {
+            if (position + size > data.size()) {
+                overflow = true;
+                memset(dst, 0, size);
+                return;
+            }
+            memcpy(dst, data.data() + position, size);
+            position += size;
+        }
+
+        template<typename T>
+        void put(const T &value) {
+            write(&value, sizeof(T));
+        }
+
+        template<typename T>
+        void get(T &value) {
+            read(&value, sizeof(T));
+        }
+
+        const byte *getData() const {
+            return data.data();
+        }
+
+        size_t getSize() const {
+            return data.size();
+        }
+
+        // false if a read ran past the end of the snapshot
+        bool isValid() const {
+            return !overflow;
+        }
+
+    private:
+        std::vector<byte> data;
+        size_t position = 0;
+        bool overflow = false;
+    };
+}
+
+#endif //NESDROID_STATE_H
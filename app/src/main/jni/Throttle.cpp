@@ -0,0 +1,131 @@
+#include <algorithm>
+#include <cmath>
+#include <ctime>
+
+#include "Throttle.h"
+#include "Console.h"
+#include "Metrics.h"
+
+namespace nesdroid {
+
+    static const uint64_t NANOS_PER_SECOND = 1000000000ULL;
+
+    // uncapped mode returns to the caller about once per display refresh
+    static const uint64_t UNCAPPED_SLICE_NANOS = FRAME_NANOS;
+
+    // falling further behind than this drops the backlog instead of catching up
+    static const uint64_t MAX_LAG_FRAMES = 8;
+
+    static inline uint64_t now() {
+        return Metrics::now();
+    }
+
+    void Throttle::sleepUntil(uint64_t deadline) {
+        uint64_t current = now();
+        if (deadline <= current) {
+            return;
+        }
+        uint64_t nanos = deadline - current;
+        timespec ts;
+        ts.tv_sec = (time_t) (nanos / NANOS_PER_SECOND);
+        ts.tv_nsec = (long) (nanos % NANOS_PER_SECOND);
+        nanosleep(&ts, nullptr);
+    }
+
+    Throttle::Throttle(Console &console) : console(console) {
+    }
+
+    void Throttle::setSpeed(float speed) {
+        this->speed = speed < 0 ? 0 : speed;
+        // restart the schedule so the new speed does not try to make up for the old one
+        startTime = 0;
+    }
+
+    bool Throttle::stepFrame(bool render) {
+        console.setOutputEnabled(render);
+        console.stepFrame();
+        frames++;
+        if (render) {
+            renderedFrames++;
+        } else {
+            skippedFrames++;
+        }
+        return render;
+    }
+
+    void Throttle::setDecimation(int decimation) {
+        // the APU restarts its sample count on every call
+        if (decimation != this->decimation) {
+            this->decimation = decimation;
+            console.setAudioDecimation(decimation);
+        }
+    }
+
+    bool Throttle::run() {
+        uint64_t current = now();
+        if (startTime == 0) {
+            startTime = current;
+            startFrames = frames;
+            windowTime = current;
+            windowFrames = frames;
+        }
+
+        bool rendered = false;
+
+        if (speed == 1) {
+            setDecimation(1);
+            uint64_t deadline = startTime + (frames - startFrames + 1) * FRAME_NANOS;
+            // this frame's audio was due before it even started
+            if (current > deadline) {
+                Metrics::add(COUNTER_AUDIO_UNDERRUNS, 1);
+            }
+            if (current > deadline + MAX_LAG_FRAMES * FRAME_NANOS) {
+                startTime = current;
+                startFrames = frames;
+                deadline = current + FRAME_NANOS;
+            }
+            rendered = stepFrame(true);
+            wakeTime = deadline;
+        } else if (speed > 0) {
+            // one mixed sample in `speed` keeps audio close to real time
+            setDecimation((int) std::max(1.0f, roundf(speed)));
+
+            uint64_t elapsed = current - startTime;
+            uint64_t due = (uint64_t) (elapsed * (double) speed / FRAME_NANOS) + 1;
+            uint64_t done = frames - startFrames;
+            if (due > done + MAX_LAG_FRAMES) {
+                startTime = current;
+                startFrames = frames;
+                done = 0;
+                due = 1;
+            }
+            // slow motion shows every frame, only fast forward skips
+            for (; done < due; done++) {
+                rendered |= stepFrame(speed < 1 || frames % renderInterval == 0);
+            }
+
+            wakeTime = startTime + (uint64_t) ((frames - startFrames) * FRAME_NANOS / (double) speed);
+        } else {
+            setDecimation((int) std::max(1.0f, roundf(achievedSpeed)));
+
+            uint64_t end = current + UNCAPPED_SLICE_NANOS;
+            do {
+                rendered |= stepFrame(frames % renderInterval == 0);
+            } while (now() < end);
+            wakeTime = 0;
+        }
+
+        updateTelemetry(now());
+        return rendered;
+    }
+
+    void Throttle::updateTelemetry(uint64_t now) {
+        uint64_t elapsed = now - windowTime;
+        if (elapsed < NANOS_PER_SECOND) {
+            return;
+        }
+        achievedSpeed = (float) ((frames - windowFrames) * (double) FRAME_NANOS / elapsed);
+        windowTime = now;
+        windowFrames = frames;
+    }
+}
@@ -0,0 +1,87 @@
+#ifndef NESDROID_THROTTLE_H
+#define NESDROID_THROTTLE_H
+
+#include "commons.h"
+
+namespace nesdroid {
+
+    class Console;
+
+    // Paces the emulation thread: real time, fast forward at a multiplier or uncapped.
+    // While fast forwarding only one frame in renderInterval produces pixels and the
+    // APU mixes one sample in `speed`, so the cost left is the cpu and ppu timing.
+    class Throttle {
+
+    public:
+
+        static const int DEFAULT_RENDER_INTERVAL = 4;
+
+        Throttle(Console &console);
+
+        // 1 is real time, 0 runs as fast as the host allows
+        void setSpeed(float speed);
+
+        float getSpeed() const {
+            return speed;
+        }
+
+        void setRenderInterval(int interval) {
+            renderInterval = interval < 1 ? 1 : interval;
+        }
+
+        // Emulate the frames that are due. Call it in a loop on the emulation
+        // thread, sleeping until getWakeTime() in between; returns true if one of
+        // the emulated frames was rendered and should be presented.
+        bool run();
+
+        // Metrics::now() time the next run() has frames to emulate
+        uint64_t getWakeTime() const {
+            return wakeTime;
+        }
+
+        static void sleepUntil(uint64_t deadline);
+
+        // emulated time / wall time over the last completed second
+        float getAchievedSpeed() const {
+            return achievedSpeed;
+        }
+
+        uint64_t getRenderedFrames() const {
+            return renderedFrames;
+        }
+
+        uint64_t getSkippedFrames() const {
+            return skippedFrames;
+        }
+
+    private:
+
+        bool stepFrame(bool render);
+
+        // pass decimation on to the APU if it changed
+        void setDecimation(int decimation);
+
+        void updateTelemetry(uint64_t now);
+
+        Console &console;
+
+        float speed = 1;
+        int renderInterval = DEFAULT_RENDER_INTERVAL;
+        int decimation = 0;     // as last set on the APU, 0 before the first run()
+
+        // wall clock reference and frames emulated since then
+        uint64_t startTime = 0;
+        uint64_t startFrames = 0;
+        uint64_t frames = 0;
+        uint64_t wakeTime = 0;
+
+        uint64_t windowTime = 0;
+        uint64_t windowFrames = 0;
+        float achievedSpeed = 0;
+
+        uint64_t renderedFrames = 0;
+        uint64_t skippedFrames = 0;
+    };
+}
+
+#endif //NESDROID_THROTTLE_H
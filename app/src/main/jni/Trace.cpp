@@ -0,0 +1,218 @@
+#include <cstring>
+
+#include "Trace.h"
+#include "cpu.h"
+
+namespace nesdroid {
+
+    static const char TRACE_MAGIC[4] = {'N', 'E', 'S', 'T'};
+    static const uint32_t TRACE_VERSION = 1;
+
+    struct TraceHeader {
+        char magic[4];
+        uint32_t version;
+        uint32_t recordSize;
+    };
+
+    TraceWriter::~TraceWriter() {
+        close();
+        for (auto chunk : chunks) {
+            delete chunk;
+        }
+    }
+
+    bool TraceWriter::open(const char *path) {
+        close();
+
+        // level 1: the writer has to keep up with the emulation
+        file = gzopen(path, "wb1");
+        if (file == nullptr) {
+            LOG("Failed to open trace %s\n", path);
+            return false;
+        }
+        TraceHeader header;
+        memcpy(header.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC));
+        header.version = TRACE_VERSION;
+        header.recordSize = sizeof(TraceRecord);
+        gzwrite(file, &header, sizeof(header));
+
+        stopping = false;
+        thread = std::thread(&TraceWriter::run, this);
+        return true;
+    }
+
+    void TraceWriter::close() {
+        if (file == nullptr) {
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        changed.notify_all();
+        thread.join();
+        gzclose(file);
+        file = nullptr;
+    }
+
+    TraceChunk *TraceWriter::acquire() {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (spare.empty() && (int) chunks.size() < MAX_CHUNKS) {
+            chunks.push_back(new TraceChunk());
+            spare.push_back(chunks.back());
+        }
+        changed.wait(lock, [this] { return !spare.empty(); });
+        TraceChunk *chunk = spare.back();
+        spare.pop_back();
+        chunk->count = 0;
+        return chunk;
+    }
+
+    void TraceWriter::submit(TraceChunk *chunk) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            queue.push_back(chunk);
+        }
+        changed.notify_all();
+    }
+
+    void TraceWriter::run() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            changed.wait(lock, [this] { return stopping || !queue.empty(); });
+            if (queue.empty()) {
+                return;
+            }
+            TraceChunk *chunk = queue.front();
+            queue.pop_front();
+
+            lock.unlock();
+            gzwrite(file, &chunk->stream, sizeof(chunk->stream));
+            gzwrite(file, &chunk->count, sizeof(chunk->count));
+            gzwrite(file, chunk->records, (unsigned) (chunk->count * sizeof(TraceRecord)));
+            lock.lock();
+
+            spare.push_back(chunk);
+            changed.notify_all();
+        }
+    }
+
+    TraceStream::TraceStream(TraceWriter &writer, uint32_t id) : writer(writer), id(id) {
+        chunk = writer.acquire();
+        chunk->stream = id;
+    }
+
+    TraceStream::~TraceStream() {
+        // an empty chunk costs 8 bytes, readers skip it
+        writer.submit(chunk);
+    }
+
+    void TraceStream::flush() {
+        writer.submit(chunk);
+        chunk = writer.acquire();
+        chunk->stream = id;
+    }
+
+    TraceReader::~TraceReader() {
+        if (file != nullptr) {
+            gzclose(file);
+        }
+    }
+
+    bool TraceReader::open(const char *path) {
+        file = gzopen(path, "rb");
+        if (file == nullptr) {
+            return false;
+        }
+        TraceHeader header;
+        if (gzread(file, &header, sizeof(header)) != sizeof(header)
+            || memcmp(header.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC)) != 0
+            || header.version != TRACE_VERSION || header.recordSize != sizeof(TraceRecord)) {
+            LOG("Not a trace: %s\n", path);
+            gzclose(file);
+            file = nullptr;
+            return false;
+        }
+        chunk.count = 0;
+        position = 0;
+        return true;
+    }
+
+    bool TraceReader::next(TraceRecord &record, uint32_t &stream) {
+        if (file == nullptr) {
+            return false;
+        }
+        while (position == chunk.count) {
+            if (gzread(file, &chunk.stream, sizeof(chunk.stream)) != sizeof(chunk.stream)
+                || gzread(file, &chunk.count, sizeof(chunk.count)) != sizeof(chunk.count)
+                || chunk.count > TRACE_CHUNK_RECORDS) {
+                return false;
+            }
+            int size = (int) (chunk.count * sizeof(TraceRecord));
+            if (gzread(file, chunk.records, (unsigned) size) != size) {
+                return false;
+            }
+            position = 0;
+        }
+        record = chunk.records[position++];
+        stream = chunk.stream;
+        return true;
+    }
+
+    void formatTraceRecord(const TraceRecord &record, char *line, size_t size) {
+        int length = InstructionLengthTable[record.opcode];
+        const char *name = InstructionNameTable[record.opcode];
+        byte low = record.operands[0];
+        dbyte word = (dbyte) (record.operands[1] << 8 | low);
+
+        char bytes[9];
+        snprintf(bytes, sizeof(bytes), length == 1 ? "%02X" : length == 2 ? "%02X %02X" : "%02X %02X %02X",
+                 record.opcode, low, record.operands[1]);
+
+        char operand[24] = "";
+        switch (AddressingModeTable[record.opcode]) {
+            case ZERO_PAGE:
+                snprintf(operand, sizeof(operand), "$%02X", low);
+                break;
+            case ZERO_PAGE_X:
+                snprintf(operand, sizeof(operand), "$%02X,X @ %02X", low, record.address & 0xFF);
+                break;
+            case ZERO_PAGE_Y:
+                snprintf(operand, sizeof(operand), "$%02X,Y @ %02X", low, record.address & 0xFF);
+                break;
+            case ABSOLUTE:
+                snprintf(operand, sizeof(operand), "$%04X", word);
+                break;
+            case ABSOLUTE_X:
+                snprintf(operand, sizeof(operand), "$%04X,X @ %04X", word, record.address);
+                break;
+            case ABSOLUTE_Y:
+                snprintf(operand, sizeof(operand), "$%04X,Y @ %04X", word, record.address);
+                break;
+            case INDIRECT:
+                snprintf(operand, sizeof(operand), "($%04X) = %04X", word, record.address);
+                break;
+            case ACCUMULATOR:
+                snprintf(operand, sizeof(operand), "A");
+                break;
+            case IMMEDIATE:
+                snprintf(operand, sizeof(operand), "#$%02X", low);
+                break;
+            case RELATIVE:
+                snprintf(operand, sizeof(operand), "$%04X", record.address);
+                break;
+            case INDEXED_INDIRECT:
+                snprintf(operand, sizeof(operand), "($%02X,X) @ %04X", low, record.address);
+                break;
+            case INDIRECT_INDEXED:
+                snprintf(operand, sizeof(operand), "($%02X),Y @ %04X", low, record.address);
+                break;
+            default:
+                break;
+        }
+
+        snprintf(line, size, "%04X  %-8s  %s %-26s A:%02X X:%02X Y:%02X P:%02X SP:%02X CYC:%llu",
+                 record.pc, bytes, name, operand, record.a, record.x, record.y, record.p, record.sp,
+                 (unsigned long long) record.cycle);
+    }
+}
@@ -0,0 +1,135 @@
+#ifndef NESDROID_TRACE_H
+#define NESDROID_TRACE_H
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <zlib.h>
+
+#include "commons.h"
+
+namespace nesdroid {
+
+    // One executed instruction, registers as they were before it ran.
+    struct TraceRecord {
+        uint64_t cycle;
+        addr_t pc;
+        // effective address, 0 for implied and accumulator operands
+        addr_t address;
+        byte opcode;
+        byte operands[2];
+        byte a;
+        byte x;
+        byte y;
+        byte p;
+        byte sp;
+    };
+
+    static_assert(sizeof(TraceRecord) == 24, "trace records are written as they are");
+
+    static const int TRACE_CHUNK_RECORDS = 4096;
+
+    struct TraceChunk {
+        // which TraceStream filled it
+        uint32_t stream;
+        uint32_t count;
+        TraceRecord records[TRACE_CHUNK_RECORDS];
+    };
+
+    // A gzip file of chunks filled by TraceStreams and compressed on a thread of its
+    // own. The chunks form a ring: once MAX_CHUNKS are queued the producers wait for
+    // the disk rather than drop records. Subclasses may keep the chunks instead.
+    class TraceWriter {
+
+    public:
+
+        static const int MAX_CHUNKS = 64;
+
+        TraceWriter() { }
+
+        virtual ~TraceWriter();
+
+        bool open(const char *path);
+
+        // write out everything submitted and close the file
+        void close();
+
+        bool isOpen() const {
+            return file != nullptr;
+        }
+
+        // an empty chunk, waits while all of them are queued
+        virtual TraceChunk *acquire();
+
+        // queue a chunk for writing, it comes back through acquire()
+        virtual void submit(TraceChunk *chunk);
+
+    private:
+
+        void run();
+
+        gzFile file = nullptr;
+        std::thread thread;
+        std::mutex mutex;
+        std::condition_variable changed;
+        std::deque<TraceChunk *> queue;
+        std::vector<TraceChunk *> spare;
+        std::vector<TraceChunk *> chunks;
+        bool stopping = false;
+    };
+
+    // The recording side for one thread, e.g. one cpu.
+    class TraceStream {
+
+    public:
+
+        TraceStream(TraceWriter &writer, uint32_t id);
+
+        // submits the records still in hand
+        virtual ~TraceStream();
+
+        // slot for the next record
+        TraceRecord &next() {
+            if (chunk->count == TRACE_CHUNK_RECORDS) {
+                flush();
+            }
+            return chunk->records[chunk->count++];
+        }
+
+        void flush();
+
+    private:
+
+        TraceWriter &writer;
+        uint32_t id;
+        TraceChunk *chunk;
+    };
+
+    // Reads a trace back, chunk by chunk, for the offline tools.
+    class TraceReader {
+
+    public:
+
+        TraceReader() { }
+
+        virtual ~TraceReader();
+
+        bool open(const char *path);
+
+        // the next record of any stream, false at the end of the file
+        bool next(TraceRecord &record, uint32_t &stream);
+
+    private:
+
+        gzFile file = nullptr;
+        TraceChunk chunk;
+        uint32_t position = 0;
+    };
+
+    // nestest.log style: "C000  4C F5 C5  JMP $C5F5  A:00 X:00 Y:00 P:24 SP:FD CYC:7"
+    void formatTraceRecord(const TraceRecord &record, char *line, size_t size);
+}
+
+#endif //NESDROID_TRACE_H
@@ -0,0 +1,85 @@
+#include <algorithm>
+
+#include "WorkerPool.h"
+
+namespace nesdroid {
+
+    static const int MAX_THREADS = 3;
+
+    int WorkerPool::defaultThreads() {
+        int cores = (int) std::thread::hardware_concurrency();
+        return std::max(0, std::min(MAX_THREADS, cores - 1));
+    }
+
+    WorkerPool::WorkerPool(int threads) {
+        for (int i = 0; i < threads; i++) {
+            workers.push_back(std::thread(&WorkerPool::work, this));
+        }
+    }
+
+    WorkerPool::~WorkerPool() {
+        wait();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (auto &worker : workers) {
+            worker.join();
+        }
+    }
+
+    void WorkerPool::dispatch(const Task &task, int count) {
+        if (workers.empty()) {
+            for (int i = 0; i < count; i++) {
+                task(i);
+            }
+            return;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (int i = 0; i < count; i++) {
+                jobs.push_back(Job{task, i});
+            }
+            pending += count;
+        }
+        wake.notify_all();
+    }
+
+    void WorkerPool::wait() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (pending > 0) {
+            if (!runOne(lock)) {
+                done.wait(lock);
+            }
+        }
+    }
+
+    bool WorkerPool::runOne(std::unique_lock<std::mutex> &lock) {
+        if (jobs.empty()) {
+            return false;
+        }
+
+        Job job = jobs.front();
+        jobs.pop_front();
+
+        lock.unlock();
+        job.task(job.index);
+        lock.lock();
+
+        if (--pending == 0) {
+            done.notify_all();
+        }
+        return true;
+    }
+
+    void WorkerPool::work() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (!stopping) {
+            if (!runOne(lock)) {
+                wake.wait(lock);
+            }
+        }
+    }
+}
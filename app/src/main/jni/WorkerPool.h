@@ -0,0 +1,62 @@
+#ifndef NESDROID_WORKERPOOL_H
+#define NESDROID_WORKERPOOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace nesdroid {
+
+    // A few threads that run indexed tasks, e.g. one call per band of the screen.
+    // Tasks may dispatch more tasks; wait() returns once all of them have returned.
+    class WorkerPool {
+
+    public:
+
+        typedef std::function<void(int)> Task;
+
+        // one worker less than the cores, the emulation thread keeps one for itself
+        static int defaultThreads();
+
+        // with 0 threads every task runs inline on the dispatching thread
+        explicit WorkerPool(int threads);
+
+        virtual ~WorkerPool();
+
+        // queue task(0) .. task(count - 1) and return at once
+        void dispatch(const Task &task, int count);
+
+        // run queued tasks on the calling thread too until everything has finished
+        void wait();
+
+        int getThreads() const {
+            return (int) workers.size();
+        }
+
+    private:
+
+        struct Job {
+            Task task;
+            int index;
+        };
+
+        void work();
+
+        // pop and run one job, the lock is released while it runs
+        bool runOne(std::unique_lock<std::mutex> &lock);
+
+        std::vector<std::thread> workers;
+        std::deque<Job> jobs;
+        std::mutex mutex;
+        std::condition_variable wake;
+        std::condition_variable done;
+        // queued plus running jobs
+        int pending = 0;
+        bool stopping = false;
+    };
+}
+
+#endif //NESDROID_WORKERPOOL_H
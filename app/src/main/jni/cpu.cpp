@@ -3,15 +3,12 @@
 //
 
 #include "cpu.h"
+#include "CodeMap.h"
+#include "Debugger.h"
+#include "Trace.h"
 
 namespace nesdroid {
 
-    // pagesDiffer returns true if the two addresses reference different pages
-    static inline bool pagesDiffer(const addr_t &a, const addr_t &b) const {
-        return (a & 0xFF00) != (b & 0xFF00);
-    }
-
-
     void Cpu::pcGoto(const Context &context) {
         PC = context.address;
         cycles++;
@@ -29,6 +26,66 @@ namespace nesdroid {
         CF = a >= b;
     }
 
+    void Cpu::reset() {
+        ACC = X = Y = 0;
+        SP = INIT_SP;
+        setProcessorStatus(0);
+        IF = 1;
+        stallCycle = 0;
+        interrupt = NONE;
+        irqLine = 0;
+        onResetInterrupt();
+    }
+
+    void Cpu::save(State &state) const {
+        state.put(cycles);
+        state.put(interrupt);
+        state.put(irqLine);
+        state.put(stallCycle);
+        state.put(ACC);
+        state.put(X);
+        state.put(Y);
+        state.put(SP);
+        state.put(PC);
+        state.put(CF);
+        state.put(ZF);
+        state.put(IF);
+        state.put(DF);
+        state.put(BF);
+        state.put(VF);
+        state.put(NF);
+        memory.save(state);
+    }
+
+    void Cpu::load(State &state) {
+        state.get(cycles);
+        state.get(interrupt);
+        state.get(irqLine);
+        state.get(stallCycle);
+        state.get(ACC);
+        state.get(X);
+        state.get(Y);
+        state.get(SP);
+        state.get(PC);
+        state.get(CF);
+        state.get(ZF);
+        state.get(IF);
+        state.get(DF);
+        state.get(BF);
+        state.get(VF);
+        state.get(NF);
+        memory.load(state);
+    }
+
+    void Cpu::getRegisters(Registers &registers) {
+        registers.pc = PC;
+        registers.a = ACC;
+        registers.x = X;
+        registers.y = Y;
+        registers.sp = SP;
+        registers.p = getProcessorStatus();
+    }
+
     void Cpu::onResetInterrupt() {
         PC = memory.readDoubleByte(0xFFFC);
         //TODO
@@ -51,22 +108,23 @@ namespace nesdroid {
     }
 
 
+    // N V 1 B D I Z C, the unused bit always reads as set
     byte Cpu::getProcessorStatus() {
-        return (byte) (CF << 7 || ZF << 6 || IF << 5 || DF << 4 || BF << 3 || VF << 1 || NF);
+        return (byte) (NF << 7 | VF << 6 | 0x20 | BF << 4 | DF << 3 | IF << 2 | ZF << 1 | CF);
     }
 
     void Cpu::setProcessorStatus(byte flags) {
-        CF = flags >> 7;
-        ZF = flags >> 6;
-        IF = flags >> 5;
-        DF = flags >> 4;
-        BF = flags >> 4;
-        VF = flags >> 2;
-        NF = flags >> 1;
+        CF = (flags & 0x01) != 0;
+        ZF = (flags & 0x02) != 0;
+        IF = (flags & 0x04) != 0;
+        DF = (flags & 0x08) != 0;
+        BF = (flags & 0x10) != 0;
+        VF = (flags & 0x40) != 0;
+        NF = (flags & 0x80) != 0;
     }
 
     void Cpu::setZN(const byte &value) {
-        NF = (value & 0x80) == 1;
+        NF = (value & 0x80) != 0;
         ZF = value == 0;
     }
 
@@ -92,11 +150,16 @@ namespace nesdroid {
 
     uint64_t Cpu::excuse() {
 
+        // DMA owns the bus: the whole stall passes as one step
         if (stallCycle > 0) {
-            --stallCycle;
-            return 1;
+            uint64_t stalled = stallCycle;
+            stallCycle = 0;
+            cycles += stalled;
+            return stalled;
         }
 
+        uint64_t startCycles = cycles;
+
 
         switch (interrupt) {
 
@@ -113,11 +176,33 @@ namespace nesdroid {
                 break;
         }
 
+        // an NMI just taken set I, so the IRQ waits for its RTI
+        if (irqLine != 0 && !IF) {
+            onMaskableInterrupt();
+        }
+
         interrupt = NONE;
 
+        // recompiled: nothing to decode; the traps and the trace need the interpreter
+        if (native != nullptr && trace == nullptr
+            && (memory.traps[PC >> 8] | memory.traps[(addr_t) (PC + 2) >> 8]) == 0) {
+            NativeOp op = native->lookup(memory.mapper, PC);
+            if (op != nullptr) {
+                nativeInstructions++;
+                op(*this);
+                return this->cycles - startCycles;
+            }
+        }
 
         byte optCode = memory.read(PC);
 
+        // breakpoints and stepping only cost this lookup
+        if ((memory.traps[PC >> 8] & ACCESS_EXECUTE) && memory.debugger->onExecute(PC, optCode)) {
+            return this->cycles - startCycles;
+        }
+
+        instructions++;
+
         const char *name = InstructionNameTable[optCode];
         opt const pOperation = InstructionTable[optCode];
         byte cycle = InstructionCycleTable[optCode];
@@ -164,10 +249,11 @@ namespace nesdroid {
             case IMMEDIATE:
                 address = nextPC;
                 break;
-            case RELATIVE:
+            case RELATIVE: {
                 dbyte offset = memory.readDoubleByte(nextPC);
                 address = (addr_t) (PC + 2 + offset + (offset < 0x80 ? 0 : -0x100));
                 break;
+            }
             case INDEXED_INDIRECT:
                 address = memory.readDoubleByteBugly(memory.readDoubleByte(nextPC) + X);
                 break;
@@ -180,19 +266,38 @@ namespace nesdroid {
         }
 
 
+        if (codeMap != nullptr) {
+            codeMap->logInstruction(memory.mapper, PC, optCode, address);
+        }
+
+        if (trace != nullptr) {
+            TraceRecord &record = trace->next();
+            record.cycle = cycles;
+            record.pc = PC;
+            record.address = address;
+            record.opcode = optCode;
+            record.operands[0] = instructionLength > 1 ? memory.read(nextPC) : (byte) 0;
+            record.operands[1] = instructionLength > 2 ? memory.read((addr_t) (PC + 2)) : (byte) 0;
+            record.a = ACC;
+            record.x = X;
+            record.y = Y;
+            record.p = getProcessorStatus();
+            record.sp = SP;
+        }
+
         PC += instructionLength;
         this->cycles += cycle;
 
         if (pageCrossed) {
-            this->cycles = pageCycle;
+            this->cycles += pageCycle;
         }
 
         if (pOperation != nullptr) {
             const Context context = {address, PC, addressingMode};
-            this->(*pOperation)(context);
+            (this->*pOperation)(context);
         }
 
-        return this->cycles - cycle;
+        return this->cycles - startCycles;
     }
 
     // ADC - Add with Carry
@@ -6,7 +6,9 @@
 #define NESDROID_CPU_H
 
 #include "commons.h"
-#include "memory.h"
+#include "Memory.h"
+#include "Native.h"
+#include "State.h"
 
 
 
@@ -15,12 +17,16 @@ namespace nesdroid {
 
     static const byte INIT_SP = 0xFF;
     static const addr_t STACK_BASE = 0x100;
-    typedef void (Cpu::*opt)(const Context &context);
 
     static inline byte bcd(byte value){
         return (byte) ((value >> 4) * 10 + (value & 0xf));
     }
 
+    // pagesDiffer returns true if the two addresses reference different pages
+    static inline bool pagesDiffer(const addr_t &a, const addr_t &b) {
+        return (a & 0xFF00) != (b & 0xFF00);
+    }
+
 
     enum AddressingMode {
         ZERO_PAGE = 0,
@@ -46,6 +52,13 @@ namespace nesdroid {
         RESET = 2
     };
 
+    // devices that can hold the IRQ line low, see Cpu::setIrqLine()
+    enum IrqSource {
+        IRQ_MAPPER = 1,
+        IRQ_FRAME_COUNTER = 2,
+        IRQ_DMC = 4
+    };
+
 
     struct Context{
         addr_t address;
@@ -53,6 +66,21 @@ namespace nesdroid {
         AddressingMode mode;
     };
 
+    // register file as shown by the debugger
+    struct Registers {
+        addr_t pc;
+        byte a;
+        byte x;
+        byte y;
+        byte sp;
+        byte p;
+    };
+
+    class CodeMap;
+    class Cpu;
+    class TraceStream;
+    typedef void (Cpu::*opt)(const Context &context);
+
 
     class Cpu {
 
@@ -62,34 +90,45 @@ namespace nesdroid {
 
         CpuMemory memory;
 
-        uint64_t cycles;
+        uint64_t cycles = 0;
         Interrupt interrupt = NONE;
-        uint64_t stallCycle;
+        byte irqLine = 0;   // IrqSource bits asserting IRQ
+        uint64_t stallCycle = 0;
+
+        // not part of the state
+        TraceStream *trace = nullptr;
+        CodeMap *codeMap = nullptr;
+        const NativeCode *native = nullptr;
+        uint64_t nativeInstructions = 0;
+        bool halted = false;
+        uint64_t instructions = 0;
+        uint64_t stalls = 0;
+        uint64_t stalledCycles = 0;
 
         ///////////Registers///////////
-        byte ACC;
+        byte ACC = 0;
 
-        byte X;
-        byte Y;
+        byte X = 0;
+        byte Y = 0;
 
         //Stack Pointer, 8bit, it decrease when push
         //Stack at memory locations $0100-$01FF
         byte SP = INIT_SP;
 
         //Program Counter, 16bit, point next instruction address
-        addr_t PC;
+        addr_t PC = 0;
 
         //Processor Status
         // 7 6 5 4 3 2 1 0
         // N V   B D I Z C
-        bit CF; //Carry Flag
-        bit ZF; //Zero Flag
-        bit IF; //Interrupt Disable
-        bit DF; //Decimal Mode
-        bit BF; //Break Command
+        bit CF = 0; //Carry Flag
+        bit ZF = 0; //Zero Flag
+        bit IF = 0; //Interrupt Disable
+        bit DF = 0; //Decimal Mode
+        bit BF = 0; //Break Command
         //  --; //Empty
-        bit VF; //Overflow Flag
-        bit NF; //Negative Flag
+        bit VF = 0; //Overflow Flag
+        bit NF = 0; //Negative Flag
 
     public:
 
@@ -100,6 +139,92 @@ namespace nesdroid {
 
         uint64_t excuse();
 
+        // power-on / reset button, PC is loaded from the reset vector
+        void reset();
+
+        // NMI and reset are edges taken before the next instruction
+        void triggerInterrupt(Interrupt interrupt) {
+            this->interrupt = interrupt;
+        }
+
+        // IRQ is a level: a source holds it until the game acknowledges it, and
+        // it is taken before any instruction that starts with the I flag clear
+        void setIrqLine(IrqSource source, bool asserted) {
+            irqLine = (byte) (asserted ? irqLine | source : irqLine & ~source);
+        }
+
+        bool isIrqAsserted(IrqSource source) const {
+            return (irqLine & source) != 0;
+        }
+
+        // halt the cpu for the given cycles, e.g. while DMA owns the bus
+        void stall(uint64_t cycles) {
+            stallCycle += cycles;
+            stalls++;
+            stalledCycles += cycles;
+        }
+
+        CpuMemory &getMemory() {
+            return memory;
+        }
+
+        uint64_t getCycles() const {
+            return cycles;
+        }
+
+        addr_t getPC() const {
+            return PC;
+        }
+
+        void getRegisters(Registers &registers);
+
+        // stopped by the debugger: the console runs no further instructions
+        void setHalted(bool halted) {
+            this->halted = halted;
+        }
+
+        bool isHalted() const {
+            return halted;
+        }
+
+        // record every instruction from now on, nullptr to stop
+        void setTrace(TraceStream *trace) {
+            this->trace = trace;
+        }
+
+        // log every instruction run from PRG ROM into codeMap, nullptr to stop
+        void setCodeMap(CodeMap *codeMap) {
+            this->codeMap = codeMap;
+        }
+
+        // run what native translated instead of interpreting it, nullptr to stop
+        void setNativeCode(const NativeCode *native) {
+            this->native = native;
+        }
+
+        // instructions run through the plugin so far, never reset
+        uint64_t getNativeInstructions() const {
+            return nativeInstructions;
+        }
+
+        // The instruction at PC as tools/recompile.cpp translated it: opcode and
+        // the two bytes after it, as they are in PRG ROM, are constants, the rest
+        // goes exactly as in excuse(). Only called for pages without traps.
+        template<byte opcode>
+        void runNative(dbyte operand);
+
+        // instructions and DMA stalls since the last call, for the metrics
+        void takeCounters(uint64_t &instructions, uint64_t &stalls, uint64_t &stalledCycles) {
+            instructions = this->instructions;
+            stalls = this->stalls;
+            stalledCycles = this->stalledCycles;
+            this->instructions = this->stalls = this->stalledCycles = 0;
+        }
+
+        void save(State &state) const;
+
+        void load(State &state);
+
 
         void push(byte value);
 
@@ -462,6 +587,64 @@ namespace nesdroid {
             0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
             1, 1, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 1, 1, 0, 0,
     };
+
+    // addressing as excuse() does it, with the reads of the operand bytes folded into operand
+    template<byte opcode>
+    inline void Cpu::runNative(dbyte operand) {
+        instructions++;
+
+        addr_t address = 0;
+        bool pageCrossed = false;
+        switch (AddressingModeTable[opcode]) {
+            case ZERO_PAGE:
+                address = (byte) operand;
+                break;
+            case ZERO_PAGE_X:
+                address = (byte) operand + X;
+                break;
+            case ZERO_PAGE_Y:
+                address = (byte) operand + Y;
+                break;
+            case ABSOLUTE:
+                address = operand;
+                break;
+            case ABSOLUTE_X:
+                address = operand + X;
+                pageCrossed = pagesDiffer(address - X, address);
+                break;
+            case ABSOLUTE_Y:
+                address = operand + Y;
+                pageCrossed = pagesDiffer(address - Y, address);
+                break;
+            case INDIRECT:
+                address = memory.readDoubleByteBugly(operand);
+                break;
+            case IMMEDIATE:
+                address = (addr_t) (PC + 1);
+                break;
+            case RELATIVE:
+                address = (addr_t) (PC + 2 + operand + (operand < 0x80 ? 0 : -0x100));
+                break;
+            case INDEXED_INDIRECT:
+                address = memory.readDoubleByteBugly(operand + X);
+                break;
+            case INDIRECT_INDEXED:
+                address = memory.readDoubleByteBugly(operand) + Y;
+                pageCrossed = pagesDiffer(address - Y, address);
+                break;
+            default:
+                break;
+        }
+
+        PC += InstructionLengthTable[opcode];
+        cycles += InstructionCycleTable[opcode];
+        if (pageCrossed) {
+            cycles += InstructionPageCycleTable[opcode];
+        }
+
+        const Context context = {address, PC, AddressingModeTable[opcode]};
+        (this->*InstructionTable[opcode])(context);
+    }
 }
 
 #endif //NESDROID_CPU_H
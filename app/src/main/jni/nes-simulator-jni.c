@@ -1,22 +0,0 @@
-#include <jni.h>
-
-JNIEXPORT void JNICALL
-Java_org_sssta_nesdroid_Nes_init(JNIEnv *env, jobject instance) {
-
-    // TODO
-
-}
-
-JNIEXPORT void JNICALL
-Java_org_sssta_nesdroid_Nes_reset(JNIEnv *env, jobject instance) {
-
-    // TODO
-
-}
-
-JNIEXPORT void JNICALL
-Java_org_sssta_nesdroid_Nes_release(JNIEnv *env, jobject instance) {
-
-    // TODO
-
-}
\ No newline at end of file
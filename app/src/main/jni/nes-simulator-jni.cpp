@@ -0,0 +1,581 @@
+#include <jni.h>
+#include <cmath>
+#include <mutex>
+#include <android/native_window.h>
+#include <android/native_window_jni.h>
+
+#include "Console.h"
+#include "Filter.h"
+#include "Input.h"
+#include "Metrics.h"
+#include "Palette.h"
+#include "RomLoader.h"
+#include "Throttle.h"
+
+using namespace nesdroid;
+
+static Console *console = nullptr;
+static Throttle *throttle = nullptr;
+static Palette palette;
+// outlives the consoles, so buttons held across a rom load stay held
+static Input input;
+static FilterPipeline *pipeline = nullptr;
+static RomLoader *loader = nullptr;
+static ROM *rom = nullptr;
+// held by whichever thread uses the console, the throttle, the rom or the filters'
+// input; the emulation thread lets go of it only while it sleeps between frames
+static std::mutex consoleMutex;
+
+static bool isFiltered() {
+    return pipeline->getFilter() != FILTER_NEAREST || pipeline->getScale() != 1;
+}
+
+// copy the last completed frame into `pixels`, lines `stride` bytes apart
+static void convertFrontBuffer(void *pixels, int stride, PixelFormat format) {
+    palette.convertFrame(console->getFrontBuffer(), console->getFrontEmphasis(), pixels, stride, format);
+}
+
+// emulation thread with consoleMutex held: switch to the console the loader
+// prepared, keeping the settings
+static void adoptLoadedRom() {
+    ROM *loadedRom;
+    Console *loaded = loader->take(loadedRom);
+    loaded->setPipelined(console->isPipelined());
+    loaded->setInput(&input);
+    float speed = throttle->getSpeed();
+
+    delete throttle;
+    delete console;
+    delete rom;
+    console = loaded;
+    rom = loadedRom;
+    throttle = new Throttle(*console);
+    throttle->setSpeed(speed);
+}
+
+extern "C" {
+
+JNIEXPORT void JNICALL
+Java_org_sssta_nesdroid_Nes_init(JNIEnv *env, jobject instance) {
+
+    std::lock_guard<std::mutex> lock(consoleMutex);
+    if (console == nullptr) {
+        console = new Console();
+        console->setInput(&input);
+        throttle = new Throttle(*console);
+        pipeline = new FilterPipeline(palette);
+        loader = new RomLoader();
+    }
+
+}
+
+// Start loading a .nes, .zip or .gz rom in the background and return at once.
+// Poll getLoadStatus(); the emulation thread switches to it in runFrame().
+JNIEXPORT jboolean JNICALL
+Java_org_sssta_nesdroid_Nes_loadRom(JNIEnv *env, jobject instance, jstring path) {
+
+    std::lock_guard<std::mutex> lock(consoleMutex);
+    if (loader == nullptr) {
+        return JNI_FALSE;
+    }
+    const char *chars = env->GetStringUTFChars(path, nullptr);
+    bool started = loader->start(chars, console->getSavePath(), console->getCodeCacheDirectory());
+    env->ReleaseStringUTFChars(path, chars);
+    return (jboolean) started;
+
+}
+
+JNIEXPORT jint JNICALL
+Java_org_sssta_nesdroid_Nes_getLoadStatus(JNIEnv *env, jobject instance) {
+
+    // release() deletes the loader under the lock
+    std::lock_guard<std::mutex> lock(consoleMutex);
+    return loader != nullptr ? loader->getStatus() : RomLoader::LOAD_IDLE;
+
+}
+
+JNIEXPORT void JNICALL
+Java_org_sssta_nesdroid_Nes_reset(JNIEnv *env, jobject instance) {
+
+    std::lock_guard<std::mutex> lock(consoleMutex);
+    if (console != nullptr) {
+        console->reset();
+    }
+
+}
+
+// any thread: buttons of a pad (bit n is button n) as of eventTime, in
+// SystemClock.uptimeMillis() time as MotionEvent.getEventTime(); 0 for now.
+// The game sees them at its next strobe of $4016.
+JNIEXPORT void JNICALL
+Java_org_sssta_nesdroid_Nes_setButtons(JNIEnv *env, jobject instance, jint port, jint buttons, jlong eventTime) {
+
+    // uptimeMillis() and Metrics::now() both count CLOCK_MONOTONIC
+    uint64_t time = eventTime > 0 ? (uint64_t) eventTime * 1000000 : Metrics::now();
+    input.setButtons(port, (byte) buttons, time);
+
+}
+
+// emulation thread: run the frames that are due and hand a rendered one to the filters,
+// which work on it while the next frames are emulated
+JNIEXPORT jboolean JNICALL
+Java_org_sssta_nesdroid_Nes_runFrame(JNIEnv *env, jobject instance) {
+
+    uint64_t wakeTime;
+    jboolean rendered;
+    {
+        std::lock_guard<std::mutex> lock(consoleMutex);
+        if (loader != nullptr && loader->getStatus() == RomLoader::LOAD_READY) {
+            adoptLoadedRom();
+        }
+        if (console == nullptr || console->getRom() == nullptr) {
+            return JNI_FALSE;
+        }
+
+        rendered = (jboolean) throttle->run();
+        if (rendered == JNI_TRUE && isFiltered()) {
+            pipeline->submit(console->getFrontBuffer(), console->getFrontEmphasis());
+        }
+        wakeTime = throttle->getWakeTime();
+    }
+    // the UI gets the console while this thread is ahead of schedule
+    Throttle::sleepUntil(wakeTime);
+    return rendered;
+
+}
+
+// 1 is real time, above fast forwards at that multiplier, 0 runs uncapped
+JNIEXPORT void JNICALL
+Java_org_sssta_nesdroid_Nes_setSpeed(JNIEnv *env, jobject instance, jfloat speed) {
+
+    std::lock_guard<std::mutex> lock(consoleMutex);
+    if (throttle != nullptr) {
+        throttle->setSpeed(speed);
+    }
+
+}
+
+// draw frames on a second thread, a frame behind the emulation
+JNIEXPORT void JNICALL
+Java_org_sssta_nesdroid_Nes_setPipelined(JNIEnv *env, jobject instance, jboolean pipelined) {
+
+    std::lock_guard<std::mutex> lock(consoleMutex);
+    if (console != nullptr) {
+        console->setPipelined(pipelined == JNI_TRUE);
+    }
+
+}
+
+JNIEXPORT void JNICALL
+Java_org_sssta_nesdroid_Nes_setFilter(JNIEnv *env, jobject instance, jint type, jint scale) {
+
+    // render() sizes the window for the filter before it presents
+    std::lock_guard<std::mutex> lock(consoleMutex);
+    if (pipeline != nullptr) {
+        pipeline->setFilter((FilterType) type, scale);
+    }
+
+}
+
+// nanoseconds per frame for every filter, nearest at 2x
+JNIEXPORT jlongArray JNICALL
+Java_org_sssta_nesdroid_Nes_benchmarkFilters(JNIEnv *env, jobject instance, jint frames) {
+
+    jlong costs[FILTER_COUNT] = {0};
+    std::lock_guard<std::mutex> lock(consoleMutex);
+    if (pipeline != nullptr) {
+        for (int type = 0; type < FILTER_COUNT; type++) {
+            costs[type] = (jlong) pipeline->benchmark((FilterType) type, 2, frames);
+            LOG("Filter %d: %lld ns per frame\n", type, (long long) costs[type]);
+        }
+    }
+
+    jlongArray result = env->NewLongArray(FILTER_COUNT);
+    env->SetLongArrayRegion(result, 0, FILTER_COUNT, costs);
+    return result;
+
+}
+
+JNIEXPORT void JNICALL
+Java_org_sssta_nesdroid_Nes_release(JNIEnv *env, jobject instance) {
+
+    std::lock_guard<std::mutex> lock(consoleMutex);
+    // waits for a load still running
+    delete loader;
+    delete pipeline;
+    delete throttle;
+    delete console;
+    delete rom;
+    loader = nullptr;
+    pipeline = nullptr;
+    throttle = nullptr;
+    console = nullptr;
+    rom = nullptr;
+
+}
+
+JNIEXPORT jboolean JNICALL
+Java_org_sssta_nesdroid_Nes_render(JNIEnv *env, jobject instance, jobject surface) {
+
+    std::lock_guard<std::mutex> lock(consoleMutex);
+    if (console == nullptr) {
+        return JNI_FALSE;
+    }
+
+    ANativeWindow *window = ANativeWindow_fromSurface(env, surface);
+    if (window == nullptr) {
+        return JNI_FALSE;
+    }
+
+    int32_t format = ANativeWindow_getFormat(window);
+    if (format != WINDOW_FORMAT_RGB_565) {
+        format = WINDOW_FORMAT_RGBA_8888;
+    }
+    PixelFormat pixelFormat = (PixelFormat) format;
+    bool filtered = isFiltered();
+    if (filtered && pipeline->getFormat() != pixelFormat) {
+        pipeline->setFormat(pixelFormat);
+    }
+    ANativeWindow_setBuffersGeometry(window, pipeline->getWidth(), pipeline->getHeight(), format);
+
+    uint64_t start = Metrics::now();
+    ANativeWindow_Buffer buffer;
+    jboolean result = JNI_FALSE;
+    if (ANativeWindow_lock(window, &buffer, nullptr) == 0) {
+        int stride = buffer.stride * bytesPerPixel(pixelFormat);
+        if (!filtered) {
+            convertFrontBuffer(buffer.bits, stride, pixelFormat);
+            result = JNI_TRUE;
+        } else {
+            result = (jboolean) pipeline->present(buffer.bits, stride);
+        }
+        ANativeWindow_unlockAndPost(window);
+    }
+    uint64_t end = Metrics::now();
+    Metrics::add(COUNTER_PRESENT_NANOS, end - start);
+    if (result == JNI_TRUE) {
+        input.onPresent(end);
+    }
+
+    ANativeWindow_release(window);
+    return result;
+
+}
+
+JNIEXPORT jboolean JNICALL
+Java_org_sssta_nesdroid_Nes_renderToBuffer(JNIEnv *env, jobject instance, jobject buffer, jint stride,
+                                           jint format) {
+
+    std::lock_guard<std::mutex> lock(consoleMutex);
+    if (console == nullptr) {
+        return JNI_FALSE;
+    }
+
+    void *pixels = env->GetDirectBufferAddress(buffer);
+    jlong capacity = env->GetDirectBufferCapacity(buffer);
+    PixelFormat pixelFormat = format == PIXEL_FORMAT_RGB_565 ? PIXEL_FORMAT_RGB_565 : PIXEL_FORMAT_RGBA_8888;
+    if (pixels == nullptr || stride < SCREEN_WIDTH * bytesPerPixel(pixelFormat)
+        || capacity < (jlong) stride * SCREEN_HEIGHT) {
+        return JNI_FALSE;
+    }
+
+    uint64_t start = Metrics::now();
+    convertFrontBuffer(pixels, stride, pixelFormat);
+    uint64_t end = Metrics::now();
+    Metrics::add(COUNTER_PRESENT_NANOS, end - start);
+    input.onPresent(end);
+    return JNI_TRUE;
+
+}
+
+// save file for battery backed PRG-RAM, used from the next rom on
+JNIEXPORT void JNICALL
+Java_org_sssta_nesdroid_Nes_setSavePath(JNIEnv *env, jobject instance, jstring path) {
+
+    std::lock_guard<std::mutex> lock(consoleMutex);
+    if (console == nullptr) {
+        return;
+    }
+    const char *chars = env->GetStringUTFChars(path, nullptr);
+    console->setSavePath(chars);
+    env->ReleaseStringUTFChars(path, chars);
+
+}
+
+// directory for the code maps of the roms loaded from now on, e.g. the cache dir
+JNIEXPORT void JNICALL
+Java_org_sssta_nesdroid_Nes_setCodeCacheDirectory(JNIEnv *env, jobject instance, jstring directory) {
+
+    std::lock_guard<std::mutex> lock(consoleMutex);
+    if (console == nullptr) {
+        return;
+    }
+    const char *chars = env->GetStringUTFChars(directory, nullptr);
+    console->setCodeCacheDirectory(chars);
+    env->ReleaseStringUTFChars(directory, chars);
+
+}
+
+// the plugin recompiled for the running rom from directory, see Console::loadNativeCode
+JNIEXPORT jboolean JNICALL
+Java_org_sssta_nesdroid_Nes_loadNativeCode(JNIEnv *env, jobject instance, jstring directory) {
+
+    std::lock_guard<std::mutex> lock(consoleMutex);
+    if (console == nullptr || console->getNativeCode() == nullptr) {
+        return JNI_FALSE;
+    }
+    const char *chars = env->GetStringUTFChars(directory, nullptr);
+    bool loaded = console->loadNativeCode(console->getNativeCode()->pathIn(chars));
+    env->ReleaseStringUTFChars(directory, chars);
+    return (jboolean) loaded;
+
+}
+
+// going to the background: wait until the saves written so far are on disk
+JNIEXPORT void JNICALL
+Java_org_sssta_nesdroid_Nes_syncSaveRam(JNIEnv *env, jobject instance) {
+
+    std::lock_guard<std::mutex> lock(consoleMutex);
+    if (console != nullptr) {
+        console->syncSaveRam();
+    }
+
+}
+
+// Game Genie or raw "AAAA:VV" / "AAAA?CC:VV" code, false if not understood
+JNIEXPORT jboolean JNICALL
+Java_org_sssta_nesdroid_Nes_addCheat(JNIEnv *env, jobject instance, jstring code) {
+
+    std::lock_guard<std::mutex> lock(consoleMutex);
+    if (console == nullptr) {
+        return JNI_FALSE;
+    }
+    const char *chars = env->GetStringUTFChars(code, nullptr);
+    bool added = console->addCheat(chars);
+    env->ReleaseStringUTFChars(code, chars);
+    return (jboolean) added;
+
+}
+
+JNIEXPORT void JNICALL
+Java_org_sssta_nesdroid_Nes_clearCheats(JNIEnv *env, jobject instance) {
+
+    std::lock_guard<std::mutex> lock(consoleMutex);
+    if (console != nullptr) {
+        console->clearCheats();
+    }
+
+}
+
+// ---- debugger, see Debugger.h; runFrame() stops emulating while paused ----
+
+JNIEXPORT jint JNICALL
+Java_org_sssta_nesdroid_Nes_addBreakpoint(JNIEnv *env, jobject instance, jint pc) {
+
+    std::lock_guard<std::mutex> lock(consoleMutex);
+    return console != nullptr ? console->getDebugger().addBreakpoint((addr_t) pc) : -1;
+
+}
+
+JNIEXPORT jint JNICALL
+Java_org_sssta_nesdroid_Nes_addWatchpoint(JNIEnv *env, jobject instance, jint space, jint first, jint last,
+                                          jint access) {
+
+    std::lock_guard<std::mutex> lock(consoleMutex);
+    if (console == nullptr) {
+        return -1;
+    }
+    return console->getDebugger().addWatchpoint(space, (addr_t) first, (addr_t) last, access);
+
+}
+
+JNIEXPORT jboolean JNICALL
+Java_org_sssta_nesdroid_Nes_removeWatch(JNIEnv *env, jobject instance, jint id) {
+
+    std::lock_guard<std::mutex> lock(consoleMutex);
+    return (jboolean) (console != nullptr && console->getDebugger().remove(id));
+
+}
+
+// 0 pause, 1 resume, 2 step into, 3 step over
+JNIEXPORT void JNICALL
+Java_org_sssta_nesdroid_Nes_debugControl(JNIEnv *env, jobject instance, jint command) {
+
+    std::lock_guard<std::mutex> lock(consoleMutex);
+    if (console == nullptr) {
+        return;
+    }
+    Debugger &debugger = console->getDebugger();
+    switch (command) {
+        case 0:
+            debugger.pause();
+            break;
+        case 1:
+            debugger.resume();
+            break;
+        case 2:
+            debugger.stepInto();
+            break;
+        case 3:
+            debugger.stepOver();
+            break;
+        default:
+            break;
+    }
+
+}
+
+// null while running, else pc, a, x, y, sp, p, then the space, address, access and value of the hit
+JNIEXPORT jintArray JNICALL
+Java_org_sssta_nesdroid_Nes_getDebugState(JNIEnv *env, jobject instance) {
+
+    std::lock_guard<std::mutex> lock(consoleMutex);
+    if (console == nullptr || !console->getDebugger().isPaused()) {
+        return nullptr;
+    }
+    Registers registers;
+    console->getCpuRegisters(registers);
+    DebugHit hit = console->getDebugger().getHit();
+    jint values[] = {registers.pc, registers.a, registers.x, registers.y, registers.sp, registers.p,
+                     hit.space, hit.address, hit.access, hit.value};
+    const int size = sizeof(values) / sizeof(values[0]);
+
+    jintArray result = env->NewIntArray(size);
+    env->SetIntArrayRegion(result, 0, size, values);
+    return result;
+
+}
+
+// record every instruction into a compressed binary trace, see tools/nestrace.cpp
+JNIEXPORT jboolean JNICALL
+Java_org_sssta_nesdroid_Nes_startTrace(JNIEnv *env, jobject instance, jstring path) {
+
+    std::lock_guard<std::mutex> lock(consoleMutex);
+    if (console == nullptr) {
+        return JNI_FALSE;
+    }
+    const char *chars = env->GetStringUTFChars(path, nullptr);
+    bool started = console->startTrace(chars);
+    env->ReleaseStringUTFChars(path, chars);
+    return (jboolean) started;
+
+}
+
+JNIEXPORT void JNICALL
+Java_org_sssta_nesdroid_Nes_stopTrace(JNIEnv *env, jobject instance) {
+
+    std::lock_guard<std::mutex> lock(consoleMutex);
+    if (console != nullptr) {
+        console->stopTrace();
+    }
+
+}
+
+// record frames and audio to <basePath>.y4m or <basePath>-NNNNNN.png, and <basePath>.wav
+JNIEXPORT jboolean JNICALL
+Java_org_sssta_nesdroid_Nes_startCapture(JNIEnv *env, jobject instance, jstring basePath, jint format) {
+
+    std::lock_guard<std::mutex> lock(consoleMutex);
+    if (console == nullptr) {
+        return JNI_FALSE;
+    }
+    const char *chars = env->GetStringUTFChars(basePath, nullptr);
+    bool started = console->startCapture(chars, format);
+    env->ReleaseStringUTFChars(basePath, chars);
+    return (jboolean) started;
+
+}
+
+// frames written, repeated and dropped; null if no capture was running
+JNIEXPORT jlongArray JNICALL
+Java_org_sssta_nesdroid_Nes_stopCapture(JNIEnv *env, jobject instance) {
+
+    std::lock_guard<std::mutex> lock(consoleMutex);
+    uint64_t frames, repeated, dropped;
+    if (console == nullptr || !console->stopCapture(frames, repeated, dropped)) {
+        return nullptr;
+    }
+    jlong values[] = {(jlong) frames, (jlong) repeated, (jlong) dropped};
+    jlongArray result = env->NewLongArray(3);
+    env->SetLongArrayRegion(result, 0, 3, values);
+    return result;
+
+}
+
+// counters, wall time, frame time p50/p95/p99, input latency p50/p95/p99, reads and
+// writes per register, then the throttle's speeds and frames, laid out as the
+// METRIC_* constants of Nes
+JNIEXPORT jlongArray JNICALL
+Java_org_sssta_nesdroid_Nes_getMetrics(JNIEnv *env, jobject instance) {
+
+    MetricsSnapshot snapshot;
+    Metrics::snapshot(snapshot);
+
+    const int size = COUNTER_COUNT + 7 + 2 * MMIO_REGISTERS + 4;
+    jlong values[size];
+    int n = 0;
+    for (int i = 0; i < COUNTER_COUNT; i++) {
+        values[n++] = (jlong) snapshot.counters[i];
+    }
+    values[n++] = (jlong) snapshot.wallNanos;
+    values[n++] = (jlong) snapshot.percentile(0.50);
+    values[n++] = (jlong) snapshot.percentile(0.95);
+    values[n++] = (jlong) snapshot.percentile(0.99);
+    values[n++] = (jlong) snapshot.latencyPercentile(0.50);
+    values[n++] = (jlong) snapshot.latencyPercentile(0.95);
+    values[n++] = (jlong) snapshot.latencyPercentile(0.99);
+    for (int i = 0; i < MMIO_REGISTERS; i++) {
+        values[n++] = (jlong) snapshot.mmioReads[i];
+    }
+    for (int i = 0; i < MMIO_REGISTERS; i++) {
+        values[n++] = (jlong) snapshot.mmioWrites[i];
+    }
+    {
+        std::lock_guard<std::mutex> lock(consoleMutex);
+        bool running = throttle != nullptr;
+        values[n++] = running ? (jlong) lroundf(throttle->getSpeed() * 1000) : 0;
+        values[n++] = running ? (jlong) lroundf(throttle->getAchievedSpeed() * 1000) : 0;
+        values[n++] = running ? (jlong) throttle->getRenderedFrames() : 0;
+        values[n++] = running ? (jlong) throttle->getSkippedFrames() : 0;
+    }
+
+    jlongArray result = env->NewLongArray(size);
+    env->SetLongArrayRegion(result, 0, size, values);
+    return result;
+
+}
+
+// inputs per millisecond of latency from event to present, the last bucket takes the slower ones
+JNIEXPORT jlongArray JNICALL
+Java_org_sssta_nesdroid_Nes_getInputLatencyHistogram(JNIEnv *env, jobject instance) {
+
+    MetricsSnapshot snapshot;
+    Metrics::snapshot(snapshot);
+
+    jlong values[LATENCY_BUCKETS];
+    for (int i = 0; i < LATENCY_BUCKETS; i++) {
+        values[i] = (jlong) snapshot.inputLatencies[i];
+    }
+    jlongArray result = env->NewLongArray(LATENCY_BUCKETS);
+    env->SetLongArrayRegion(result, 0, LATENCY_BUCKETS, values);
+    return result;
+
+}
+
+JNIEXPORT jstring JNICALL
+Java_org_sssta_nesdroid_Nes_dumpMetrics(JNIEnv *env, jobject instance) {
+
+    std::string report = Metrics::format();
+    LOG("%s", report.c_str());
+    return env->NewStringUTF(report.c_str());
+
+}
+
+JNIEXPORT void JNICALL
+Java_org_sssta_nesdroid_Nes_resetMetrics(JNIEnv *env, jobject instance) {
+
+    Metrics::reset();
+
+}
+
+}
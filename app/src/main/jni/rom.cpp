@@ -2,31 +2,70 @@
 // Created by Cauchywei on 16/5/7.
 //
 
+#include <cstring>
+
 #include "rom.h"
+#include "RomStore.h"
+
+static const uint64_t FNV_OFFSET_BASIS = 0xcbf29ce484222325ULL;
+static const uint64_t FNV_PRIME = 0x100000001b3ULL;
+
+static uint64_t fnv1a(uint64_t hash, const byte *data, size_t size) {
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= data[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
 
 ROM::ROM(const char *path){
 
-    FILE *pFILE = fopen(path, "r");
+    FILE *pFILE = fopen(path, "rb");
 
     if (!pFILE) {
         return ;
     }
 
-    int fileSize = fseek(pFILE, 0, SEEK_END);
+    fseek(pFILE, 0, SEEK_END);
+    long fileSize = ftell(pFILE);
+    fseek(pFILE, 0, SEEK_SET);
+
+    if (fileSize <= 0) {
+        fclose(pFILE);
+        return;
+    }
 
+    // the whole image in one allocation, banks point into it
     content = new byte[fileSize];
-    byte* contentP = content;
+    contentSize = fread(content, sizeof(byte), (size_t) fileSize, pFILE);
+
+    fclose(pFILE);
+}
 
-    const int BUFFER_SIZE = 1024;
-    byte buffer[BUFFER_SIZE];
-    size_t count;
+size_t ROM::getImageSize(const byte *header) {
 
-    while((count = fread(buffer,BUFFER_SIZE, sizeof(byte),pFILE)) != 0){
-        memcpy(contentP,buffer,count);
-        contentP += count;
+    //NES file start with "NES\x1a"
+    if(header[0] != 'N' || header[1] != 'E' || header[2] != 'S' || header[3] != '\u001a') {
+        return 0;
     }
 
-    fclose(pFILE);
+    //Lower 4 bit  $7 must be 0
+    if (((header[7] & 0xF) != 0)) {
+        return 0;
+    }
+
+    //Lower 4 bit int content[7] must be 0
+    for (auto i = 8; i < 0xF; i++) {
+        if (header[i] != 0) {
+            return 0;
+        }
+    }
+
+    size_t size = HEADER_LENGTH + (size_t) PRG_BANK_SIZE * header[4] + (size_t) CHR_BANK_SIZE * header[5];
+    if (header[6] & 0b100) {
+        size += TRAINER_LENGTH;
+    }
+    return size;
 }
 
 void ROM::load() {
@@ -37,14 +76,14 @@ void ROM::load() {
         return;
     }
 
-    auto fileSize = sizeof(content) / sizeof(byte);
+    auto fileSize = contentSize;
 
-    if (fileSize < 16) {
+    if (fileSize < HEADER_LENGTH) {
         return;
     }
 
-    //NES file start with "NES\x1a"
-    if(content[0] != 'N' || content[1] != 'E' || content[2] != 'S' || content[1] != '\u001a') {
+    size_t imageSize = getImageSize(content);
+    if (imageSize == 0 || fileSize < imageSize) {
         return;
     }
 
@@ -56,79 +95,52 @@ void ROM::load() {
     hasFourScreen = ((content[6] & 0b1000) >> 3) == 1;
     romMapperType = (byte) (((content[6] & 0xF0) >> 4) | (content[7] & 0xF0));
 
-    if (hasBatteryRam) {
-        //TODO
-    }
-
+    // battery backed PRG-RAM is mapped from a save file by the console, see SaveRam
 
-    //Lower 4 bit  $7 must be 0
-    if (((content[7] & 0xF) != 0)) {
-        return;
+    size_t offset = HEADER_LENGTH;
+    if (hasTrainer) {
+        offset += TRAINER_LENGTH;
     }
 
-    //Lower 4 bit int content[7] must be 0
-    for (auto i = 8; i < 0xF; i++) {
-        if (content[i] != 0) {
-            return;
-        }
+    //Program Rom banks
+    for (auto i = 0; i < romBankCount; i++) {
+        rom[i] = content + offset;
+        offset += PRG_BANK_SIZE;
     }
 
-    const auto romUnitSize = 16 * 1024;
-
-    int prgRomSize = romUnitSize * romBankCount;
-
-    if(fileSize - HEADER_LENGTH < prgRomSize) {
-        return;
+    //Character Rom banks
+    for (auto i = 0; i < vromBankCount; i++) {
+        vrom[i] = content + offset;
+        offset += CHR_BANK_SIZE;
     }
 
-    //load Program Rom from file
-    rom = new byte*[romBankCount];
-    byte* p = content;
-    p += HEADER_LENGTH;
-
+    hash = FNV_OFFSET_BASIS;
     for (auto i = 0; i < romBankCount; i++) {
-        rom[i] = new byte[romUnitSize];
-        memcpy(rom[i], p, romUnitSize);
-        p += romUnitSize;
+        hash = fnv1a(hash, rom[i], PRG_BANK_SIZE);
     }
-
-    const auto vromBankSize = 8 * 1024;
-    int chrRomSize = romUnitSize * vromBankCount;
-
-    if(fileSize - HEADER_LENGTH - prgRomSize < chrRomSize) {
-        return;
+    for (auto i = 0; i < vromBankCount; i++) {
+        hash = fnv1a(hash, vrom[i], CHR_BANK_SIZE);
     }
 
-    //load Character Rom from file
-    vrom = new byte*[vromBankCount];
-    for (int i = 0; i < vromBankSize; i++) {
-        vrom[i] = new byte[vromBankSize];
-        memcpy(vrom[i], p, vromBankSize);
-        p += vromBankSize;
-    }
-
-
-
-
-
     valid  = true;
 }
 
-ROM::~ROM() {
+void ROM::shareBanks(nesdroid::RomBanks *banks) {
 
-    delete this->content;
-
-    if (rom != nullptr) {
-        size_t len = sizeof(rom) / sizeof(byte*);
-        for (size_t i = 0; i < len; ++i) {
-            delete [] rom[i];
-        }
+    sharedBanks = banks;
+    for (auto i = 0; i < romBankCount; i++) {
+        rom[i] = banks->getPrg() + i * PRG_BANK_SIZE;
     }
-
-    if (vrom != nullptr) {
-        size_t len = sizeof(vrom) / sizeof(byte*);
-        for (size_t i = 0; i < len; ++i) {
-            delete [] vrom[i];
-        }
+    for (auto i = 0; i < vromBankCount; i++) {
+        vrom[i] = banks->getChr() + i * CHR_BANK_SIZE;
     }
+    delete [] content;
+    content = nullptr;
+    contentSize = 0;
+}
+
+ROM::~ROM() {
+
+    nesdroid::RomStore::shared().release(sharedBanks);
+    delete [] this->content;
 }
@@ -13,11 +13,18 @@
 
 using namespace std;
 
-static const int HEADER_LENGTH = 0xf;
+static const int HEADER_LENGTH = 0x10;
+static const int TRAINER_LENGTH = 0x200;
+
+static const int PRG_BANK_SIZE = 0x4000;
+static const int CHR_BANK_SIZE = 0x2000;
+static const int MAX_BANKS = 256;
 
 static const uint8_t HORIZONTAL_MIRRORING = 0;
 static const uint8_t VERTICAL_MIRRORING = 1;
 static const uint8_t FOUR_SCREEN_MIRRORING = 2;
+static const uint8_t SINGLE_SCREEN_0_MIRRORING = 3;
+static const uint8_t SINGLE_SCREEN_1_MIRRORING = 4;
 
 static map<uint16_t, const char *> MAPPER_NAMES = {
         {1,  "Nintendo MMC1"},
@@ -57,6 +64,10 @@ static map<uint16_t, const char *> MAPPER_NAMES = {
         {91, "Pirate HK-SF3 chip"}
 };
 
+namespace nesdroid {
+    class RomBanks;
+}
+
 //
 
 
@@ -64,12 +75,16 @@ class ROM {
 
 public:
 
-    ROM(byte *content) : content(content) { }
+    // takes over content, an iNES image of size bytes allocated with new[]
+    ROM(byte *content, size_t size) : content(content), contentSize(size) { }
 
     ROM(const char *path);
 
     virtual ~ROM();
 
+    // size of the whole image an iNES header describes, 0 if it is not one
+    static size_t getImageSize(const byte *header);
+
     void load();
 
     bool isValid() const {
@@ -118,17 +133,33 @@ public:
         }
     }
 
-    byte **getPrgRom() const {
-        return rom;
+    // 16K PRG ROM bank, points into the file image or the shared banks
+    const byte *getPrgBank(int index) const {
+        return rom[index];
+    }
+
+    // 8K CHR ROM bank, points into the file image or the shared banks
+    const byte *getChrBank(int index) const {
+        return vrom[index];
+    }
+
+    // FNV-1a hash of PRG and CHR banks, identifies the game independent of the header
+    uint64_t getHash() const {
+        return hash;
     }
 
-    byte **getChrRom() const {
-        return vrom;
+    // Point the banks at the store's copy, which the ROM keeps a reference to,
+    // and free the file image; the header fields and the hash stay.
+    void shareBanks(nesdroid::RomBanks *banks);
+
+    nesdroid::RomBanks *getSharedBanks() const {
+        return sharedBanks;
     }
 
 private:
     bool valid = false;
     byte *content = nullptr;
+    size_t contentSize = 0;
 
     byte romBankCount;
     byte vromBankCount;
@@ -137,9 +168,11 @@ private:
     bool hasTrainer;
     bool hasFourScreen;
     byte romMapperType;
+    uint64_t hash = 0;
+    nesdroid::RomBanks *sharedBanks = nullptr;
 
-    byte **rom = nullptr;
-    byte **vrom = nullptr;
+    const byte *rom[MAX_BANKS];
+    const byte *vrom[MAX_BANKS];
 };
 
 
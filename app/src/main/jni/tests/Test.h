@@ -0,0 +1,102 @@
+//
+// Host tests of the emulator core. The cases register themselves and one runner
+// runs them all, or the ones whose names are given. Kept out of the app build.
+//
+//   nestests [name]...
+//
+// Built on the host against the emulator core, from the repository root:
+//   g++ -std=c++11 -O2 -pthread -Iapp/src/main/jni app/src/main/jni/tests/*.cpp
+//       $(ls app/src/main/jni/*.cpp | grep -v jni.cpp) -lz -ldl -o nestests
+//
+
+#ifndef NESDROID_TEST_H
+#define NESDROID_TEST_H
+
+#include <initializer_list>
+#include <string>
+#include <vector>
+
+#include "commons.h"
+#include "rom.h"
+
+namespace nesdroid {
+    namespace test {
+
+        typedef void (*TestFunction)();
+
+        struct TestCase {
+            const char *name;
+            TestFunction run;
+        };
+
+        std::vector<TestCase> &registry();
+
+        struct Registrar {
+            Registrar(const char *name, TestFunction run) {
+                registry().push_back({name, run});
+            }
+        };
+
+        // record a failed check of the running case, which goes on
+        void fail(const char *file, int line, const std::string &message);
+
+        // an iNES image: header, PRG banks of 16K then CHR banks of 8K, all zero
+        std::vector<byte> makeImage(int mapper, int prgBanks, int chrBanks);
+
+        // a loaded ROM over a copy of image, owned by the caller
+        ROM *makeRom(const std::vector<byte> &image);
+
+        // hand assembled code written into the PRG banks of an image
+        class CodeWriter {
+        public:
+            explicit CodeWriter(std::vector<byte> &image) : prg(&image[HEADER_LENGTH]) {
+            }
+
+            // offset into the PRG banks the next bytes go to
+            CodeWriter &at(size_t offset) {
+                this->offset = offset;
+                return *this;
+            }
+
+            CodeWriter &emit(std::initializer_list<int> bytes) {
+                for (int value : bytes) {
+                    prg[offset++] = (byte) value;
+                }
+                return *this;
+            }
+
+        private:
+            byte *prg;
+            size_t offset = 0;
+        };
+
+        // write data to a fresh file in the temporary directory, removed when the
+        // runner exits; returns its path
+        std::string writeTemporary(const std::string &name, const std::vector<byte> &data);
+    }
+}
+
+#define TEST(name) \
+    static void name(); \
+    static nesdroid::test::Registrar name##Registrar(#name, name); \
+    static void name()
+
+#define CHECK(condition) \
+    do { \
+        if (!(condition)) { \
+            nesdroid::test::fail(__FILE__, __LINE__, #condition); \
+        } \
+    } while (0)
+
+// integral values, both printed when they differ
+#define CHECK_EQ(expected, actual) \
+    do { \
+        long long e = (long long) (expected); \
+        long long a = (long long) (actual); \
+        if (e != a) { \
+            nesdroid::test::fail(__FILE__, __LINE__, std::string(#actual) + " is " + std::to_string(a) \
+                                 + ", expected " + std::to_string(e)); \
+        } \
+    } while (0)
+
+#endif //NESDROID_TEST_H
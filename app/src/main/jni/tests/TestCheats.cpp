@@ -0,0 +1,50 @@
+#include "Test.h"
+#include "Cheats.h"
+
+using namespace nesdroid;
+
+struct GameGenieVector {
+    const char *code;
+    addr_t address;
+    byte value;
+    int compare;
+};
+
+TEST(gameGenieDecodesKnownCodes) {
+    static const GameGenieVector vectors[] = {
+            {"GOSSIP",   0xD1DD, 0x14, -1},
+            {"SXIOPO",   0x91D9, 0xAD, -1},
+            {"AAAAAA",   0x8000, 0x00, -1},
+            {"YYYYYY",   0xF777, 0x77, -1},
+            {"ZEXPYGLA", 0x94A7, 0x02, 0x03},
+            {"zexpygla", 0x94A7, 0x02, 0x03},
+    };
+    for (const GameGenieVector &vector : vectors) {
+        Cheat cheat = {0, 0, 0};
+        CHECK(Cheats::decodeGameGenie(vector.code, cheat));
+        CHECK_EQ(vector.address, cheat.address);
+        CHECK_EQ(vector.value, cheat.value);
+        CHECK_EQ(vector.compare, cheat.compare);
+    }
+}
+
+TEST(gameGenieRejectsMalformedCodes) {
+    Cheat cheat;
+    for (const char *code : {"", "GOSSI", "GOSSIPA", "GOSSIPAAA", "GOS1IP", "GOSSI ", " GOSSIP", "GOSS\tP"}) {
+        CHECK(!Cheats::decodeGameGenie(code, cheat));
+    }
+}
+
+TEST(cheatsRejectRegisterFreezes) {
+    Cheats cheats;
+    CHECK(cheats.add("0010:05"));
+    CHECK(cheats.add("6000:01"));
+    CHECK(cheats.add("SXIOPO"));
+    CHECK(cheats.add("91D9?AD:EA"));
+    CHECK(!cheats.add("2002:00"));
+    CHECK(!cheats.add("4016:00"));
+    CHECK(!cheats.add("5FFF:00"));
+    CHECK(!cheats.add("91D9:"));
+    CHECK(cheats.hasFreezes());
+    CHECK(cheats.hasPatches());
+}
@@ -0,0 +1,132 @@
+#include <memory>
+
+#include "Test.h"
+#include "Console.h"
+
+using namespace nesdroid;
+using namespace nesdroid::test;
+
+static const addr_t CALL = 0xC005;
+static const addr_t RETURN = 0xC008;
+static const addr_t SUBROUTINE = 0xC010;
+
+// NROM game looping over a store to $0800, the mirror of $0000, a JSR to a
+// subroutine that counts its calls in X, and a load of $0000 into Y
+static ROM *makeDebugGame() {
+    std::vector<byte> image = makeImage(0, 1, 1);
+    CodeWriter code(image);
+    code.emit({0xA9, 0x11, 0x8D, 0x00, 0x08, 0x20, 0x10, 0xC0, 0xAC, 0x00, 0x00, 0x4C, 0x00, 0xC0});
+    code.at(0x10).emit({0xE8, 0x60});
+    code.at(0x20).emit({0x40});
+    code.at(0x3FFA).emit({0x20, 0xC0, 0x00, 0xC0, 0x20, 0xC0});
+    return makeRom(image);
+}
+
+static Registers registersOf(Console &console) {
+    Registers registers;
+    console.getCpuRegisters(registers);
+    return registers;
+}
+
+static void checkHit(Debugger &debugger, addr_t address, int access, byte value) {
+    CHECK(debugger.isPaused());
+    DebugHit hit = debugger.getHit();
+    CHECK_EQ(SPACE_CPU, hit.space);
+    CHECK_EQ(address, hit.address);
+    CHECK_EQ(access, hit.access);
+    CHECK_EQ(value, hit.value);
+}
+
+TEST(breakpointStopsOnceBeforeInstruction) {
+    std::unique_ptr<ROM> rom(makeDebugGame());
+    Console console;
+    CHECK(console.insert(rom.get()));
+    Debugger &debugger = console.getDebugger();
+    int id = debugger.addBreakpoint(CALL);
+    CHECK(id > 0);
+
+    uint64_t frame = console.getFrame();
+    console.stepFrame();
+    checkHit(debugger, CALL, ACCESS_EXECUTE, 0x20);
+    CHECK_EQ(frame, console.getFrame());
+    CHECK_EQ(CALL, registersOf(console).pc);
+    CHECK_EQ(0, registersOf(console).x);
+    // halted: the frame does not go on
+    console.stepFrame();
+    CHECK_EQ(CALL, registersOf(console).pc);
+
+    // the resumed JSR runs, the next time round the loop stops again
+    debugger.resume();
+    CHECK(!debugger.isPaused());
+    console.stepFrame();
+    checkHit(debugger, CALL, ACCESS_EXECUTE, 0x20);
+    CHECK_EQ(CALL, registersOf(console).pc);
+    CHECK_EQ(1, registersOf(console).x);
+
+    // without breakpoints the frame runs to its end
+    CHECK(debugger.remove(id));
+    CHECK(!debugger.remove(id));
+    debugger.resume();
+    console.stepFrame();
+    CHECK(!debugger.isPaused());
+    CHECK_EQ(frame + 1, console.getFrame());
+}
+
+TEST(watchpointTrapsThroughMirrors) {
+    std::unique_ptr<ROM> rom(makeDebugGame());
+    Console console;
+    CHECK(console.insert(rom.get()));
+    Debugger &debugger = console.getDebugger();
+    // canonical addresses only
+    CHECK(debugger.addWatchpoint(SPACE_CPU, 0x0001, 0x0000, ACCESS_WRITE) < 0);
+    int write = debugger.addWatchpoint(SPACE_CPU, 0x0000, 0x0000, ACCESS_WRITE);
+    CHECK(write > 0);
+
+    // the store to $0800 traps, the cpu stops once it is done
+    console.stepFrame();
+    checkHit(debugger, 0x0800, ACCESS_WRITE, 0x11);
+    CHECK_EQ(CALL, registersOf(console).pc);
+
+    // a read watch on the same byte sees the load, not the store
+    CHECK(debugger.remove(write));
+    CHECK(debugger.addWatchpoint(SPACE_CPU, 0x0000, 0x0000, ACCESS_READ) > 0);
+    debugger.resume();
+    console.stepFrame();
+    checkHit(debugger, 0x0000, ACCESS_READ, 0x11);
+    CHECK_EQ(0xC00B, registersOf(console).pc);
+    CHECK_EQ(0x11, registersOf(console).y);
+}
+
+TEST(stepOverRunsSubroutine) {
+    std::unique_ptr<ROM> rom(makeDebugGame());
+    Console console;
+    CHECK(console.insert(rom.get()));
+    Debugger &debugger = console.getDebugger();
+    int id = debugger.addBreakpoint(CALL);
+    console.stepFrame();
+    checkHit(debugger, CALL, ACCESS_EXECUTE, 0x20);
+    CHECK(debugger.remove(id));
+
+    // step into enters the subroutine
+    debugger.stepInto();
+    console.stepFrame();
+    checkHit(debugger, SUBROUTINE, ACCESS_EXECUTE, 0xE8);
+    CHECK_EQ(0, registersOf(console).x);
+
+    // back at the JSR through the loop, then over it: the subroutine runs once
+    debugger.addBreakpoint(CALL);
+    debugger.resume();
+    console.stepFrame();
+    checkHit(debugger, CALL, ACCESS_EXECUTE, 0x20);
+    CHECK_EQ(1, registersOf(console).x);
+    debugger.clear();
+    debugger.stepOver();
+    console.stepFrame();
+    checkHit(debugger, RETURN, ACCESS_EXECUTE, 0xAC);
+    CHECK_EQ(2, registersOf(console).x);
+
+    // the step over left no breakpoint behind
+    debugger.resume();
+    console.stepFrame();
+    CHECK(!debugger.isPaused());
+}
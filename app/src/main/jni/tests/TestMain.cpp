@@ -0,0 +1,88 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+
+#include "Test.h"
+
+namespace nesdroid {
+    namespace test {
+
+        static int failures = 0;
+        static std::vector<std::string> temporaries;
+
+        std::vector<TestCase> &registry() {
+            static std::vector<TestCase> cases;
+            return cases;
+        }
+
+        void fail(const char *file, int line, const std::string &message) {
+            const char *slash = strrchr(file, '/');
+            printf("  %s:%d: %s\n", slash != nullptr ? slash + 1 : file, line, message.c_str());
+            failures++;
+        }
+
+        std::vector<byte> makeImage(int mapper, int prgBanks, int chrBanks) {
+            std::vector<byte> image(HEADER_LENGTH + (size_t) prgBanks * PRG_BANK_SIZE
+                                    + (size_t) chrBanks * CHR_BANK_SIZE, 0);
+            memcpy(image.data(), "NES\x1a", 4);
+            image[4] = (byte) prgBanks;
+            image[5] = (byte) chrBanks;
+            image[6] = (byte) ((mapper & 0x0F) << 4);
+            image[7] = (byte) (mapper & 0xF0);
+            return image;
+        }
+
+        ROM *makeRom(const std::vector<byte> &image) {
+            byte *content = new byte[image.size()];
+            memcpy(content, image.data(), image.size());
+            ROM *rom = new ROM(content, image.size());
+            rom->load();
+            return rom;
+        }
+
+        std::string writeTemporary(const std::string &name, const std::vector<byte> &data) {
+            const char *directory = getenv("TMPDIR");
+            std::string path = std::string(directory != nullptr ? directory : "/tmp") + "/nestests-"
+                               + std::to_string(getpid()) + "-" + name;
+            FILE *file = fopen(path.c_str(), "wb");
+            if (file == nullptr) {
+                return path;
+            }
+            fwrite(data.data(), 1, data.size(), file);
+            fclose(file);
+            temporaries.push_back(path);
+            return path;
+        }
+    }
+}
+
+using namespace nesdroid::test;
+
+int main(int argc, char **argv) {
+    int run = 0;
+    int failed = 0;
+    for (const TestCase &test : registry()) {
+        bool wanted = argc < 2;
+        for (int i = 1; i < argc; i++) {
+            wanted |= strcmp(argv[i], test.name) == 0;
+        }
+        if (!wanted) {
+            continue;
+        }
+        int before = failures;
+        test.run();
+        run++;
+        if (failures != before) {
+            printf("FAIL %s\n", test.name);
+            failed++;
+        } else {
+            printf("PASS %s\n", test.name);
+        }
+    }
+    for (const std::string &path : temporaries) {
+        unlink(path.c_str());
+    }
+    printf("%d of %d tests passed\n", run - failed, run);
+    return failed > 0 || run == 0 ? 1 : 0;
+}
@@ -0,0 +1,201 @@
+#include <memory>
+
+#include "Test.h"
+#include "Console.h"
+
+using namespace nesdroid;
+using namespace nesdroid::test;
+
+static const int LATCH = 29;
+static const int DOTS_PER_LINE = 341;
+// from the counter clock to the handler's INX, in dots: the JMP it lands in,
+// the one before the line is polled, the interrupt sequence, both STAs and INX
+static const int IRQ_LATENCY = (3 + 3 + 7 + 4 + 4 + 2) * 3;
+
+struct IrqEvent {
+    uint64_t frame;
+    int line;
+    int cycle;
+};
+
+// MMC3 game that sets PPUCTRL and PPUMASK and spins. Its NMI reloads the counter
+// with LATCH and enables the IRQ; the IRQ acknowledges, enables again and
+// counts in X.
+static ROM *makeIrqGame(byte control, byte mask) {
+    std::vector<byte> image = makeImage(4, 2, 1);
+    CodeWriter code(image);
+    // all in the last 8K, fixed at $E000. PPUMASK first: setting PPUCTRL in
+    // vblank runs the NMI, which clobbers A
+    code.at(0x6000).emit({0xA9, mask, 0x8D, 0x01, 0x20, 0xA9, control, 0x8D, 0x00, 0x20, 0xA2, 0x00, 0x58});
+    code.emit({0x4C, 0x0D, 0xE0});
+    code.at(0x6010).emit({0xA9, LATCH, 0x8D, 0x00, 0xC0, 0x8D, 0x01, 0xC0, 0x8D, 0x01, 0xE0, 0x40});
+    code.at(0x6020).emit({0x8D, 0x00, 0xE0, 0x8D, 0x01, 0xE0, 0xE8, 0x40});
+    code.at(0x7FFA).emit({0x10, 0xE0, 0x00, 0xE0, 0x20, 0xE0});
+    return makeRom(image);
+}
+
+// The same game with the I flag set while the counter reaches zero: with
+// inNmi the NMI runs `nops` NOPs at $8000 before its RTI, else the main code
+// runs them before its CLI. Either way the IRQ has to wait for them.
+static ROM *makeMaskedIrqGame(bool inNmi, int nops) {
+    std::vector<byte> image = makeImage(4, 2, 1);
+    CodeWriter code(image);
+    code.at(0x6000).emit({0xA9, 0x18, 0x8D, 0x01, 0x20, 0xA9, 0x88, 0x8D, 0x00, 0x20, 0xA2, 0x00});
+    if (inNmi) {
+        code.emit({0x58, 0x4C, 0x0D, 0xE0});
+    } else {
+        code.emit({0x4C, 0x00, 0x80});
+    }
+    code.at(0x6010).emit({0xA9, LATCH, 0x8D, 0x00, 0xC0, 0x8D, 0x01, 0xC0, 0x8D, 0x01, 0xE0});
+    code.emit(inNmi ? std::initializer_list<int>{0x4C, 0x00, 0x80} : std::initializer_list<int>{0x40});
+    code.at(0x6020).emit({0x8D, 0x00, 0xE0, 0x8D, 0x01, 0xE0, 0xE8, 0x40});
+    code.at(0x7FFA).emit({0x10, 0xE0, 0x00, 0xE0, 0x20, 0xE0});
+    // $8000, bank 0 after reset
+    code.at(0);
+    for (int i = 0; i < nops; i++) {
+        code.emit({0xEA});
+    }
+    if (inNmi) {
+        code.emit({0x40});
+    } else {
+        code.emit({0x58, 0x4C, nops + 1, 0x80 + ((nops + 1) >> 8)});
+    }
+    return makeRom(image);
+}
+
+// Runs until the PPU starts frame `frames`, calling at(console) once when it
+// reaches line `switchLine` of frame `switchFrame`; returns where the handler ran.
+template<typename Action>
+static std::vector<IrqEvent> runIrqGame(ROM *rom, uint64_t frames, uint64_t switchFrame, int switchLine,
+                                        Action at) {
+    std::vector<IrqEvent> events;
+    Console console;
+    CHECK(console.insert(rom));
+    PPU &ppu = console.getPpu();
+    Registers registers;
+    console.getCpuRegisters(registers);
+    byte count = registers.x;
+    bool switched = false;
+    while (ppu.getFrame() < frames) {
+        console.step();
+        if (!switched && ppu.getFrame() == switchFrame && ppu.getScanLine() == switchLine) {
+            at(console);
+            switched = true;
+        }
+        console.getCpuRegisters(registers);
+        if (registers.x != count) {
+            count = registers.x;
+            events.push_back({ppu.getFrame(), ppu.getScanLine(), ppu.getCycle()});
+        }
+    }
+    return events;
+}
+
+static std::vector<IrqEvent> runIrqGame(ROM *rom, uint64_t frames) {
+    return runIrqGame(rom, frames, 0, -1, [](Console &) { });
+}
+
+// the handler ran for the counter clock of `line` at `dot`
+static void checkIrq(const IrqEvent &event, uint64_t frame, int line, int dot) {
+    CHECK_EQ(frame, event.frame);
+    int position = event.line * DOTS_PER_LINE + event.cycle;
+    int expected = line * DOTS_PER_LINE + dot;
+    if (position < expected || position >= expected + IRQ_LATENCY) {
+        fail(__FILE__, __LINE__, "IRQ handled at line " + std::to_string(event.line) + " dot "
+                                 + std::to_string(event.cycle) + ", expected the clock at line "
+                                 + std::to_string(line) + " dot " + std::to_string(dot));
+    }
+}
+
+// the NMI reloads the counter, the pre-render line's clock loads LATCH and every
+// LATCH + 1 visible lines after it raise an IRQ
+static void checkFrames(const std::vector<IrqEvent> &events, uint64_t first, uint64_t last, int dot) {
+    const int perFrame = 240 / (LATCH + 1);
+    CHECK_EQ((last - first + 1) * perFrame, events.size());
+    for (size_t i = 0; i < events.size(); i++) {
+        checkIrq(events[i], first + i / perFrame, LATCH - 1 + (LATCH + 1) * (int) (i % perFrame), dot);
+    }
+}
+
+TEST(mmc3ClocksAtSpriteFetchesWithSpritesAt1000) {
+    std::unique_ptr<ROM> rom(makeIrqGame(0x88, 0x18));
+    checkFrames(runIrqGame(rom.get(), 4), 1, 3, 260);
+}
+
+TEST(mmc3ClocksAtTilePrefetchWithBackgroundAt1000) {
+    std::unique_ptr<ROM> rom(makeIrqGame(0x90, 0x18));
+    checkFrames(runIrqGame(rom.get(), 4), 1, 3, 324);
+}
+
+TEST(mmc3ClocksAtSpriteFetchesWithBothAt1000) {
+    std::unique_ptr<ROM> rom(makeIrqGame(0x98, 0x18));
+    checkFrames(runIrqGame(rom.get(), 4), 1, 3, 260);
+}
+
+TEST(mmc3ClocksAtSpriteFetchesWithTallSprites) {
+    std::unique_ptr<ROM> rom(makeIrqGame(0xA0, 0x18));
+    checkFrames(runIrqGame(rom.get(), 4), 1, 3, 260);
+}
+
+TEST(mmc3NeverClocksWithBothAt0000) {
+    std::unique_ptr<ROM> rom(makeIrqGame(0x80, 0x18));
+    CHECK_EQ(0, runIrqGame(rom.get(), 4).size());
+}
+
+TEST(mmc3NeverClocksWithRenderingOff) {
+    std::unique_ptr<ROM> rom(makeIrqGame(0x88, 0x00));
+    CHECK_EQ(0, runIrqGame(rom.get(), 4).size());
+}
+
+TEST(mmc3FollowsPatternTableSwitch) {
+    // no clocks until sprites move to $1000 on line 100 of frame 1
+    std::unique_ptr<ROM> rom(makeIrqGame(0x80, 0x18));
+    std::vector<IrqEvent> events = runIrqGame(rom.get(), 3, 1, 100, [](Console &console) {
+        console.getPpu().writeRegister(0x2000, 0x88);
+    });
+    const int rest = (239 - (100 + LATCH)) / (LATCH + 1) + 1;
+    CHECK_EQ(rest + 240 / (LATCH + 1), events.size());
+    for (int i = 0; i < rest && i < (int) events.size(); i++) {
+        checkIrq(events[i], 1, 100 + LATCH + (LATCH + 1) * i, 260);
+    }
+    std::vector<IrqEvent> next(events.begin() + std::min((size_t) rest, events.size()), events.end());
+    checkFrames(next, 2, 2, 260);
+}
+
+// the first IRQ of the frame waited for the NOPs: handled after its clock's
+// window, before the next clock, then the rest as usual
+static void checkHeldFrame(const std::vector<IrqEvent> &events, size_t first, uint64_t frame) {
+    const int perFrame = 240 / (LATCH + 1);
+    CHECK(events.size() >= first + perFrame);
+    if (events.size() < first + perFrame) {
+        return;
+    }
+    const IrqEvent &held = events[first];
+    int position = held.line * DOTS_PER_LINE + held.cycle;
+    CHECK_EQ(frame, held.frame);
+    CHECK(position >= (LATCH - 1) * DOTS_PER_LINE + 260 + IRQ_LATENCY);
+    CHECK(position < (2 * LATCH) * DOTS_PER_LINE + 260);
+    for (int i = 1; i < perFrame; i++) {
+        checkIrq(events[first + i], frame, LATCH - 1 + (LATCH + 1) * i, 260);
+    }
+}
+
+TEST(mmc3IrqWaitsForRti) {
+    // every NMI runs past line 28 of the next frame
+    std::unique_ptr<ROM> rom(makeMaskedIrqGame(true, 3000));
+    std::vector<IrqEvent> events = runIrqGame(rom.get(), 3);
+    CHECK_EQ(2 * 240 / (LATCH + 1), events.size());
+    checkHeldFrame(events, 0, 1);
+    checkHeldFrame(events, 240 / (LATCH + 1), 2);
+}
+
+TEST(mmc3IrqWaitsForCli) {
+    // the main code runs past line 28 of frame 1 with I set
+    std::unique_ptr<ROM> rom(makeMaskedIrqGame(false, 3000));
+    std::vector<IrqEvent> events = runIrqGame(rom.get(), 3);
+    CHECK_EQ(2 * 240 / (LATCH + 1), events.size());
+    checkHeldFrame(events, 0, 1);
+    if (events.size() > 240 / (LATCH + 1)) {
+        checkFrames(std::vector<IrqEvent>(events.begin() + 240 / (LATCH + 1), events.end()), 2, 2, 260);
+    }
+}
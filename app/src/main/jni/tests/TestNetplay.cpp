@@ -0,0 +1,88 @@
+#include <map>
+#include <memory>
+
+#include "Test.h"
+#include "Console.h"
+#include "Netplay.h"
+
+using namespace nesdroid;
+using namespace nesdroid::test;
+
+static const int FRAMES = 300;
+
+// NROM game whose RAM depends on every button read: the NMI strobes both pads
+// and adds each bit into $10 (pad 1) and $11 (pad 2)
+static ROM *makePadGame() {
+    std::vector<byte> image = makeImage(0, 1, 1);
+    CodeWriter code(image);
+    // $C000: NMI on, then spin
+    code.emit({0xA9, 0x80, 0x8D, 0x00, 0x20, 0x4C, 0x05, 0xC0});
+    // $C008: strobe, then LDA $4016/$4017, ADC $10/$11, STA $10/$11 per button
+    code.at(0x08).emit({0xA9, 0x01, 0x8D, 0x16, 0x40, 0xA9, 0x00, 0x8D, 0x16, 0x40});
+    for (int port = 0; port < 2; port++) {
+        for (int button = 0; button < 8; button++) {
+            code.emit({0xAD, 0x16 + port, 0x40, 0x65, 0x10 + port, 0x85, 0x10 + port});
+        }
+    }
+    code.emit({0x40});
+    // NMI, reset and IRQ vectors
+    code.at(0x3FFA).emit({0x08, 0xC0, 0x00, 0xC0, 0x00, 0xC0});
+    return makeRom(image);
+}
+
+static byte buttonsFor(uint64_t frame, int port) {
+    // hold each combination for a few frames, like a player would
+    uint64_t x = (frame / 6) * 0x9E3779B97F4A7C15ULL + port;
+    x ^= x >> 29;
+    x *= 0xBF58476D1CE4E5B9ULL;
+    return (byte) (x >> 32);
+}
+
+TEST(rollbackPeersMatchAnUninterruptedRun) {
+    std::unique_ptr<ROM> rom(makePadGame());
+    Console consoles[2];
+    CHECK(consoles[0].insert(rom.get()) && consoles[1].insert(rom.get()));
+
+    LoopbackTransport transports[2];
+    LoopbackTransport::connect(transports[0], transports[1]);
+    std::unique_ptr<RollbackSession> sessions[2];
+    for (int p = 0; p < 2; p++) {
+        // lost packets make the peers predict further ahead
+        transports[p].setImpairment(0, 0.3f, (uint32_t) (p + 1));
+        sessions[p].reset(new RollbackSession(consoles[p], transports[p], p));
+    }
+
+    std::map<uint64_t, uint64_t> checksums[2];
+    for (int tick = 0; tick < FRAMES; tick++) {
+        for (int p = 0; p < 2; p++) {
+            sessions[p]->advance(buttonsFor(sessions[p]->getFrame(), p));
+            uint64_t frame, checksum;
+            if (sessions[p]->getChecksum(frame, checksum)) {
+                checksums[p][frame] = checksum;
+            }
+        }
+    }
+    CHECK(sessions[0]->getRollbacks() > 0 && sessions[1]->getRollbacks() > 0);
+    CHECK(transports[0].getLost() > 0 && transports[1].getLost() > 0);
+
+    // the same game with every input known up front
+    Console reference;
+    CHECK(reference.insert(rom.get()));
+    int compared[2] = {0, 0};
+    for (uint64_t frame = 0; frame < FRAMES; frame++) {
+        State state;
+        reference.save(state);
+        uint64_t expected = RollbackSession::hashState(state);
+        for (int p = 0; p < 2; p++) {
+            auto found = checksums[p].find(frame);
+            if (found != checksums[p].end()) {
+                CHECK(found->second == expected);
+                compared[p]++;
+            }
+        }
+        reference.getController(0).setButtons(buttonsFor(frame, 0));
+        reference.getController(1).setButtons(buttonsFor(frame, 1));
+        reference.stepFrame();
+    }
+    CHECK(compared[0] > FRAMES / 2 && compared[1] > FRAMES / 2);
+}
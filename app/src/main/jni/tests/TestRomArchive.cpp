@@ -0,0 +1,207 @@
+#include <cstring>
+#include <memory>
+#include <zlib.h>
+
+#include "Test.h"
+#include "RomArchive.h"
+
+using namespace nesdroid;
+using namespace nesdroid::test;
+
+// PRG and CHR bytes that tell the banks apart
+static std::vector<byte> patternedImage(int mapper, int prgBanks, int chrBanks) {
+    std::vector<byte> image = makeImage(mapper, prgBanks, chrBanks);
+    for (size_t i = HEADER_LENGTH; i < image.size(); i++) {
+        image[i] = (byte) (i * 7 + i / PRG_BANK_SIZE);
+    }
+    return image;
+}
+
+static uint64_t hashOf(const std::vector<byte> &image) {
+    std::unique_ptr<ROM> rom(makeRom(image));
+    return rom->isValid() ? rom->getHash() : 0;
+}
+
+// windowBits as deflateInit2 takes them: negative for raw deflate, + 16 for gzip
+static std::vector<byte> deflateData(const std::vector<byte> &data, int windowBits) {
+    z_stream stream;
+    memset(&stream, 0, sizeof(stream));
+    deflateInit2(&stream, Z_BEST_COMPRESSION, Z_DEFLATED, windowBits, 8, Z_DEFAULT_STRATEGY);
+    std::vector<byte> out(deflateBound(&stream, data.size()) + 32);
+    stream.next_in = (Bytef *) data.data();
+    stream.avail_in = (uInt) data.size();
+    stream.next_out = out.data();
+    stream.avail_out = (uInt) out.size();
+    deflate(&stream, Z_FINISH);
+    out.resize(stream.total_out);
+    deflateEnd(&stream);
+    return out;
+}
+
+static void put16(std::vector<byte> &out, uint32_t value) {
+    out.push_back((byte) value);
+    out.push_back((byte) (value >> 8));
+}
+
+static void put32(std::vector<byte> &out, uint32_t value) {
+    put16(out, value & 0xFFFF);
+    put16(out, value >> 16);
+}
+
+struct ZipEntry {
+    std::string name;
+    std::vector<byte> data;
+    bool deflated;
+};
+
+static std::vector<byte> makeZip(const std::vector<ZipEntry> &entries) {
+    std::vector<byte> zip;
+    std::vector<byte> directory;
+    for (const ZipEntry &entry : entries) {
+        std::vector<byte> stored = entry.deflated ? deflateData(entry.data, -MAX_WBITS) : entry.data;
+        uint32_t crc = (uint32_t) crc32(0, entry.data.data(), (uInt) entry.data.size());
+        uint32_t offset = (uint32_t) zip.size();
+        int method = entry.deflated ? 8 : 0;
+
+        put32(zip, 0x04034b50);
+        put16(zip, 20);
+        put16(zip, 0);
+        put16(zip, method);
+        put32(zip, 0);
+        put32(zip, crc);
+        put32(zip, (uint32_t) stored.size());
+        put32(zip, (uint32_t) entry.data.size());
+        put16(zip, (uint32_t) entry.name.size());
+        put16(zip, 0);
+        zip.insert(zip.end(), entry.name.begin(), entry.name.end());
+        zip.insert(zip.end(), stored.begin(), stored.end());
+
+        put32(directory, 0x02014b50);
+        put16(directory, 20);
+        put16(directory, 20);
+        put16(directory, 0);
+        put16(directory, method);
+        put32(directory, 0);
+        put32(directory, crc);
+        put32(directory, (uint32_t) stored.size());
+        put32(directory, (uint32_t) entry.data.size());
+        put16(directory, (uint32_t) entry.name.size());
+        put16(directory, 0);
+        put16(directory, 0);
+        put16(directory, 0);
+        put16(directory, 0);
+        put32(directory, 0);
+        put32(directory, offset);
+        directory.insert(directory.end(), entry.name.begin(), entry.name.end());
+    }
+    uint32_t directoryOffset = (uint32_t) zip.size();
+    zip.insert(zip.end(), directory.begin(), directory.end());
+    put32(zip, 0x06054b50);
+    put16(zip, 0);
+    put16(zip, 0);
+    put16(zip, (uint32_t) entries.size());
+    put16(zip, (uint32_t) entries.size());
+    put32(zip, (uint32_t) directory.size());
+    put32(zip, directoryOffset);
+    put16(zip, 0);
+    return zip;
+}
+
+TEST(romArchiveOpensRawImage) {
+    std::vector<byte> image = patternedImage(4, 2, 1);
+    image[6] |= 0x03;
+    std::unique_ptr<ROM> rom(RomArchive::open(writeTemporary("raw.nes", image).c_str()));
+    CHECK(rom != nullptr);
+    if (rom == nullptr) {
+        return;
+    }
+    CHECK_EQ(2, rom->getRomCount());
+    CHECK_EQ(1, rom->getVromCount());
+    CHECK_EQ(4, rom->getRomMapperType());
+    CHECK_EQ(VERTICAL_MIRRORING, rom->getMirrorType());
+    CHECK(rom->isHasBatteryRam());
+    CHECK(memcmp(rom->getPrgBank(1), &image[HEADER_LENGTH + PRG_BANK_SIZE], PRG_BANK_SIZE) == 0);
+    CHECK(memcmp(rom->getChrBank(0), &image[HEADER_LENGTH + 2 * PRG_BANK_SIZE], CHR_BANK_SIZE) == 0);
+    CHECK(rom->getHash() == hashOf(image));
+}
+
+TEST(romArchiveSkipsTrainer) {
+    std::vector<byte> image = patternedImage(0, 1, 1);
+    image[6] |= 0x04;
+    image.insert(image.begin() + HEADER_LENGTH, TRAINER_LENGTH, 0xEE);
+    std::unique_ptr<ROM> rom(RomArchive::open(writeTemporary("trainer.nes", image).c_str()));
+    CHECK(rom != nullptr);
+    if (rom != nullptr) {
+        CHECK_EQ(image[HEADER_LENGTH + TRAINER_LENGTH], rom->getPrgBank(0)[0]);
+        CHECK_EQ(image[HEADER_LENGTH + TRAINER_LENGTH + 1], rom->getPrgBank(0)[1]);
+    }
+}
+
+TEST(romArchiveInflatesGzip) {
+    std::vector<byte> image = patternedImage(1, 4, 2);
+    std::string path = writeTemporary("game.nes.gz", deflateData(image, 16 + MAX_WBITS));
+    std::unique_ptr<ROM> rom(RomArchive::open(path.c_str()));
+    CHECK(rom != nullptr);
+    if (rom != nullptr) {
+        CHECK_EQ(4, rom->getRomCount());
+        CHECK_EQ(2, rom->getVromCount());
+        CHECK(rom->getHash() == hashOf(image));
+    }
+}
+
+TEST(romArchiveTakesFirstRomOfZip) {
+    std::vector<byte> text = {'h', 'e', 'l', 'l', 'o', ' ', 'w', 'o', 'r', 'l', 'd', ' ', 'a', 'g', 'a', 'i', 'n'};
+    std::vector<byte> first = patternedImage(2, 2, 0);
+    std::vector<byte> second = patternedImage(3, 1, 1);
+    std::string path = writeTemporary("games.zip", makeZip({{"readme.txt", text, false},
+                                                            {"first.nes", first, true},
+                                                            {"second.nes", second, false}}));
+
+    std::unique_ptr<ROM> rom(RomArchive::open(path.c_str()));
+    CHECK(rom != nullptr);
+    if (rom != nullptr) {
+        CHECK_EQ(2, rom->getRomMapperType());
+        CHECK(rom->getHash() == hashOf(first));
+    }
+
+    // the filter sees every header and picks the stored entry
+    std::vector<std::string> seen;
+    rom.reset(RomArchive::open(path.c_str(), [&seen](const char *name, const byte *header) {
+        seen.push_back(name);
+        return header[6] >> 4 == 3;
+    }));
+    CHECK(rom != nullptr);
+    if (rom != nullptr) {
+        CHECK_EQ(3, rom->getRomMapperType());
+        CHECK(rom->getHash() == hashOf(second));
+    }
+    CHECK_EQ(2, seen.size());
+    CHECK(seen.size() == 2 && seen[0] == "first.nes" && seen[1] == "second.nes");
+}
+
+TEST(romArchiveRejectsBadHeaders) {
+    std::vector<byte> image = patternedImage(0, 1, 1);
+
+    std::vector<byte> magic = image;
+    magic[3] = 0x1b;
+    CHECK(RomArchive::open(writeTemporary("magic.nes", magic).c_str()) == nullptr);
+
+    // NES 2.0 and archaic headers leave junk in bytes 7-15
+    std::vector<byte> flags = image;
+    flags[7] = 0x08;
+    CHECK(RomArchive::open(writeTemporary("flags.nes", flags).c_str()) == nullptr);
+    std::vector<byte> padding = image;
+    padding[12] = 'D';
+    CHECK(RomArchive::open(writeTemporary("padding.nes", padding).c_str()) == nullptr);
+
+    std::vector<byte> truncated(image.begin(), image.end() - 1);
+    CHECK(RomArchive::open(writeTemporary("truncated.nes", truncated).c_str()) == nullptr);
+    CHECK(RomArchive::open(writeTemporary("truncated.nes.gz",
+                                          deflateData(truncated, 16 + MAX_WBITS)).c_str()) == nullptr);
+    CHECK(RomArchive::open(writeTemporary("truncated.zip",
+                                          makeZip({{"a.nes", truncated, true}})).c_str()) == nullptr);
+
+    std::vector<byte> header(image.begin(), image.begin() + 8);
+    CHECK(RomArchive::open(writeTemporary("short.nes", header).c_str()) == nullptr);
+    CHECK(RomArchive::open("/nonexistent/rom.nes") == nullptr);
+}
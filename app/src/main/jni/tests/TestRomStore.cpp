@@ -0,0 +1,88 @@
+#include <cstring>
+#include <memory>
+
+#include "Test.h"
+#include "Console.h"
+#include "RomStore.h"
+
+using namespace nesdroid;
+using namespace nesdroid::test;
+
+static std::vector<byte> patternedImage(int prgBanks, int chrBanks, int seed) {
+    std::vector<byte> image = makeImage(0, prgBanks, chrBanks);
+    for (size_t i = HEADER_LENGTH; i < image.size(); i++) {
+        image[i] = (byte) (i * 13 + seed);
+    }
+    return image;
+}
+
+static size_t banksHeld() {
+    size_t count, bytes;
+    RomStore::shared().getUsage(count, bytes);
+    return count;
+}
+
+TEST(romStoreSharesBanksBetweenConsoles) {
+    size_t before = banksHeld();
+    std::vector<byte> image = patternedImage(1, 1, 1);
+    ROM *rom = makeRom(image);
+    std::unique_ptr<ROM> copy(makeRom(image));
+    std::unique_ptr<Console> consoles[3];
+    for (auto &console : consoles) {
+        console.reset(new Console());
+    }
+    CHECK(consoles[0]->insert(rom) && consoles[1]->insert(rom) && consoles[2]->insert(copy.get()));
+
+    // one set of banks for the content, whichever ROM object brought it
+    const RomBanks *banks = consoles[0]->getBanks();
+    CHECK(banks != nullptr);
+    CHECK(consoles[1]->getBanks() == banks && consoles[2]->getBanks() == banks);
+    CHECK(rom->getSharedBanks() == banks && copy->getSharedBanks() == banks);
+    CHECK_EQ(before + 1, banksHeld());
+    // the ROMs read from the banks in place of their file images
+    CHECK(rom->getPrgBank(0) == banks->getPrg());
+    CHECK(memcmp(banks->getChr(), &image[HEADER_LENGTH + PRG_BANK_SIZE], CHR_BANK_SIZE) == 0);
+
+    // the ROM and the consoles each hold a reference: the last one out frees them
+    delete rom;
+    copy.reset();
+    consoles[0].reset();
+    consoles[2].reset();
+    CHECK_EQ(before + 1, banksHeld());
+    consoles[1].reset();
+    CHECK_EQ(before, banksHeld());
+}
+
+TEST(romStoreKeepsHashCollisionsApart) {
+    size_t before = banksHeld();
+    // the same bytes split as 32K PRG and 16K CHR, or 48K PRG: same hash, other rom
+    std::vector<byte> split = patternedImage(2, 2, 2);
+    std::vector<byte> whole = split;
+    whole[4] = 3;
+    whole[5] = 0;
+    std::unique_ptr<ROM> first(makeRom(split));
+    std::unique_ptr<ROM> second(makeRom(whole));
+    CHECK(first->getHash() == second->getHash());
+
+    RomBanks *firstBanks = RomStore::shared().acquire(first.get());
+    RomBanks *secondBanks = RomStore::shared().acquire(second.get());
+    CHECK(firstBanks != nullptr && secondBanks != nullptr && firstBanks != secondBanks);
+    CHECK_EQ(before + 2, banksHeld());
+    if (firstBanks != nullptr && secondBanks != nullptr) {
+        CHECK_EQ(2 * PRG_BANK_SIZE, firstBanks->getPrgSize());
+        CHECK_EQ(3 * PRG_BANK_SIZE, secondBanks->getPrgSize());
+        CHECK(secondBanks->getChr() == nullptr);
+    }
+
+    // a second acquire of the colliding rom finds its own banks again
+    RomBanks *again = RomStore::shared().acquire(second.get());
+    CHECK(again == secondBanks);
+    RomStore::shared().release(again);
+
+    RomStore::shared().release(firstBanks);
+    RomStore::shared().release(secondBanks);
+    CHECK_EQ(before + 2, banksHeld());
+    first.reset();
+    second.reset();
+    CHECK_EQ(before, banksHeld());
+}
@@ -0,0 +1,54 @@
+#include <cstdio>
+#include <memory>
+
+#include "Test.h"
+#include "Console.h"
+#include "Mapper.h"
+
+using namespace nesdroid;
+using namespace nesdroid::test;
+
+// battery backed NROM game that increments $6000 once, then spins
+static ROM *makeCounterGame() {
+    std::vector<byte> image = makeImage(0, 1, 1);
+    image[6] |= 0x02;
+    CodeWriter code(image);
+    code.emit({0xEE, 0x00, 0x60, 0x4C, 0x03, 0xC0});
+    code.at(0x3FFA).emit({0x03, 0xC0, 0x00, 0xC0, 0x03, 0xC0});
+    return makeRom(image);
+}
+
+static int readFirstByte(const std::string &path) {
+    FILE *file = fopen(path.c_str(), "rb");
+    if (file == nullptr) {
+        return -1;
+    }
+    int value = fgetc(file);
+    fclose(file);
+    return value;
+}
+
+TEST(saveRamTakesGameWritesOnly) {
+    std::unique_ptr<ROM> rom(makeCounterGame());
+    std::vector<byte> save(PRG_RAM_SIZE, 0);
+    save[0] = 0x42;
+    std::string path = writeTemporary("counter.sav", save);
+
+    Console console;
+    console.setSavePath(path.c_str());
+    CHECK(console.insert(rom.get()));
+    console.stepFrame();
+    console.syncSaveRam();
+    CHECK_EQ(0x43, readFirstByte(path));
+
+    // a state of the same game without the save, as a movie or a rollback loads it
+    Console other;
+    CHECK(other.insert(rom.get()));
+    other.stepFrame();
+    State state;
+    other.save(state);
+    CHECK(console.load(state));
+    console.stepFrame();
+    console.syncSaveRam();
+    CHECK_EQ(0x43, readFirstByte(path));
+}
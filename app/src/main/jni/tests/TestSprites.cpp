@@ -0,0 +1,124 @@
+#include <memory>
+#include <random>
+
+#include "Test.h"
+#include "Console.h"
+
+using namespace nesdroid;
+using namespace nesdroid::test;
+
+// Hardware sprite evaluation of one line: the first eight in range are taken;
+// after them every miss steps both the sprite and the byte compared within it.
+// Returns whether the line overflows.
+static bool overflowsLine(const byte *oam, int line, int height) {
+    int n = 0;
+    int count = 0;
+    for (; n < 64 && count < 8; n++) {
+        count += (unsigned) (line - oam[n * 4]) < (unsigned) height;
+    }
+    if (count < 8) {
+        return false;
+    }
+    for (int m = 0; n < 64; n++, m = (m + 1) & 3) {
+        if ((unsigned) (line - oam[n * 4 + m]) < (unsigned) height) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// crowded OAM: 8 to 10 sprites in a band, the others below the screen with
+// random tiles, attributes and X for the scan after the eighth to trip over
+static void makeCrowdedOam(std::mt19937 &random, byte *oam) {
+    int band = (int) (random() % 200);
+    int crowd = 8 + (int) (random() % 3);
+    for (int i = 0; i < 256; i++) {
+        oam[i] = (byte) random();
+    }
+    for (int i = 0; i < 64; i++) {
+        oam[i * 4] = (byte) (0xF0 + random() % 16);
+    }
+    for (int i = 0; i < crowd; i++) {
+        oam[(random() % 64) * 4] = (byte) (band + random() % 8);
+    }
+}
+
+TEST(spritesOnLineMatchesScalar) {
+    std::mt19937 random(1);
+    byte oam[256];
+    for (int round = 0; round < 200; round++) {
+        for (int i = 0; i < 256; i++) {
+            oam[i] = (byte) random();
+        }
+        if (round % 2 != 0) {
+            makeCrowdedOam(random, oam);
+        }
+        for (int height : {8, 16}) {
+            for (int line = 0; line < 240; line++) {
+                uint64_t expected = PPU::spritesOnLineScalar(oam, line, height);
+                uint64_t hits = PPU::spritesOnLine(oam, line, height);
+                if (hits != expected) {
+                    fail(__FILE__, __LINE__, "round " + std::to_string(round) + " line " + std::to_string(line)
+                                             + " height " + std::to_string(height) + " differs");
+                    return;
+                }
+            }
+        }
+    }
+}
+
+// Renders a frame of each crowded OAM and checks the line PPUSTATUS first shows
+// the overflow on against overflowsLine(), false positives and negatives included.
+TEST(spriteOverflowFollowsHardwareScan) {
+    std::vector<byte> image = makeImage(0, 1, 1);
+    CodeWriter code(image);
+    // sprites on, spin; PPUCTRL is set from the test
+    code.emit({0xA9, 0x10, 0x8D, 0x01, 0x20, 0x4C, 0x05, 0xC0});
+    code.at(0x3FFA).emit({0x05, 0xC0, 0x00, 0xC0, 0x05, 0xC0});
+    std::unique_ptr<ROM> rom(makeRom(image));
+
+    std::mt19937 random(2);
+    int overflows = 0;
+    for (int round = 0; round < 100; round++) {
+        byte oam[256];
+        makeCrowdedOam(random, oam);
+        int height = round % 2 != 0 ? 16 : 8;
+
+        Console console;
+        CHECK(console.insert(rom.get()));
+        PPU &ppu = console.getPpu();
+        ppu.writeRegister(0x2000, (byte) (height == 16 ? 0x20 : 0x00));
+        ppu.writeRegister(0x2003, 0);
+        for (int i = 0; i < 256; i++) {
+            ppu.writeRegister(0x2004, oam[i]);
+        }
+        int expected = -1;
+        for (int line = 0; line < 240 && expected < 0; line++) {
+            if (overflowsLine(oam, line, height)) {
+                expected = line;
+            }
+        }
+
+        // the frame after power on, from its first line
+        while (ppu.getFrame() < 1) {
+            console.step();
+        }
+        int first = -1;
+        while (ppu.getScanLine() < 240 && first < 0) {
+            int line = ppu.getScanLine();
+            int cycle = ppu.getCycle();
+            console.step();
+            // evaluated at dot 257 of each line
+            if ((ppu.readRegister(0x2002) & 0x20) != 0) {
+                first = ppu.getScanLine() == line || cycle <= 257 ? line : ppu.getScanLine();
+            }
+        }
+        if (first != expected) {
+            fail(__FILE__, __LINE__, "round " + std::to_string(round) + ": overflow first on line "
+                                     + std::to_string(first) + ", expected " + std::to_string(expected));
+        }
+        overflows += expected >= 0;
+    }
+    // both outcomes were exercised
+    CHECK(overflows > 10 && overflows < 90);
+}
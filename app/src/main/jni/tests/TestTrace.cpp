@@ -0,0 +1,126 @@
+#include <cstring>
+#include <memory>
+
+#include "Test.h"
+#include "Trace.h"
+
+using namespace nesdroid;
+using namespace nesdroid::test;
+
+static TraceRecord makeRecord(uint32_t stream, uint32_t index) {
+    TraceRecord record;
+    memset(&record, 0, sizeof(record));
+    record.cycle = (uint64_t) stream << 32 | index;
+    record.pc = (addr_t) (0x8000 + index);
+    record.address = (addr_t) (index * 7);
+    record.opcode = (byte) index;
+    record.operands[0] = (byte) (index >> 8);
+    record.operands[1] = (byte) stream;
+    record.a = (byte) (index * 3);
+    record.x = (byte) (index * 5);
+    record.y = (byte) (index * 11);
+    record.p = (byte) (0x24 | (index & 0xC3));
+    record.sp = (byte) (0xFD - index);
+    return record;
+}
+
+// more chunks than the ring holds, so the streams may wait for the writer
+TEST(traceRoundTripsThroughFile) {
+    const uint32_t counts[2] = {TraceWriter::MAX_CHUNKS * TRACE_CHUNK_RECORDS + 5, 100};
+    std::string path = writeTemporary("trace.gz", std::vector<byte>());
+    TraceWriter writer;
+    CHECK(writer.open(path.c_str()));
+    {
+        std::unique_ptr<TraceStream> streams[2];
+        for (uint32_t id = 0; id < 2; id++) {
+            streams[id].reset(new TraceStream(writer, id));
+        }
+        for (uint32_t index = 0; index < counts[0]; index++) {
+            for (uint32_t id = 0; id < 2; id++) {
+                if (index < counts[id]) {
+                    streams[id]->next() = makeRecord(id, index);
+                }
+            }
+        }
+    }
+    writer.close();
+
+    TraceReader reader;
+    CHECK(reader.open(path.c_str()));
+    uint32_t read[2] = {0, 0};
+    TraceRecord record;
+    uint32_t stream;
+    while (reader.next(record, stream)) {
+        CHECK(stream < 2);
+        if (stream >= 2) {
+            return;
+        }
+        // each stream comes back in its own order, whole
+        TraceRecord expected = makeRecord(stream, read[stream]++);
+        if (memcmp(&expected, &record, sizeof(record)) != 0) {
+            fail(__FILE__, __LINE__, "stream " + std::to_string(stream) + " record "
+                                     + std::to_string(read[stream] - 1) + " differs");
+            return;
+        }
+    }
+    CHECK_EQ(counts[0], read[0]);
+    CHECK_EQ(counts[1], read[1]);
+
+    // anything else is refused
+    TraceReader other;
+    CHECK(!other.open(writeTemporary("notrace.gz", std::vector<byte>(64, 0x5A)).c_str()));
+}
+
+// the words of a line, nestest's PPU column dropped as traces have none
+static std::string words(const std::string &line) {
+    std::string result;
+    size_t ppu = line.find("PPU:");
+    std::string text = ppu == std::string::npos ? line : line.substr(0, ppu) + line.substr(line.find(" CYC:", ppu));
+    for (size_t i = 0; i < text.size(); i++) {
+        if (text[i] != ' ' || (!result.empty() && result.back() != ' ')) {
+            result += text[i];
+        }
+    }
+    return result;
+}
+
+static std::string format(addr_t pc, std::initializer_list<int> bytes, addr_t address, byte a, byte x, byte y,
+                          byte p, byte sp, uint64_t cycle) {
+    TraceRecord record;
+    memset(&record, 0, sizeof(record));
+    std::vector<int> code(bytes);
+    record.pc = pc;
+    record.opcode = (byte) code[0];
+    record.operands[0] = (byte) (code.size() > 1 ? code[1] : 0);
+    record.operands[1] = (byte) (code.size() > 2 ? code[2] : 0);
+    record.address = address;
+    record.a = a;
+    record.x = x;
+    record.y = y;
+    record.p = p;
+    record.sp = sp;
+    record.cycle = cycle;
+    char line[128];
+    formatTraceRecord(record, line, sizeof(line));
+    return line;
+}
+
+static void checkLine(int line, const std::string &expected, const std::string &actual) {
+    if (expected != actual) {
+        fail(__FILE__, line, "got \"" + actual + "\", expected \"" + expected + "\"");
+    }
+}
+
+TEST(traceFormatsLikeNestest) {
+    // the first lines of nestest.log
+    checkLine(__LINE__, words("C000  4C F5 C5  JMP $C5F5                       A:00 X:00 Y:00 P:24 SP:FD PPU:  0, 21 CYC:7"),
+              words(format(0xC000, {0x4C, 0xF5, 0xC5}, 0xC5F5, 0x00, 0x00, 0x00, 0x24, 0xFD, 7)));
+    checkLine(__LINE__, words("C5F5  A2 00     LDX #$00                        A:00 X:00 Y:00 P:24 SP:FD PPU:  0, 30 CYC:10"),
+              words(format(0xC5F5, {0xA2, 0x00}, 0, 0x00, 0x00, 0x00, 0x24, 0xFD, 10)));
+    // single byte instructions, indexed operands with their effective address
+    checkLine(__LINE__, "C72D  EA        NOP", format(0xC72D, {0xEA}, 0, 0, 0, 0, 0x24, 0xFD, 0).substr(0, 19));
+    checkLine(__LINE__, "D959 BD 00 03 LDA $0300,X @ 0305 A:12 X:05 Y:34 P:A5 SP:FB CYC:1234",
+              words(format(0xD959, {0xBD, 0x00, 0x03}, 0x0305, 0x12, 0x05, 0x34, 0xA5, 0xFB, 1234)));
+    std::string indirect = format(0xD95F, {0xB1, 0x33}, 0x0400, 0, 0, 0, 0x24, 0xFD, 0);
+    CHECK(indirect.find("B1 33     LDA ($33),Y @ 0400") != std::string::npos);
+}
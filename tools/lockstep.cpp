@@ -0,0 +1,150 @@
+// Runs roms on the reference console and a candidate configuration side by side
+// and reports the first divergence, see Lockstep.
+//
+//   lockstep [--frames N] [--every N] [--instructions] [--window N]
+//            [--candidate reference|pipelined|native:DIR] <rom or directory>...
+//
+// Directories are searched for .nes, .zip and .gz files, e.g. tests/roms. Input
+// is a fixed pseudo random sequence so menus and attract modes get exercised the
+// same way. native:DIR runs the plugin tools/recompile.cpp left for each rom in
+// DIR and fails a rom whose plugin never ran; it compares states only, as the
+// trace of --instructions would leave the candidate interpreting.
+//
+// Built on the host against the emulator core:
+//   g++ -std=c++11 -O2 -pthread -Iapp/src/main/jni tools/lockstep.cpp
+//       $(ls app/src/main/jni/*.cpp | grep -v jni.cpp) -lz -ldl -rdynamic -o lockstep
+//
+
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Lockstep.h"
+#include "RomArchive.h"
+
+using namespace nesdroid;
+
+static bool isRomFile(const std::string &name) {
+    for (const char *extension : {".nes", ".zip", ".gz"}) {
+        size_t length = strlen(extension);
+        if (name.size() > length && strcasecmp(name.c_str() + name.size() - length, extension) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void findRoms(const std::string &path, std::vector<std::string> &roms) {
+    DIR *dir = opendir(path.c_str());
+    if (dir == nullptr) {
+        roms.push_back(path);
+        return;
+    }
+    while (dirent *entry = readdir(dir)) {
+        std::string name = entry->d_name;
+        if (name == "." || name == "..") {
+            continue;
+        }
+        std::string child = path + "/" + name;
+        if (isRomFile(name)) {
+            roms.push_back(child);
+        } else if (entry->d_type == DT_DIR) {
+            findRoms(child, roms);
+        }
+    }
+    closedir(dir);
+}
+
+static byte buttonsFor(uint64_t frame, int port) {
+    // hold each combination for a few frames, like a player would
+    uint64_t x = (frame / 8) * 0x9E3779B97F4A7C15ULL + port;
+    x ^= x >> 29;
+    x *= 0xBF58476D1CE4E5B9ULL;
+    return (byte) (x >> 32);
+}
+
+int main(int argc, char **argv) {
+    uint64_t frames = 600;
+    int every = 1;
+    int window = 16;
+    Lockstep::Granularity granularity = Lockstep::GRANULARITY_FRAME;
+    std::string candidateName = "reference";
+    std::vector<std::string> roms;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--frames" && i + 1 < argc) {
+            frames = strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--every" && i + 1 < argc) {
+            every = atoi(argv[++i]);
+        } else if (arg == "--window" && i + 1 < argc) {
+            window = atoi(argv[++i]);
+        } else if (arg == "--instructions") {
+            granularity = Lockstep::GRANULARITY_INSTRUCTION;
+        } else if (arg == "--candidate" && i + 1 < argc) {
+            candidateName = argv[++i];
+        } else {
+            findRoms(arg, roms);
+        }
+    }
+
+    bool native = candidateName.compare(0, 7, "native:") == 0;
+    if (native && granularity == Lockstep::GRANULARITY_INSTRUCTION) {
+        fprintf(stderr, "native candidates are compared by state, not with --instructions\n");
+        return 2;
+    }
+    std::function<void(Console &)> configure;
+    if (candidateName == "reference") {
+        configure = [](Console &) { };
+    } else if (candidateName == "pipelined") {
+        configure = [](Console &console) { console.setPipelined(true); };
+    } else if (native) {
+        std::string directory = candidateName.substr(7);
+        configure = [directory](Console &console) {
+            std::string plugin = console.getNativeCode()->pathIn(directory);
+            if (!console.loadNativeCode(plugin)) {
+                printf("no plugin %s, interpreting\n", plugin.c_str());
+            }
+        };
+    } else {
+        fprintf(stderr, "unknown candidate %s\n", candidateName.c_str());
+        return 2;
+    }
+    if (roms.empty()) {
+        fprintf(stderr, "usage: lockstep [--frames N] [--every N] [--instructions] [--window N]\n"
+                "                [--candidate reference|pipelined|native:DIR] <rom or directory>...\n");
+        return 2;
+    }
+
+    int failed = 0;
+    for (auto &path : roms) {
+        std::unique_ptr<ROM> rom(RomArchive::open(path.c_str()));
+        if (rom == nullptr) {
+            printf("SKIP %s: not a rom\n", path.c_str());
+            continue;
+        }
+
+        Lockstep lockstep(rom.get(), configure);
+        lockstep.setGranularity(granularity, every);
+        lockstep.setWindow(window);
+        lockstep.setInput(buttonsFor);
+        if (!lockstep.isValid()) {
+            printf("SKIP %s: unsupported\n", path.c_str());
+        } else if (!lockstep.run(frames)) {
+            printf("FAIL %s\n%s", path.c_str(), lockstep.getReport().c_str());
+            failed++;
+        } else if (native && lockstep.getNativeInstructions() == 0) {
+            printf("FAIL %s: the plugin never ran\n", path.c_str());
+            failed++;
+        } else if (native) {
+            printf("PASS %s, %llu instructions recompiled\n", path.c_str(),
+                   (unsigned long long) lockstep.getNativeInstructions());
+        } else {
+            printf("PASS %s\n", path.c_str());
+        }
+    }
+    return failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,550 @@
+// Whole system benchmark: runs roms headless for a number of frames, presents
+// every frame through the palette like the app does and reports frames per
+// second. perf_event_open counts instructions, cycles, branch misses, L1D and
+// LLC misses; their samples are split by the function they land in into the
+// cpu core (Cpu), the bus (CpuMemory, mappers, pads), PPU, APU, presentation
+// (Palette, filters) and everything else.
+//
+//   nesbench [--frames N] [--warmup N] [--json out.json] [--baseline old.json]
+//            [--tolerance PCT] <rom or directory>...
+//
+// A movie next to a rom (game.nesm for game.nes) provides its input, otherwise
+// the pads get a fixed pseudo random sequence. With --baseline each rom is
+// compared against an earlier --json output; with --tolerance as well the exit
+// code is 1 if frames per second dropped by more than PCT percent.
+//
+// Events the kernel or the machine refuses (perf_event_paranoid, virtual
+// machines without a PMU) are left out. Built on the host against the emulator
+// core, -rdynamic lets samples be resolved to functions:
+//   g++ -std=c++11 -O2 -g -rdynamic -pthread -Iapp/src/main/jni tools/nesbench.cpp
+//       $(ls app/src/main/jni/*.cpp | grep -v jni.cpp) -lz -ldl -o nesbench
+//
+
+#include <cstdlib>
+#include <cstring>
+#include <cxxabi.h>
+#include <dirent.h>
+#include <dlfcn.h>
+#include <linux/perf_event.h>
+#include <memory>
+#include <string>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+#include "Console.h"
+#include "Metrics.h"
+#include "Movie.h"
+#include "Palette.h"
+#include "RomArchive.h"
+
+using namespace nesdroid;
+
+enum Part {
+    PART_CPU,
+    PART_BUS,
+    PART_PPU,
+    PART_APU,
+    PART_PRESENT,
+    PART_OTHER,
+    PART_COUNT
+};
+
+static const char *PART_NAMES[PART_COUNT] = {"cpu", "bus", "ppu", "apu", "present", "other"};
+
+// demangled name prefixes of each part, the first match wins
+static const struct {
+    const char *prefix;
+    Part part;
+} PART_PREFIXES[] = {
+        {"nesdroid::CpuMemory::", PART_BUS},
+        {"nesdroid::IMapper::", PART_BUS},
+        {"nesdroid::NROM::", PART_BUS},
+        {"nesdroid::MMC3::", PART_BUS},
+        {"nesdroid::Controller::", PART_BUS},
+        {"nesdroid::Cpu::", PART_CPU},
+        {"nesdroid::PPU::", PART_PPU},
+        {"nesdroid::spritesOnLine", PART_PPU},
+        {"nesdroid::APU::", PART_APU},
+        {"nesdroid::Pulse::", PART_APU},
+        {"nesdroid::Triangle::", PART_APU},
+        {"nesdroid::Noise::", PART_APU},
+        {"nesdroid::DMC::", PART_APU},
+        {"nesdroid::Filter::", PART_APU},
+        {"nesdroid::Palette::", PART_PRESENT},
+        {"nesdroid::FilterPipeline::", PART_PRESENT},
+        {"presentFrame", PART_PRESENT},
+};
+
+struct EventSpec {
+    const char *name;
+    uint32_t type;
+    uint64_t config;
+    uint64_t period;
+};
+
+static const EventSpec EVENTS[] = {
+        {"task_clock_ns", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK,    100000},
+        {"instructions",  PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS,  1000003},
+        {"cycles",        PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES,    1000003},
+        {"branch_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, 10007},
+        {"l1d_misses",    PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+                                              | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16), 10007},
+        {"llc_misses",    PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES,  1009},
+};
+
+static const int EVENT_COUNT = sizeof(EVENTS) / sizeof(EVENTS[0]);
+static const int EVENT_INSTRUCTIONS = 1;
+static const int EVENT_CYCLES = 2;
+
+// 2^n pages of samples, drained every frame
+static const size_t RING_PAGES = 64;
+
+// A counting and sampling event on this thread with its sample ring mapped.
+class SampledEvent {
+
+public:
+
+    virtual ~SampledEvent() {
+        if (page != nullptr) {
+            munmap(page, mapSize);
+        }
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+
+    bool open(const EventSpec &spec) {
+        perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = spec.type;
+        attr.config = spec.config;
+        attr.sample_period = spec.period;
+        attr.sample_type = PERF_SAMPLE_IP;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        fd = (int) syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+        if (fd < 0) {
+            return false;
+        }
+        size_t pageSize = (size_t) sysconf(_SC_PAGESIZE);
+        mapSize = (RING_PAGES + 1) * pageSize;
+        void *mapped = mmap(nullptr, mapSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (mapped == MAP_FAILED) {
+            close(fd);
+            fd = -1;
+            return false;
+        }
+        page = (perf_event_mmap_page *) mapped;
+        data = (byte *) mapped + pageSize;
+        dataSize = RING_PAGES * pageSize;
+        return true;
+    }
+
+    void start() {
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+
+    void stop() {
+        ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+    }
+
+    uint64_t total() const {
+        uint64_t count = 0;
+        return read(fd, &count, sizeof(count)) == sizeof(count) ? count : 0;
+    }
+
+    uint64_t getLost() const {
+        return lost;
+    }
+
+    // hand the address of every sample written since the last call to onSample
+    template<typename F>
+    void drain(F onSample) {
+        uint64_t head = page->data_head;
+        __sync_synchronize();
+        uint64_t tail = page->data_tail;
+        while (tail < head) {
+            // records may wrap around the end of the ring
+            perf_event_header header;
+            copyOut(tail, &header, sizeof(header));
+            if (header.size < sizeof(header)) {
+                break;
+            }
+            if (header.type == PERF_RECORD_SAMPLE) {
+                uint64_t ip;
+                copyOut(tail + sizeof(header), &ip, sizeof(ip));
+                onSample(ip);
+            } else if (header.type == PERF_RECORD_LOST) {
+                uint64_t counts[2];
+                copyOut(tail + sizeof(header), counts, sizeof(counts));
+                lost += counts[1];
+            }
+            tail += header.size;
+        }
+        __sync_synchronize();
+        page->data_tail = tail;
+    }
+
+private:
+
+    void copyOut(uint64_t position, void *dst, size_t size) const {
+        for (size_t i = 0; i < size; i++) {
+            ((byte *) dst)[i] = data[(position + i) % dataSize];
+        }
+    }
+
+    int fd = -1;
+    perf_event_mmap_page *page = nullptr;
+    byte *data = nullptr;
+    size_t dataSize = 0;
+    size_t mapSize = 0;
+    uint64_t lost = 0;
+};
+
+static Part classify(uint64_t ip) {
+    static std::unordered_map<uint64_t, Part> cache;
+    auto found = cache.find(ip);
+    if (found != cache.end()) {
+        return found->second;
+    }
+
+    Part part = PART_OTHER;
+    Dl_info info;
+    if (dladdr((void *) ip, &info) && info.dli_sname != nullptr) {
+        int status = 0;
+        char *demangled = abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status);
+        const char *name = status == 0 ? demangled : info.dli_sname;
+        for (auto &entry : PART_PREFIXES) {
+            if (strncmp(name, entry.prefix, strlen(entry.prefix)) == 0) {
+                part = entry.part;
+                break;
+            }
+        }
+        free(demangled);
+    }
+    cache[ip] = part;
+    return part;
+}
+
+// what the app does with a frame, not static so that samples resolve to it
+void presentFrame(const Palette &palette, const Console &console, std::vector<uint32_t> &pixels) {
+    palette.convertFrame(const_cast<Console &>(console).getFrontBuffer(),
+                         const_cast<Console &>(console).getFrontEmphasis(),
+                         pixels.data(), SCREEN_WIDTH * 4, PIXEL_FORMAT_RGBA_8888);
+}
+
+struct RomResult {
+    std::string name;
+    uint64_t frames = 0;
+    double seconds = 0;
+    bool available[EVENT_COUNT];
+    uint64_t totals[EVENT_COUNT];
+    uint64_t parts[EVENT_COUNT][PART_COUNT];
+
+    double fps() const {
+        return seconds > 0 ? frames / seconds : 0;
+    }
+};
+
+static void findRoms(const std::string &path, std::vector<std::string> &roms) {
+    DIR *dir = opendir(path.c_str());
+    if (dir == nullptr) {
+        roms.push_back(path);
+        return;
+    }
+    while (dirent *entry = readdir(dir)) {
+        std::string name = entry->d_name;
+        if (name == "." || name == "..") {
+            continue;
+        }
+        std::string child = path + "/" + name;
+        size_t dot = name.rfind('.');
+        std::string extension = dot == std::string::npos ? "" : name.substr(dot);
+        if (extension == ".nes" || extension == ".zip" || extension == ".gz") {
+            roms.push_back(child);
+        } else if (entry->d_type == DT_DIR) {
+            findRoms(child, roms);
+        }
+    }
+    closedir(dir);
+}
+
+static std::string moviePath(const std::string &rom) {
+    size_t slash = rom.rfind('/');
+    size_t dot = rom.rfind('.');
+    std::string base = dot != std::string::npos && (slash == std::string::npos || dot > slash)
+                       ? rom.substr(0, dot) : rom;
+    return base + ".nesm";
+}
+
+static byte buttonsFor(uint64_t frame, int port) {
+    uint64_t x = (frame / 8) * 0x9E3779B97F4A7C15ULL + port;
+    x ^= x >> 29;
+    x *= 0xBF58476D1CE4E5B9ULL;
+    return (byte) (x >> 32);
+}
+
+static bool runRom(const std::string &path, uint64_t frames, uint64_t warmup, SampledEvent *events,
+                   const bool *opened, const Palette &palette, RomResult &result) {
+    std::unique_ptr<ROM> rom(RomArchive::open(path.c_str()));
+    Console console;
+    if (rom == nullptr || !console.insert(rom.get())) {
+        return false;
+    }
+    Movie movie(console);
+    std::string movieFile = moviePath(path);
+    bool playing = access(movieFile.c_str(), R_OK) == 0 && movie.play(movieFile.c_str());
+    if (playing) {
+        console.setMovie(&movie);
+    }
+    std::vector<uint32_t> pixels(SCREEN_WIDTH * SCREEN_HEIGHT);
+
+    result.name = path;
+    result.frames = frames;
+    memset(result.totals, 0, sizeof(result.totals));
+    memset(result.parts, 0, sizeof(result.parts));
+
+    uint64_t start = 0;
+    for (uint64_t frame = 0; frame < warmup + frames; frame++) {
+        if (frame == warmup) {
+            for (int e = 0; e < EVENT_COUNT; e++) {
+                if (opened[e]) {
+                    events[e].drain([](uint64_t) { });
+                    events[e].start();
+                }
+            }
+            start = Metrics::now();
+        }
+        if (!playing) {
+            console.getController(0).setButtons(buttonsFor(frame, 0));
+            console.getController(1).setButtons(buttonsFor(frame, 1));
+        }
+        console.stepFrame();
+        presentFrame(palette, console, pixels);
+
+        if (frame >= warmup) {
+            for (int e = 0; e < EVENT_COUNT; e++) {
+                if (opened[e]) {
+                    uint64_t *parts = result.parts[e];
+                    uint64_t period = EVENTS[e].period;
+                    events[e].drain([parts, period](uint64_t ip) { parts[classify(ip)] += period; });
+                }
+            }
+        }
+    }
+    result.seconds = (Metrics::now() - start) / 1e9;
+
+    for (int e = 0; e < EVENT_COUNT; e++) {
+        result.available[e] = opened[e];
+        if (opened[e]) {
+            events[e].stop();
+            events[e].drain([](uint64_t) { });
+            result.totals[e] = events[e].total();
+        }
+    }
+    console.setMovie(nullptr);
+    return true;
+}
+
+static std::string toJson(const RomResult &result) {
+    char buffer[256];
+    snprintf(buffer, sizeof(buffer), "{\"name\": \"%s\", \"frames\": %llu, \"seconds\": %.6f, \"fps\": %.3f",
+             result.name.c_str(), (unsigned long long) result.frames, result.seconds, result.fps());
+    std::string json = buffer;
+    for (int e = 0; e < EVENT_COUNT; e++) {
+        if (!result.available[e]) {
+            continue;
+        }
+        snprintf(buffer, sizeof(buffer), ", \"%s\": {\"total\": %llu", EVENTS[e].name,
+                 (unsigned long long) result.totals[e]);
+        json += buffer;
+        for (int p = 0; p < PART_COUNT; p++) {
+            snprintf(buffer, sizeof(buffer), ", \"%s\": %llu", PART_NAMES[p],
+                     (unsigned long long) result.parts[e][p]);
+            json += buffer;
+        }
+        json += "}";
+    }
+    return json + "}";
+}
+
+// the number after "key": in a line of our own output, or -1
+static double findNumber(const std::string &line, const std::string &key) {
+    size_t at = line.find("\"" + key + "\": ");
+    return at == std::string::npos ? -1 : atof(line.c_str() + at + key.size() + 4);
+}
+
+static std::string findName(const std::string &line) {
+    size_t at = line.find("\"name\": \"");
+    if (at == std::string::npos) {
+        return "";
+    }
+    at += 9;
+    return line.substr(at, line.find('"', at) - at);
+}
+
+// baseline results by rom, one line of our JSON each
+static std::unordered_map<std::string, std::string> readBaseline(const char *path) {
+    std::unordered_map<std::string, std::string> lines;
+    FILE *file = fopen(path, "r");
+    if (file == nullptr) {
+        fprintf(stderr, "cannot read baseline %s\n", path);
+        return lines;
+    }
+    char buffer[4096];
+    while (fgets(buffer, sizeof(buffer), file)) {
+        std::string line = buffer;
+        std::string name = findName(line);
+        if (!name.empty()) {
+            lines[name] = line;
+        }
+    }
+    fclose(file);
+    return lines;
+}
+
+static void printResult(const RomResult &result, const std::string *baseline) {
+    printf("%s\n  %.1f frames/s", result.name.c_str(), result.fps());
+    if (baseline != nullptr) {
+        double old = findNumber(*baseline, "fps");
+        if (old > 0) {
+            printf(" (baseline %.1f, %+.1f%%)", old, (result.fps() / old - 1) * 100);
+        }
+    }
+    printf("\n");
+
+    bool haveIpc = result.available[EVENT_INSTRUCTIONS] && result.available[EVENT_CYCLES];
+    printf("  %-14s %14s", "", "total");
+    for (int p = 0; p < PART_COUNT; p++) {
+        printf(" %8s", PART_NAMES[p]);
+    }
+    printf("\n");
+    for (int e = 0; e < EVENT_COUNT; e++) {
+        if (!result.available[e]) {
+            continue;
+        }
+        uint64_t sampled = 0;
+        for (int p = 0; p < PART_COUNT; p++) {
+            sampled += result.parts[e][p];
+        }
+        printf("  %-14s %14llu", EVENTS[e].name, (unsigned long long) result.totals[e]);
+        for (int p = 0; p < PART_COUNT; p++) {
+            printf(" %7.1f%%", sampled > 0 ? 100.0 * result.parts[e][p] / sampled : 0.0);
+        }
+        if (baseline != nullptr) {
+            // the first total in the event's object
+            size_t at = baseline->find(std::string("\"") + EVENTS[e].name + "\": {");
+            double old = at == std::string::npos ? -1 : findNumber(baseline->substr(at), "total");
+            if (old > 0) {
+                printf("  %+.1f%%", (result.totals[e] / old - 1) * 100);
+            }
+        }
+        printf("\n");
+    }
+    if (haveIpc) {
+        printf("  %-14s %14.2f", "ipc",
+               result.totals[EVENT_CYCLES] > 0
+               ? (double) result.totals[EVENT_INSTRUCTIONS] / result.totals[EVENT_CYCLES] : 0.0);
+        for (int p = 0; p < PART_COUNT; p++) {
+            uint64_t cycles = result.parts[EVENT_CYCLES][p];
+            printf(" %8.2f", cycles > 0 ? (double) result.parts[EVENT_INSTRUCTIONS][p] / cycles : 0.0);
+        }
+        printf("\n");
+    }
+}
+
+int main(int argc, char **argv) {
+    uint64_t frames = 1800;
+    uint64_t warmup = 120;
+    const char *jsonPath = nullptr;
+    const char *baselinePath = nullptr;
+    double tolerance = -1;
+    std::vector<std::string> roms;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--frames" && i + 1 < argc) {
+            frames = strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--warmup" && i + 1 < argc) {
+            warmup = strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--json" && i + 1 < argc) {
+            jsonPath = argv[++i];
+        } else if (arg == "--baseline" && i + 1 < argc) {
+            baselinePath = argv[++i];
+        } else if (arg == "--tolerance" && i + 1 < argc) {
+            tolerance = atof(argv[++i]);
+        } else {
+            findRoms(arg, roms);
+        }
+    }
+    if (roms.empty()) {
+        fprintf(stderr, "usage: nesbench [--frames N] [--warmup N] [--json out.json] [--baseline old.json]\n"
+                "                [--tolerance PCT] <rom or directory>...\n");
+        return 2;
+    }
+
+    SampledEvent events[EVENT_COUNT];
+    bool opened[EVENT_COUNT];
+    for (int e = 0; e < EVENT_COUNT; e++) {
+        opened[e] = events[e].open(EVENTS[e]);
+        if (!opened[e]) {
+            fprintf(stderr, "%s: not available (%s)\n", EVENTS[e].name, strerror(errno));
+        }
+    }
+
+    std::unordered_map<std::string, std::string> baseline;
+    if (baselinePath != nullptr) {
+        baseline = readBaseline(baselinePath);
+    }
+
+    Palette palette;
+    std::vector<std::string> lines;
+    int regressions = 0;
+    for (auto &path : roms) {
+        RomResult result;
+        if (!runRom(path, frames, warmup, events, opened, palette, result)) {
+            printf("SKIP %s: not a supported rom\n", path.c_str());
+            continue;
+        }
+        auto old = baseline.find(path);
+        printResult(result, old != baseline.end() ? &old->second : nullptr);
+        lines.push_back(toJson(result));
+
+        if (tolerance >= 0 && old != baseline.end()) {
+            double oldFps = findNumber(old->second, "fps");
+            if (oldFps > 0 && result.fps() < oldFps * (1 - tolerance / 100)) {
+                printf("  REGRESSION beyond %.1f%%\n", tolerance);
+                regressions++;
+            }
+        }
+    }
+    for (int e = 0; e < EVENT_COUNT; e++) {
+        if (opened[e] && events[e].getLost() > 0) {
+            fprintf(stderr, "%s: %llu samples lost\n", EVENTS[e].name, (unsigned long long) events[e].getLost());
+        }
+    }
+
+    if (jsonPath != nullptr) {
+        FILE *file = fopen(jsonPath, "w");
+        if (file == nullptr) {
+            fprintf(stderr, "cannot write %s\n", jsonPath);
+            return 2;
+        }
+        // one rom per line, --baseline reads it back line by line
+        fprintf(file, "{\"frames\": %llu, \"warmup\": %llu, \"roms\": [\n",
+                (unsigned long long) frames, (unsigned long long) warmup);
+        for (size_t i = 0; i < lines.size(); i++) {
+            fprintf(file, "%s%s\n", lines[i].c_str(), i + 1 < lines.size() ? "," : "");
+        }
+        fprintf(file, "]}\n");
+        fclose(file);
+    }
+    return regressions > 0 ? 1 : 0;
+}
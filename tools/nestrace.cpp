@@ -0,0 +1,95 @@
+// Offline reader for the binary traces written by Console::startTrace().
+//
+//   nestrace print <trace> [stream]       nestest.log style text
+//   nestrace diff <a> <b> [context]       first record where two traces part
+//
+// Built on the host against the emulator core:
+//   g++ -std=c++11 -O2 -pthread -Iapp/src/main/jni tools/nestrace.cpp
+//       $(ls app/src/main/jni/*.cpp | grep -v jni.cpp) -lz -ldl -o nestrace
+//
+
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <string>
+
+#include "Trace.h"
+
+using namespace nesdroid;
+
+static const int DEFAULT_CONTEXT = 8;
+
+static bool sameRecord(const TraceRecord &a, const TraceRecord &b) {
+    return a.cycle == b.cycle && a.pc == b.pc && a.address == b.address && a.opcode == b.opcode
+           && a.operands[0] == b.operands[0] && a.operands[1] == b.operands[1]
+           && a.a == b.a && a.x == b.x && a.y == b.y && a.p == b.p && a.sp == b.sp;
+}
+
+static std::string format(const TraceRecord &record) {
+    char line[128];
+    formatTraceRecord(record, line, sizeof(line));
+    return line;
+}
+
+static int print(const char *path, int onlyStream) {
+    TraceReader reader;
+    if (!reader.open(path)) {
+        fprintf(stderr, "can't read %s\n", path);
+        return 2;
+    }
+    TraceRecord record;
+    uint32_t stream;
+    while (reader.next(record, stream)) {
+        if (onlyStream < 0 || (uint32_t) onlyStream == stream) {
+            puts(format(record).c_str());
+        }
+    }
+    return 0;
+}
+
+static int diff(const char *pathA, const char *pathB, int context) {
+    TraceReader a, b;
+    if (!a.open(pathA) || !b.open(pathB)) {
+        fprintf(stderr, "can't read %s or %s\n", pathA, pathB);
+        return 2;
+    }
+
+    std::deque<TraceRecord> history;
+    TraceRecord ra, rb;
+    uint32_t sa, sb;
+    uint64_t index = 0;
+    while (true) {
+        bool moreA = a.next(ra, sa);
+        bool moreB = b.next(rb, sb);
+        if (!moreA && !moreB) {
+            printf("identical, %llu records\n", (unsigned long long) index);
+            return 0;
+        }
+        if (moreA != moreB || sa != sb || !sameRecord(ra, rb)) {
+            printf("traces part at record %llu\n", (unsigned long long) index);
+            for (auto &record : history) {
+                printf("  %s\n", format(record).c_str());
+            }
+            printf("< %s\n", moreA ? format(ra).c_str() : "(end of trace)");
+            printf("> %s\n", moreB ? format(rb).c_str() : "(end of trace)");
+            return 1;
+        }
+        history.push_back(ra);
+        if ((int) history.size() > context) {
+            history.pop_front();
+        }
+        index++;
+    }
+}
+
+int main(int argc, char **argv) {
+    if (argc >= 3 && strcmp(argv[1], "print") == 0) {
+        return print(argv[2], argc > 3 ? atoi(argv[3]) : -1);
+    }
+    if (argc >= 4 && strcmp(argv[1], "diff") == 0) {
+        return diff(argv[2], argv[3], argc > 4 ? atoi(argv[4]) : DEFAULT_CONTEXT);
+    }
+    fprintf(stderr, "usage: nestrace print <trace> [stream]\n"
+            "       nestrace diff <a> <b> [context]\n");
+    return 2;
+}
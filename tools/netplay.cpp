@@ -0,0 +1,181 @@
+// Plays a rom as two rollback peers in one process and checks that they agree,
+// then times the rollback of a full window, see RollbackSession.
+//
+//   netplay [--frames N] [--delay MS] [--loss RATE] [--rollback N] [--udp PORT]
+//           [--repeat N] <rom>
+//
+// The peers talk over a LoopbackTransport, or over UDP on 127.0.0.1 ports PORT
+// and PORT + 1, with the given artificial delay and loss on both ends. With a
+// delay the peers run at the NTSC frame rate so that it counts in frames. Each
+// peer presses its own fixed pseudo random sequence, changing every 8 frames.
+//
+// Built on the host against the emulator core:
+//   g++ -std=c++11 -O2 -pthread -Iapp/src/main/jni tools/netplay.cpp
+//       $(ls app/src/main/jni/*.cpp | grep -v jni.cpp) -lz -ldl -o netplay
+//
+
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <string>
+#include <time.h>
+
+#include "Console.h"
+#include "Metrics.h"
+#include "Netplay.h"
+#include "RomArchive.h"
+
+using namespace nesdroid;
+
+// re-running this many frames has to fit in the budget
+static const int BUDGET_FRAMES = 8;
+static const uint64_t BUDGET_NANOS = 4000000;
+
+static byte buttonsFor(uint64_t frame, int port) {
+    uint64_t x = (frame / 8) * 0x9E3779B97F4A7C15ULL + port;
+    x ^= x >> 29;
+    x *= 0xBF58476D1CE4E5B9ULL;
+    return (byte) (x >> 32);
+}
+
+struct Peer {
+    Console console;
+    std::unique_ptr<Transport> transport;
+    std::unique_ptr<RollbackSession> session;
+    // checksums of confirmed states by the frame they start
+    std::map<uint64_t, uint64_t> checksums;
+
+    void advance(int port) {
+        session->advance(buttonsFor(session->getFrame(), port));
+        uint64_t frame, checksum;
+        if (session->getChecksum(frame, checksum)) {
+            checksums[frame] = checksum;
+        }
+    }
+};
+
+static void sleepUntil(uint64_t time) {
+    uint64_t current = Metrics::now();
+    if (time > current) {
+        timespec ts;
+        ts.tv_sec = (time_t) ((time - current) / 1000000000ULL);
+        ts.tv_nsec = (long) ((time - current) % 1000000000ULL);
+        nanosleep(&ts, nullptr);
+    }
+}
+
+int main(int argc, char **argv) {
+    uint64_t frames = 600;
+    uint64_t delayMs = 0;
+    float loss = 0;
+    int maxRollback = BUDGET_FRAMES;
+    int udpPort = 0;
+    int repeat = 100;
+    const char *path = nullptr;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--frames" && i + 1 < argc) {
+            frames = strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--delay" && i + 1 < argc) {
+            delayMs = strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--loss" && i + 1 < argc) {
+            loss = (float) atof(argv[++i]);
+        } else if (arg == "--rollback" && i + 1 < argc) {
+            maxRollback = atoi(argv[++i]);
+        } else if (arg == "--udp" && i + 1 < argc) {
+            udpPort = atoi(argv[++i]);
+        } else if (arg == "--repeat" && i + 1 < argc) {
+            repeat = atoi(argv[++i]);
+        } else {
+            path = argv[i];
+        }
+    }
+    if (path == nullptr) {
+        fprintf(stderr, "usage: netplay [--frames N] [--delay MS] [--loss RATE] [--rollback N] [--udp PORT]\n"
+                "               [--repeat N] <rom>\n");
+        return 2;
+    }
+
+    std::unique_ptr<ROM> rom(RomArchive::open(path));
+    Peer peers[2];
+    if (rom == nullptr || !peers[0].console.insert(rom.get()) || !peers[1].console.insert(rom.get())) {
+        fprintf(stderr, "%s: not a supported rom\n", path);
+        return 2;
+    }
+
+    if (udpPort > 0) {
+        for (int p = 0; p < 2; p++) {
+            UdpTransport *udp = new UdpTransport();
+            peers[p].transport.reset(udp);
+            if (!udp->open(udpPort + p, "127.0.0.1", udpPort + (p ^ 1))) {
+                return 2;
+            }
+        }
+    } else {
+        LoopbackTransport *a = new LoopbackTransport();
+        LoopbackTransport *b = new LoopbackTransport();
+        LoopbackTransport::connect(*a, *b);
+        peers[0].transport.reset(a);
+        peers[1].transport.reset(b);
+    }
+    for (int p = 0; p < 2; p++) {
+        peers[p].transport->setImpairment(delayMs * 1000000ULL, loss, (uint32_t) (p + 1));
+        peers[p].session.reset(new RollbackSession(peers[p].console, *peers[p].transport, p, maxRollback));
+    }
+
+    uint64_t next = Metrics::now();
+    for (uint64_t tick = 0; tick < frames; tick++) {
+        if (delayMs > 0) {
+            next += FRAME_NANOS;
+            sleepUntil(next);
+        }
+        peers[0].advance(0);
+        peers[1].advance(1);
+    }
+
+    uint64_t compared = 0;
+    uint64_t mismatches = 0;
+    for (auto &entry : peers[0].checksums) {
+        auto other = peers[1].checksums.find(entry.first);
+        if (other == peers[1].checksums.end()) {
+            continue;
+        }
+        compared++;
+        if (other->second != entry.second) {
+            if (mismatches == 0) {
+                printf("desync at frame %llu\n", (unsigned long long) entry.first);
+            }
+            mismatches++;
+        }
+    }
+    for (int p = 0; p < 2; p++) {
+        RollbackSession &session = *peers[p].session;
+        printf("peer %d: %llu frames, %llu rollbacks re-running %llu frames, %llu stalls, "
+                       "slowest rollback %.2f ms, %llu of %llu packets lost\n",
+               p, (unsigned long long) session.getFrame(), (unsigned long long) session.getRollbacks(),
+               (unsigned long long) session.getResimulatedFrames(), (unsigned long long) session.getStalls(),
+               session.getMaxRollbackNanos() / 1e6, (unsigned long long) peers[p].transport->getLost(),
+               (unsigned long long) peers[p].transport->getSent());
+    }
+    printf("%llu confirmed states compared, %llu differ\n", (unsigned long long) compared,
+           (unsigned long long) mismatches);
+
+    // a full window every time, without the network
+    RollbackSession &session = *peers[0].session;
+    int window = maxRollback < BUDGET_FRAMES ? maxRollback : BUDGET_FRAMES;
+    uint64_t total = 0;
+    uint64_t slowest = 0;
+    for (int i = 0; i < repeat; i++) {
+        session.rollback(session.getFrame() - window);
+        total += session.getLastRollbackNanos();
+        if (session.getLastRollbackNanos() > slowest) {
+            slowest = session.getLastRollbackNanos();
+        }
+    }
+    if (repeat > 0) {
+        printf("rollback of %d frames: mean %.2f ms, max %.2f ms, budget %.2f ms\n", window,
+               total / 1e6 / repeat, slowest / 1e6, BUDGET_NANOS / 1e6);
+    }
+    return mismatches > 0 || compared == 0 ? 1 : 0;
+}
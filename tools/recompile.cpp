@@ -0,0 +1,146 @@
+// Ahead-of-time recompiler: translates the PRG ROM code of a rom into a C++
+// plugin the console runs instead of interpreting it, see NativeCode.
+//
+//   recompile [--frames N] <rom> <directory>
+//
+// The code comes from the rom's code map: <directory> is a code cache directory
+// (Console::setCodeCacheDirectory), so the map merges what earlier runs logged
+// with the static pass from the vectors. The rom then plays N frames (600 by
+// default) of a fixed pseudo random input to log the banks and indirect jump
+// targets only a running game reaches, and the grown map is saved back.
+//
+// Every instruction start in the map becomes a function with its opcode and
+// operand bytes as constants, see Cpu::runNative. Instructions still run one
+// per Cpu::excuse() with the ppu and apu stepped in between, so cycles and
+// timing are exactly the interpreter's. Left to the interpreter: code in RAM,
+// whatever the map does not know, pages patched by cheats, and instructions
+// straddling a 4K page, whose bytes may come from different banks.
+//
+// Writes <directory>/<hash>.cpp, to be compiled next to it as lib<hash>.so and
+// loaded with Console::loadNativeCode(); an app ships it under jniLibs. The
+// plugin calls into the core, so the program loading it exports its symbols
+// (-rdynamic on the host, libnes-simulator-jni.so as a dependency on Android):
+//   g++ -std=c++11 -O2 -shared -fPIC -Iapp/src/main/jni <directory>/<hash>.cpp
+//       -o <directory>/lib<hash>.so
+//
+// Built on the host against the emulator core:
+//   g++ -std=c++11 -O2 -pthread -Iapp/src/main/jni tools/recompile.cpp
+//       $(ls app/src/main/jni/*.cpp | grep -v jni.cpp) -lz -ldl -o recompile
+//
+
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "Console.h"
+#include "RomArchive.h"
+
+using namespace nesdroid;
+
+static byte buttonsFor(uint64_t frame, int port) {
+    uint64_t x = (frame / 8) * 0x9E3779B97F4A7C15ULL + port;
+    x ^= x >> 29;
+    x *= 0xBF58476D1CE4E5B9ULL;
+    return (byte) (x >> 32);
+}
+
+int main(int argc, char **argv) {
+    uint64_t frames = 600;
+    std::vector<const char *> paths;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--frames" && i + 1 < argc) {
+            frames = strtoull(argv[++i], nullptr, 10);
+        } else {
+            paths.push_back(argv[i]);
+        }
+    }
+    if (paths.size() != 2) {
+        fprintf(stderr, "usage: recompile [--frames N] <rom> <directory>\n");
+        return 2;
+    }
+    const char *path = paths[0];
+    std::string directory = paths[1];
+
+    std::unique_ptr<ROM> rom(RomArchive::open(path));
+    Console console;
+    console.setCodeCacheDirectory(directory.c_str());
+    if (rom == nullptr || !console.insert(rom.get())) {
+        fprintf(stderr, "%s: not a supported rom\n", path);
+        return 2;
+    }
+    // translate what the interpreter runs, not an older plugin
+    console.unloadNativeCode();
+    for (uint64_t frame = 0; frame < frames; frame++) {
+        console.getController(0).setButtons(buttonsFor(frame, 0));
+        console.getController(1).setButtons(buttonsFor(frame, 1));
+        console.stepFrame();
+    }
+    console.saveCodeMap();
+
+    const byte *prg = console.getBanks()->getPrg();
+    size_t prgSize = console.getBanks()->getPrgSize();
+
+    char name[32];
+    snprintf(name, sizeof(name), "/%016llx", (unsigned long long) rom->getHash());
+    std::string output = directory + name + ".cpp";
+    FILE *file = fopen(output.c_str(), "w");
+    if (file == nullptr) {
+        fprintf(stderr, "cannot write %s\n", output.c_str());
+        return 2;
+    }
+    fprintf(file, "// Generated by tools/recompile.cpp from %s, do not edit.\n\n", path);
+    fprintf(file, "#include \"cpu.h\"\n#include \"Native.h\"\n\nusing namespace nesdroid;\n\n");
+
+    const CodeMap &map = *console.getCodeMap();
+    std::vector<uint32_t> offsets;
+    size_t straddling = 0;
+    for (size_t offset = 0; offset < prgSize; offset++) {
+        if ((map.getFlags(offset) & CODE_OPCODE) == 0) {
+            continue;
+        }
+        byte opcode = prg[offset];
+        if (InstructionTable[opcode] == nullptr || InstructionLengthTable[opcode] == 0) {
+            continue;
+        }
+        // excuse() reads up to two bytes after the opcode
+        if ((offset & 0xFFF) > 0xFFD) {
+            straddling++;
+            continue;
+        }
+        dbyte operand = (dbyte) (prg[offset + 1] | prg[offset + 2] << 8);
+        fprintf(file, "static void op%06zx(Cpu &cpu) { cpu.runNative<0x%02x>(0x%04x); } // %s\n",
+                offset, opcode, operand, InstructionNameTable[opcode]);
+        offsets.push_back((uint32_t) offset);
+    }
+
+    // a rom without known code still gets a plugin, one that translates nothing
+    if (!offsets.empty()) {
+        fprintf(file, "\nstatic const uint32_t OFFSETS[] = {\n");
+        for (uint32_t offset : offsets) {
+            fprintf(file, "        0x%06x,\n", offset);
+        }
+        fprintf(file, "};\n\nstatic const NativeOp OPS[] = {\n");
+        for (uint32_t offset : offsets) {
+            fprintf(file, "        op%06x,\n", offset);
+        }
+        fprintf(file, "};\n");
+    }
+    const char *tables = offsets.empty() ? "nullptr, nullptr" : "OFFSETS, OPS";
+    fprintf(file, "\nstatic const NativeModule MODULE = {\n"
+                    "        NATIVE_VERSION, sizeof(Cpu), 0x%016llxULL, 0x%zx, %zu, %s,\n};\n\n",
+            (unsigned long long) rom->getHash(), prgSize, offsets.size(), tables);
+    fprintf(file, "extern \"C\" const NativeModule *nesdroidNativeModule() {\n    return &MODULE;\n}\n");
+    bool written = ferror(file) == 0;
+    written = fclose(file) == 0 && written;
+    if (!written) {
+        fprintf(stderr, "cannot write %s\n", output.c_str());
+        return 2;
+    }
+
+    printf("%s: %zu instructions known in %zu bytes of PRG ROM, %zu translated, %zu straddling a page\n",
+           output.c_str(), map.count(CODE_OPCODE), prgSize, offsets.size(), straddling);
+    return 0;
+}
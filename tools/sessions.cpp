@@ -0,0 +1,189 @@
+// Runs many sessions of a rom at the NTSC frame rate and reports how well they
+// keep their deadlines, see FrameScheduler.
+//
+//   sessions [--sessions N] [--threads N] [--seconds S] [--naive] <rom>
+//
+// Sessions go through a FrameScheduler with a worker per core, or with --naive
+// through a thread each that sleeps until its next frame is due, for
+// comparison. Each session presses its own fixed pseudo random sequence. The
+// totals are printed, then the session with the most missed deadlines.
+//
+// Built on the host against the emulator core:
+//   g++ -std=c++11 -O2 -pthread -Iapp/src/main/jni tools/sessions.cpp
+//       $(ls app/src/main/jni/*.cpp | grep -v jni.cpp) -lz -ldl -o sessions
+//
+
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <thread>
+#include <time.h>
+#include <vector>
+
+#include "Console.h"
+#include "FrameScheduler.h"
+#include "Metrics.h"
+#include "RomArchive.h"
+
+using namespace nesdroid;
+
+static byte buttonsFor(uint64_t frame, int session) {
+    uint64_t x = (frame / 8) * 0x9E3779B97F4A7C15ULL + session;
+    x ^= x >> 29;
+    x *= 0xBF58476D1CE4E5B9ULL;
+    return (byte) (x >> 32);
+}
+
+static void sleepUntil(uint64_t time) {
+    uint64_t current = Metrics::now();
+    if (time > current) {
+        timespec ts;
+        ts.tv_sec = (time_t) ((time - current) / 1000000000ULL);
+        ts.tv_nsec = (long) ((time - current) % 1000000000ULL);
+        nanosleep(&ts, nullptr);
+    }
+}
+
+// a thread per session, frames as the Throttle paces them
+static void runNaive(Console &console, int session, uint64_t end, SessionStats &stats) {
+    uint64_t deadline = Metrics::now() + FRAME_NANOS;
+    uint64_t lastFinish = 0;
+    uint64_t jitterSum = 0;
+    uint64_t costSum = 0;
+    while (Metrics::now() < end) {
+        uint64_t begin = Metrics::now();
+        if (begin > deadline + FrameScheduler::MAX_LAG_FRAMES * FRAME_NANOS) {
+            stats.dropped += (begin - deadline) / FRAME_NANOS;
+            deadline = begin + FRAME_NANOS;
+            lastFinish = 0;
+        }
+        console.getController(0).setButtons(buttonsFor(stats.frames, session));
+        console.stepFrame();
+        uint64_t finish = Metrics::now();
+        stats.frames++;
+        costSum += finish - begin;
+        if (finish > deadline) {
+            stats.missed++;
+            stats.maxLatenessNanos = std::max(stats.maxLatenessNanos, finish - deadline);
+        }
+        if (lastFinish != 0) {
+            uint64_t interval = finish - lastFinish;
+            jitterSum += interval > FRAME_NANOS ? interval - FRAME_NANOS : FRAME_NANOS - interval;
+            stats.jitterNanos = jitterSum / (stats.frames - 1);
+        }
+        stats.frameNanos = costSum / stats.frames;
+        lastFinish = finish;
+        deadline += FRAME_NANOS;
+        sleepUntil(deadline - FRAME_NANOS);
+    }
+}
+
+static void print(const char *label, const SessionStats &stats) {
+    printf("%s: %llu frames, %llu missed (%.2f%%), %llu skipped, %llu dropped, %llu stolen, "
+                   "%llu migrations, worst lateness %.2f ms, jitter %.2f ms, frame %.2f ms\n",
+           label, (unsigned long long) stats.frames, (unsigned long long) stats.missed,
+           stats.frames > 0 ? 100.0 * stats.missed / stats.frames : 0.0, (unsigned long long) stats.skipped,
+           (unsigned long long) stats.dropped, (unsigned long long) stats.stolen,
+           (unsigned long long) stats.migrations, stats.maxLatenessNanos / 1e6, stats.jitterNanos / 1e6,
+           stats.frameNanos / 1e6);
+}
+
+int main(int argc, char **argv) {
+    int count = 16;
+    int threads = FrameScheduler::defaultThreads();
+    double seconds = 5;
+    bool naive = false;
+    const char *path = nullptr;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--sessions" && i + 1 < argc) {
+            count = atoi(argv[++i]);
+        } else if (arg == "--threads" && i + 1 < argc) {
+            threads = atoi(argv[++i]);
+        } else if (arg == "--seconds" && i + 1 < argc) {
+            seconds = atof(argv[++i]);
+        } else if (arg == "--naive") {
+            naive = true;
+        } else {
+            path = argv[i];
+        }
+    }
+    if (path == nullptr || count < 1) {
+        fprintf(stderr, "usage: sessions [--sessions N] [--threads N] [--seconds S] [--naive] <rom>\n");
+        return 2;
+    }
+
+    std::unique_ptr<ROM> rom(RomArchive::open(path));
+    std::vector<std::unique_ptr<Console>> consoles;
+    for (int i = 0; i < count; i++) {
+        consoles.emplace_back(new Console());
+        if (rom == nullptr || !consoles.back()->insert(rom.get())) {
+            fprintf(stderr, "%s: not a supported rom\n", path);
+            return 2;
+        }
+    }
+    uint64_t end = Metrics::now() + (uint64_t) (seconds * 1e9);
+
+    std::vector<SessionStats> stats((size_t) count);
+    if (naive) {
+        std::vector<std::thread> running;
+        for (int i = 0; i < count; i++) {
+            running.emplace_back(runNaive, std::ref(*consoles[i]), i, end, std::ref(stats[i]));
+        }
+        for (auto &thread : running) {
+            thread.join();
+        }
+        SessionStats totals;
+        uint64_t jitterSum = 0;
+        uint64_t costSum = 0;
+        for (const SessionStats &session : stats) {
+            totals.frames += session.frames;
+            totals.missed += session.missed;
+            totals.dropped += session.dropped;
+            totals.maxLatenessNanos = std::max(totals.maxLatenessNanos, session.maxLatenessNanos);
+            jitterSum += session.jitterNanos * session.frames;
+            costSum += session.frameNanos * session.frames;
+        }
+        totals.jitterNanos = totals.frames > 0 ? jitterSum / totals.frames : 0;
+        totals.frameNanos = totals.frames > 0 ? costSum / totals.frames : 0;
+        printf("%d sessions, a thread each\n", count);
+        print("total", totals);
+    } else {
+        FrameScheduler scheduler(threads);
+        std::vector<std::unique_ptr<std::atomic<uint64_t>>> frames;
+        std::vector<int> ids;
+        for (int i = 0; i < count; i++) {
+            frames.emplace_back(new std::atomic<uint64_t>(0));
+            Console *console = consoles[i].get();
+            std::atomic<uint64_t> *frame = frames.back().get();
+            // pads for the next frame, right after this one
+            console->getController(0).setButtons(buttonsFor(0, i));
+            ids.push_back(scheduler.add(console, [console, frame, i](int, bool) {
+                console->getController(0).setButtons(buttonsFor(++*frame, i));
+            }));
+        }
+        sleepUntil(end);
+        printf("%d sessions on %d workers\n", count, scheduler.getThreads());
+        print("total", scheduler.getTotals());
+        for (int i = 0; i < count; i++) {
+            scheduler.getStats(ids[i], stats[i]);
+        }
+        for (int id : ids) {
+            scheduler.remove(id);
+        }
+    }
+
+    int worst = 0;
+    for (int i = 1; i < count; i++) {
+        if (stats[i].missed > stats[worst].missed) {
+            worst = i;
+        }
+    }
+    char label[32];
+    snprintf(label, sizeof(label), "worst, session %d", worst);
+    print(label, stats[worst]);
+    return 0;
+}